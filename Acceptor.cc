@@ -1,64 +1,148 @@
 #include "Acceptor.h"
 #include "Logger.h"
 #include "InetAddress.h"
+#include "MemoryBudget.h"
 
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <errno.h>
 #include <functional>
 #include <unistd.h>
+#include <fcntl.h>
+#include <string>
 
-static int createNonblocking() {
-    int sockfd = ::socket( AF_INET , SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC , 0 );
+static int createNonblocking( sa_family_t family ) {
+    int sockfd = ::socket( family , SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC , 0 );
     if (sockfd < 0) {
         LOG_FATAL( "%s:%s:%d listen socket create err:%d \n" , __FILE__ , __FUNCTION__ , __LINE__ , errno );
     }
+    return sockfd;
+}
+
+/**
+ * 上次退出时留下的socket文件会导致bind失败，确认没有进程在监听后再删除；抽象地址随最后一个fd关闭自动消失
+ * 能连上（或监听队列已满）说明另一个实例正在使用，保留文件，随后bind失败，不会悄悄抢走它的地址
+*/
+static void removeStaleUnixSocket( const InetAddress &listenAddr ) {
+    std::string path = listenAddr.unixPath();
+    if (path.empty() || path[0] == '@') {
+        return;
+    }
+    int probe = ::socket( AF_UNIX , SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC , 0 );
+    if (probe < 0) {
+        LOG_ERROR( "Acceptor - probe socket for %s failed, errno:%d \n" , path.c_str() , errno );
+        return;
+    }
+    int ret = ::connect( probe , listenAddr.getSockAddrGeneric() , listenAddr.getSockLen() );
+    int savedErrno = errno;
+    ::close( probe );
+    if (ret == 0 || savedErrno == EAGAIN) {
+        LOG_ERROR( "Acceptor - %s is in use by another process, not removing it \n" , path.c_str() );
+    }
+    else if (savedErrno == ECONNREFUSED) {
+        LOG_INFO( "Acceptor - removing stale socket file %s \n" , path.c_str() );
+        ::unlink( path.c_str() );
+    }
+    else if (savedErrno != ENOENT) {
+        LOG_ERROR( "Acceptor - cannot probe %s, errno:%d, not removing it \n" , path.c_str() , savedErrno );
+    }
 }
 
 Acceptor::Acceptor( EventLoop *loop , const InetAddress &listenAddr , bool reuseport )
     : loop_( loop )
-    , acceptSocket_( createNonblocking() )  // 创建监听socket，并封装成Socket对象（管理socket选项和开关）
+    , acceptSocket_( createNonblocking( listenAddr.family() ) )  // 创建监听socket，并封装成Socket对象（管理socket选项和开关）
     , acceptChannel_( loop , acceptSocket_.fd() ) // 封装成Channel（管理事件及事件回调）
-    , listenning_( false ) {
-    acceptSocket_.setReuseAddr( true );
-    acceptSocket_.setReusePort( true );
+    , listenning_( false )
+    , backlog_( 1024 )
+    , idleFd_( ::open( "/dev/null" , O_RDONLY | O_CLOEXEC ) ) {
+    if (listenAddr.isUnix()) {
+        removeStaleUnixSocket( listenAddr );
+    }
+    else {
+        acceptSocket_.setReuseAddr( true );
+        acceptSocket_.setReusePort( reuseport );
+    }
     acceptSocket_.bindAddress( listenAddr ); // bind
     // 注册连接socket的读事件的回调函数
     // TcpServer::start() => Acceptor::listen => 有新用户连接，执行回调 => connfd => Channel => subloop
     acceptChannel_.setReadCallback( std::bind( &Acceptor::handleRead , this ) );
 }
 
+Acceptor::Acceptor( EventLoop *loop , int listenFd )
+    : loop_( loop )
+    , acceptSocket_( listenFd )
+    , acceptChannel_( loop , listenFd )
+    , listenning_( false )
+    , backlog_( 1024 )
+    , idleFd_( ::open( "/dev/null" , O_RDONLY | O_CLOEXEC ) ) {
+    // 继承来的fd可能没有设置这两个标志
+    ::fcntl( listenFd , F_SETFL , ::fcntl( listenFd , F_GETFL ) | O_NONBLOCK );
+    ::fcntl( listenFd , F_SETFD , FD_CLOEXEC );
+    acceptChannel_.setReadCallback( std::bind( &Acceptor::handleRead , this ) );
+}
+
 Acceptor::~Acceptor() {
     /* 注意：监听socket由Socket的析构函数关闭 */
     acceptChannel_.disableAll();
     acceptChannel_.remove();
+    ::close( idleFd_ );
 }
 
 void Acceptor::listen() {
     listenning_ = true;
-    acceptSocket_.listen(); // listen
+    acceptSocket_.listen( backlog_ ); // listen
     acceptChannel_.enableReading();
 }
 
+void Acceptor::stop() {
+    listenning_ = false;
+    acceptChannel_.disableAll();
+}
+
 
 // listenfd有读事件发生了，就是有新用户连接了
+// 一次读事件中尽量把全连接队列取空（有上限），减少epoll_wait的次数
 void Acceptor::handleRead() {
-    InetAddress peerAddr;
-    int connfd = acceptSocket_.accept( &peerAddr );
-    if (connfd >= 0) {
-        if (newConnectionCallback_) {
-            newConnectionCallback_( connfd , peerAddr ); // 轮询找到subLoop，唤醒，分发当前的新连接的Channel
+    for (int i = 0; i < kMaxAcceptsPerRead; ++i) {
+        InetAddress peerAddr;
+        int connfd = acceptSocket_.accept( &peerAddr );
+        if (connfd >= 0) {
+            if (MemoryBudget::instance().rejectAccepts()) {
+                // 缓冲区内存超出预算，拒绝新连接
+                ::close( connfd );
+                continue;
+            }
+            if (newConnectionCallback_) {
+                newConnectionCallback_( connfd , peerAddr ); // 轮询找到subLoop，唤醒，分发当前的新连接的Channel
+            }
+            else {
+                ::close( connfd );
+            }
+            continue;
         }
-        else {
-            ::close( connfd );
+
+        int savedErrno = errno;
+        if (savedErrno == EAGAIN || savedErrno == EWOULDBLOCK) {
+            break;  // 队列已空
         }
-    }
-    else {
-        LOG_ERROR( "%s:%s:%d accpet err:%d \n" , __FILE__ , __FUNCTION__ , __LINE__ , errno );
-        if (errno == EMFILE) {
-            LOG_ERROR( "%s:%s:%d sockfd reached limit \n" , __FILE__ , __FUNCTION__ , __LINE__);
+        if (savedErrno == ECONNABORTED || savedErrno == EINTR || savedErrno == EPROTO) {
+            continue;   // 对端在accept之前就断开了，继续取下一个
+        }
+        if (savedErrno == EMFILE || savedErrno == ENFILE) {
+            /**
+             * fd耗尽时连接一直留在队列中，LT模式下listenfd会一直可读导致busy loop
+             * 关闭预留的fd腾出位置，accept后立即关闭，对端能明确感知被拒绝，然后重新预留
+            */
+            LOG_ERROR( "%s:%s:%d sockfd reached limit, shedding connection \n" , __FILE__ , __FUNCTION__ , __LINE__ );
+            ::close( idleFd_ );
+            idleFd_ = ::accept( acceptSocket_.fd() , nullptr , nullptr );
+            if (idleFd_ >= 0) {
+                ::close( idleFd_ );
+            }
+            idleFd_ = ::open( "/dev/null" , O_RDONLY | O_CLOEXEC );
+            continue;
         }
+        LOG_ERROR( "%s:%s:%d accpet err:%d \n" , __FILE__ , __FUNCTION__ , __LINE__ , savedErrno );
+        break;
     }
 }
-
-
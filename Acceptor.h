@@ -12,20 +12,35 @@ class InetAddress;
 class Acceptor : noncopyable {
 public:
     using NewConnectionCallback = std::function<void( int sockfd , const InetAddress & )>;
+    // listenAddr可以是AF_UNIX地址，此时忽略reuseport；退出时不删除socket文件
     Acceptor( EventLoop *loop , const InetAddress &listenAddr , bool reuseport );
+    // 接管已经bind（可能已经listen）的监听socket，用于热重启时继承旧进程的socket
+    Acceptor( EventLoop *loop , int listenFd );
     ~Acceptor();
 
     void setNewConnectionCallback( const NewConnectionCallback &cb ) {
         newConnectionCallback_ = cb;
     }
 
+    // 在listen之前设置
+    void setBacklog( int backlog ) { backlog_ = backlog; }
+
+    EventLoop *getLoop() const { return loop_; }
+    int fd() const { return acceptSocket_.fd(); }
     bool listenning() const { return listenning_; }
     void listen();
+    // 不再accept，socket保持打开，队列中的连接留给共享该socket的其它进程
+    void stop();
 private:
+    // 每次读事件最多accept的连接数，避免连接风暴时长时间占用loop
+    static const int kMaxAcceptsPerRead = 64;
+
     void handleRead();
-    EventLoop *loop_;   // Accptor用的用户定义的baseLoop，也就是mainLoop
+    EventLoop *loop_;   // Accptor用的用户定义的baseLoop，也就是mainLoop；reuseport模式下为各个subloop
     Socket acceptSocket_;
     Channel acceptChannel_;
     NewConnectionCallback newConnectionCallback_;
     bool listenning_;
+    int backlog_;
+    int idleFd_;    // 预留的空闲fd，fd耗尽(EMFILE)时用它腾出位置拒绝连接
 };
\ No newline at end of file
@@ -1,5 +1,7 @@
 #pragma once
 
+#include "FreeListPool.h"
+
 #include <vector>
 #include <string>
 #include <algorithm>
@@ -74,6 +76,29 @@ public:
         return begin() + writerIndex_;
     }
 
+    // 直接写入beginWrite()之后调用，如TLS解密
+    void hasWritten( size_t len ) {
+        writerIndex_ += len;
+    }
+
+    // 底层数组的容量，即缓冲区实际占用的内存
+    size_t internalCapacity() const {
+        return buffer_.capacity();
+    }
+
+    // 释放多余的内存，只保留可读数据和reserve字节的可写空间
+    void shrink( size_t reserve ) {
+        Buffer other( readableBytes() + reserve );
+        other.append( peek() , readableBytes() );
+        swap( other );
+    }
+
+    void swap( Buffer &rhs ) {
+        buffer_.swap( rhs.buffer_ );
+        std::swap( readerIndex_ , rhs.readerIndex_ );
+        std::swap( writerIndex_ , rhs.writerIndex_ );
+    }
+
     // 从fd上读取数据
     ssize_t readFd( int fd , int *saveErrno );
     ssize_t writeFd( int fd , int *saveErrno );
@@ -99,7 +124,7 @@ private:
             writerIndex_ = readerIndex_ + readable;
         }
     }
-    std::vector<char> buffer_;
+    std::vector<char , PoolAllocator<char>> buffer_;   // 默认大小的缓冲区从线程局部的空闲链表分配
     size_t readerIndex_;
     size_t writerIndex_;
 };
\ No newline at end of file
@@ -2,6 +2,7 @@
 
 #include <memory>
 #include <functional>
+#include <string>
 
 class Buffer;
 class TcpConnection;
@@ -13,4 +14,7 @@ using CloseCallback = std::function<void( const TcpConnectionPtr & )>;
 using WriteCompleteCallback = std::function<void( const TcpConnectionPtr & )>;
 using MessageCallback = std::function<void( const TcpConnectionPtr & , Buffer * , Timestamp )>;
 
-using HighWaterMarkCallback = std::function<void( const TcpConnectionPtr & , size_t )>;
\ No newline at end of file
+using HighWaterMarkCallback = std::function<void( const TcpConnectionPtr & , size_t )>;
+
+// 多个连接共享的只读发送数据，见TcpConnection::sendShared和TcpServer::broadcast
+using Payload = std::shared_ptr<const std::string>;
\ No newline at end of file
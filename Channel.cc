@@ -1,6 +1,5 @@
 #include "Channel.h"
 #include "EventLoop.h"
-#include <sys/epoll.h>
 #include "Logger.h"
 
 const int Channel::kNoneEvent = 0;
@@ -9,15 +8,22 @@ const int Channel::kWriteEvent = EPOLLOUT;
 
 // EventLoop: ChannelList Pooler
 Channel::Channel( EventLoop* loop , int fd )
-    : loop_( loop ), fd_( fd ), events_( 0 ), revents_( 0 ), index_( -1 ), tied_( false ) {
+    : handler_( nullptr ), owner_( nullptr ), revents_( 0 ), events_( 0 ), fd_( fd ), index_( -1 ), loop_( loop ) {
     
 }
 
 Channel::~Channel() {}
 
+Channel::Callbacks *Channel::callbacks() {
+    if (!callbacks_) {
+        callbacks_.reset( new Callbacks );
+    }
+    return callbacks_.get();
+}
+
 void Channel::tie( const std::shared_ptr<void>& obj ) {
-    tie_ = obj;
-    tied_ = true;
+    callbacks()->tie = obj;
+    callbacks()->tied = true;
 }
 
 /**
@@ -33,9 +39,12 @@ void Channel::remove() {
     loop_->removeChannel( this );
 }
 
-void Channel::handleEvent( Timestamp receiveTime ) {
-    if (tied_) {
-        std::shared_ptr<void> guard = tie_.lock();
+void Channel::handleEventWithCallbacks( Timestamp receiveTime ) {
+    if (!callbacks_) {
+        return;
+    }
+    if (callbacks_->tied) {
+        std::shared_ptr<void> guard = callbacks_->tie.lock();
         if (guard) {
             handleEventWithGuard( receiveTime );
         }
@@ -46,28 +55,30 @@ void Channel::handleEvent( Timestamp receiveTime ) {
 }
 
 void Channel::handleEventWithGuard( Timestamp receiveTime ) {
-    LOG_INFO( "channel handleEvent revents:%d" , revents_ );
+    LOG_DEBUG( "channel handleEvent revents:%d" , revents_ );
+    // callbacks_只在channel析构时释放，回调期间一直有效
+    Callbacks *cb = callbacks_.get();
     if (( revents_ & EPOLLHUP ) && !( revents_ & EPOLLIN )) {
-        if (closeCallback_) {
-            closeCallback_();
+        if (cb->closeCallback) {
+            cb->closeCallback();
         }
     }
 
     if (revents_ & EPOLLERR) {
-        if (errorCallback_) {
-            errorCallback_();
+        if (cb->errorCallback) {
+            cb->errorCallback();
         }
     }
 
     if (revents_ & ( EPOLLIN | EPOLLPRI )) {
-        if (readCallback_) {
-            readCallback_( receiveTime );
+        if (cb->readCallback) {
+            cb->readCallback( receiveTime );
         }
     }
 
     if (revents_ & EPOLLOUT) {
-        if (writeCallback_) {
-            writeCallback_();
+        if (cb->writeCallback) {
+            cb->writeCallback();
         }
     }
 }
\ No newline at end of file
@@ -5,45 +5,70 @@
 
 #include <functional>
 #include <memory>
+#include <sys/epoll.h>
 
 class EventLoop;
 class Timestamp;
 /**
  * Channel 封装了sockfd和感兴趣的event，如EPOLLIN、EPOLLOUT事件
  * 还绑定了poller返回的具体事件
+ *
+ * 两种分发方式：
+ *  - setReadCallback等设置std::function回调，可以tie到owner的shared_ptr上，回调对象在第一次设置时才分配
+ *  - setOwner设置紧凑分发：事件直接交给一个函数指针和owner指针，没有std::function、bind和tie，
+ *    每个事件少一次weak_ptr::lock的原子操作；owner要保证分发期间不被析构（TcpConnection在handleClose中自己持有）
 */
 class Channel : noncopyable {
 public:
     using EventCallback = std::function<void()>;
     using ReadEventCallback = std::function<void( Timestamp )>;
+    // 紧凑分发的入口，owner为setOwner传入的对象
+    using EventHandler = void (*)( void *owner , int revents , Timestamp receiveTime );
 
     Channel( EventLoop *loop , int fd );
     ~Channel();
 
     // 处理事件
-    void handleEvent( Timestamp receiveTime );
+    void handleEvent( Timestamp receiveTime ) {
+        if (handler_ != nullptr) {
+            handler_( owner_ , revents_ , receiveTime );
+        }
+        else {
+            handleEventWithCallbacks( receiveTime );
+        }
+    }
 
     // 设置回调函数对象
     void setReadCallback( ReadEventCallback cb ) {
-        readCallback_ = std::move( cb );
+        callbacks()->readCallback = std::move( cb );
     }
     void setWriteCallback( EventCallback cb ) {
-        writeCallback_ = std::move( cb );
+        callbacks()->writeCallback = std::move( cb );
     }
     void setCloseCallback( EventCallback cb ) {
-        closeCallback_ = std::move( cb );
+        callbacks()->closeCallback = std::move( cb );
     }
     void setErrorCallback( EventCallback cb ) {
-        errorCallback_ = std::move( cb );
+        callbacks()->errorCallback = std::move( cb );
+    }
+
+    /**
+     * 紧凑分发：事件按和回调方式相同的规则直接调用owner的handleRead(Timestamp)、handleWrite()、
+     * handleClose()、handleError()，设置后不再使用std::function回调
+    */
+    template <typename Owner>
+    void setOwner( Owner *owner ) {
+        handler_ = &Channel::dispatch<Owner>;
+        owner_ = owner;
     }
 
-    //防止当channel被手动remove掉，channel还在执行回调操作
+    //防止当channel被手动remove掉，channel还在执行回调操作，只对std::function回调生效
     void tie( const std::shared_ptr<void>& );
 
     int fd() const { return fd_; }
     int events() const { return events_; }
-    int set_revents( int revt ) { revents_ = revt; }
-    
+    void set_revents( int revt ) { revents_ = revt; }
+
 
     //设置fd相应的事件状态
     void enableReading() { events_ |= kReadEvent;  update(); }
@@ -63,24 +88,51 @@ public:
     EventLoop* ownerLoop() { return loop_; }
     void remove();
 private:
+    // std::function回调和tie，紧凑分发的channel不分配
+    struct Callbacks {
+        Callbacks() : tied( false ) {}
+
+        std::weak_ptr<void> tie;
+        bool tied;
+        ReadEventCallback readCallback;
+        EventCallback writeCallback;
+        EventCallback closeCallback;
+        EventCallback errorCallback;
+    };
+
+    template <typename Owner>
+    static void dispatch( void *owner , int revents , Timestamp receiveTime ) {
+        Owner *obj = static_cast<Owner *>( owner );
+        if (( revents & EPOLLHUP ) && !( revents & EPOLLIN )) {
+            obj->handleClose();
+        }
+        if (revents & EPOLLERR) {
+            obj->handleError();
+        }
+        if (revents & ( EPOLLIN | EPOLLPRI )) {
+            obj->handleRead( receiveTime );
+        }
+        if (revents & EPOLLOUT) {
+            obj->handleWrite();
+        }
+    }
 
+    Callbacks *callbacks();
     void update();
+    void handleEventWithCallbacks( Timestamp receiveTime );
     void handleEventWithGuard( Timestamp receiveTime );
     static const int kNoneEvent;
     static const int kReadEvent;
     static const int kWriteEvent;
 
-    EventLoop* loop_;   // 事件循环
-    const int fd_;  // fd, Poller监听的对象
-    int events_;    // 注册fd感兴趣的事件
+    // 每个事件都要访问的字段放在前面，落在同一个cache line中
+    EventHandler handler_;  // 紧凑分发的入口，为空时使用callbacks_
+    void *owner_;
     int revents_;   // poller返回的具体发生的事件
+    int events_;    // 注册fd感兴趣的事件
+    const int fd_;  // fd, Poller监听的对象
     int index_;
+    EventLoop* loop_;   // 事件循环
 
-    std::weak_ptr<void> tie_;
-    bool tied_;
-
-    ReadEventCallback readCallback_;
-    EventCallback writeCallback_;
-    EventCallback closeCallback_;
-    EventCallback errorCallback_;
-};
\ No newline at end of file
+    std::unique_ptr<Callbacks> callbacks_;
+};
@@ -0,0 +1,199 @@
+#include "Connector.h"
+#include "Channel.h"
+#include "EventLoop.h"
+#include "Logger.h"
+
+#include <errno.h>
+#include <unistd.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <algorithm>
+
+static int createNonblocking( sa_family_t family ) {
+    int sockfd = ::socket( family , SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC , 0 );
+    if (sockfd < 0) {
+        LOG_FATAL( "%s:%s:%d connect socket create err:%d \n" , __FILE__ , __FUNCTION__ , __LINE__ , errno );
+    }
+    return sockfd;
+}
+
+static int getSocketError( int sockfd ) {
+    int optval;
+    socklen_t optlen = sizeof optval;
+    if (::getsockopt( sockfd , SOL_SOCKET , SO_ERROR , &optval , &optlen ) < 0) {
+        return errno;
+    }
+    return optval;
+}
+
+// 连接本机未监听的端口时，内核可能分配到与目标相同的临时端口，形成自连接；AF_UNIX不存在这种情况
+static bool isSelfConnect( int sockfd ) {
+    sockaddr_in local , peer;
+    socklen_t len = sizeof local;
+    ::bzero( &local , sizeof local );
+    ::bzero( &peer , sizeof peer );
+    ::getsockname( sockfd , (sockaddr *)&local , &len );
+    len = sizeof peer;
+    ::getpeername( sockfd , (sockaddr *)&peer , &len );
+    return local.sin_port == peer.sin_port && local.sin_addr.s_addr == peer.sin_addr.s_addr;
+}
+
+const int Connector::kMaxRetryDelayMs;
+const int Connector::kInitRetryDelayMs;
+
+Connector::Connector( EventLoop *loop , const InetAddress &serverAddr )
+    : loop_( loop )
+    , serverAddr_( serverAddr )
+    , connect_( false )
+    , state_( kDisconnected )
+    , retryDelayMs_( kInitRetryDelayMs )
+    , retries_( 0 )
+    , maxRetries_( -1 ) {
+    LOG_DEBUG( "Connector ctor[%p] \n" , this );
+}
+
+Connector::~Connector() {
+    LOG_DEBUG( "Connector dtor[%p] \n" , this );
+}
+
+void Connector::start() {
+    connect_ = true;
+    loop_->runInLoop( std::bind( &Connector::startInLoop , shared_from_this() ) );
+}
+
+void Connector::startInLoop() {
+    if (connect_) {
+        connect();
+    }
+}
+
+void Connector::stop() {
+    connect_ = false;
+    loop_->queueInLoop( std::bind( &Connector::stopInLoop , shared_from_this() ) );
+}
+
+void Connector::stopInLoop() {
+    loop_->cancel( retryTimer_ );
+    if (state_ == kConnecting) {
+        setState( kDisconnected );
+        int sockfd = removeAndResetChannel();
+        ::close( sockfd );
+    }
+}
+
+void Connector::restart() {
+    setState( kDisconnected );
+    retryDelayMs_ = kInitRetryDelayMs;
+    retries_ = 0;
+    connect_ = true;
+    startInLoop();
+}
+
+void Connector::connect() {
+    int sockfd = createNonblocking( serverAddr_.family() );
+    int ret = ::connect( sockfd , serverAddr_.getSockAddrGeneric() , serverAddr_.getSockLen() );
+    int savedErrno = ( ret == 0 ) ? 0 : errno;
+    switch (savedErrno) {
+    case 0:
+    case EINPROGRESS:
+    case EINTR:
+    case EISCONN:
+        connecting( sockfd );   // 连接正在建立，等待可写事件
+        break;
+
+    case EAGAIN:
+    case EADDRINUSE:
+    case EADDRNOTAVAIL:
+    case ECONNREFUSED:
+    case ENETUNREACH:
+    case ENOENT:    // AF_UNIX的socket文件还没有创建
+        retry( sockfd );    // 暂时性错误，稍后重试
+        break;
+
+    default:
+        LOG_ERROR( "%s:%s:%d connect error:%d \n" , __FILE__ , __FUNCTION__ , __LINE__ , savedErrno );
+        ::close( sockfd );
+        if (errorCallback_) {
+            errorCallback_();
+        }
+        break;
+    }
+}
+
+void Connector::connecting( int sockfd ) {
+    setState( kConnecting );
+    channel_.reset( new Channel( loop_ , sockfd ) );
+    channel_->setWriteCallback( std::bind( &Connector::handleWrite , this ) );
+    channel_->setErrorCallback( std::bind( &Connector::handleError , this ) );
+    channel_->enableWriting();
+}
+
+int Connector::removeAndResetChannel() {
+    channel_->disableAll();
+    channel_->remove();
+    int sockfd = channel_->fd();
+    // 当前可能正处于channel的回调中，不能在这里析构channel
+    loop_->queueInLoop( std::bind( &Connector::resetChannel , shared_from_this() ) );
+    return sockfd;
+}
+
+void Connector::resetChannel() {
+    channel_.reset();
+}
+
+void Connector::handleWrite() {
+    if (state_ == kConnecting) {
+        int sockfd = removeAndResetChannel();
+        int err = getSocketError( sockfd );
+        if (err) {
+            LOG_DEBUG( "Connector::handleWrite - SO_ERROR = %d \n" , err );
+            retry( sockfd );
+        }
+        else if (!serverAddr_.isUnix() && isSelfConnect( sockfd )) {
+            LOG_ERROR( "Connector::handleWrite - Self connect \n" );
+            retry( sockfd );
+        }
+        else {
+            setState( kConnected );
+            if (connect_ && newConnectionCallback_) {
+                newConnectionCallback_( sockfd );
+            }
+            else {
+                ::close( sockfd );
+            }
+        }
+    }
+}
+
+void Connector::handleError() {
+    LOG_ERROR( "Connector::handleError state=%d \n" , state_ );
+    if (state_ == kConnecting) {
+        int sockfd = removeAndResetChannel();
+        int err = getSocketError( sockfd );
+        LOG_ERROR( "Connector::handleError - SO_ERROR = %d \n" , err );
+        retry( sockfd );
+    }
+}
+
+// 关闭当前socket，退避后用新的socket重试
+void Connector::retry( int sockfd ) {
+    ::close( sockfd );
+    setState( kDisconnected );
+    if (!connect_) {
+        return;
+    }
+    if (maxRetries_ >= 0 && retries_ >= maxRetries_) {
+        LOG_ERROR( "Connector::retry - give up connecting to %s \n" , serverAddr_.toIpPort().c_str() );
+        if (errorCallback_) {
+            errorCallback_();
+        }
+        return;
+    }
+    ++retries_;
+    LOG_INFO( "Connector::retry - Retry connecting to %s in %d milliseconds. \n" ,
+        serverAddr_.toIpPort().c_str() , retryDelayMs_ );
+    retryTimer_ = loop_->runAfter( retryDelayMs_ / 1000.0 ,
+        std::bind( &Connector::startInLoop , shared_from_this() ) );
+    retryDelayMs_ = std::min( retryDelayMs_ * 2 , kMaxRetryDelayMs );
+}
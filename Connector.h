@@ -0,0 +1,65 @@
+#pragma once
+
+#include "noncopyable.h"
+#include "InetAddress.h"
+#include "TimerId.h"
+
+#include <functional>
+#include <memory>
+
+class Channel;
+class EventLoop;
+
+/**
+ * 主动发起非阻塞连接：connect返回EINPROGRESS后注册EPOLLOUT，可写时检查SO_ERROR判断是否连接成功
+ * 失败时按指数退避重试，成功后把sockfd交给NewConnectionCallback，由使用者封装成TcpConnection
+*/
+class Connector : noncopyable , public std::enable_shared_from_this<Connector> {
+public:
+    using NewConnectionCallback = std::function<void( int sockfd )>;
+    using ErrorCallback = std::function<void()>;
+
+    Connector( EventLoop *loop , const InetAddress &serverAddr );
+    ~Connector();
+
+    void setNewConnectionCallback( const NewConnectionCallback &cb ) { newConnectionCallback_ = cb; }
+    // 重试次数用完后调用
+    void setErrorCallback( const ErrorCallback &cb ) { errorCallback_ = cb; }
+    // 最多重试的次数，小于0表示一直重试（默认）
+    void setMaxRetries( int maxRetries ) { maxRetries_ = maxRetries; }
+
+    const InetAddress &serverAddress() const { return serverAddr_; }
+
+    void start();   // 可以跨线程调用
+    void restart(); // 只能在loop线程中调用
+    void stop();    // 可以跨线程调用
+private:
+    enum States { kDisconnected , kConnecting , kConnected };
+    static const int kMaxRetryDelayMs = 30 * 1000;
+    static const int kInitRetryDelayMs = 500;
+
+    void setState( States s ) { state_ = s; }
+    void startInLoop();
+    void stopInLoop();
+    void connect();
+    void connecting( int sockfd );
+    void handleWrite();
+    void handleError();
+    void retry( int sockfd );
+    int removeAndResetChannel();
+    void resetChannel();
+
+    EventLoop *loop_;
+    InetAddress serverAddr_;
+    bool connect_;
+    States state_;
+    std::unique_ptr<Channel> channel_;
+    NewConnectionCallback newConnectionCallback_;
+    ErrorCallback errorCallback_;
+    int retryDelayMs_;
+    int retries_;
+    int maxRetries_;
+    TimerId retryTimer_;
+};
+
+using ConnectorPtr = std::shared_ptr<Connector>;
@@ -0,0 +1,90 @@
+#ifdef MYMUDUO_COROUTINE
+
+#include "Coroutine.h"
+#include "Logger.h"
+
+namespace {
+
+// co_spawn使用的外层协程，结束时自动销毁协程帧
+struct DetachedTask {
+    struct promise_type : detail::PooledPromise {
+        DetachedTask get_return_object() {
+            return DetachedTask{ std::coroutine_handle<promise_type>::from_promise( *this ) };
+        }
+        std::suspend_always initial_suspend() const noexcept { return {}; }
+        std::suspend_never final_suspend() const noexcept { return {}; }
+        void return_void() const noexcept {}
+        void unhandled_exception() const noexcept { std::terminate(); }
+    };
+    std::coroutine_handle<promise_type> handle;
+};
+
+DetachedTask runDetached( Task<> task ) {
+    co_await task;
+}
+
+} // namespace
+
+void co_spawn( EventLoop *loop , Task<> task ) {
+    std::coroutine_handle<> h = runDetached( std::move( task ) ).handle;
+    loop->runInLoop( [h] () { h.resume(); } );
+}
+
+SleepAwaiter EventLoop::sleep( double seconds ) {
+    return SleepAwaiter( this , seconds );
+}
+
+void SleepAwaiter::await_suspend( std::coroutine_handle<> h ) {
+    loop_->runAfter( seconds_ , [h] () { h.resume(); } );
+}
+
+ReadAwaiter TcpConnection::readAtLeast( size_t n ) {
+    return ReadAwaiter( this , n );
+}
+
+WriteAwaiter TcpConnection::write( const std::string &buf ) {
+    return WriteAwaiter( this , buf.data() , buf.size() );
+}
+
+WriteAwaiter TcpConnection::write( const void *data , size_t len ) {
+    return WriteAwaiter( this , data , len );
+}
+
+bool ReadAwaiter::await_ready() const noexcept {
+    return conn_->inputBuffer_.readableBytes() >= bytes_ || !conn_->connected();
+}
+
+void ReadAwaiter::await_suspend( std::coroutine_handle<> h ) {
+    if (!conn_->getLoop()->isInLoopThread() || conn_->readWaiter_ != nullptr) {
+        LOG_FATAL( "%s:%s:%d readAtLeast must be awaited by a single coroutine in the loop thread \n" ,
+            __FILE__ , __FUNCTION__ , __LINE__ );
+    }
+    conn_->readWaiter_ = h.address();
+    conn_->readWaitBytes_ = bytes_;
+}
+
+Buffer *ReadAwaiter::await_resume() const noexcept {
+    if (conn_->inputBuffer_.readableBytes() >= bytes_) {
+        return &conn_->inputBuffer_;
+    }
+    return nullptr;
+}
+
+bool WriteAwaiter::await_suspend( std::coroutine_handle<> h ) {
+    if (!conn_->getLoop()->isInLoopThread() || conn_->writeWaiter_ != nullptr) {
+        LOG_FATAL( "%s:%s:%d write must be awaited by a single coroutine in the loop thread \n" ,
+            __FILE__ , __FUNCTION__ , __LINE__ );
+    }
+    if (!conn_->connected()) {
+        return false;
+    }
+    conn_->countEvent( TrafficCounters::kMessagesSent );
+    conn_->sendInLoop( data_ , len_ );
+    if (conn_->pendingOutputBytes() == 0 || !conn_->connected()) {
+        return false;
+    }
+    conn_->writeWaiter_ = h.address();
+    return true;
+}
+
+#endif
@@ -0,0 +1,187 @@
+#pragma once
+
+#if __cplusplus < 202002L
+#error "Coroutine.h requires C++20, configure with -DMYMUDUO_COROUTINE=ON"
+#endif
+
+#include "EventLoop.h"
+#include "TcpConnection.h"
+#include "FreeListPool.h"
+
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <string>
+#include <utility>
+
+/**
+ * 基于C++20协程的接口，协程运行在连接所属的loop线程中
+ *
+ *  Task<> echo( TcpConnectionPtr conn ) {
+ *      while (Buffer *buf = co_await conn->readAtLeast( 1 )) {
+ *          std::string msg = buf->retrieveAllAsString();
+ *          if (!co_await conn->write( msg )) break;
+ *      }
+ *  }
+ *  co_spawn( conn->getLoop() , echo( conn ) );
+ *
+ * 协程帧从线程局部的FreeListPool中分配，不走全局的malloc
+*/
+
+namespace detail {
+
+// 所有promise的公共部分：协程帧的池化分配
+struct PooledPromise {
+    static void *operator new( size_t size ) {
+        return FreeListPool::allocate( size );
+    }
+    static void operator delete( void *ptr , size_t size ) {
+        FreeListPool::deallocate( ptr , size );
+    }
+};
+
+template<typename Promise>
+struct FinalAwaiter {
+    bool await_ready() const noexcept { return false; }
+    // 对称转移，直接切换到等待该Task的协程，不增加栈深度
+    std::coroutine_handle<> await_suspend( std::coroutine_handle<Promise> h ) noexcept {
+        std::coroutine_handle<> continuation = h.promise().continuation;
+        if (continuation) {
+            return continuation;
+        }
+        return std::noop_coroutine();
+    }
+    void await_resume() const noexcept {}
+};
+
+template<typename T>
+struct TaskPromiseBase : PooledPromise {
+    std::coroutine_handle<> continuation;
+    std::exception_ptr exception;
+
+    std::suspend_always initial_suspend() const noexcept { return {}; }
+    void unhandled_exception() { exception = std::current_exception(); }
+};
+
+} // namespace detail
+
+// 惰性启动的协程任务，被co_await或co_spawn时才开始执行
+template<typename T = void>
+class Task : noncopyable {
+public:
+    struct promise_type : detail::TaskPromiseBase<T> {
+        std::optional<T> value;
+
+        Task get_return_object() {
+            return Task( std::coroutine_handle<promise_type>::from_promise( *this ) );
+        }
+        detail::FinalAwaiter<promise_type> final_suspend() const noexcept { return {}; }
+        void return_value( T v ) { value.emplace( std::move( v ) ); }
+    };
+
+    Task( Task &&other ) noexcept : handle_( std::exchange( other.handle_ , nullptr ) ) {}
+    ~Task() {
+        if (handle_) {
+            handle_.destroy();
+        }
+    }
+
+    bool await_ready() const noexcept { return !handle_ || handle_.done(); }
+    std::coroutine_handle<> await_suspend( std::coroutine_handle<> continuation ) noexcept {
+        handle_.promise().continuation = continuation;
+        return handle_;
+    }
+    T await_resume() {
+        if (handle_.promise().exception) {
+            std::rethrow_exception( handle_.promise().exception );
+        }
+        return std::move( *handle_.promise().value );
+    }
+private:
+    explicit Task( std::coroutine_handle<promise_type> h ) : handle_( h ) {}
+    std::coroutine_handle<promise_type> handle_;
+};
+
+template<>
+class Task<void> : noncopyable {
+public:
+    struct promise_type : detail::TaskPromiseBase<void> {
+        Task get_return_object() {
+            return Task( std::coroutine_handle<promise_type>::from_promise( *this ) );
+        }
+        detail::FinalAwaiter<promise_type> final_suspend() const noexcept { return {}; }
+        void return_void() const noexcept {}
+    };
+
+    Task( Task &&other ) noexcept : handle_( std::exchange( other.handle_ , nullptr ) ) {}
+    ~Task() {
+        if (handle_) {
+            handle_.destroy();
+        }
+    }
+
+    bool await_ready() const noexcept { return !handle_ || handle_.done(); }
+    std::coroutine_handle<> await_suspend( std::coroutine_handle<> continuation ) noexcept {
+        handle_.promise().continuation = continuation;
+        return handle_;
+    }
+    void await_resume() {
+        if (handle_.promise().exception) {
+            std::rethrow_exception( handle_.promise().exception );
+        }
+    }
+private:
+    explicit Task( std::coroutine_handle<promise_type> h ) : handle_( h ) {}
+    std::coroutine_handle<promise_type> handle_;
+};
+
+// 在loop中启动一个协程，协程结束后自动释放，loop所在线程中调用时立即开始执行
+void co_spawn( EventLoop *loop , Task<> task );
+
+// co_await loop->sleep( seconds )
+class SleepAwaiter {
+public:
+    SleepAwaiter( EventLoop *loop , double seconds )
+        : loop_( loop )
+        , seconds_( seconds ) {}
+
+    bool await_ready() const noexcept { return seconds_ <= 0.0; }
+    void await_suspend( std::coroutine_handle<> h );
+    void await_resume() const noexcept {}
+private:
+    EventLoop *loop_;
+    double seconds_;
+};
+
+// co_await conn->readAtLeast( n )
+class ReadAwaiter {
+public:
+    ReadAwaiter( TcpConnection *conn , size_t n )
+        : conn_( conn )
+        , bytes_( n ) {}
+
+    bool await_ready() const noexcept;
+    void await_suspend( std::coroutine_handle<> h );
+    Buffer *await_resume() const noexcept;
+private:
+    TcpConnection *conn_;
+    size_t bytes_;
+};
+
+// co_await conn->write( buf )
+class WriteAwaiter {
+public:
+    WriteAwaiter( TcpConnection *conn , const void *data , size_t len )
+        : conn_( conn )
+        , data_( data )
+        , len_( len ) {}
+
+    bool await_ready() const noexcept { return false; }
+    // 数据能立即全部写入内核时不挂起
+    bool await_suspend( std::coroutine_handle<> h );
+    bool await_resume() const noexcept { return conn_->connected(); }
+private:
+    TcpConnection *conn_;
+    const void *data_;
+    size_t len_;
+};
@@ -2,18 +2,34 @@
 #include "Logger.h"
 #include "Poller.h"
 #include "Channel.h"
+#include "TimerQueue.h"
+#include "MemoryBudget.h"
+#include "Tracer.h"
 
 #include <sys/eventfd.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <errno.h>
 #include <memory>
+#include <signal.h>
 
 // 防止一个线程创建多个EventLoop thread_local
 __thread EventLoop *t_loopInThisThread = nullptr;
 
 // 定义默认的Poller IO复用接口的超时时间
 const int kPollTimeMs = 10000;
+// loop利用率的统计周期，微秒
+const int64_t kUtilizationWindowUs = 100 * 1000;
+
+// 对端关闭后继续写会收到SIGPIPE，默认动作是终止进程；忽略后write/splice返回EPIPE，按连接出错处理
+// AF_UNIX连接在对端关闭后第一次写就会触发
+class IgnoreSigPipe {
+public:
+    IgnoreSigPipe() {
+        ::signal( SIGPIPE , SIG_IGN );
+    }
+};
+static IgnoreSigPipe initObj;
 
 // 创建wakeupfd，用来notify唤醒subReactor处理新来的channel
 int createEventfd() {
@@ -27,11 +43,24 @@ int createEventfd() {
 EventLoop::EventLoop()
     :looping_( false )
     , quit_( false )
-    , callingPendingFunctors_( false )  /* 表征loop是否在执行用户注册的回调中 */
     , threadId_( CurrentThread::tid() ) /* 当前线程Id，loop只会在创建其的线程上运行 */
     , poller_( Poller::newDefaultPoller( this ) ) /* 根据系统环境变量创建Poller对象，可为epoll和poll */
+    , timerQueue_( new TimerQueue( this ) ) /* 定时器队列，timerfd注册在当前loop的poller上 */
     , wakeupFd_( createEventfd() )  /* 创建eventfd，用于其它线程唤醒当前线程执行及时执行注册在当前loop上的回调 */
-    , wakeupChannel_( new Channel( this , wakeupFd_ ) )/* 将eventfd封装到Channel */{
+    , wakeupChannel_( new Channel( this , wakeupFd_ ) )/* 将eventfd封装到Channel */
+    , callingPendingFunctors_( false )  /* 表征loop是否在执行用户注册的回调中 */
+    , callingAfterDispatch_( false )
+    , numConnections_( 0 )
+    , utilization_( 0 )
+    , utilizationUpdated_( 0 )
+    , busyMicroSeconds_( 0 )
+    , bufferedBytes_( 0 )
+    , unflushedBytes_( 0 )
+    , iterations_( 0 )
+    , busySince_( 0 )
+    , activity_( "poll" )
+    , activityFd_( -1 )
+    , activityConn_( 0 ) {
     LOG_DEBUG( "EventLoop created %p in thread %d \n" , this , threadId_ );
     if (t_loopInThisThread) {
         LOG_FATAL( "Another EventLoop %p exists in this thread %d \n" , t_loopInThisThread , threadId_ );
@@ -59,21 +88,38 @@ EventLoop::~EventLoop() {
 void EventLoop::loop() {
     looping_ = true;
     quit_ = false;
+    windowStart_ = Timestamp::now();
 
     LOG_INFO( "EventLoop %p start looping \n" , this );
 
     while (!quit_) {
         activeChannels_.clear();
-         pollReturnTime_ = poller_->poll( kPollTimeMs , &activeChannels_ );
+        // 开启追踪时记下poll开始的时间，这一轮处理了被采样的请求时记录poll等待和处理的时间
+        int64_t pollStart = Tracer::sampleRate() != 0 ? Timestamp::now().microSecondsSinceEpoch() : 0;
+        pollReturnTime_ = poller_->poll( kPollTimeMs , &activeChannels_ );
+        busySince_.store( pollReturnTime_.microSecondsSinceEpoch() , std::memory_order_relaxed );
+        iterations_.store( iterations_.load( std::memory_order_relaxed ) + 1 , std::memory_order_relaxed );
         for (Channel *channel : activeChannels_) {
+            setActivity( "channel" , channel->fd() , 0 );
             // Poller监听哪些channel发生事件了，然后上报给EventLoop，通知channel处理相应的的事件
             channel->handleEvent( pollReturnTime_ );
         }
+        setActivity( "functor" , -1 , 0 );
         // 执行当前EventLoop时间内循环需要处理的回调操作
         /**
         * mainLoop 事先注册一个回调cb（需要subloop来执行） wakeup subloop后，执行下面的方法，执行之前mainloop注册的cb操作
         */
         doPendingFunctors();
+        // 事件和回调中合并的操作，如auto-cork连接的发送
+        setActivity( "afterDispatch" , -1 , 0 );
+        doAfterDispatchFunctors();
+        setActivity( "poll" , -1 , 0 );
+        busySince_.store( 0 , std::memory_order_relaxed );
+        if (pollStart != 0) {
+            Tracer::recordIteration( pollStart , pollReturnTime_.microSecondsSinceEpoch() ,
+                Timestamp::now().microSecondsSinceEpoch() , static_cast<int64_t>( activeChannels_.size() ) );
+        }
+        updateUtilization( pollReturnTime_ );
     }
 
     LOG_INFO( "EventLoop %p stop looping. \n" , this );
@@ -98,23 +144,54 @@ void EventLoop::runInLoop( Functor cb ) {
         cb();
     }
     else {  //在非当前loop线程中执行，就需要先唤醒loop所在线程，执行cb
-        queueInLoop( cb );
+        queueInLoop( std::move( cb ) );
     }
 }
 
 // 把cb放入队列中，唤醒loop
 void EventLoop::queueInLoop( Functor cb ) {
+    // 被采样的请求中提交的回调跟随请求的决定；loop之外的线程提交的回调本身是一个请求的入口，在这里决定
+    if (Tracer::sampling() || ( t_loopInThisThread == nullptr && Tracer::sample() )) {
+        cb = Tracer::wrapQueued( std::move( cb ) );
+    }
     {
         std::unique_lock<std::mutex> lock( mutex_ );
-        pendingFunctors_.emplace_back( cb );
+        pendingFunctors_.emplace_back( std::move( cb ) );
     }
     // 唤醒相应的，需要执行回调操作的loop的线程了
     // callingPendingFunctors_解释：当回调正在执行过程中，执行完后马上会阻塞在epoll_wait处，因此，也需要通过写wakeupfd来唤醒它，来执行新注册的回调函数
-    if (!isInLoopThread() || callingPendingFunctors_) {
+    // 在runAfterDispatch的回调中加入的同理，例如发送完成后的writeCompleteCallback_
+    if (!isInLoopThread() || callingPendingFunctors_ || callingAfterDispatch_) {
         wakeup();   // 唤醒loop所在线程
     }
 }
 
+void EventLoop::runAfterDispatch( Functor cb ) {
+    afterDispatchFunctors_.emplace_back( std::move( cb ) );
+    // 在loop开始之前调用时，不能等到第一次poll超时才执行
+    if (!looping_) {
+        wakeup();
+    }
+}
+
+TimerId EventLoop::runAt( Timestamp time , Functor cb ) {
+    return timerQueue_->addTimer( std::move( cb ) , time , 0.0 );
+}
+
+TimerId EventLoop::runAfter( double delay , Functor cb ) {
+    Timestamp time( addTime( Timestamp::now() , delay ) );
+    return runAt( time , std::move( cb ) );
+}
+
+TimerId EventLoop::runEvery( double interval , Functor cb ) {
+    Timestamp time( addTime( Timestamp::now() , interval ) );
+    return timerQueue_->addTimer( std::move( cb ) , time , interval );
+}
+
+void EventLoop::cancel( TimerId timerId ) {
+    timerQueue_->cancel( timerId );
+}
+
 void EventLoop::handleRead() {
     uint64_t one = 1;
     ssize_t n = read( wakeupFd_ , &one , sizeof one );
@@ -144,6 +221,36 @@ bool EventLoop::hasChannel( Channel *channel ) {
     return poller_->hasChannel( channel );
 }
 
+void EventLoop::updateUtilization( Timestamp pollReturnTime ) {
+    Timestamp now( Timestamp::now() );
+    busyMicroSeconds_ += now.microSecondsSinceEpoch() - pollReturnTime.microSecondsSinceEpoch();
+    int64_t window = now.microSecondsSinceEpoch() - windowStart_.microSecondsSinceEpoch();
+    if (window >= kUtilizationWindowUs) {
+        utilization_.store( static_cast<int>( busyMicroSeconds_ * 1000 / window ) , std::memory_order_relaxed );
+        utilizationUpdated_.store( now.microSecondsSinceEpoch() , std::memory_order_relaxed );
+        busyMicroSeconds_ = 0;
+        windowStart_ = now;
+    }
+}
+
+void EventLoop::addBufferedBytes( int64_t delta ) {
+    bufferedBytes_.store( bufferedBytes_.load( std::memory_order_relaxed ) + delta , std::memory_order_relaxed );
+    unflushedBytes_ += delta;
+    if (unflushedBytes_ >= MemoryBudget::kFlushBytes || unflushedBytes_ <= -MemoryBudget::kFlushBytes) {
+        MemoryBudget::instance().addUsage( unflushedBytes_ );
+        unflushedBytes_ = 0;
+    }
+}
+
+int EventLoop::utilization() const {
+    // loop长时间阻塞在poll上时不会更新，说明它是空闲的
+    int64_t updated = utilizationUpdated_.load( std::memory_order_relaxed );
+    if (Timestamp::now().microSecondsSinceEpoch() - updated > 2 * kUtilizationWindowUs) {
+        return 0;
+    }
+    return utilization_.load( std::memory_order_relaxed );
+}
+
 // 执行回调
 void EventLoop::doPendingFunctors() {
     std::vector< Functor> functors;
@@ -158,4 +265,14 @@ void EventLoop::doPendingFunctors() {
         functor();
     }
     callingPendingFunctors_ = false;
-}
\ No newline at end of file
+}
+void EventLoop::doAfterDispatchFunctors() {
+    callingAfterDispatch_ = true;
+    // 回调中可能再注册新的回调，按下标遍历，先移出再调用，扩容不影响正在执行的回调；clear保留容量，每轮不再分配
+    for (size_t i = 0; i < afterDispatchFunctors_.size(); ++i) {
+        Functor cb( std::move( afterDispatchFunctors_[i] ) );
+        cb();
+    }
+    afterDispatchFunctors_.clear();
+    callingAfterDispatch_ = false;
+}
@@ -9,9 +9,12 @@
 #include "noncopyable.h"
 #include "Timestamp.h"
 #include "CurrentThread.h"
+#include "TimerId.h"
 
 class Channel;
 class Poller;
+class TimerQueue;
+class SleepAwaiter;
 
 class EventLoop : noncopyable{
 public:
@@ -31,6 +34,24 @@ public:
     void runInLoop( Functor cb );
     // 把cb放入队列中，唤醒loop
     void queueInLoop( Functor cb );
+    /**
+     * 本轮循环的事件和回调都处理完之后、下一次poll之前执行cb，只能在loop线程中调用
+     * 用于把一轮中的多次操作合并成一次，如TcpConnection的auto-cork在这里统一发送
+    */
+    void runAfterDispatch( Functor cb );
+
+    // 定时器，可以跨线程调用，回调在loop所在线程执行
+    // 在time时刻执行cb
+    TimerId runAt( Timestamp time , Functor cb );
+    // delay秒后执行cb
+    TimerId runAfter( double delay , Functor cb );
+    // 每隔interval秒执行一次cb
+    TimerId runEvery( double interval , Functor cb );
+    void cancel( TimerId timerId );
+
+    // 协程中使用：co_await loop->sleep(seconds)，到期后在本loop线程中恢复执行
+    // 需要以MYMUDUO_COROUTINE选项编译，并包含Coroutine.h
+    SleepAwaiter sleep( double seconds );
 
     // 用来唤醒loop所在线程的
     void wakeup();
@@ -41,11 +62,48 @@ public:
 
     // 判断EventLoop对象是否在当前线程里
     bool isInLoopThread() const { return threadId_ == CurrentThread::tid(); }
+
+    /**
+     * 负载信号，供EventLoopThreadPool选择subloop，都是原子变量，任意线程无锁读取
+    */
+    // 分配到该loop上的连接数，TcpServer分配连接时增加，移除连接时减少
+    void addConnectionCount( int delta ) { numConnections_.fetch_add( delta , std::memory_order_relaxed ); }
+    int connectionCount() const { return numConnections_.load( std::memory_order_relaxed ); }
+    // 最近一个统计周期内loop处理事件和回调的时间占比，千分比
+    int utilization() const;
+
+    // 本loop上所有连接缓冲区占用的内存，任意线程读取
+    int64_t bufferedBytes() const { return bufferedBytes_.load( std::memory_order_relaxed ); }
+    // 只能在loop线程中调用，累计到一定量后刷新到MemoryBudget的全局计数
+    void addBufferedBytes( int64_t delta );
+
+    /**
+     * 心跳，供Watchdog在其它线程中检测loop是否卡在某个回调中，只由loop线程写入，任意线程无锁读取
+    */
+    pid_t threadId() const { return threadId_; }
+    // poll返回的次数
+    uint64_t iterations() const { return iterations_.load( std::memory_order_relaxed ); }
+    // 本轮开始处理事件的时间（poll返回时），微秒；阻塞在poll中时为0
+    int64_t busySince() const { return busySince_.load( std::memory_order_relaxed ); }
+    // 正在执行的操作，如"channel"、"messageCallback"、"functor"，以及相关的fd和连接id（没有时为-1和0）
+    const char *activity() const { return activity_.load( std::memory_order_relaxed ); }
+    int activityFd() const { return activityFd_.load( std::memory_order_relaxed ); }
+    uint64_t activityConnection() const { return activityConn_.load( std::memory_order_relaxed ); }
+    // 只能在loop线程中调用，activity必须是字符串字面量
+    void setActivity( const char *activity , int fd , uint64_t connId ) {
+        activity_.store( activity , std::memory_order_relaxed );
+        activityFd_.store( fd , std::memory_order_relaxed );
+        activityConn_.store( connId , std::memory_order_relaxed );
+    }
 private:
     // wake up
     void handleRead();
     // 执行回调
     void doPendingFunctors();
+    // 执行runAfterDispatch注册的回调
+    void doAfterDispatchFunctors();
+    // 每轮循环结束时累计忙碌时间，每个统计周期更新一次utilization_
+    void updateUtilization( Timestamp pollReturnTime );
     
     using ChannelList = std::vector<Channel *>;
 
@@ -55,6 +113,7 @@ private:
     const pid_t threadId_;  // 记录当前loop所在的线程Id
     Timestamp pollReturnTime_;  //poller返回发生事件的channels的时间点
     std::unique_ptr<Poller> poller_;
+    std::unique_ptr<TimerQueue> timerQueue_;
 
     int wakeupFd_;  //当mainLoop获取一个新用户的channel，通过轮询算法选择一个subloop，通过该成员唤醒subloop处理
     std::unique_ptr<Channel> wakeupChannel_;
@@ -64,4 +123,21 @@ private:
     std::atomic_bool callingPendingFunctors_;   // 标识当前loop是否有需要执行的回调操作
     std::vector<Functor> pendingFunctors_;  // 存储loop需要执行的所有的回调操作
     std::mutex mutex_;
+    std::vector<Functor> afterDispatchFunctors_;    // 只在loop线程中访问，不需要加锁
+    bool callingAfterDispatch_;
+
+    std::atomic_int numConnections_;
+    std::atomic_int utilization_;   // 千分比
+    std::atomic<int64_t> utilizationUpdated_;    // utilization_最近一次更新的时间，微秒
+    int64_t busyMicroSeconds_;  // 当前统计周期内的忙碌时间，只在loop线程中访问
+    Timestamp windowStart_;
+
+    std::atomic<int64_t> bufferedBytes_;    // 只由loop线程写
+    int64_t unflushedBytes_;    // 尚未刷新到MemoryBudget的变化量
+
+    std::atomic<uint64_t> iterations_;  // 心跳，只由loop线程写
+    std::atomic<int64_t> busySince_;
+    std::atomic<const char *> activity_;
+    std::atomic_int activityFd_;
+    std::atomic<uint64_t> activityConn_;
 };
\ No newline at end of file
@@ -7,6 +7,7 @@
 #include <mutex>
 #include <condition_variable>
 #include <string>
+#include <vector>
 
 class EventLoop;
 
@@ -19,6 +20,10 @@ public:
 
     ~EventLoopThread();
 
+    // 线程放置，在startLoop之前设置，见Thread::setCpuAffinity/setNumaLocal
+    void setCpuAffinity( const std::vector<int> &cpus ) { thread_.setCpuAffinity( cpus ); }
+    void setNumaLocal( bool on ) { thread_.setNumaLocal( on ); }
+
     EventLoop *startLoop();
 private:
     void threadFunc();
@@ -1,13 +1,34 @@
 #include "EventLoopThreadPool.h"
 #include "EventLoopThread.h"
+#include "EventLoop.h"
+#include "InetAddress.h"
 #include <memory>
+#include <algorithm>
+#include <string>
+#include <string.h>
+
+// FNV-1a哈希，再做一次混合，让相邻的ip在环上分散开
+static uint32_t hashBytes( const void *data , size_t len ) {
+    const unsigned char *p = static_cast<const unsigned char *>( data );
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < len; ++i) {
+        h ^= p[i];
+        h *= 16777619u;
+    }
+    h ^= h >> 16;
+    h *= 0x85ebca6bu;
+    h ^= h >> 13;
+    return h;
+}
 
 EventLoopThreadPool::EventLoopThreadPool( EventLoop *baseLoop , const std::string &nameArg )
     : baseLoop_( baseLoop )
     , name_( nameArg )
     , started_( false )
     , numThreads_( 0 )
-    , next_( 0 ) {}
+    , next_( 0 )
+    , numaLocal_( false )
+    , strategy_( kRoundRobin ) {}
 
 EventLoopThreadPool::~EventLoopThreadPool() {}
 
@@ -18,6 +39,10 @@ void EventLoopThreadPool::start( const ThreadInitCallback &cb ) {
         char buf[name_.size() + 32];
         snprintf( buf , sizeof buf , "%s%d" , name_.c_str() , i );
         EventLoopThread *t = new EventLoopThread( cb , buf );
+        if (!cpuSets_.empty()) {
+            t->setCpuAffinity( cpuSets_[i % cpuSets_.size()] );
+            t->setNumaLocal( numaLocal_ );
+        }
         threads_.push_back( std::unique_ptr<EventLoopThread>( t ) );
         loops_.push_back( t->startLoop() ); // 底层创建线程，线程函数中创建一个新的EventLoop，并启动循环返回该loop的地址
     }
@@ -26,6 +51,8 @@ void EventLoopThreadPool::start( const ThreadInitCallback &cb ) {
     if (numThreads_ == 0 && cb) {
         cb( baseLoop_ );
     }
+
+    buildHashRing();
 }
 
 // 如果工作在多线程中，baseloop_默认以轮询的方式分配channel给subloop
@@ -42,6 +69,98 @@ EventLoop *EventLoopThreadPool::getNextLoop() {
     return loop;
 }
 
+EventLoop *EventLoopThreadPool::getNextLoop( const InetAddress &peerAddr ) {
+    if (loops_.empty()) {
+        return baseLoop_;
+    }
+    if (chooser_) {
+        return chooser_( loops_ , peerAddr );
+    }
+
+    switch (strategy_) {
+    case kLeastConnections:
+        return getLeastConnectionsLoop();
+    case kLeastUtilization:
+        return getLeastUtilizationLoop();
+    case kConsistentHash:
+    {
+        // AF_UNIX的对端地址一般是未命名的，无法区分客户端，退化为轮询
+        if (peerAddr.isUnix()) {
+            return getNextLoop();
+        }
+        // 只取ip，同一客户端的多个连接落在同一个loop上
+        const sockaddr_in *addr = peerAddr.getSockAddr();
+        return getLoopForHash( hashBytes( &addr->sin_addr , sizeof addr->sin_addr ) );
+    }
+    default:
+        return getNextLoop();
+    }
+}
+
+EventLoop *EventLoopThreadPool::getLoopForHash( uint32_t hashCode ) {
+    if (hashRing_.empty()) {
+        return baseLoop_;
+    }
+    // 顺时针找到第一个不小于hashCode的虚拟节点
+    auto it = std::lower_bound( hashRing_.begin() , hashRing_.end() , std::make_pair( hashCode , static_cast<EventLoop *>( nullptr ) ) );
+    if (it == hashRing_.end()) {
+        it = hashRing_.begin();
+    }
+    return it->second;
+}
+
+// 从轮询位置开始扫描，连接数相同时不会总是选中第一个loop
+EventLoop *EventLoopThreadPool::getLeastConnectionsLoop() {
+    size_t n = loops_.size();
+    size_t start = next_;
+    next_ = ( next_ + 1 ) % n;
+
+    EventLoop *best = loops_[start];
+    int bestCount = best->connectionCount();
+    for (size_t i = 1; i < n && bestCount > 0; ++i) {
+        EventLoop *loop = loops_[( start + i ) % n];
+        int count = loop->connectionCount();
+        if (count < bestCount) {
+            best = loop;
+            bestCount = count;
+        }
+    }
+    return best;
+}
+
+// 利用率相同时按连接数比较
+EventLoop *EventLoopThreadPool::getLeastUtilizationLoop() {
+    size_t n = loops_.size();
+    size_t start = next_;
+    next_ = ( next_ + 1 ) % n;
+
+    EventLoop *best = loops_[start];
+    int bestUtil = best->utilization();
+    int bestCount = best->connectionCount();
+    for (size_t i = 1; i < n; ++i) {
+        EventLoop *loop = loops_[( start + i ) % n];
+        int util = loop->utilization();
+        int count = loop->connectionCount();
+        if (util < bestUtil || ( util == bestUtil && count < bestCount )) {
+            best = loop;
+            bestUtil = util;
+            bestCount = count;
+        }
+    }
+    return best;
+}
+
+void EventLoopThreadPool::buildHashRing() {
+    hashRing_.clear();
+    for (size_t i = 0; i < loops_.size(); ++i) {
+        for (int v = 0; v < kVirtualNodes; ++v) {
+            std::string key = name_ + "#" + std::to_string( i ) + "#" + std::to_string( v );
+            hashRing_.push_back( std::make_pair( hashBytes( key.data() , key.size() ) , loops_[i] ) );
+        }
+    }
+    std::sort( hashRing_.begin() , hashRing_.end() );
+}
+
 std::vector<EventLoop *> EventLoopThreadPool::getAllLoops() {
     if (loops_.empty()) {
         return std::vector<EventLoop *>( 1 , baseLoop_ );
@@ -5,13 +5,25 @@
 #include <string>
 #include <vector>
 #include <memory>
+#include <stdint.h>
 
 class EventLoop;
 class EventLoopThread;
+class InetAddress;
 
 class EventLoopThreadPool {
 public:
     using ThreadInitCallback = std::function<void( EventLoop * )>;
+    // 自定义的subloop选择策略，loops为所有subloop
+    using LoopChooser = std::function<EventLoop *( const std::vector<EventLoop *> &loops , const InetAddress &peerAddr )>;
+
+    // 新连接分配到subloop的策略
+    enum Strategy {
+        kRoundRobin ,       // 轮询
+        kLeastConnections , // 连接数最少的loop
+        kLeastUtilization , // 最近利用率最低的loop
+        kConsistentHash ,   // 按对端ip做一致性哈希，同一客户端总是落在同一个loop上
+    };
 
     EventLoopThreadPool( EventLoop *baseLoop , const std::string &nameArg );
     ~EventLoopThreadPool();
@@ -19,14 +31,37 @@ public:
 
     void start( const ThreadInitCallback &cb = ThreadInitCallback() );
 
+    /**
+     * subloop线程的放置，在start之前设置
+     * 第i个subloop线程绑定到cpuSets[i % cpuSets.size()]上，线程名为name+i
+     * numaLocal为true时，loop线程的内存（连接对象、Buffer等）优先分配在其cpu所在的NUMA节点
+    */
+    void setCpuAffinity( const std::vector<std::vector<int>> &cpuSets ) { cpuSets_ = cpuSets; }
+    void setNumaLocal( bool on ) { numaLocal_ = on; }
+
+    // 在start之前设置
+    void setStrategy( Strategy strategy ) { strategy_ = strategy; }
+    void setLoopChooser( const LoopChooser &chooser ) { chooser_ = chooser; }
+
     // 如果工作在多线程中，baseloop_默认以轮询的方式分配channel给subloop
     EventLoop *getNextLoop();
+    // 按设置的策略为来自peerAddr的新连接选择subloop
+    EventLoop *getNextLoop( const InetAddress &peerAddr );
+    // 在一致性哈希环上查找hashCode对应的subloop
+    EventLoop *getLoopForHash( uint32_t hashCode );
 
     std::vector<EventLoop *> getAllLoops();
 
     bool started() const { return started_; }
     const std::string name() const { return name_; }
 private:
+    EventLoop *getLeastConnectionsLoop();
+    EventLoop *getLeastUtilizationLoop();
+    void buildHashRing();
+
+    // 每个subloop在哈希环上的虚拟节点数
+    static const int kVirtualNodes = 100;
+
     EventLoop *baseLoop_;
     std::string name_;
     bool started_;
@@ -34,4 +69,9 @@ private:
     int next_;
     std::vector<std::unique_ptr<EventLoopThread>> threads_;
     std::vector<EventLoop *> loops_;
+    std::vector<std::vector<int>> cpuSets_;
+    bool numaLocal_;
+    Strategy strategy_;
+    LoopChooser chooser_;
+    std::vector<std::pair<uint32_t , EventLoop *>> hashRing_;   // 按哈希值排序，start之后只读
 };
\ No newline at end of file
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <stddef.h>
+#include <new>
+
+/**
+ * 线程局部的定长内存块空闲链表，按64字节对齐分档（最大kMaxBlockSize）
+ * one loop per thread，分配和释放绝大多数发生在同一个loop线程中，因此不需要加锁
+ * 在别的线程中释放的内存块会进入该线程的空闲链表，不会出错，只是不再回到原线程
+*/
+class FreeListPool {
+public:
+    static const size_t kAlignment = 64;
+    static const size_t kMaxBlockSize = 4096;
+    static const size_t kNumClasses = kMaxBlockSize / kAlignment;
+    static const size_t kMaxFreeBlocks = 1024;  // 每档最多缓存的空闲块数量
+
+    static void *allocate( size_t size ) {
+        if (size == 0 || size > kMaxBlockSize) {
+            return ::operator new( size );
+        }
+        FreeList &list = freeLists()[sizeClass( size )];
+        if (list.head != nullptr) {
+            Node *node = list.head;
+            list.head = node->next;
+            --list.count;
+            return node;
+        }
+        return ::operator new( ( sizeClass( size ) + 1 ) * kAlignment );
+    }
+
+    static void deallocate( void *ptr , size_t size ) {
+        if (size == 0 || size > kMaxBlockSize) {
+            ::operator delete( ptr );
+            return;
+        }
+        FreeList &list = freeLists()[sizeClass( size )];
+        if (list.count >= kMaxFreeBlocks) {
+            ::operator delete( ptr );
+            return;
+        }
+        Node *node = static_cast<Node *>( ptr );
+        node->next = list.head;
+        list.head = node;
+        ++list.count;
+    }
+private:
+    struct Node {
+        Node *next;
+    };
+
+    struct FreeList {
+        Node *head;
+        size_t count;
+    };
+
+    static size_t sizeClass( size_t size ) {
+        return ( size - 1 ) / kAlignment;
+    }
+
+    // 线程退出时不归还缓存的内存块，数量有上限
+    static FreeList *freeLists() {
+        static __thread FreeList lists[kNumClasses];
+        return lists;
+    }
+};
+
+// 从FreeListPool分配内存的标准分配器，用于std::allocate_shared和容器
+template <typename T>
+class PoolAllocator {
+public:
+    using value_type = T;
+
+    PoolAllocator() noexcept {}
+    template <typename U>
+    PoolAllocator( const PoolAllocator<U> & ) noexcept {}
+
+    T *allocate( size_t n ) {
+        return static_cast<T *>( FreeListPool::allocate( n * sizeof( T ) ) );
+    }
+    void deallocate( T *ptr , size_t n ) {
+        FreeListPool::deallocate( ptr , n * sizeof( T ) );
+    }
+};
+
+template <typename T , typename U>
+bool operator==( const PoolAllocator<T> & , const PoolAllocator<U> & ) { return true; }
+template <typename T , typename U>
+bool operator!=( const PoolAllocator<T> & , const PoolAllocator<U> & ) { return false; }
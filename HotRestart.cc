@@ -0,0 +1,254 @@
+#include "HotRestart.h"
+#include "Acceptor.h"
+#include "Channel.h"
+#include "EventLoop.h"
+#include "TcpServer.h"
+#include "Logger.h"
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+static const char kHandoverRequest[] = "HANDOVER\n";
+static const char kReady[] = "READY\n";
+
+HotRestart::HotRestart( EventLoop *loop , const InetAddress &controlAddr )
+    : loop_( loop )
+    , controlAddr_( controlAddr )
+    , controlListenFd_( -1 )
+    , sentFds_( false )
+    , controlFd_( -1 ) {
+}
+
+HotRestart::~HotRestart() {
+    if (controlChannel_) {
+        controlChannel_->disableAll();
+        controlChannel_->remove();
+        ::close( controlChannel_->fd() );
+    }
+    if (controlFd_ >= 0) {
+        ::close( controlFd_ );
+    }
+    if (controlListenFd_ >= 0) {
+        ::close( controlListenFd_ );
+    }
+    for (int fd : inheritedFds_) {
+        ::close( fd );
+    }
+}
+
+bool HotRestart::inherit( double timeoutSeconds ) {
+    int sockfd = ::socket( AF_UNIX , SOCK_STREAM | SOCK_CLOEXEC , 0 );
+    if (sockfd < 0) {
+        LOG_ERROR( "HotRestart::inherit - socket error:%d \n" , errno );
+        return false;
+    }
+    if (::connect( sockfd , controlAddr_.getSockAddrGeneric() , controlAddr_.getSockLen() ) < 0) {
+        LOG_INFO( "HotRestart - no running process at %s, start fresh \n" , controlAddr_.toIpPort().c_str() );
+        ::close( sockfd );
+        return false;
+    }
+    timeval tv;
+    tv.tv_sec = static_cast<time_t>( timeoutSeconds );
+    tv.tv_usec = static_cast<suseconds_t>( ( timeoutSeconds - tv.tv_sec ) * 1000000 );
+    ::setsockopt( sockfd , SOL_SOCKET , SO_RCVTIMEO , &tv , sizeof tv );
+    ::setsockopt( sockfd , SOL_SOCKET , SO_SNDTIMEO , &tv , sizeof tv );
+
+    if (::write( sockfd , kHandoverRequest , sizeof kHandoverRequest - 1 ) < 0) {
+        LOG_ERROR( "HotRestart::inherit - write error:%d \n" , errno );
+        ::close( sockfd );
+        return false;
+    }
+
+    char data[64];
+    iovec iov = { data , sizeof data };
+    std::vector<char> control( CMSG_SPACE( kMaxFds * sizeof( int ) ) );
+    msghdr msg;
+    ::memset( &msg , 0 , sizeof msg );
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.data();
+    msg.msg_controllen = control.size();
+    ssize_t n = ::recvmsg( sockfd , &msg , MSG_CMSG_CLOEXEC );
+    if (n <= 0 || ( msg.msg_flags & MSG_CTRUNC )) {
+        LOG_ERROR( "HotRestart::inherit - no fds from %s, errno:%d \n" , controlAddr_.toIpPort().c_str() , n < 0 ? errno : 0 );
+        ::close( sockfd );
+        return false;
+    }
+
+    std::vector<int> fds;
+    for (cmsghdr *cmsg = CMSG_FIRSTHDR( &msg ); cmsg != nullptr; cmsg = CMSG_NXTHDR( &msg , cmsg )) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+            size_t count = ( cmsg->cmsg_len - CMSG_LEN( 0 ) ) / sizeof( int );
+            const int *received = reinterpret_cast<const int *>( CMSG_DATA( cmsg ) );
+            fds.insert( fds.end() , received , received + count );
+        }
+    }
+    if (fds.empty()) {
+        LOG_ERROR( "HotRestart::inherit - empty handover from %s \n" , controlAddr_.toIpPort().c_str() );
+        ::close( sockfd );
+        return false;
+    }
+
+    // 第一个fd是旧进程的控制socket
+    controlListenFd_ = fds[0];
+    inheritedFds_.assign( fds.begin() + 1 , fds.end() );
+    controlFd_ = sockfd;
+    LOG_INFO( "HotRestart - inherited %zu listening sockets from %s \n" , inheritedFds_.size() , controlAddr_.toIpPort().c_str() );
+    return true;
+}
+
+void HotRestart::ready() {
+    if (controlFd_ < 0) {
+        return;
+    }
+    if (::write( controlFd_ , kReady , sizeof kReady - 1 ) < 0) {
+        LOG_ERROR( "HotRestart::ready - write error:%d \n" , errno );
+    }
+    ::close( controlFd_ );
+    controlFd_ = -1;
+    // 关闭没有server接管的socket，旧进程退出后它们也随之关闭
+    for (int fd : inheritedFds_) {
+        LOG_ERROR( "HotRestart::ready - listening fd=%d is not adopted by any server, closed \n" , fd );
+        ::close( fd );
+    }
+    inheritedFds_.clear();
+}
+
+void HotRestart::listen() {
+    if (controlListenFd_ >= 0) {
+        controlAcceptor_.reset( new Acceptor( loop_ , controlListenFd_ ) );
+        controlListenFd_ = -1;
+    }
+    else {
+        controlAcceptor_.reset( new Acceptor( loop_ , controlAddr_ , false ) );
+    }
+    controlAcceptor_->setNewConnectionCallback( std::bind( &HotRestart::onControlConnection , this ,
+        std::placeholders::_1 , std::placeholders::_2 ) );
+    controlAcceptor_->listen();
+}
+
+void HotRestart::onControlConnection( int sockfd , const InetAddress & ) {
+    if (controlChannel_) {
+        LOG_ERROR( "HotRestart - handover already in progress, reject fd=%d \n" , sockfd );
+        ::close( sockfd );
+        return;
+    }
+    controlInput_.clear();
+    sentFds_ = false;
+    controlChannel_.reset( new Channel( loop_ , sockfd ) );
+    controlChannel_->setReadCallback( std::bind( &HotRestart::handleControlRead , this ) );
+    controlChannel_->enableReading();
+}
+
+void HotRestart::handleControlRead() {
+    char data[64];
+    ssize_t n = ::read( controlChannel_->fd() , data , sizeof data );
+    if (n < 0 && ( errno == EAGAIN || errno == EINTR )) {
+        return;
+    }
+    if (n <= 0) {
+        if (sentFds_) {
+            LOG_ERROR( "HotRestart - new process exited before ready, keep serving \n" );
+        }
+        closeControlConnection();
+        return;
+    }
+    controlInput_.append( data , n );
+
+    if (!sentFds_ && controlInput_.find( kHandoverRequest ) != std::string::npos) {
+        sendListenFds();
+    }
+    else if (sentFds_ && controlInput_.find( kReady ) != std::string::npos) {
+        LOG_INFO( "HotRestart - new process is ready, handing over \n" );
+        closeControlConnection();
+        // 新进程已经接管控制socket，这里只关闭自己的引用；它的channel可能也在本轮的活跃列表中，延迟析构
+        Acceptor *acceptor = controlAcceptor_.release();
+        loop_->queueInLoop( [acceptor] () { delete acceptor; } );
+        if (handoverCallback_) {
+            handoverCallback_();
+        }
+    }
+}
+
+void HotRestart::sendListenFds() {
+    std::vector<int> fds( 1 , controlAcceptor_->fd() );
+    for (TcpServer *server : servers_) {
+        std::vector<int> serverFds = server->listenFds();
+        fds.insert( fds.end() , serverFds.begin() , serverFds.end() );
+    }
+    if (fds.size() > static_cast<size_t>( kMaxFds )) {
+        LOG_ERROR( "HotRestart - %zu listening sockets exceed %d \n" , fds.size() , kMaxFds );
+        closeControlConnection();
+        return;
+    }
+
+    std::string payload = "FDS " + std::to_string( fds.size() ) + "\n";
+    iovec iov = { &payload[0] , payload.size() };
+    std::vector<char> control( CMSG_SPACE( fds.size() * sizeof( int ) ) );
+    msghdr msg;
+    ::memset( &msg , 0 , sizeof msg );
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.data();
+    msg.msg_controllen = control.size();
+    cmsghdr *cmsg = CMSG_FIRSTHDR( &msg );
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN( fds.size() * sizeof( int ) );
+    ::memcpy( CMSG_DATA( cmsg ) , fds.data() , fds.size() * sizeof( int ) );
+
+    if (::sendmsg( controlChannel_->fd() , &msg , MSG_NOSIGNAL ) < 0) {
+        LOG_ERROR( "HotRestart - sendmsg error:%d \n" , errno );
+        closeControlConnection();
+        return;
+    }
+    sentFds_ = true;
+    LOG_INFO( "HotRestart - sent %zu listening sockets, waiting for the new process \n" , fds.size() - 1 );
+}
+
+void HotRestart::closeControlConnection() {
+    controlChannel_->disableAll();
+    controlChannel_->remove();
+    // 可能正处于该channel的回调中，延迟析构
+    Channel *channel = controlChannel_.release();
+    loop_->queueInLoop( [channel] () {
+        ::close( channel->fd() );
+        delete channel;
+    } );
+    sentFds_ = false;
+}
+
+void HotRestart::drain( double timeoutSeconds , const DrainCallback &done ) {
+    for (TcpServer *server : servers_) {
+        server->stopAccepting();
+    }
+    drainCallback_ = done;
+    drainDeadline_ = addTime( Timestamp::now() , timeoutSeconds );
+    drainTimer_ = loop_->runEvery( 0.1 , std::bind( &HotRestart::checkDrained , this ) );
+}
+
+void HotRestart::checkDrained() {
+    int connections = 0;
+    for (TcpServer *server : servers_) {
+        connections += server->numConnections();
+    }
+    bool timeout = drainDeadline_ < Timestamp::now();
+    if (connections > 0 && !timeout) {
+        return;
+    }
+    if (connections > 0) {
+        LOG_ERROR( "HotRestart - drain timeout with %d connections left \n" , connections );
+    }
+    else {
+        LOG_INFO( "HotRestart - all connections drained \n" );
+    }
+    loop_->cancel( drainTimer_ );
+    DrainCallback done;
+    done.swap( drainCallback_ );
+    if (done) {
+        done();
+    }
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include "noncopyable.h"
+#include "InetAddress.h"
+#include "Timestamp.h"
+#include "TimerId.h"
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+class EventLoop;
+class Channel;
+class Acceptor;
+class TcpServer;
+
+/**
+ * 热重启：旧进程通过AF_UNIX控制socket（SCM_RIGHTS）把所有监听socket交给新进程
+ * 新旧进程共享同一个监听socket，交接期间新连接留在监听队列中，不会被拒绝
+ *
+ * 交接过程：
+ *  1. 新进程inherit()连接控制地址，发送HANDOVER，收到所有监听fd（第一个是控制socket本身）
+ *  2. 新进程用TcpServer::adoptListenFds接管fd并start，然后ready()发送READY，再listen()等待下一次重启
+ *  3. 旧进程收到READY后关闭自己的控制socket，回调handoverCallback_，一般在其中drain()：停止accept，连接处理完后退出
+ * 新进程在READY之前退出时，旧进程继续正常服务
+ *
+ * 所有接口在loop线程中调用，inherit在loop运行之前阻塞调用
+*/
+class HotRestart : noncopyable {
+public:
+    using HandoverCallback = std::function<void()>;
+    using DrainCallback = std::function<void()>;
+
+    HotRestart( EventLoop *loop , const InetAddress &controlAddr );
+    ~HotRestart();
+
+    // 新进程：从旧进程取得监听fd，最多阻塞timeoutSeconds；没有旧进程时返回false，按正常方式bind
+    bool inherit( double timeoutSeconds = 5.0 );
+    // 继承到的监听fd，交给各个TcpServer::adoptListenFds挑选
+    std::vector<int> *inheritedFds() { return &inheritedFds_; }
+    // 新进程：所有server都已start，通知旧进程停止accept；没有被接管的fd在这里关闭
+    void ready();
+
+    // 重启时要交出监听socket的server
+    void addServer( TcpServer *server ) { servers_.push_back( server ); }
+    void setHandoverCallback( const HandoverCallback &cb ) { handoverCallback_ = cb; }
+    // 在控制地址上等待下一个新进程，控制socket是继承来的则直接使用
+    void listen();
+    // 旧进程：所有server停止accept，连接数降为0或超过timeoutSeconds后回调done
+    void drain( double timeoutSeconds , const DrainCallback &done );
+private:
+    // 协议中最多传递的fd个数，不超过内核的SCM_MAX_FD
+    static const int kMaxFds = 253;
+
+    void onControlConnection( int sockfd , const InetAddress &peerAddr );
+    void handleControlRead();
+    void sendListenFds();
+    void closeControlConnection();
+    void checkDrained();
+
+    EventLoop *loop_;
+    const InetAddress controlAddr_;
+    std::unique_ptr<Acceptor> controlAcceptor_;
+    int controlListenFd_;                       // 新进程：继承来的控制socket，listen时接管
+
+    // 旧进程：与新进程之间的控制连接
+    std::unique_ptr<Channel> controlChannel_;
+    std::string controlInput_;
+    bool sentFds_;
+
+    int controlFd_;                             // 新进程：到旧进程的控制连接，ready后关闭
+    std::vector<int> inheritedFds_;
+
+    std::vector<TcpServer *> servers_;
+    HandoverCallback handoverCallback_;
+    DrainCallback drainCallback_;
+    Timestamp drainDeadline_;
+    TimerId drainTimer_;
+};
@@ -1,21 +1,65 @@
 #include "InetAddress.h"
 #include <strings.h>
 #include <string.h>
+#include <stddef.h>
+#include <algorithm>
 
 InetAddress::InetAddress( uint16_t port , std::string ip) {
-    bzero( &addr_ , sizeof addr_ );
+    bzero( &unix_ , sizeof unix_ );
     addr_.sin_family = AF_INET;
     addr_.sin_port = htons( port );
     addr_.sin_addr.s_addr = inet_addr( ip.c_str() );
+    len_ = sizeof addr_;
+}
+
+InetAddress InetAddress::unixAddress( const std::string &path ) {
+    InetAddress addr;
+    bzero( &addr.unix_ , sizeof addr.unix_ );
+    addr.unix_.sun_family = AF_UNIX;
+    // 普通路径需要保留结尾的'\0'，抽象地址的sun_path[0]为'\0'
+    size_t n = std::min( path.size() , sizeof addr.unix_.sun_path - 1 );
+    memcpy( addr.unix_.sun_path , path.data() , n );
+    if (n > 0 && path[0] == '@') {
+        addr.unix_.sun_path[0] = '\0';
+        addr.len_ = static_cast<socklen_t>( offsetof( sockaddr_un , sun_path ) + n );
+    }
+    else {
+        addr.len_ = static_cast<socklen_t>( offsetof( sockaddr_un , sun_path ) + n + 1 );
+    }
+    return addr;
+}
+
+void InetAddress::setSockAddrGeneric( const sockaddr *addr , socklen_t len ) {
+    bzero( &unix_ , sizeof unix_ );
+    len_ = std::min( len , static_cast<socklen_t>( sizeof unix_ ) );
+    memcpy( &unix_ , addr , len_ );
+}
+
+std::string InetAddress::unixPath() const {
+    size_t n = len_ > offsetof( sockaddr_un , sun_path ) ? len_ - offsetof( sockaddr_un , sun_path ) : 0;
+    if (n == 0) {
+        return std::string();
+    }
+    if (unix_.sun_path[0] == '\0') {
+        return "@" + std::string( unix_.sun_path + 1 , n - 1 );
+    }
+    return std::string( unix_.sun_path , strnlen( unix_.sun_path , n ) );
 }
 
 std::string InetAddress::toIp() const {
+    if (isUnix()) {
+        std::string path = unixPath();
+        return path.empty() ? "unix" : path;
+    }
     char buf[64] = { 0 };
     ::inet_ntop( AF_INET , &addr_.sin_addr , buf , sizeof buf );
     return buf;
 }
 
 std::string InetAddress::toIpPort() const {
+    if (isUnix()) {
+        return "unix:" + unixPath();
+    }
     char buf[64] = { 0 };
     ::inet_ntop( AF_INET , &addr_.sin_addr , buf , sizeof buf );
     size_t end = strlen( buf );
@@ -25,7 +69,7 @@ std::string InetAddress::toIpPort() const {
 }
 
 uint16_t InetAddress::toPort() const {
-    return ntohs( addr_.sin_port );
+    return isUnix() ? 0 : ntohs( addr_.sin_port );
 }
 
 // #include <iostream>
@@ -34,4 +78,4 @@ uint16_t InetAddress::toPort() const {
 //     std::cout << addr.toIpPort() << std::endl;
 
 //     return 0;
-// }
\ No newline at end of file
+// }
@@ -2,20 +2,47 @@
 
 #include <netinet/in.h>
 #include <arpa/inet.h>
+#include <sys/un.h>
 #include <string>
 
+// 封装socket地址，支持IPv4和AF_UNIX
 class InetAddress {
 public:
     explicit InetAddress( uint16_t port = 0 , std::string ip = "127.0.0.1" );
     explicit InetAddress( const sockaddr_in & addr )
-        : addr_( addr ) {}
+        : addr_( addr ) 
+        , len_( sizeof addr ) {}
 
+    /**
+     * AF_UNIX流式socket地址，path以@开头时为抽象命名空间地址（Linux特有，不在文件系统中创建文件，@之后的部分为名字）
+     * path超出sun_path长度时被截断
+    */
+    static InetAddress unixAddress( const std::string &path );
+
+    sa_family_t family() const { return addr_.sin_family; }
+    bool isUnix() const { return family() == AF_UNIX; }
+    // AF_UNIX地址的路径，抽象地址以@开头，未命名地址（如客户端一端）为空
+    std::string unixPath() const;
+
+    // AF_UNIX地址返回路径，未命名时为"unix"
     std::string toIp() const;
+    // AF_UNIX地址返回"unix:路径"
     std::string toIpPort() const;
+    // AF_UNIX地址返回0
     uint16_t toPort() const;
 
+    // 只对AF_INET地址有意义
     const sockaddr_in* getSockAddr() const { return &addr_; }
-    void setSockAddr( const sockaddr_in &addr ) { addr_ = addr; }
+    void setSockAddr( const sockaddr_in &addr ) { addr_ = addr; len_ = sizeof addr; }
+
+    // 与地址族无关的接口，用于bind/connect/accept
+    const sockaddr *getSockAddrGeneric() const { return reinterpret_cast<const sockaddr *>( &addr_ ); }
+    socklen_t getSockLen() const { return len_; }
+    void setSockAddrGeneric( const sockaddr *addr , socklen_t len );
 private:
-    sockaddr_in addr_;
-};
\ No newline at end of file
+    union {
+        sockaddr_in addr_;
+        sockaddr_un unix_;
+    };
+    socklen_t len_;     // 抽象地址的名字不以'\0'结尾，bind/connect时必须传入准确的长度
+};
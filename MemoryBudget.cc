@@ -0,0 +1,25 @@
+#include "MemoryBudget.h"
+
+MemoryBudget &MemoryBudget::instance() {
+    static MemoryBudget budget;
+    return budget;
+}
+
+MemoryBudget::MemoryBudget()
+    : limit_( 0 )
+    , policy_( kPauseReading )
+    , used_( 0 )
+    , connections_( 0 ) {}
+
+void MemoryBudget::setLimit( size_t limit , Policy policy ) {
+    policy_.store( policy , std::memory_order_relaxed );
+    limit_.store( limit , std::memory_order_relaxed );
+}
+
+bool MemoryBudget::isOffender( int64_t connectionBytes ) const {
+    int n = connections();
+    if (n <= 0) {
+        return connectionBytes > 0;
+    }
+    return connectionBytes > 0 && connectionBytes >= usage() / n;
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include "noncopyable.h"
+
+#include <atomic>
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * 进程级的连接缓冲区内存预算，统计所有TcpConnection的inputBuffer_/outputBuffer_占用的内存（容量而不是数据量）
+ * 缓冲区清空后容量超过TcpConnection::kShrinkThreshold，或者超出预算时，收缩到初始大小
+ * 每个loop先在本地累计，变化超过kFlushBytes才更新全局计数，全局值的误差不超过 loop数 * kFlushBytes
+ * 每个loop的精确用量见EventLoop::bufferedBytes()
+*/
+class MemoryBudget : noncopyable {
+public:
+    // 超出预算时的处理策略
+    enum Policy {
+        kPauseReading ,     // 缓冲区内存多于平均值的连接停止读取，预算回落后恢复
+        kRejectAccepts ,    // 新连接accept后立即关闭
+        kCloseConnections , // 关闭缓冲区内存多于平均值的连接
+    };
+
+    // loop本地累计的变化量超过该值才刷新到全局计数
+    static const int64_t kFlushBytes = 64 * 1024;
+
+    static MemoryBudget &instance();
+
+    // limit为0表示不限制（默认）
+    void setLimit( size_t limit , Policy policy );
+    size_t limit() const { return limit_.load( std::memory_order_relaxed ); }
+    Policy policy() const { return static_cast<Policy>( policy_.load( std::memory_order_relaxed ) ); }
+
+    // 所有连接缓冲区占用的内存总量（近似值）
+    int64_t usage() const { return used_.load( std::memory_order_relaxed ); }
+    int connections() const { return connections_.load( std::memory_order_relaxed ); }
+
+    bool overBudget() const {
+        size_t lim = limit();
+        return lim > 0 && usage() > static_cast<int64_t>( lim );
+    }
+    // 回落到预算的90%以下才恢复，避免在临界点来回切换
+    bool belowResumeMark() const {
+        size_t lim = limit();
+        return lim == 0 || usage() < static_cast<int64_t>( lim / 10 * 9 );
+    }
+    // 当前是否应该拒绝新连接
+    bool rejectAccepts() const { return policy() == kRejectAccepts && overBudget(); }
+    // 连接的缓冲区内存不少于平均值时被视为占用内存最多的连接之一
+    bool isOffender( int64_t connectionBytes ) const;
+
+    void addUsage( int64_t delta ) { used_.fetch_add( delta , std::memory_order_relaxed ); }
+    void addConnections( int delta ) { connections_.fetch_add( delta , std::memory_order_relaxed ); }
+private:
+    MemoryBudget();
+
+    std::atomic<size_t> limit_;
+    std::atomic_int policy_;
+    std::atomic<int64_t> used_;
+    std::atomic_int connections_;
+};
@@ -0,0 +1,68 @@
+#pragma once
+
+#include "noncopyable.h"
+
+#include <atomic>
+#include <vector>
+#include <utility>
+
+/**
+ * 多生产者单消费者的无锁队列
+ * 生产者用CAS把节点压入链表头（Treiber栈），消费者用一次exchange取走整条链表再反转成入队顺序，
+ * 两边都不加锁，生产者之间只在同一个CAS上竞争
+ *
+ * push返回队列之前是否为空：由空变为非空的那个生产者负责安排一次消费，
+ * 消费者取走全部元素后队列重新为空，之后的push再安排下一次，不会丢失也不会重复安排
+*/
+template <typename T>
+class MpscQueue : noncopyable {
+public:
+    MpscQueue() : head_( nullptr ) {}
+    ~MpscQueue() {
+        Node *node = head_.load( std::memory_order_acquire );
+        while (node != nullptr) {
+            Node *next = node->next;
+            delete node;
+            node = next;
+        }
+    }
+
+    // 任意线程调用
+    bool push( T value ) {
+        Node *node = new Node( std::move( value ) );
+        Node *old = head_.load( std::memory_order_relaxed );
+        do {
+            node->next = old;
+        } while (!head_.compare_exchange_weak( old , node , std::memory_order_release , std::memory_order_relaxed ));
+        return old == nullptr;
+    }
+
+    // 只在消费者线程调用，按入队顺序把所有元素追加到out
+    void popAll( std::vector<T> *out ) {
+        Node *node = head_.exchange( nullptr , std::memory_order_acquire );
+        Node *reversed = nullptr;
+        while (node != nullptr) {
+            Node *next = node->next;
+            node->next = reversed;
+            reversed = node;
+            node = next;
+        }
+        while (reversed != nullptr) {
+            Node *next = reversed->next;
+            out->push_back( std::move( reversed->value ) );
+            delete reversed;
+            reversed = next;
+        }
+    }
+
+    bool empty() const { return head_.load( std::memory_order_acquire ) == nullptr; }
+private:
+    struct Node {
+        explicit Node( T &&v ) : value( std::move( v ) ) , next( nullptr ) {}
+
+        T value;
+        Node *next;
+    };
+
+    std::atomic<Node *> head_;
+};
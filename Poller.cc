@@ -6,6 +6,8 @@ Poller::Poller( EventLoop* loop )
 
 }
 
+Poller::~Poller() {}
+
 bool Poller::hasChannel( Channel* channel ) const {
     auto it = channels_.find( channel->fd() );
     return it != channels_.end() && it->second == channel;
@@ -0,0 +1,88 @@
+#pragma once
+
+#include "Buffer.h"
+
+#include <string>
+#include <stdint.h>
+#include <sys/types.h>
+
+/**
+ * PubSubServer的帧格式，所有整数为网络字节序
+ *
+ *  | 长度(4) | 类型(1) | 主题长度(2) | 主题 | 内容 |
+ *
+ * 长度是长度字段之后的字节数；客户端发送订阅S、取消订阅U、发布P，服务端向订阅者推送M，
+ * 推送帧除了类型之外和发布帧完全相同，服务端只需改写一个字节
+*/
+class PubSubCodec {
+public:
+    enum Type {
+        kSubscribe = 'S' ,
+        kUnsubscribe = 'U' ,
+        kPublish = 'P' ,
+        kMessage = 'M' ,
+    };
+    static const size_t kLengthSize = 4;
+    static const size_t kHeaderSize = kLengthSize + 1 + 2;  // 到主题之前
+    static const size_t kMaxFrameSize = 16 * 1024 * 1024;
+
+    // 解析出的一帧，topic和content指向Buffer中的数据，retrieve之前有效
+    struct Frame {
+        char type;
+        const char *topic;
+        size_t topicLen;
+        const char *content;
+        size_t contentLen;
+    };
+
+    static std::string encode( Type type , const std::string &topic , const void *content , size_t len ) {
+        std::string frame( kHeaderSize , '\0' );
+        size_t bodyLen = 1 + 2 + topic.size() + len;
+        frame[0] = static_cast<char>( bodyLen >> 24 );
+        frame[1] = static_cast<char>( bodyLen >> 16 );
+        frame[2] = static_cast<char>( bodyLen >> 8 );
+        frame[3] = static_cast<char>( bodyLen );
+        frame[4] = static_cast<char>( type );
+        frame[5] = static_cast<char>( topic.size() >> 8 );
+        frame[6] = static_cast<char>( topic.size() );
+        frame.append( topic );
+        frame.append( static_cast<const char *>( content ) , len );
+        return frame;
+    }
+
+    /**
+     * 解析buf开头的一帧：完整时填写frame并返回整帧的字节数，数据还不完整时返回0，格式错误返回-1
+     * 不从buf中取走数据
+    */
+    static ssize_t decode( const Buffer *buf , Frame *frame ) {
+        if (buf->readableBytes() < kLengthSize) {
+            return 0;
+        }
+        const unsigned char *p = reinterpret_cast<const unsigned char *>( buf->peek() );
+        size_t bodyLen = ( static_cast<size_t>( p[0] ) << 24 ) | ( static_cast<size_t>( p[1] ) << 16 )
+            | ( static_cast<size_t>( p[2] ) << 8 ) | p[3];
+        if (bodyLen < kHeaderSize - kLengthSize || bodyLen > kMaxFrameSize) {
+            return -1;
+        }
+        if (buf->readableBytes() < kLengthSize + bodyLen) {
+            return 0;
+        }
+        size_t topicLen = ( static_cast<size_t>( p[5] ) << 8 ) | p[6];
+        if (kHeaderSize + topicLen > kLengthSize + bodyLen) {
+            return -1;
+        }
+        frame->type = static_cast<char>( p[4] );
+        frame->topic = buf->peek() + kHeaderSize;
+        frame->topicLen = topicLen;
+        frame->content = frame->topic + topicLen;
+        frame->contentLen = kLengthSize + bodyLen - kHeaderSize - topicLen;
+        return static_cast<ssize_t>( kLengthSize + bodyLen );
+    }
+
+    // 已经编码的帧中的主题
+    static void topicOf( const std::string &frame , std::string *topic ) {
+        size_t topicLen = ( static_cast<size_t>( static_cast<unsigned char>( frame[5] ) ) << 8 )
+            | static_cast<unsigned char>( frame[6] );
+        topic->assign( frame.data() + kHeaderSize , topicLen );
+    }
+};
@@ -0,0 +1,205 @@
+#include "PubSubServer.h"
+#include "TcpConnection.h"
+#include "EventLoop.h"
+#include "Logger.h"
+
+#include <functional>
+#include <algorithm>
+
+PubSubServer::PubSubServer( EventLoop *loop , const InetAddress &listenAddr , const std::string &nameArg ,
+    TcpServer::Option option )
+    : server_( loop , listenAddr , nameArg , option )
+    , highWaterMark_( 4 * 1024 * 1024 )
+    , policy_( kDropMessages ) {
+    server_.setThreadInitcallback( std::bind( &PubSubServer::onThreadInit , this , std::placeholders::_1 ) );
+    server_.setConnectionCallback( std::bind( &PubSubServer::onConnection , this , std::placeholders::_1 ) );
+    server_.setMessageCallback( std::bind( &PubSubServer::onMessage , this ,
+        std::placeholders::_1 , std::placeholders::_2 , std::placeholders::_3 ) );
+}
+
+void PubSubServer::start() {
+    // 线程池启动时每个loop都回调onThreadInit，server_.start返回前分片都已注册，之后才开始accept
+    server_.start();
+}
+
+void PubSubServer::onThreadInit( EventLoop *loop ) {
+    TopicShardPtr shard( new TopicShard );
+    shard->loop = loop;
+    std::unique_lock<std::mutex> lock( mutex_ );
+    shards_.push_back( shard );
+    shardIndex_[loop] = shard.get();
+}
+
+PubSubServer::TopicShard *PubSubServer::shardOf( EventLoop *loop ) const {
+    return shardIndex_.find( loop )->second;
+}
+
+PubSubServer::Subscriber *PubSubServer::subscriberOf( const TcpConnectionPtr &conn ) const {
+    TopicShard *shard = shardOf( conn->getLoop() );
+    auto it = shard->subscribers.find( conn->id() );
+    return it == shard->subscribers.end() ? nullptr : it->second.get();
+}
+
+int64_t PubSubServer::droppedMessages() const {
+    int64_t dropped = 0;
+    for (const TopicShardPtr &shard : shards_) {
+        dropped += shard->dropped.load( std::memory_order_relaxed );
+    }
+    return dropped;
+}
+
+void PubSubServer::onConnection( const TcpConnectionPtr &conn ) {
+    TopicShard *shard = shardOf( conn->getLoop() );
+    if (conn->connected()) {
+        Subscriber *subscriber = new Subscriber;
+        subscriber->conn = conn;
+        subscriber->slow = false;
+        shard->subscribers[conn->id()].reset( subscriber );
+        // 推送帧通常很小，不能等待上一帧的ACK
+        conn->setTcpNoDelay( true );
+        conn->setHighWaterMarkCallback( std::bind( &PubSubServer::onHighWaterMark , this ,
+            std::placeholders::_1 , std::placeholders::_2 ) , highWaterMark_ );
+    }
+    else {
+        auto it = shard->subscribers.find( conn->id() );
+        if (it == shard->subscribers.end()) {
+            return;
+        }
+        Subscriber *subscriber = it->second.get();
+        while (!subscriber->topics.empty()) {
+            unsubscribe( shard , subscriber , subscriber->topics.back() );
+        }
+        shard->subscribers.erase( it );
+    }
+}
+
+void PubSubServer::onMessage( const TcpConnectionPtr &conn , Buffer *buf , Timestamp ) {
+    TopicShard *shard = shardOf( conn->getLoop() );
+    Subscriber *subscriber = subscriberOf( conn );
+    PubSubCodec::Frame frame;
+    ssize_t n;
+    while (( n = PubSubCodec::decode( buf , &frame ) ) > 0) {
+        switch (frame.type) {
+        case PubSubCodec::kSubscribe:
+            subscribe( shard , subscriber , std::string( frame.topic , frame.topicLen ) );
+            break;
+        case PubSubCodec::kUnsubscribe:
+            unsubscribe( shard , subscriber , std::string( frame.topic , frame.topicLen ) );
+            break;
+        case PubSubCodec::kPublish: {
+            // 发布帧改写类型后就是推送帧
+            std::string message( buf->peek() , n );
+            message[PubSubCodec::kLengthSize] = PubSubCodec::kMessage;
+            dispatch( std::make_shared<const std::string>( std::move( message ) ) );
+            break;
+        }
+        default:
+            n = -1;
+            break;
+        }
+        if (n < 0) {
+            break;
+        }
+        buf->retrieve( n );
+    }
+    if (n < 0) {
+        LOG_ERROR( "PubSubServer::onMessage [%s] - bad frame, close \n" , conn->name().c_str() );
+        buf->retrieveAll();
+        conn->forceClose();
+    }
+}
+
+void PubSubServer::subscribe( TopicShard *shard , Subscriber *subscriber , const std::string &topic ) {
+    if (std::find( subscriber->topics.begin() , subscriber->topics.end() , topic ) != subscriber->topics.end()) {
+        return;
+    }
+    subscriber->topics.push_back( topic );
+    shard->topics[topic].push_back( subscriber );
+}
+
+void PubSubServer::unsubscribe( TopicShard *shard , Subscriber *subscriber , const std::string &topic ) {
+    auto pos = std::find( subscriber->topics.begin() , subscriber->topics.end() , topic );
+    if (pos == subscriber->topics.end()) {
+        return;
+    }
+    auto it = shard->topics.find( topic );
+    SubscriberList &list = it->second;
+    // 订阅者之间没有顺序要求，和最后一个交换后删除
+    *std::find( list.begin() , list.end() , subscriber ) = list.back();
+    list.pop_back();
+    if (list.empty()) {
+        shard->topics.erase( it );
+    }
+    *pos = subscriber->topics.back();   // topic可能引用*pos，最后才修改
+    subscriber->topics.pop_back();
+}
+
+void PubSubServer::publish( const std::string &topic , const std::string &content ) {
+    dispatch( std::make_shared<const std::string>(
+        PubSubCodec::encode( PubSubCodec::kMessage , topic , content.data() , content.size() ) ) );
+}
+
+void PubSubServer::dispatch( const Payload &frame ) {
+    for (const TopicShardPtr &shard : shards_) {
+        if (shard->queue.push( frame )) {
+            shard->loop->queueInLoop( std::bind( &PubSubServer::deliver , shard ) );
+        }
+    }
+}
+
+void PubSubServer::deliver( const TopicShardPtr &shard ) {
+    shard->queue.popAll( &shard->batch );
+    int64_t dropped = 0;
+    for (const Payload &frame : shard->batch) {
+        PubSubCodec::topicOf( *frame , &shard->topic );
+        auto it = shard->topics.find( shard->topic );
+        if (it == shard->topics.end()) {
+            continue;
+        }
+        for (Subscriber *subscriber : it->second) {
+            if (subscriber->slow) {
+                ++dropped;
+                continue;
+            }
+            if (subscriber->pending.empty()) {
+                shard->touched.push_back( subscriber );
+            }
+            subscriber->pending.push_back( frame );
+        }
+    }
+    // 每个订阅者本批次的帧一次writev写出；sendShared不会同步关闭连接或回调，订阅表在遍历期间不变
+    for (Subscriber *subscriber : shard->touched) {
+        subscriber->conn->sendShared( subscriber->pending.data() , subscriber->pending.size() );
+        subscriber->pending.clear();
+    }
+    shard->touched.clear();
+    shard->batch.clear();
+    if (dropped > 0) {
+        shard->dropped.fetch_add( dropped , std::memory_order_relaxed );
+    }
+}
+
+void PubSubServer::onHighWaterMark( const TcpConnectionPtr &conn , size_t bytes ) {
+    Subscriber *subscriber = subscriberOf( conn );
+    if (subscriber == nullptr || !conn->connected()) {
+        return;     // 回调排队期间已经断开
+    }
+    if (policy_ == kDisconnect) {
+        LOG_INFO( "PubSubServer - subscriber [%s] has %zu bytes pending, disconnect \n" , conn->name().c_str() , bytes );
+        conn->forceClose();
+    }
+    else if (!subscriber->slow) {
+        LOG_DEBUG( "PubSubServer - subscriber [%s] has %zu bytes pending, drop messages \n" , conn->name().c_str() , bytes );
+        subscriber->slow = true;
+        // 积压的数据全部写出时恢复推送
+        conn->setWriteCompleteCallback( std::bind( &PubSubServer::onDrained , this , std::placeholders::_1 ) );
+    }
+}
+
+void PubSubServer::onDrained( const TcpConnectionPtr &conn ) {
+    Subscriber *subscriber = subscriberOf( conn );
+    if (subscriber != nullptr) {
+        subscriber->slow = false;
+    }
+    conn->setWriteCompleteCallback( WriteCompleteCallback() );
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include "TcpServer.h"
+#include "PubSubCodec.h"
+#include "MpscQueue.h"
+#include "noncopyable.h"
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <unordered_map>
+#include <stdint.h>
+
+/**
+ * 基于TcpServer的主题发布/订阅服务，帧格式见PubSubCodec
+ *
+ * 订阅表按loop分片：连接的订阅只登记在它所属loop的分片中，只在该loop线程中访问，不加锁
+ * 发布时推送帧只编码一次，放入每个分片的无锁队列，队列由空变为非空时才向该loop投递一个任务；
+ * 任务取出全部推送帧，按订阅者归并后对每个订阅者调用一次sendShared，连接只保存推送帧的引用
+ *
+ * 慢订阅者：待发送数据超过高水位时由TcpConnection的highWaterMarkCallback按策略处理
+*/
+class PubSubServer : noncopyable {
+public:
+    enum SlowSubscriberPolicy {
+        kDropMessages ,     // 丢弃之后发给它的消息，积压的数据全部写出后恢复
+        kDisconnect ,       // 断开连接
+    };
+
+    PubSubServer( EventLoop *loop , const InetAddress &listenAddr , const std::string &nameArg ,
+        TcpServer::Option option = TcpServer::kNoReusePort );
+
+    void setThreadNum( int numThreads ) { server_.setThreadNum( numThreads ); }
+    // 慢订阅者的高水位（默认4MB）和处理策略（默认kDropMessages），在start之前设置
+    void setSlowSubscriberPolicy( size_t highWaterMark , SlowSubscriberPolicy policy ) {
+        highWaterMark_ = highWaterMark;
+        policy_ = policy;
+    }
+
+    void start();
+    // 服务端直接发布消息，start之后可以在任意线程调用
+    void publish( const std::string &topic , const std::string &content );
+
+    int numConnections() const { return server_.numConnections(); }
+    // 底层的TcpServer，用于读取流量计数，如StatsServer::addServer
+    const TcpServer *tcpServer() const { return &server_; }
+    // 因订阅者过慢而丢弃的推送数
+    int64_t droppedMessages() const;
+private:
+    struct Subscriber {
+        TcpConnectionPtr conn;
+        std::vector<std::string> topics;
+        std::vector<Payload> pending;   // 本批次要推送给它的帧
+        bool slow;  // kDropMessages策略下超过了高水位
+    };
+    using SubscriberList = std::vector<Subscriber *>;
+
+    // 一个loop上的订阅表，除queue和dropped之外只在该loop线程中访问
+    struct TopicShard {
+        TopicShard() : loop( nullptr ) , dropped( 0 ) {}
+
+        EventLoop *loop;
+        std::unordered_map<uint64_t , std::unique_ptr<Subscriber>> subscribers;    // 连接id -> 订阅者
+        std::unordered_map<std::string , SubscriberList> topics;
+        MpscQueue<Payload> queue;   // 待推送的帧，任意线程写入
+        std::vector<Payload> batch;     // 以下保留容量，避免每批分配
+        std::vector<Subscriber *> touched;  // 本批次有帧要推送的订阅者
+        std::string topic;
+        std::atomic<int64_t> dropped;
+    };
+    using TopicShardPtr = std::shared_ptr<TopicShard>;
+
+    // loop线程启动时创建该loop的分片
+    void onThreadInit( EventLoop *loop );
+    void onConnection( const TcpConnectionPtr &conn );
+    void onMessage( const TcpConnectionPtr &conn , Buffer *buf , Timestamp receiveTime );
+    void onHighWaterMark( const TcpConnectionPtr &conn , size_t bytes );
+    void onDrained( const TcpConnectionPtr &conn );
+
+    TopicShard *shardOf( EventLoop *loop ) const;
+    Subscriber *subscriberOf( const TcpConnectionPtr &conn ) const;
+    void subscribe( TopicShard *shard , Subscriber *subscriber , const std::string &topic );
+    void unsubscribe( TopicShard *shard , Subscriber *subscriber , const std::string &topic );
+    // 把编码好的推送帧放入每个分片的队列
+    void dispatch( const Payload &frame );
+    // 在分片所属loop中推送队列中的全部帧
+    static void deliver( const TopicShardPtr &shard );
+
+    TcpServer server_;
+    size_t highWaterMark_;
+    SlowSubscriberPolicy policy_;
+
+    std::mutex mutex_;  // 只保护start期间的分片注册
+    std::vector<TopicShardPtr> shards_;     // start之后只读
+    std::unordered_map<EventLoop * , TopicShard *> shardIndex_;
+};
@@ -7,30 +7,34 @@
 #include <sys/socket.h>
 #include <strings.h>
 #include <netinet/tcp.h>
+#include <sys/un.h>
+#include <errno.h>
 
 Socket::~Socket() {
     close( sockfd_ );
 }
 
 void Socket::bindAddress( const InetAddress &localaddr ) {
-    if (0 != bind( sockfd_ , (sockaddr *)localaddr.getSockAddr() , sizeof( sockaddr_in ) )) {
-        LOG_FATAL( "bind sockfd: %d fail \n" , sockfd_ );
+    if (0 != bind( sockfd_ , localaddr.getSockAddrGeneric() , localaddr.getSockLen() )) {
+        LOG_FATAL( "bind sockfd: %d to %s fail, errno:%d \n" , sockfd_ , localaddr.toIpPort().c_str() , errno );
     }
 }
 
-void Socket::listen() {
-    if (0 != ::listen( sockfd_ , 1024 )) {
+void Socket::listen( int backlog ) {
+    if (0 != ::listen( sockfd_ , backlog )) {
         LOG_FATAL( "listen sockfd:%d fail \n" , sockfd_ );
     }
 }
 
 int Socket::accept(InetAddress *peeraddr) {
-    sockaddr_in addr;
-    socklen_t len = sizeof( sockaddr_in );
+    // 足够容纳sockaddr_in和sockaddr_un
+    sockaddr_un addr;
+    socklen_t len = sizeof addr;
     bzero( &addr , sizeof addr );
-    int connfd = ::accept( sockfd_ , (sockaddr *)&addr , &len );
+    // 直接得到非阻塞、close-on-exec的connfd，省去两次fcntl
+    int connfd = ::accept4( sockfd_ , (sockaddr *)&addr , &len , SOCK_NONBLOCK | SOCK_CLOEXEC );
     if (connfd >= 0) {
-        peeraddr->setSockAddr( addr );
+        peeraddr->setSockAddrGeneric( (sockaddr *)&addr , len );
     }
     return connfd;
 }
@@ -14,7 +14,9 @@ public:
 
     int fd() const { return sockfd_; }
     void bindAddress( const InetAddress &localaddr );
-    void listen();
+    // backlog为全连接队列长度，内核会截断到net.core.somaxconn
+    void listen( int backlog = 1024 );
+    // 返回的connfd已经是非阻塞、close-on-exec的
     int accept( InetAddress *peeraddr );
 
     void shutdownWrite();
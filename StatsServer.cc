@@ -0,0 +1,141 @@
+#include "StatsServer.h"
+#include "TcpConnection.h"
+#include "MemoryBudget.h"
+#include "Logger.h"
+#include "Tracer.h"
+
+#include <algorithm>
+#include <functional>
+
+StatsServer::StatsServer( EventLoop *loop , const InetAddress &listenAddr , const std::string &prefix )
+    : server_( loop , listenAddr , "StatsServer" )
+    , prefix_( prefix + "_" ) {
+    server_.setConnectionCallback( std::bind( &StatsServer::onConnection , this , std::placeholders::_1 ) );
+    server_.setMessageCallback( std::bind( &StatsServer::onMessage , this ,
+        std::placeholders::_1 , std::placeholders::_2 , std::placeholders::_3 ) );
+}
+
+void StatsServer::addServer( const TcpServer *server ) {
+    servers_.push_back( server );
+}
+
+void StatsServer::addCounter( const std::string &name , const std::string &help , const ValueFunction &value ) {
+    Metric metric = { name , help , "counter" , value };
+    metrics_.push_back( metric );
+}
+
+void StatsServer::addGauge( const std::string &name , const std::string &help , const ValueFunction &value ) {
+    Metric metric = { name , help , "gauge" , value };
+    metrics_.push_back( metric );
+}
+
+void StatsServer::start() {
+    server_.start();
+}
+
+void StatsServer::appendHeader( std::string *out , const std::string &name , const char *help , const char *type ) const {
+    out->append( "# HELP " ).append( prefix_ ).append( name ).append( " " ).append( help ).append( "\n" );
+    out->append( "# TYPE " ).append( prefix_ ).append( name ).append( " " ).append( type ).append( "\n" );
+}
+
+// 标签值中的反斜杠、双引号和换行需要转义
+static void appendLabelValue( std::string *out , const std::string &value ) {
+    for (char c : value) {
+        if (c == '\\' || c == '"') {
+            out->push_back( '\\' );
+            out->push_back( c );
+        }
+        else if (c == '\n') {
+            out->append( "\\n" );
+        }
+        else {
+            out->push_back( c );
+        }
+    }
+}
+
+std::string StatsServer::render() const {
+    std::string out;
+    out.reserve( 4096 );
+    // 同一指标族的样本必须连续，按指标遍历各个server
+    if (!servers_.empty()) {
+        for (int i = 0; i < TrafficCounters::kNumCounters; ++i) {
+            TrafficCounters::Counter counter = static_cast<TrafficCounters::Counter>( i );
+            appendHeader( &out , TrafficCounters::name( counter ) , TrafficCounters::help( counter ) , "counter" );
+            for (const TcpServer *server : servers_) {
+                out.append( prefix_ ).append( TrafficCounters::name( counter ) ).append( "{server=\"" );
+                appendLabelValue( &out , server->name() );
+                out.append( "\"} " ).append( std::to_string( server->trafficCount( counter ) ) ).append( "\n" );
+            }
+        }
+        appendHeader( &out , "connections" , "Connections currently open." , "gauge" );
+        for (const TcpServer *server : servers_) {
+            out.append( prefix_ ).append( "connections{server=\"" );
+            appendLabelValue( &out , server->name() );
+            out.append( "\"} " ).append( std::to_string( server->numConnections() ) ).append( "\n" );
+        }
+    }
+    appendHeader( &out , "buffered_bytes" , "Memory held by connection buffers across the process (approximate)." , "gauge" );
+    out.append( prefix_ ).append( "buffered_bytes " ).append( std::to_string( MemoryBudget::instance().usage() ) ).append( "\n" );
+    for (const Metric &metric : metrics_) {
+        appendHeader( &out , metric.name , metric.help.c_str() , metric.type );
+        out.append( prefix_ ).append( metric.name ).append( " " ).append( std::to_string( metric.value() ) ).append( "\n" );
+    }
+    return out;
+}
+
+void StatsServer::onConnection( const TcpConnectionPtr &conn ) {
+    if (conn->connected()) {
+        conn->setTcpNoDelay( true );
+    }
+}
+
+void StatsServer::onMessage( const TcpConnectionPtr &conn , Buffer *buf , Timestamp ) {
+    static const char kHeaderEnd[] = "\r\n\r\n";
+    const char *end = std::search( buf->peek() , buf->peek() + buf->readableBytes() ,
+        kHeaderEnd , kHeaderEnd + 4 );
+    if (end == buf->peek() + buf->readableBytes()) {
+        if (buf->readableBytes() > kMaxRequestSize) {
+            LOG_ERROR( "StatsServer - request from %s too large, close \n" , conn->peerAddress().toIpPort().c_str() );
+            buf->retrieveAll();
+            conn->forceClose();
+        }
+        return;     // 请求头还不完整
+    }
+
+    // 请求行：方法 路径 版本，忽略请求头和查询参数
+    std::string requestLine( buf->peek() , std::find( buf->peek() , end , '\r' ) );
+    buf->retrieveAll();
+    size_t methodEnd = requestLine.find( ' ' );
+    size_t pathEnd = methodEnd == std::string::npos ? std::string::npos : requestLine.find( ' ' , methodEnd + 1 );
+    if (pathEnd == std::string::npos) {
+        reply( conn , "400 Bad Request" , "bad request\n" );
+        return;
+    }
+    std::string path = requestLine.substr( methodEnd + 1 , pathEnd - methodEnd - 1 );
+    path = path.substr( 0 , path.find( '?' ) );
+    if (requestLine.compare( 0 , methodEnd , "GET" ) != 0) {
+        reply( conn , "405 Method Not Allowed" , "only GET is supported\n" );
+    }
+    else if (path == "/metrics") {
+        reply( conn , "200 OK" , render() );
+    }
+    else if (path == "/trace") {
+        reply( conn , "200 OK" , Tracer::dump() , "application/json" );
+    }
+    else {
+        reply( conn , "404 Not Found" , "metrics are at /metrics, sampled traces at /trace\n" );
+    }
+}
+
+void StatsServer::reply( const TcpConnectionPtr &conn , const char *status , const std::string &body , const char *contentType ) {
+    std::string response;
+    response.reserve( body.size() + 128 );
+    response.append( "HTTP/1.1 " ).append( status ).append( "\r\n" );
+    response.append( "Content-Type: " ).append( contentType ).append( "\r\n" );
+    response.append( "Content-Length: " ).append( std::to_string( body.size() ) ).append( "\r\n" );
+    response.append( "Connection: close\r\n\r\n" );
+    response.append( body );
+    conn->send( std::move( response ) );
+    conn->shutdown();
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include "TcpServer.h"
+#include "noncopyable.h"
+
+#include <functional>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+/**
+ * 内置的指标服务：在单独的端口上监听，GET /metrics返回Prometheus文本格式（0.0.4），
+ * GET /trace返回Tracer采样到的追踪记录（Chrome trace_event JSON）
+ *
+ * 抓取时才读取各个TcpServer每个loop的流量计数器并求和，数据路径上只有计数器本身的累加
+ * 所有请求在构造时传入的loop中处理，不创建线程；每个请求返回后关闭连接
+*/
+class StatsServer : noncopyable {
+public:
+    // 自定义指标的取值函数，抓取时在loop线程中调用
+    using ValueFunction = std::function<int64_t()>;
+
+    // 指标名都以prefix_开头
+    StatsServer( EventLoop *loop , const InetAddress &listenAddr , const std::string &prefix = "mymuduo" );
+
+    /**
+     * 导出server的全部流量计数和当前连接数，样本带标签server="名字"
+     * 在start之前调用，server要在第一次抓取之前start，并且比StatsServer活得久
+    */
+    void addServer( const TcpServer *server );
+    // 自定义指标，name不含前缀，在start之前调用
+    void addCounter( const std::string &name , const std::string &help , const ValueFunction &value );
+    void addGauge( const std::string &name , const std::string &help , const ValueFunction &value );
+
+    void start();
+
+    // 当前全部指标的文本，即/metrics的响应内容
+    std::string render() const;
+private:
+    struct Metric {
+        std::string name;
+        std::string help;
+        const char *type;
+        ValueFunction value;
+    };
+
+    void onConnection( const TcpConnectionPtr &conn );
+    void onMessage( const TcpConnectionPtr &conn , Buffer *buf , Timestamp receiveTime );
+    void reply( const TcpConnectionPtr &conn , const char *status , const std::string &body ,
+        const char *contentType = "text/plain; version=0.0.4; charset=utf-8" );
+    // 一个指标族的HELP和TYPE
+    void appendHeader( std::string *out , const std::string &name , const char *help , const char *type ) const;
+
+    static const size_t kMaxRequestSize = 8 * 1024;
+
+    TcpServer server_;
+    const std::string prefix_;
+    std::vector<const TcpServer *> servers_;
+    std::vector<Metric> metrics_;
+};
@@ -0,0 +1,101 @@
+#include "TcpClient.h"
+#include "EventLoop.h"
+#include "Logger.h"
+
+#include <functional>
+
+static EventLoop *CheckLoopNotNull( EventLoop *loop ) {
+    if (loop == nullptr) {
+        LOG_FATAL( "%s:%s:%d TcpClient Loop is null! \n" , __FILE__ , __FUNCTION__ , __LINE__ );
+    }
+    return loop;
+}
+
+// TcpClient析构后连接才关闭时，只需要在loop中销毁连接
+static void removeConnectionAfterClient( EventLoop *loop , const TcpConnectionPtr &conn ) {
+    loop->queueInLoop( std::bind( &TcpConnection::connectDestroyed , conn ) );
+}
+
+TcpClient::TcpClient( EventLoop *loop , const InetAddress &serverAddr , const std::string &nameArg )
+    : loop_( CheckLoopNotNull( loop ) )
+    , connector_( new Connector( loop , serverAddr ) )
+    , name_( nameArg )
+    , connNamePrefix_( std::make_shared<const std::string>( nameArg + "-" + serverAddr.toIpPort() + "#" ) )
+    , retry_( false )
+    , connect_( true )
+    , nextConnId_( 1 ) {
+    connector_->setNewConnectionCallback( std::bind( &TcpClient::newConnection , this , std::placeholders::_1 ) );
+    LOG_DEBUG( "TcpClient::TcpClient[%s] - connector %p \n" , name_.c_str() , connector_.get() );
+}
+
+TcpClient::~TcpClient() {
+    TcpConnectionPtr conn;
+    bool unique = false;
+    {
+        std::unique_lock<std::mutex> lock( mutex_ );
+        unique = connection_.use_count() == 1;
+        conn = connection_;
+    }
+    if (conn) {
+        // 连接的关闭回调不能再回到已经析构的TcpClient
+        CloseCallback cb = std::bind( &removeConnectionAfterClient , loop_ , std::placeholders::_1 );
+        loop_->runInLoop( std::bind( &TcpConnection::setCloseCallback , conn , cb ) );
+        if (unique) {
+            conn->forceClose();
+        }
+    }
+    else {
+        connector_->stop();
+    }
+}
+
+void TcpClient::connect() {
+    LOG_DEBUG( "TcpClient::connect[%s] - connecting to %s \n" , name_.c_str() ,
+        connector_->serverAddress().toIpPort().c_str() );
+    connect_ = true;
+    connector_->start();
+}
+
+void TcpClient::disconnect() {
+    connect_ = false;
+    std::unique_lock<std::mutex> lock( mutex_ );
+    if (connection_) {
+        connection_->shutdown();
+    }
+}
+
+void TcpClient::stop() {
+    connect_ = false;
+    connector_->stop();
+}
+
+void TcpClient::newConnection( int sockfd ) {
+    uint64_t id = nextConnId_++;
+    TcpConnectionPtr conn( TcpConnection::create( loop_ , id , connNamePrefix_ , sockfd , connector_->serverAddress() ) );
+    conn->setConnectionCallback( connectionCallback_ );
+    conn->setMessageCallback( messageCallback_ );
+    conn->setWriteCompleteCallback( writeCompleteCallback_ );
+    conn->setCloseCallback( std::bind( &TcpClient::removeConnection , this , std::placeholders::_1 ) );
+    if (tlsContext_) {
+        conn->startTls( tlsContext_ );
+    }
+    {
+        std::unique_lock<std::mutex> lock( mutex_ );
+        connection_ = conn;
+    }
+    conn->connectEstablished();
+}
+
+void TcpClient::removeConnection( const TcpConnectionPtr &conn ) {
+    {
+        std::unique_lock<std::mutex> lock( mutex_ );
+        connection_.reset();
+    }
+
+    loop_->queueInLoop( std::bind( &TcpConnection::connectDestroyed , conn ) );
+    if (retry_ && connect_) {
+        LOG_INFO( "TcpClient::removeConnection[%s] - Reconnecting to %s \n" , name_.c_str() ,
+            connector_->serverAddress().toIpPort().c_str() );
+        connector_->restart();
+    }
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include "noncopyable.h"
+#include "Callbacks.h"
+#include "Connector.h"
+#include "TcpConnection.h"
+
+#include <mutex>
+#include <string>
+#include <atomic>
+
+class EventLoop;
+
+// 客户端，管理一条到serverAddr的连接，复用TcpConnection
+class TcpClient : noncopyable {
+public:
+    TcpClient( EventLoop *loop , const InetAddress &serverAddr , const std::string &nameArg );
+    ~TcpClient();
+
+    void connect();
+    // 优雅关闭当前连接
+    void disconnect();
+    // 停止正在进行的连接和重试
+    void stop();
+
+    TcpConnectionPtr connection() const {
+        std::unique_lock<std::mutex> lock( mutex_ );
+        return connection_;
+    }
+
+    EventLoop *getLoop() const { return loop_; }
+    bool retry() const { return retry_; }
+    // 连接断开后自动重连
+    void enableRetry() { retry_ = true; }
+    const std::string &name() const { return name_; }
+
+    void setConnectionCallback( const ConnectionCallback &cb ) { connectionCallback_ = cb; }
+    void setMessageCallback( const MessageCallback &cb ) { messageCallback_ = cb; }
+    void setWriteCompleteCallback( const WriteCompleteCallback &cb ) { writeCompleteCallback_ = cb; }
+    // 连接建立后先进行TLS握手，需要以MYMUDUO_TLS选项编译，在connect之前设置
+    void setTlsContext( const std::shared_ptr<TlsContext> &context ) { tlsContext_ = context; }
+private:
+    // 在loop线程中被Connector调用
+    void newConnection( int sockfd );
+    void removeConnection( const TcpConnectionPtr &conn );
+
+    EventLoop *loop_;
+    ConnectorPtr connector_;
+    const std::string name_;
+    const TcpConnection::NamePrefix connNamePrefix_;
+
+    ConnectionCallback connectionCallback_;
+    MessageCallback messageCallback_;
+    WriteCompleteCallback writeCompleteCallback_;
+    std::shared_ptr<TlsContext> tlsContext_;
+
+    std::atomic_bool retry_;
+    std::atomic_bool connect_;
+    uint64_t nextConnId_;   // 只在loop线程中访问
+    mutable std::mutex mutex_;
+    TcpConnectionPtr connection_;   // 受mutex_保护
+};
@@ -3,6 +3,11 @@
 #include "Socket.h"
 #include "Channel.h"
 #include "EventLoop.h"
+#include "MemoryBudget.h"
+#include "TcpRelay.h"
+#include "TlsContext.h"
+#include "FreeListPool.h"
+#include "Tracer.h"
 
 #include <functional>
 #include <errno.h>
@@ -11,51 +16,197 @@
 #include <strings.h>
 #include <netinet/tcp.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <string>
+#ifdef MYMUDUO_COROUTINE
+#include <coroutine>
+#endif
 
 static EventLoop *CheckLoopNotNull( EventLoop *loop ) {
     if (loop == nullptr) {
         LOG_FATAL( "%s:%s:%d TcpConnection Loop is null! \n" , __FILE__ , __FUNCTION__ , __LINE__ );
     }
+    return loop;
+}
+
+// 恢复一个挂起的协程，未开启协程支持时不会有协程挂起在连接上
+static void resumeWaiter( void *address ) {
+#ifdef MYMUDUO_COROUTINE
+    std::coroutine_handle<>::from_address( address ).resume();
+#else
+    (void)address;
+#endif
 }
 
 TcpConnection::TcpConnection( EventLoop *loop ,
-        const std::string &nameArg ,
+        uint64_t id ,
+        const NamePrefix &namePrefix ,
         int sockfd ,
-        const InetAddress &localAddr ,
     const InetAddress &peerAddr )
     : loop_( CheckLoopNotNull( loop ) ) /* 处理该连接的loop，由轮询算法获得 */
-    , name_( nameArg )
+    , id_( id )
+    , namePrefix_( namePrefix )
     , state_( kConnecting ) /* 处于连接构造中 */
     , reading_( true )
-    , socket_( new Socket( sockfd ) )   /* 建立一个Socket对象来管理该连接socket的选项和生命周期，socket文件描述符在Socket析构中被关闭 */
-    , channel_( new Channel( loop , sockfd ) )  /* 建立一个Channel对象来管理该连接socket关心的读写事件 */
-    , localAddr_( localAddr )
+    , socket_( sockfd )   /* Socket对象管理该连接socket的选项和生命周期，socket文件描述符在Socket析构中被关闭 */
+    , channel_( loop , sockfd )  /* Channel对象管理该连接socket关心的读写事件 */
     , peerAddr_( peerAddr )
-    , highWaterMark_( 64 * 1024 * 1024 ) /* 64M */ {
-    /* 设置channel的事件处理函数 */
-    channel_->setReadCallback( std::bind( &TcpConnection::handleRead , this , std::placeholders::_1 ) );
-    channel_->setWriteCallback( std::bind( &TcpConnection::handleWrite , this ) );
-    channel_->setCloseCallback( std::bind( &TcpConnection::handleClose , this ) );
-    channel_->setErrorCallback( std::bind( &TcpConnection::handleError , this ) );
+    , highWaterMark_( 64 * 1024 * 1024 ) /* 64M */
+    , lowWaterMark_( 0 )
+    , readBackpressure_( false )
+    , aboveHighWaterMark_( false )
+    , readPausers_( 0 )
+    , accountedBytes_( 0 )
+    , bytesRead_( 0 )
+    , bytesWritten_( 0 )
+    , traceReceived_( 0 )
+    , traceFlushStart_( 0 )
+    , autoCork_( false )
+    , corkFlushQueued_( false )
+    , chainHead_( 0 )
+    , chainOffset_( 0 )
+    , chainBytes_( 0 )
+    , readWaiter_( nullptr )
+    , readWaitBytes_( 0 )
+    , writeWaiter_( nullptr ) {
+    /* channel的事件直接分发到handleRead/handleWrite/handleClose/handleError，不经过std::function */
+    channel_.setOwner( this );
 
-    LOG_INFO( "TcpConnection::ctor[%s] at fd=%d\n" , name_.c_str() , sockfd );
-    socket_->setKeepAlive( true );
+    LOG_DEBUG( "TcpConnection::ctor[%llu] at fd=%d\n" , (unsigned long long)id_ , sockfd );
+    socket_.setKeepAlive( true );
+}
+
+TcpConnectionPtr TcpConnection::create( EventLoop *loop ,
+        uint64_t id ,
+        const NamePrefix &namePrefix ,
+        int sockfd ,
+    const InetAddress &peerAddr ) {
+    return std::allocate_shared<TcpConnection>( PoolAllocator<TcpConnection>() , loop , id , namePrefix , sockfd , peerAddr );
 }
 
 TcpConnection::~TcpConnection() {
-    LOG_INFO( "TcpConnection::dtor[%s] at fd=%d state=%d \n" , name_.c_str() , channel_->fd() , (int)state_);
+    LOG_DEBUG( "TcpConnection::dtor[%llu] at fd=%d state=%d \n" , (unsigned long long)id_ , channel_.fd() , (int)state_ );
+}
+
+const std::string &TcpConnection::name() const {
+    std::call_once( nameOnce_ , [this] () {
+        name_ = *namePrefix_ + std::to_string( id_ );
+    } );
+    return name_;
+}
+
+const InetAddress &TcpConnection::localAddress() const {
+    std::call_once( localAddrOnce_ , [this] () {
+        sockaddr_un local;
+        ::bzero( &local , sizeof local );
+        socklen_t addrlen = sizeof local;
+        if (::getsockname( socket_.fd() , (sockaddr *)&local , &addrlen ) < 0) {
+            LOG_ERROR( "sockets::getLocalAddr" );
+        }
+        localAddr_.setSockAddrGeneric( (sockaddr *)&local , addrlen );
+    } );
+    return localAddr_;
 }
 
 void TcpConnection::send( const std::string &buf ) {
     if (state_ == kConnected) {
         if (loop_->isInLoopThread()) {
+            countEvent( TrafficCounters::kMessagesSent );
+            sendInLoop( buf.c_str() , buf.size() );
+        }
+        else {
+            queueSend( std::string( buf ) );
+        }
+    }
+}
+
+void TcpConnection::send( std::string &&buf ) {
+    if (state_ == kConnected) {
+        if (loop_->isInLoopThread()) {
+            countEvent( TrafficCounters::kMessagesSent );
             sendInLoop( buf.c_str() , buf.size() );
         }
         else {
-            loop_->runInLoop( std::bind( &TcpConnection::sendInLoop , this , buf.c_str() , buf.size() ) );
+            queueSend( std::move( buf ) );
+        }
+    }
+}
+
+void TcpConnection::queueSend( std::string &&message ) {
+    // 队列由空变为非空时才投递一次drainSendQueue，之后的消息由同一次drain一起发出
+    if (sendQueue_.push( std::move( message ) )) {
+        loop_->queueInLoop( std::bind( &TcpConnection::drainSendQueue , shared_from_this() ) );
+    }
+}
+
+void TcpConnection::drainSendQueue() {
+    sendQueue_.popAll( &sendBatch_ );
+    countEvent( TrafficCounters::kMessagesSent , sendBatch_.size() );
+    bool direct = state_ != kDisconnected
+        && !channel_.isWriting() && pendingOutputBytes() == 0 && !autoCork_
+        && ( !tls_ || tls_->ktlsSend() );
+    if (!direct || sendBatch_.size() == 1) {
+        // 只有一条消息，或者需要先进入outputBuffer_（TLS用户态加密、auto-cork、已经在等待可写事件）
+        for (const std::string &message : sendBatch_) {
+            sendInLoop( message.data() , message.size() );
+        }
+        sendBatch_.clear();
+        return;
+    }
+
+    // 一次writev写出一批消息，写不完的部分放入outputBuffer_
+    size_t index = 0;   // 第一个没有完全写出的消息
+    size_t offset = 0;  // 该消息已经写出的字节数
+    bool faultError = false;
+    while (index < sendBatch_.size()) {
+        struct iovec vec[kMaxSendIov];
+        int count = 0;
+        size_t bytes = 0;
+        for (size_t i = index; i < sendBatch_.size() && count < kMaxSendIov; ++i) {
+            size_t start = i == index ? offset : 0;
+            vec[count].iov_base = const_cast<char *>( sendBatch_[i].data() ) + start;
+            vec[count].iov_len = sendBatch_[i].size() - start;
+            bytes += vec[count].iov_len;
+            ++count;
+        }
+        ssize_t n = ::writev( channel_.fd() , vec , count );
+        if (n < 0) {
+            if (errno != EWOULDBLOCK) {
+                LOG_ERROR( "TcpConnection::drainSendQueue" );
+                countEvent( TrafficCounters::kConnectionErrors );
+                faultError = errno == EPIPE || errno == ECONNRESET;
+            }
+            break;
+        }
+        countWritten( n );
+        // 跳过已经写出的消息（包括空消息）
+        size_t left = n;
+        while (index < sendBatch_.size() && left >= sendBatch_[index].size() - offset) {
+            left -= sendBatch_[index].size() - offset;
+            ++index;
+            offset = 0;
+        }
+        offset += left;
+        if (static_cast<size_t>( n ) < bytes) {
+            break;  // socket发送缓冲区已满
+        }
+    }
+
+    if (index == sendBatch_.size()) {
+        if (writeCompleteCallback_) {
+            loop_->queueInLoop( std::bind( writeCompleteCallback_ , shared_from_this() ) );
         }
     }
+    else if (!faultError) {
+        for (; index < sendBatch_.size(); ++index , offset = 0) {
+            const std::string &message = sendBatch_[index];
+            if (message.size() > offset) {
+                bufferOutput( message.data() + offset , message.size() - offset );
+            }
+        }
+        updateBufferAccounting();
+    }
+    sendBatch_.clear();
 }
 
 void TcpConnection::sendInLoop(const void* data, size_t len) {
@@ -68,11 +219,18 @@ void TcpConnection::sendInLoop(const void* data, size_t len) {
         LOG_ERROR( "disconnected, give up writing!" );
         return;
     }
+    if (tls_ && !tls_->established()) {
+        // TLS握手还没完成，明文先缓存，握手完成后由handleWrite发出
+        outputBuffer_.append( (const char *)data , len );
+        updateBufferAccounting();
+        return;
+    }
 
-    // 没有写缓冲区中待写的数据，且没有设置感兴趣的写事件
-    if (!channel_->isWriting() && outputBuffer_.readableBytes() == 0) {
-        nwrote = ::write( channel_->fd() , data , len );
+    // 没有写缓冲区中待写的数据，且没有设置感兴趣的写事件；auto-cork时先缓存，本轮循环结束时一起写
+    if (!channel_.isWriting() && pendingOutputBytes() == 0 && !autoCork_) {
+        nwrote = writeSocket( data , len );
         if (nwrote >= 0) {
+            countWritten( nwrote );
             remaining = len - nwrote;
             if (remaining == 0 && writeCompleteCallback_) {
                 // 既然在这里数据全部发送完成，就不用再给channel设置epollout事件了
@@ -83,6 +241,7 @@ void TcpConnection::sendInLoop(const void* data, size_t len) {
             nwrote = 0;
             if (errno != EWOULDBLOCK) {
                 LOG_ERROR( "TcpConnection::sendInLoop" ); 
+                countEvent( TrafficCounters::kConnectionErrors );
                 if (errno == EPIPE || errno == ECONNRESET) {
                     faultError = true;
                 }
@@ -93,24 +252,131 @@ void TcpConnection::sendInLoop(const void* data, size_t len) {
     注册epollout事件，poller发现tcp发送缓冲区有多余空间，会通知相应的sock-channel，调用注册的writeCallback_回调方法
     最终调用TcpConnection::handleWrite方法，把发送缓冲区的数据全部发送完 */
     if (!faultError && remaining > 0) {
-        // 目前发送缓冲区剩余待发送数据长度
-        size_t oldLen = outputBuffer_.readableBytes();
-        if (oldLen + remaining >= highWaterMark_ && oldLen < highWaterMark_ && highWaterMarkCallback_) {
-            loop_->queueInLoop(std::bind( highWaterMarkCallback_ , shared_from_this() , oldLen + remaining ));
+        bufferOutput( (const char *)data + nwrote , remaining );
+    }
+    updateBufferAccounting();
+}
+
+void TcpConnection::bufferOutput( const char *data , size_t len ) {
+    // 目前剩余待发送数据长度
+    size_t oldLen = pendingOutputBytes();
+    if (outputChain_.empty()) {
+        outputBuffer_.append( data , len );
+    }
+    else {
+        // 要排在输出链中的共享数据之后
+        outputChain_.push_back( std::make_shared<const std::string>( data , len ) );
+        chainBytes_ += len;
+    }
+    outputQueued( oldLen );
+}
+
+void TcpConnection::sendShared( const Payload &payload ) {
+    sendShared( &payload , 1 );
+}
+
+void TcpConnection::sendShared( const Payload *payloads , size_t count ) {
+    if (state_ != kConnected) {
+        return;
+    }
+    countEvent( TrafficCounters::kMessagesSent , count );
+    if (tls_ && !tls_->ktlsSend()) {
+        // 用户态加密要经过SSL_write，和普通数据一样拷贝
+        for (size_t i = 0; i < count; ++i) {
+            sendInLoop( payloads[i]->data() , payloads[i]->size() );
+        }
+        return;
+    }
+
+    size_t index = 0;   // 第一个没有完全写出的payload
+    size_t offset = 0;  // 该payload已经写出的字节数
+    if (!channel_.isWriting() && pendingOutputBytes() == 0 && !autoCork_) {
+        struct iovec vec[kMaxSendIov];
+        int n = 0;
+        for (size_t i = 0; i < count && n < kMaxSendIov; ++i) {
+            vec[n].iov_base = const_cast<char *>( payloads[i]->data() );
+            vec[n].iov_len = payloads[i]->size();
+            ++n;
         }
-        outputBuffer_.append( (char *)data + nwrote , remaining );
-        if (!channel_->isWriting()) {
-            channel_->enableWriting(); //注册channel的写事件
+        ssize_t nwrote = ::writev( channel_.fd() , vec , n );
+        if (nwrote >= 0) {
+            countWritten( nwrote );
+            size_t left = nwrote;
+            while (index < count && left >= payloads[index]->size()) {
+                left -= payloads[index]->size();
+                ++index;
+            }
+            offset = left;
+            if (index == count) {
+                if (writeCompleteCallback_) {
+                    loop_->queueInLoop( std::bind( writeCompleteCallback_ , shared_from_this() ) );
+                }
+                return;
+            }
+        }
+        else if (errno != EWOULDBLOCK) {
+            LOG_ERROR( "TcpConnection::sendShared" );
+            countEvent( TrafficCounters::kConnectionErrors );
+            if (errno == EPIPE || errno == ECONNRESET) {
+                return;
+            }
         }
     }
+
+    // 剩余部分只保存引用；没有直接写时输出链可能不为空，此时offset为0
+    size_t oldLen = pendingOutputBytes();
+    if (outputChain_.empty()) {
+        chainOffset_ = offset;
+    }
+    for (size_t i = index; i < count; ++i) {
+        if (!payloads[i]->empty()) {
+            outputChain_.push_back( payloads[i] );
+            chainBytes_ += payloads[i]->size() - ( i == index ? offset : 0 );
+        }
+    }
+    if (pendingOutputBytes() != oldLen) {
+        outputQueued( oldLen );
+    }
+}
+
+void TcpConnection::outputQueued( size_t oldLen ) {
+    size_t newLen = pendingOutputBytes();
+    if (newLen >= highWaterMark_ && oldLen < highWaterMark_) {
+        countEvent( TrafficCounters::kHighWaterMarkHits );
+        if (highWaterMarkCallback_) {
+            loop_->queueInLoop( std::bind( highWaterMarkCallback_ , shared_from_this() , newLen ) );
+        }
+    }
+    if (channel_.isWriting()) {
+        // 已经在等待可写事件，handleWrite会一起发出
+    }
+    else if (autoCork_) {
+        if (!corkFlushQueued_) {
+            corkFlushQueued_ = true;
+            TcpConnectionPtr self( shared_from_this() );
+            loop_->runAfterDispatch( [self] () { self->flushCorked(); } );
+        }
+    }
+    else {
+        channel_.enableWriting(); //注册channel的写事件
+    }
+    checkOutputWaterMark();
 }
 
 void TcpConnection::handleRead( Timestamp receiveTime ) {
+    if (relay_) {
+        relay_->handleRead( this );
+        return;
+    }
+    if (tls_) {
+        handleTlsRead( receiveTime );
+        return;
+    }
     int savedErrno = 0;
-    ssize_t n = inputBuffer_.readFd( channel_->fd() , &savedErrno );
+    ssize_t n = inputBuffer_.readFd( channel_.fd() , &savedErrno );
     if (n > 0) {
-        // 已建立连接的用户，有可读事件发生了，调用客户传入的回调函数
-        messageCallback_(shared_from_this() , &inputBuffer_ , receiveTime );
+        countRead( n );
+        onInputReceived( receiveTime );
     }
     else if (n == 0) {  /* 客户端关闭连接 */
         handleClose();
@@ -122,41 +388,220 @@ void TcpConnection::handleRead( Timestamp receiveTime ) {
     }
 }
 
+void TcpConnection::onInputReceived( Timestamp receiveTime ) {
+    countEvent( TrafficCounters::kMessagesRead );
+    if (readWaiter_ != nullptr) {
+        // 有协程在等待数据，数据足够时直接在当前loop线程中恢复它
+        if (inputBuffer_.readableBytes() >= readWaitBytes_) {
+            resumeReadWaiter();
+        }
+    }
+    else if (messageCallback_) {
+        // Watchdog发现loop卡住时报告正在执行哪个连接的回调
+        loop_->setActivity( "messageCallback" , channel_.fd() , id_ );
+        // 上一个被采样的请求还没写完时不采样新的请求，它的区间要完整记录
+        if (traceFlushStart_ == 0 && Tracer::sample()) {
+            tracedMessageCallback( receiveTime );
+        }
+        else {
+            // 已建立连接的用户，有可读事件发生了，调用客户传入的回调函数
+            messageCallback_( shared_from_this() , &inputBuffer_ , receiveTime );
+        }
+        loop_->setActivity( "channel" , channel_.fd() , id_ );
+    }
+    updateBufferAccounting();
+    if (MemoryBudget::instance().overBudget()) {
+        applyMemoryBudget();
+    }
+}
+
+void TcpConnection::tracedMessageCallback( Timestamp receiveTime ) {
+    int64_t received = receiveTime.microSecondsSinceEpoch();
+    int64_t start = Timestamp::now().microSecondsSinceEpoch();
+    // 回调中queueInLoop的回调也属于这个请求
+    bool saved = Tracer::setSampling( true );
+    messageCallback_( shared_from_this() , &inputBuffer_ , receiveTime );
+    Tracer::setSampling( saved );
+    int64_t end = Timestamp::now().microSecondsSinceEpoch();
+    Tracer::record( "poll_to_callback" , received , start , "conn" , static_cast<int64_t>( id_ ) );
+    Tracer::record( "message_callback" , start , end , "conn" , static_cast<int64_t>( id_ ) );
+    if (state_ != kDisconnected && pendingOutputBytes() > 0) {
+        // 回调中直接写完的部分已经计入message_callback，剩下的等writeOutputBuffer写完
+        traceReceived_ = received;
+        traceFlushStart_ = end;
+    }
+    else {
+        Tracer::record( "request" , received , end , "conn" , static_cast<int64_t>( id_ ) );
+    }
+}
+
+void TcpConnection::finishTrace() {
+    int64_t now = Timestamp::now().microSecondsSinceEpoch();
+    Tracer::record( "write_flush" , traceFlushStart_ , now , "conn" , static_cast<int64_t>( id_ ) );
+    Tracer::record( "request" , traceReceived_ , now , "conn" , static_cast<int64_t>( id_ ) );
+    traceReceived_ = 0;
+    traceFlushStart_ = 0;
+}
+
+ssize_t TcpConnection::writeSocket( const void *data , size_t len ) {
+#ifdef MYMUDUO_TLS
+    // 内核接管了加密时直接写明文
+    if (tls_ && !tls_->ktlsSend()) {
+        return tls_->write( data , len );
+    }
+#endif
+    return ::write( channel_.fd() , data , len );
+}
+
 void TcpConnection::handleWrite() {
-    if (channel_->isWriting()) {
-        int savedErrno = 0;
-        ssize_t n = outputBuffer_.writeFd( channel_->fd() , &savedErrno );
+    if (channel_.isWriting()) {
+        if (tls_ && !tls_->established()) {
+            handleTlsHandshake();
+            return;
+        }
+        if (relay_ && pendingOutputBytes() == 0) {
+            // 只有TcpRelay管道中的数据等待发送
+            relay_->handleWrite( this );
+            return;
+        }
+        writeOutputBuffer();
+    }
+    else {
+        LOG_ERROR( "TcpConnection fd=%d is down, no more writing \n" , channel_.fd() );
+    }
+}
+
+void TcpConnection::writeOutputBuffer() {
+    ssize_t n;
+    if (outputChain_.empty()) {
+        n = writeSocket( outputBuffer_.peek() , outputBuffer_.readableBytes() );
         if (n > 0) {
             outputBuffer_.retrieve( n );
-            if (outputBuffer_.readableBytes() == 0/* 数据发送完毕 */) {
-                channel_->disableWriting();
-                if (writeCompleteCallback_) {
-                    // 唤醒loop_对应的thread线程，执行回调，放入队列中，等处理完其它socket的读写事件，再处理回调，优先级低一些
-                    loop_->queueInLoop( std::bind( writeCompleteCallback_ , shared_from_this() ) );
-                }
-                if (state_ == kDisconnecting) {
-                    shutdownInLoop();
-                }
-            }
         }
-        else {
-            LOG_ERROR( "TCPConnection::handleWrite" );
+    }
+    else {
+        n = writeOutputChain();
+    }
+    if (n > 0) {
+        countWritten( n );
+        checkOutputWaterMark();
+        updateBufferAccounting();
+        if (pendingOutputBytes() == 0/* 数据发送完毕 */) {
+            if (channel_.isWriting()) {
+                channel_.disableWriting();
+            }
+            if (traceFlushStart_ != 0) {
+                finishTrace();
+            }
+            if (writeCompleteCallback_) {
+                // 唤醒loop_对应的thread线程，执行回调，放入队列中，等处理完其它socket的读写事件，再处理回调，优先级低一些
+                loop_->queueInLoop( std::bind( writeCompleteCallback_ , shared_from_this() ) );
+            }
+            if (writeWaiter_ != nullptr) {
+                resumeWriteWaiter();
+            }
+            if (relay_) {
+                relay_->handleWrite( this );
+            }
+            if (state_ == kDisconnecting) {
+                shutdownInLoop();
+            }
+            return;
         }
     }
+    else if (n < 0 && errno == EWOULDBLOCK) {
+        // socket发送缓冲区已满，或TLS记录还没有完整写入，等下一次可写事件
+    }
     else {
-        LOG_ERROR( "TcpConnection fd=%d is down, no more writing \n" , channel_->fd() );
+        LOG_ERROR( "TCPConnection::handleWrite" );
+        countEvent( TrafficCounters::kConnectionErrors );
+        return;
+    }
+    if (!channel_.isWriting()) {
+        channel_.enableWriting();
+    }
+}
+
+ssize_t TcpConnection::writeOutputChain() {
+    // 输出链只在内核负责加密（或没有TLS）时使用，直接writev明文
+    struct iovec vec[kMaxSendIov];
+    int count = 0;
+    size_t buffered = outputBuffer_.readableBytes();
+    if (buffered > 0) {
+        vec[count].iov_base = const_cast<char *>( outputBuffer_.peek() );
+        vec[count].iov_len = buffered;
+        ++count;
     }
+    for (size_t i = chainHead_; i < outputChain_.size() && count < kMaxSendIov; ++i) {
+        size_t start = i == chainHead_ ? chainOffset_ : 0;
+        vec[count].iov_base = const_cast<char *>( outputChain_[i]->data() ) + start;
+        vec[count].iov_len = outputChain_[i]->size() - start;
+        ++count;
+    }
+    ssize_t n = ::writev( channel_.fd() , vec , count );
+    if (n <= 0) {
+        return n;
+    }
+
+    size_t left = n;
+    if (buffered > 0) {
+        size_t fromBuffer = left < buffered ? left : buffered;
+        outputBuffer_.retrieve( fromBuffer );
+        left -= fromBuffer;
+    }
+    chainBytes_ -= left;
+    while (left > 0) {
+        size_t rest = outputChain_[chainHead_]->size() - chainOffset_;
+        if (left < rest) {
+            chainOffset_ += left;
+            break;
+        }
+        left -= rest;
+        outputChain_[chainHead_].reset();   // 写完立即释放引用
+        ++chainHead_;
+        chainOffset_ = 0;
+    }
+    if (chainHead_ == outputChain_.size()) {
+        outputChain_.clear();
+        chainHead_ = 0;
+    }
+    else if (chainHead_ >= kMaxSendIov && chainHead_ * 2 >= outputChain_.size()) {
+        // 一直写不完时移走前面已经释放的位置，不让数组无限增长
+        outputChain_.erase( outputChain_.begin() , outputChain_.begin() + chainHead_ );
+        chainHead_ = 0;
+    }
+    return n;
+}
+
+void TcpConnection::flushCorked() {
+    corkFlushQueued_ = false;
+    // 期间注册了写事件的由handleWrite发送
+    if (state_ == kDisconnected || channel_.isWriting() || pendingOutputBytes() == 0) {
+        return;
+    }
+    writeOutputBuffer();
 }
 
 /* 关闭连接 */
 void TcpConnection::handleClose() {
-    LOG_INFO( "fd=%d state=%d \n" , channel_->fd() , (int)state_ );
+    LOG_DEBUG( "fd=%d state=%d \n" , channel_.fd() , (int)state_ );
     setState( kDisconnected );
-    channel_->disableAll();
+    channel_.disableAll();
+    detachRelay();
 
     TcpConnectionPtr connPtr( shared_from_this() );
+    /* 连接断开后不会再发送数据，恢复跟随者的读取 */
+    if (aboveHighWaterMark_) {
+        aboveHighWaterMark_ = false;
+        notifyFollowers( false );
+    }
+    /* 连接已断开，唤醒挂起的协程，它们会得到失败的结果 */
+    resumeReadWaiter();
+    resumeWriteWaiter();
     /* 调用用户设置的连接事件的处理回调 */
-    connectionCallback_( connPtr );
+    if (userNotified()) {
+        connectionCallback_( connPtr );
+    }
     /* 调用TcpServer中设置的关闭连接的回到 */
     closeCallback_( connPtr );
 }
@@ -165,22 +610,30 @@ void TcpConnection::handleError() {
     int optval; 
     socklen_t optlen = sizeof optval;
     int err = 0;
-    if (::getsockopt( channel_->fd() , SOL_SOCKET , SO_ERROR , &optval , &optlen ) < 0) {
+    if (::getsockopt( channel_.fd() , SOL_SOCKET , SO_ERROR , &optval , &optlen ) < 0) {
         err = errno;
     } 
     else {
         err = optval;
     }
-    LOG_ERROR( "TcpConnection::handleError name:%s - SO_ERROR:%d \n" , name_.c_str() , err );
+    LOG_ERROR( "TcpConnection::handleError name:%s - SO_ERROR:%d \n" , name().c_str() , err );
+    countEvent( TrafficCounters::kConnectionErrors );
 }
 
 // 建立连接
 void TcpConnection::connectEstablished() {
     setState( kConnected );
-    channel_->tie( shared_from_this() );
-    // 设置该连接的socket上的读事件
-    channel_->enableReading(); //  向poller注册channel的epollin事件
+    MemoryBudget::instance().addConnections( 1 );
+    /* 不需要tie：连接只在connectDestroyed之后、loop处理完本轮事件时才析构，handleClose自己持有shared_ptr */
+    // 设置该连接的socket上的读事件，建立之前已经被stopRead的连接不注册
+    reading_ = false;
+    updateReading(); //  向poller注册channel的epollin事件
 
+    if (tls_) {
+        // 握手完成后再回调，客户端在这里发出ClientHello
+        handleTlsHandshake();
+        return;
+    }
     // 新连接建立，执行回调
     connectionCallback_( shared_from_this() );
 }
@@ -189,11 +642,20 @@ void TcpConnection::connectEstablished() {
 void TcpConnection::connectDestroyed() {
     if (state_ == kConnected) {
         setState( kDisconnected );
-        channel_->disableAll();
+        channel_.disableAll();
+        resumeReadWaiter();
+        resumeWriteWaiter();
         /* 调用用户定义的连接事件的回调函数 */
-        connectionCallback_( shared_from_this() );
+        if (userNotified()) {
+            connectionCallback_( shared_from_this() );
+        }
     }
-    channel_->remove(); // 把channel从poller中删除
+    detachRelay();
+    channel_.remove(); // 把channel从poller中删除
+    // 连接销毁后缓冲区中的数据不再计入预算
+    MemoryBudget::instance().addConnections( -1 );
+    loop_->addBufferedBytes( -accountedBytes_ );
+    accountedBytes_ = 0;
 }
 
 /** 当服务器主动关闭写端时，SEND_SHUTDOWN被设置，
@@ -207,8 +669,306 @@ void TcpConnection::shutdown() { // 优雅地关闭连接
 }
 
 void TcpConnection::shutdownInLoop() {
-    if (!channel_->isWriting()) {
-        socket_->shutdownWrite();
+    if (tls_ && !tls_->established()) {
+        return;     // 握手完成、缓存的数据发出后再关闭
+    }
+    // auto-cork缓存的数据还没有写出时同样等发送完
+    if (!channel_.isWriting() && pendingOutputBytes() == 0) {
+#ifdef MYMUDUO_TLS
+        if (tls_) {
+            tls_->shutdown();
+        }
+#endif
+        socket_.shutdownWrite();
+    }
+}
+
+bool TcpConnection::userNotified() const {
+    return !tls_ || tls_->established();
+}
+
+#ifdef MYMUDUO_TLS
+void TcpConnection::startTls( const std::shared_ptr<TlsContext> &context ) {
+    tls_ = std::make_shared<TlsStream>( context , socket_.fd() );
+    // 握手的每一轮由多个TLS记录分别写入，Nagle算法会和对方的延迟ACK互相等待
+    if (!peerAddr_.isUnix()) {
+        socket_.setTcpNoDelay( true );
+    }
+}
+
+void TcpConnection::handleTlsHandshake() {
+    TlsStream::Result result = tls_->handshake();
+    if (result == TlsStream::kWantRead) {
+        if (channel_.isWriting()) {
+            channel_.disableWriting();
+        }
+        return;
+    }
+    if (result == TlsStream::kWantWrite) {
+        if (!channel_.isWriting()) {
+            channel_.enableWriting();
+        }
+        return;
+    }
+    if (result != TlsStream::kOk) {
+        if (result == TlsStream::kError) {
+            LOG_ERROR( "TcpConnection::handleTlsHandshake [%s] - handshake with %s failed \n" , name().c_str() , peerAddr_.toIpPort().c_str() );
+        }
+        handleClose();
+        return;
+    }
+    LOG_DEBUG( "TcpConnection::handleTlsHandshake [%s] - %s %s ktls send:%d recv:%d \n" , name().c_str() ,
+        tls_->version().c_str() , tls_->cipher().c_str() , (int)tls_->ktlsSend() , (int)tls_->ktlsRecv() );
+
+    connectionCallback_( shared_from_this() );
+    // 发出握手期间缓存的数据和回调中send的数据
+    if (outputBuffer_.readableBytes() > 0) {
+        if (!channel_.isWriting()) {
+            channel_.enableWriting();
+        }
+    }
+    else {
+        if (channel_.isWriting()) {
+            channel_.disableWriting();
+        }
+        if (state_ == kDisconnecting) {
+            shutdownInLoop();
+        }
+    }
+}
+
+void TcpConnection::handleTlsRead( Timestamp receiveTime ) {
+    if (!tls_->established()) {
+        handleTlsHandshake();
+        return;
+    }
+    TlsStream::Result result = TlsStream::kOk;
+    ssize_t n = tls_->read( &inputBuffer_ , &result );
+    if (n > 0) {
+        countRead( n );
+        onInputReceived( receiveTime );
+    }
+    if (state_ == kDisconnected) {
+        return;     // 回调中或超出内存预算时已经关闭
+    }
+    if (result == TlsStream::kClosed) {
+        handleClose();
+    }
+    else if (result == TlsStream::kError) {
+        LOG_ERROR( "TcpConnection::handleTlsRead [%s] - TLS error, close \n" , name().c_str() );
+        countEvent( TrafficCounters::kConnectionErrors );
+        handleClose();
     }
 }
+#else
+void TcpConnection::startTls( const std::shared_ptr<TlsContext> & ) {
+    LOG_FATAL( "TcpConnection::startTls - built without MYMUDUO_TLS \n" );
+}
+
+// 不开启TLS编译时tls_始终为空，不会执行到这里
+void TcpConnection::handleTlsHandshake() {}
+void TcpConnection::handleTlsRead( Timestamp ) {}
+#endif
 
+void TcpConnection::detachRelay() {
+    if (relay_) {
+        // relay_在回调中会被清空，保证处理期间TcpRelay不被析构
+        std::shared_ptr<TcpRelay> relay;
+        relay.swap( relay_ );
+        relay->handleClose( this );
+    }
+}
+
+void TcpConnection::resumeReadWaiter() {
+    void *waiter = readWaiter_;
+    if (waiter != nullptr) {
+        // 先清空再恢复，协程恢复后可能再次挂起在该连接上
+        readWaiter_ = nullptr;
+        resumeWaiter( waiter );
+    }
+}
+
+void TcpConnection::resumeWriteWaiter() {
+    void *waiter = writeWaiter_;
+    if (waiter != nullptr) {
+        writeWaiter_ = nullptr;
+        resumeWaiter( waiter );
+    }
+}
+
+// 可能跨线程调用，回调持有连接，执行之前连接关闭也不会访问已释放的对象
+void TcpConnection::startRead() {
+    loop_->runInLoop( std::bind( &TcpConnection::resumeReading , shared_from_this() , kPausedByUser ) );
+}
+
+void TcpConnection::stopRead() {
+    loop_->runInLoop( std::bind( &TcpConnection::pauseReading , shared_from_this() , kPausedByUser ) );
+}
+
+void TcpConnection::pauseReading( int reason ) {
+    readPausers_ |= reason;
+    updateReading();
+}
+
+void TcpConnection::resumeReading( int reason ) {
+    readPausers_ &= ~reason;
+    updateReading();
+}
+
+void TcpConnection::updateReading() {
+    // 连接断开后channel已经disableAll，不能再注册读事件
+    if (state_ != kConnected && state_ != kDisconnecting) {
+        return;
+    }
+    bool want = readPausers_ == 0;
+    if (want && !reading_) {
+        channel_.enableReading();
+        reading_ = true;
+    }
+    else if (!want && reading_) {
+        channel_.disableReading();
+        reading_ = false;
+    }
+}
+
+void TcpConnection::setReadBackpressure( size_t highWaterMark , size_t lowWaterMark ) {
+    highWaterMark_ = highWaterMark;
+    lowWaterMark_ = lowWaterMark < highWaterMark ? lowWaterMark : highWaterMark;
+    readBackpressure_ = true;
+}
+
+void TcpConnection::setBackpressurePeer( const TcpConnectionPtr &peer ) {
+    std::weak_ptr<TcpConnection> follower( shared_from_this() );
+    peer->getLoop()->runInLoop( std::bind( &TcpConnection::addBackpressureFollower , peer , follower ) );
+}
+
+void TcpConnection::addBackpressureFollower( const std::weak_ptr<TcpConnection> &follower ) {
+    backpressureFollowers_.push_back( follower );
+    // peer此时已经在高水位之上，立即让跟随者停止读取
+    if (aboveHighWaterMark_) {
+        TcpConnectionPtr conn( follower.lock() );
+        if (conn) {
+            conn->getLoop()->runInLoop( std::bind( &TcpConnection::pauseReading , conn , kPausedByPeer ) );
+        }
+    }
+}
+
+void TcpConnection::checkOutputWaterMark() {
+    if (!readBackpressure_ && backpressureFollowers_.empty()) {
+        return;
+    }
+    size_t pending = pendingOutputBytes();
+    if (!aboveHighWaterMark_ && pending >= highWaterMark_) {
+        aboveHighWaterMark_ = true;
+        if (readBackpressure_) {
+            pauseReading( kPausedByOutput );
+        }
+        notifyFollowers( true );
+    }
+    else if (aboveHighWaterMark_ && pending <= lowWaterMark_) {
+        aboveHighWaterMark_ = false;
+        resumeReading( kPausedByOutput );
+        notifyFollowers( false );
+    }
+}
+
+void TcpConnection::notifyFollowers( bool pause ) {
+    size_t n = 0;
+    for (size_t i = 0; i < backpressureFollowers_.size(); ++i) {
+        TcpConnectionPtr conn( backpressureFollowers_[i].lock() );
+        if (!conn) {
+            continue;   // 跟随者已经销毁，顺便从列表中移除
+        }
+        backpressureFollowers_[n++] = backpressureFollowers_[i];
+        if (pause) {
+            conn->getLoop()->runInLoop( std::bind( &TcpConnection::pauseReading , conn , kPausedByPeer ) );
+        }
+        else {
+            conn->getLoop()->runInLoop( std::bind( &TcpConnection::resumeReading , conn , kPausedByPeer ) );
+        }
+    }
+    backpressureFollowers_.resize( n );
+}
+
+void TcpConnection::forceClose() {
+    if (state_ == kConnected || state_ == kDisconnecting) {
+        setState( kDisconnecting );
+        loop_->queueInLoop( std::bind( &TcpConnection::forceCloseInLoop , shared_from_this() ) );
+    }
+}
+
+void TcpConnection::forceCloseInLoop() {
+    if (state_ == kConnected || state_ == kDisconnecting) {
+        handleClose();
+    }
+}
+
+// 缓冲区清空后容量超过threshold时收缩到初始大小，Buffer只增不减，否则一次突发的内存会一直被占用
+static void shrinkDrained( Buffer *buf , size_t threshold ) {
+    if (buf->readableBytes() == 0 && buf->internalCapacity() > threshold) {
+        buf->shrink( Buffer::kInitialSize );
+    }
+}
+
+void TcpConnection::updateBufferAccounting() {
+    // 连接断开后不再更新，剩余的计数在connectDestroyed中一次性释放
+    if (state_ == kDisconnected) {
+        return;
+    }
+    // 超出预算时清空的缓冲区全部收缩，否则只收缩大块的，避免每条大消息都重新分配
+    size_t threshold = MemoryBudget::instance().overBudget() ? Buffer::kCheapPrepend + Buffer::kInitialSize : kShrinkThreshold;
+    shrinkDrained( &inputBuffer_ , threshold );
+    shrinkDrained( &outputBuffer_ , threshold );
+    // 按容量而不是数据量计入，数据取走后没有释放的内存同样占用预算
+    int64_t bytes = static_cast<int64_t>( inputBuffer_.internalCapacity() + outputBuffer_.internalCapacity() );
+    if (bytes != accountedBytes_) {
+        loop_->addBufferedBytes( bytes - accountedBytes_ );
+        accountedBytes_ = bytes;
+    }
+}
+
+void TcpConnection::applyMemoryBudget() {
+    MemoryBudget &budget = MemoryBudget::instance();
+    if (!budget.isOffender( accountedBytes_ )) {
+        return;
+    }
+    switch (budget.policy()) {
+    case MemoryBudget::kPauseReading:
+        if (!( readPausers_ & kPausedByBudget )) {
+            pauseReading( kPausedByBudget );
+            scheduleBudgetRecheck();
+        }
+        break;
+    case MemoryBudget::kCloseConnections:
+        LOG_ERROR( "TcpConnection::applyMemoryBudget close [%s] holding %lld bytes \n" ,
+            name().c_str() , (long long)accountedBytes_ );
+        forceCloseInLoop();
+        break;
+    default:    // kRejectAccepts由Acceptor处理
+        break;
+    }
+}
+
+void TcpConnection::scheduleBudgetRecheck() {
+    std::weak_ptr<TcpConnection> weak( shared_from_this() );
+    loop_->runAfter( 0.05 , [weak] () {
+        TcpConnectionPtr conn( weak.lock() );
+        if (conn) {
+            conn->recheckMemoryBudget();
+        }
+    } );
+}
+
+void TcpConnection::recheckMemoryBudget() {
+    if (!( readPausers_ & kPausedByBudget )) {
+        return;
+    }
+    // 停止读取期间输出缓冲区可能已经写空，先收缩并释放它的预算
+    updateBufferAccounting();
+    if (MemoryBudget::instance().belowResumeMark()) {
+        resumeReading( kPausedByBudget );
+    }
+    else {
+        scheduleBudgetRecheck();
+    }
+}
@@ -5,33 +5,107 @@
 #include "Callbacks.h"
 #include "Buffer.h"
 #include "Timestamp.h"
+#include "Socket.h"
+#include "Channel.h"
+#include "MpscQueue.h"
+#include "TrafficCounters.h"
 
 #include <memory>
 #include <string>
 #include <atomic>
+#include <mutex>
+#include <vector>
+#include <stdint.h>
 
-class Channel;
 class EventLoop;
-class Socket;
+class ReadAwaiter;
+class WriteAwaiter;
+class TcpRelay;
+class TlsContext;
+class TlsStream;
 
 class TcpConnection :noncopyable, public std::enable_shared_from_this<TcpConnection>{
 public:
+    // 连接名的公共前缀，由所有者（如TcpServer）共享，连接名为前缀 + id
+    using NamePrefix = std::shared_ptr<const std::string>;
+
+    /**
+     * 连接对象、Socket、Channel和shared_ptr的控制块一次从当前线程的FreeListPool中分配，
+     * 在连接所属的loop线程中调用，销毁时内存回到该线程的空闲链表，下一个连接直接复用
+    */
+    static TcpConnectionPtr create( EventLoop *loop ,
+        uint64_t id ,
+        const NamePrefix &namePrefix ,
+        int sockfd ,
+        const InetAddress &peerAddr );
+
     TcpConnection( EventLoop *loop ,
-        const std::string &nameArg ,
+        uint64_t id ,
+        const NamePrefix &namePrefix ,
         int sockfd ,
-        const InetAddress &localAddr ,
         const InetAddress &peerAddr );
     ~TcpConnection();
 
     EventLoop *getLoop()const { return loop_; }
-    const std::string &name() const { return name_; }
-    const  InetAddress &localAddress() const { return localAddr_; }
+    uint64_t id() const { return id_; }
+    // 连接名和本端地址在第一次使用时才生成，不占用建立连接的路径
+    const std::string &name() const;
+    const InetAddress &localAddress() const;
     const InetAddress &peerAddress()const { return peerAddr_; }
 
     bool connected()const { return state_ == kConnected; }
 
+    /**
+     * 可以在任意线程调用。loop线程中直接写socket或追加到outputBuffer_；
+     * 其它线程中消息（拷贝或移入）放入连接的无锁发送队列，队列由空变为非空时才向loop投递一次任务，
+     * loop一次取出队列中的全部消息用writev写出，多个线程密集发送时每批只有一次唤醒和一次系统调用
+    */
     void send( const std::string &buffer );
+    void send( std::string &&buffer );
+    /**
+     * 发送多个连接共享的只读数据，只能在连接所属loop线程中调用，广播见TcpServer::broadcast
+     * 空闲时直接用一次writev写出，写不完的部分不拷贝，只在输出链中保存payload的引用，之后和outputBuffer_一起写出
+     * TLS连接在用户态加密时仍然拷贝到outputBuffer_
+    */
+    void sendShared( const Payload &payload );
+    void sendShared( const Payload *payloads , size_t count );
     void shutdown();
+    // 立即关闭连接，不等待outputBuffer_中的数据发送完，可以跨线程调用
+    void forceClose();
+
+    // 开始/停止读取数据（注册/注销EPOLLIN），可以跨线程调用
+    void startRead();
+    void stopRead();
+    bool isReading() const { return reading_; }
+
+    /**
+     * 自动读背压，用于限制内存和延迟：
+     * outputBuffer_中待发送的数据达到highWaterMark时停止读取，发送到不超过lowWaterMark时恢复读取
+     * 高水位同时也是highWaterMarkCallback_的触发阈值
+    */
+    void setReadBackpressure( size_t highWaterMark , size_t lowWaterMark );
+    /**
+     * 代理场景：本连接读到的数据会转发给peer，peer的outputBuffer_超过peer的高水位时本连接停止读取，
+     * 降到peer的低水位时恢复读取。一个连接只跟随一个peer，peer可以在别的loop上
+    */
+    void setBackpressurePeer( const TcpConnectionPtr &peer );
+
+    /**
+     * auto-cork：loop线程中的send不立即写socket，先追加到outputBuffer_，
+     * 本轮循环的事件和回调处理完后一次写出，一个响应分多次send（头部、正文、尾部）时只有一次系统调用，
+     * 也不会被拆成多个小包（避免和Nagle、延迟ACK互相等待）；代价是发送推迟到本轮循环结束，大块数据多一次拷贝
+     * 在连接所属loop线程中调用，通常在连接回调中设置
+    */
+    void setAutoCork( bool on ) { autoCork_ = on; }
+    bool autoCork() const { return autoCork_; }
+    // 关闭Nagle算法，小消息不等待之前数据的ACK立即发出，AF_UNIX连接上没有作用
+    void setTcpNoDelay( bool on ) { socket_.setTcpNoDelay( on ); }
+
+    // 本连接收到和写出的字节数，在连接所属loop线程中读取
+    int64_t bytesRead() const { return bytesRead_; }
+    int64_t bytesWritten() const { return bytesWritten_; }
+    // 同时累加到所属loop的计数器，TcpServer在connectEstablished之前设置，不设置时只统计本连接
+    void setTrafficCounters( const std::shared_ptr<TrafficCounters> &counters ) { traffic_ = counters; }
 
     void setConnectionCallback( const ConnectionCallback &cb ) {
         connectionCallback_ = cb;
@@ -53,8 +127,31 @@ public:
     void connectEstablished();
     void connectDestroyed();
 
-    void shutdown();
+    /**
+     * 在该连接上进行TLS握手，需要以MYMUDUO_TLS选项编译，TcpServer/TcpClient设置了TlsContext时自动调用
+     * 在connectEstablished之前调用；握手完成后才回调connectionCallback_，握手失败或握手期间断开时直接关闭，不回调，
+     * 建立和断开的回调总是成对出现；TcpClient通过closeCallback_得知连接关闭并按retry设置重连
+     * 握手完成前send的数据缓存在outputBuffer_中，握手完成后加密发出
+    */
+    void startTls( const std::shared_ptr<TlsContext> &context );
+    // 连接上的TLS会话，没有开启TLS时为nullptr
+    TlsStream *tlsStream() const { return tls_.get(); }
+
+    /**
+     * 协程接口，需要以MYMUDUO_COROUTINE选项编译，并包含Coroutine.h
+     * 只能在该连接所属loop上运行的协程中co_await，协程在loop线程中直接恢复，不会跨线程
+    */
+    // 等待inputBuffer_中至少有n个字节，返回inputBuffer_；连接断开且数据不足时返回nullptr
+    ReadAwaiter readAtLeast( size_t n );
+    // 发送数据并等待outputBuffer_中的数据全部写入内核，返回连接是否仍然有效
+    WriteAwaiter write( const std::string &buf );
+    WriteAwaiter write( const void *data , size_t len );
 private:
+    friend class ReadAwaiter;
+    friend class WriteAwaiter;
+    friend class TcpRelay;
+    friend class Channel;   // 紧凑分发直接调用handleXxx
+
     enum StateE { kDisconnected , kConnecting , kConnected , kDisconnecting };
     void setState( StateE state ) { state_ = state; }
     
@@ -64,17 +161,101 @@ private:
     void handleError();
 
     void sendInLoop( const void *message , size_t len );
+    // 把没有写出的数据追加到outputBuffer_（输出链不为空时追加到输出链），并注册写事件或auto-cork的flush
+    void bufferOutput( const char *data , size_t len );
+    // 其它线程的send放入sendQueue_
+    void queueSend( std::string &&message );
+    // 在loop线程中发出sendQueue_中的全部消息
+    void drainSendQueue();
+    // 写出outputBuffer_和输出链，写完时关闭写事件并通知，没写完时注册写事件
+    void writeOutputBuffer();
+    // 用一次writev写出outputBuffer_和输出链中的数据，返回写出的字节数
+    ssize_t writeOutputChain();
+    // 待发送数据增加后：高水位回调，注册写事件或auto-cork的flush，更新读背压
+    void outputQueued( size_t oldLen );
+    // outputBuffer_和输出链中等待发送的字节数
+    size_t pendingOutputBytes() const { return outputBuffer_.readableBytes() + chainBytes_; }
+    // auto-cork在本轮循环结束时发送合并的数据
+    void flushCorked();
     void shutdownInLoop();
+    // 写socket，TLS连接在内核没有接管加密时经过SSL_write
+    ssize_t writeSocket( const void *data , size_t len );
+    // 累加本连接和所属loop的流量计数
+    void countRead( ssize_t n ) {
+        bytesRead_ += n;
+        if (traffic_) {
+            traffic_->add( TrafficCounters::kBytesRead , n );
+        }
+    }
+    void countWritten( ssize_t n ) {
+        bytesWritten_ += n;
+        if (traffic_) {
+            traffic_->add( TrafficCounters::kBytesWritten , n );
+        }
+    }
+    void countEvent( TrafficCounters::Counter counter , int64_t n = 1 ) {
+        if (traffic_) {
+            traffic_->add( counter , n );
+        }
+    }
+    // inputBuffer_中有新数据，恢复等待的协程或回调messageCallback_
+    void onInputReceived( Timestamp receiveTime );
+    // TLS握手完成之前用户还不知道这个连接，不回调connectionCallback_
+    bool userNotified() const;
+    // 被采样时回调messageCallback_并记录追踪区间，见Tracer
+    void tracedMessageCallback( Timestamp receiveTime );
+    // 采样的请求在回调之后写完了全部数据
+    void finishTrace();
+
+    void handleTlsHandshake();
+    void handleTlsRead( Timestamp receiveTime );
+
+    // 停止读取的原因，任意一个原因存在时都不读取
+    enum ReadPauseReason {
+        kPausedByUser = 1 ,     // 用户调用了stopRead
+        kPausedByOutput = 2 ,   // 自己的outputBuffer_超过高水位
+        kPausedByPeer = 4 ,     // 跟随的peer的outputBuffer_超过高水位
+        kPausedByBudget = 8 ,   // 进程缓冲区内存超出MemoryBudget预算
+        kPausedByRelay = 16 ,   // TcpRelay的管道中还有数据没有发出，或者已经读到EOF
+    };
+    void pauseReading( int reason );
+    void resumeReading( int reason );
+    // 根据readPausers_和连接状态注册/注销EPOLLIN
+    void updateReading();
+    // outputBuffer_越过高水位或回落到低水位时，更新自己和跟随者的读取状态
+    void checkOutputWaterMark();
+    void addBackpressureFollower( const std::weak_ptr<TcpConnection> &follower );
+    void notifyFollowers( bool pause );
+
+    void forceCloseInLoop();
+    // 收缩已经清空的缓冲区，并把缓冲区容量的变化计入所属loop和MemoryBudget
+    void updateBufferAccounting();
+    // 超出内存预算时按策略处理本连接
+    void applyMemoryBudget();
+    // 因预算停止读取后，定时检查是否可以恢复
+    void scheduleBudgetRecheck();
+    void recheckMemoryBudget();
+
+    // 连接断开时结束转发，并关闭转发的另一端
+    void detachRelay();
+
+    // 恢复挂起在该连接上的协程
+    void resumeReadWaiter();
+    void resumeWriteWaiter();
 
     EventLoop *loop_;   // 这里在多线程下绝对不是baseLoop，因为TcpConnection都是在subLoop里面管理的
-    const std::string name_;
+    const uint64_t id_;
+    const NamePrefix namePrefix_;
+    mutable std::once_flag nameOnce_;
+    mutable std::string name_;
     std::atomic_int state_;
     bool reading_;
 
-    std::unique_ptr<Socket> socket_;
-    std::unique_ptr<Channel> channel_;
+    Socket socket_;     // 和连接在同一块内存中，析构时关闭fd
+    Channel channel_;
 
-    const InetAddress localAddr_;
+    mutable std::once_flag localAddrOnce_;
+    mutable InetAddress localAddr_;
     const InetAddress peerAddr_;
 
     ConnectionCallback connectionCallback_; // 有新连接时的回调
@@ -84,7 +265,48 @@ private:
     CloseCallback closeCallback_;
 
     size_t highWaterMark_;
+    size_t lowWaterMark_;
+    bool readBackpressure_; // 是否开启自动读背压
+    bool aboveHighWaterMark_;   // outputBuffer_当前是否处于高水位之上
+    int readPausers_;   // ReadPauseReason的组合
+    std::vector<std::weak_ptr<TcpConnection>> backpressureFollowers_;  // 跟随本连接outputBuffer_水位停止读取的连接
+
+    int64_t accountedBytes_;    // 已经计入loop和MemoryBudget的缓冲区容量
+
+    int64_t bytesRead_;
+    int64_t bytesWritten_;
+    std::shared_ptr<TrafficCounters> traffic_;  // 所属loop的计数器，持有引用使连接可以比TcpServer活得久
+
+    // 被采样的请求在回调结束时还有数据没写出：poll返回和回调结束的时间，微秒，没有时为0
+    int64_t traceReceived_;
+    int64_t traceFlushStart_;
+
+    bool autoCork_;
+    bool corkFlushQueued_;  // 已经在本轮循环中注册了flushCorked
+
+    static const int kMaxSendIov = 64;  // 一次writev的最多消息数
+    static const size_t kShrinkThreshold = 256 * 1024;  // 清空后容量仍超过该值的缓冲区收缩到初始大小
+    MpscQueue<std::string> sendQueue_;  // 其它线程send的消息
+    std::vector<std::string> sendBatch_;    // drainSendQueue取出的消息，只在loop线程中使用，保留容量
+
+    std::shared_ptr<TcpRelay> relay_;   // 与另一个连接之间的splice转发，读写事件交给它处理
+    std::shared_ptr<TlsStream> tls_;    // TLS会话，用shared_ptr使不开启TLS编译时不需要TlsStream的定义
 
     Buffer inputBuffer_;    // 接收数据缓冲区
     Buffer outputBuffer_;    // 发送数据缓冲区
+
+    /**
+     * 输出链：排在outputBuffer_之后等待发送的共享数据，只保存引用
+     * 输出链不为空时后续send的数据也追加到输出链末尾，保持发送顺序；写完的引用立即释放
+     * 共享数据不属于单个连接，不计入loop和MemoryBudget，但计入高低水位
+    */
+    std::vector<Payload> outputChain_;
+    size_t chainHead_;      // 第一个没有写完的payload
+    size_t chainOffset_;    // 该payload已经写出的字节数
+    size_t chainBytes_;     // 输出链中没有写出的字节数
+
+    // 挂起的协程句柄，保存为std::coroutine_handle<>::address()，没有协程等待时为nullptr
+    void *readWaiter_;
+    size_t readWaitBytes_;
+    void *writeWaiter_;
 };
\ No newline at end of file
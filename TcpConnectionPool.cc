@@ -0,0 +1,141 @@
+#include "TcpConnectionPool.h"
+#include "EventLoop.h"
+#include "Logger.h"
+#include "Buffer.h"
+
+#include <functional>
+#include <algorithm>
+
+// 连接池析构后连接才关闭时，只需要在loop中销毁连接
+static void removeConnectionAfterPool( EventLoop *loop , const TcpConnectionPtr &conn ) {
+    loop->queueInLoop( std::bind( &TcpConnection::connectDestroyed , conn ) );
+}
+
+static void ignoreConnection( const TcpConnectionPtr & ) {}
+
+TcpConnectionPool::TcpConnectionPool( EventLoop *loop , const std::string &nameArg )
+    : loop_( loop )
+    , name_( nameArg )
+    , maxIdlePerHost_( 64 )
+    , connectRetries_( 3 )
+    , nextConnId_( 1 ) {}
+
+TcpConnectionPool::~TcpConnectionPool() {
+    for (auto &item : connecting_) {
+        item.second->setNewConnectionCallback( Connector::NewConnectionCallback() );
+        item.second->setErrorCallback( Connector::ErrorCallback() );
+        item.second->stop();
+    }
+    // 连接上的回调不能再引用已经析构的连接池
+    ConnectionCallback connCb = connectionCallback_ ? connectionCallback_ : ConnectionCallback( &ignoreConnection );
+    CloseCallback closeCb = std::bind( &removeConnectionAfterPool , loop_ , std::placeholders::_1 );
+    for (auto &item : connections_) {
+        item.second->setConnectionCallback( connCb );
+        item.second->setCloseCallback( closeCb );
+        item.second->forceClose();
+    }
+}
+
+void TcpConnectionPool::acquire( const InetAddress &addr , const AcquireCallback &cb ) {
+    std::string key = addr.toIpPort();
+    auto it = idle_.find( key );
+    while (it != idle_.end() && !it->second.empty()) {
+        TcpConnectionPtr conn( std::move( it->second.back() ) );
+        it->second.pop_back();
+        if (conn->connected()) {
+            cb( conn );
+            return;
+        }
+    }
+
+    ConnectorPtr connector( new Connector( loop_ , addr ) );
+    connector->setMaxRetries( connectRetries_ );
+    // 回调中只保存裸指针，避免Connector持有自身形成循环引用
+    connector->setNewConnectionCallback( std::bind( &TcpConnectionPool::newConnection , this , connector.get() , cb , std::placeholders::_1 ) );
+    connector->setErrorCallback( std::bind( &TcpConnectionPool::connectFailed , this , connector.get() , cb ) );
+    connecting_[connector.get()] = connector;
+    connector->start();
+}
+
+void TcpConnectionPool::release( const TcpConnectionPtr &conn ) {
+    if (!conn->connected()) {
+        return; // 连接已断开，关闭回调中会从池中移除
+    }
+    conn->setMessageCallback( std::bind( &TcpConnectionPool::idleMessage , this ,
+        std::placeholders::_1 , std::placeholders::_2 , std::placeholders::_3 ) );
+    conn->setWriteCompleteCallback( WriteCompleteCallback() );
+
+    ConnectionList &idle = idle_[conn->peerAddress().toIpPort()];
+    if (idle.size() >= maxIdlePerHost_) {
+        conn->shutdown();
+        return;
+    }
+    idle.push_back( conn );
+}
+
+size_t TcpConnectionPool::idleCount() const {
+    size_t n = 0;
+    for (const auto &item : idle_) {
+        n += item.second.size();
+    }
+    return n;
+}
+
+// 当前处于Connector的回调中，延迟到下一轮再析构Connector
+static void releaseConnector( const ConnectorPtr & ) {}
+
+ConnectorPtr TcpConnectionPool::takeConnector( Connector *connector ) {
+    ConnectorPtr guard;
+    auto it = connecting_.find( connector );
+    if (it != connecting_.end()) {
+        guard.swap( it->second );
+        connecting_.erase( it );
+        loop_->queueInLoop( std::bind( &releaseConnector , guard ) );
+    }
+    return guard;
+}
+
+void TcpConnectionPool::newConnection( Connector *connector , AcquireCallback cb , int sockfd ) {
+    takeConnector( connector );
+
+    InetAddress peerAddr( connector->serverAddress() );
+    TcpConnection::NamePrefix &prefix = namePrefixes_[peerAddr.toIpPort()];
+    if (!prefix) {
+        prefix = std::make_shared<const std::string>( name_ + "-" + peerAddr.toIpPort() + "#" );
+    }
+    uint64_t id = nextConnId_++;
+    TcpConnectionPtr conn( TcpConnection::create( loop_ , id , prefix , sockfd , peerAddr ) );
+    conn->setConnectionCallback( std::bind( &TcpConnectionPool::connectionChanged , this , std::placeholders::_1 ) );
+    conn->setCloseCallback( std::bind( &TcpConnectionPool::removeConnection , this , std::placeholders::_1 ) );
+    connections_[id] = conn;
+    conn->connectEstablished();
+    cb( conn );
+}
+
+void TcpConnectionPool::connectFailed( Connector *connector , AcquireCallback cb ) {
+    takeConnector( connector );
+    cb( TcpConnectionPtr() );
+}
+
+void TcpConnectionPool::removeConnection( const TcpConnectionPtr &conn ) {
+    connections_.erase( conn->id() );
+    auto it = idle_.find( conn->peerAddress().toIpPort() );
+    if (it != idle_.end()) {
+        ConnectionList &idle = it->second;
+        idle.erase( std::remove( idle.begin() , idle.end() , conn ) , idle.end() );
+    }
+    loop_->queueInLoop( std::bind( &TcpConnection::connectDestroyed , conn ) );
+}
+
+void TcpConnectionPool::idleMessage( const TcpConnectionPtr &conn , Buffer *buffer , Timestamp ) {
+    LOG_ERROR( "TcpConnectionPool[%s] - unexpected %zu bytes on idle connection %s \n" , name_.c_str() ,
+        buffer->readableBytes() , conn->name().c_str() );
+    buffer->retrieveAll();
+    conn->forceClose();
+}
+
+void TcpConnectionPool::connectionChanged( const TcpConnectionPtr &conn ) {
+    if (connectionCallback_) {
+        connectionCallback_( conn );
+    }
+}
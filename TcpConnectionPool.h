@@ -0,0 +1,73 @@
+#pragma once
+
+#include "noncopyable.h"
+#include "Callbacks.h"
+#include "Connector.h"
+#include "TcpConnection.h"
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+class EventLoop;
+
+/**
+ * 单个loop上的出站连接池，按上游地址保存空闲的TcpConnection
+ * 每个subloop一个实例（例如在ThreadInitCallback中创建），所有操作都在所属loop线程中进行，不需要加锁
+ *
+ *  pool->acquire( backendAddr , [] ( const TcpConnectionPtr &conn ) {
+ *      conn->setMessageCallback( onBackendMessage );
+ *      conn->send( request );
+ *  } );
+ *  ...
+ *  pool->release( conn );  // 响应处理完后归还
+*/
+class TcpConnectionPool : noncopyable {
+public:
+    // 连接失败时conn为nullptr
+    using AcquireCallback = std::function<void( const TcpConnectionPtr &conn )>;
+
+    TcpConnectionPool( EventLoop *loop , const std::string &nameArg );
+    // 只能在loop线程中析构，会关闭池中所有的连接
+    ~TcpConnectionPool();
+
+    // 每个上游地址最多保留的空闲连接数，超出的连接在归还时关闭
+    void setMaxIdlePerHost( size_t n ) { maxIdlePerHost_ = n; }
+    // 建立连接失败后的重试次数，用完后AcquireCallback得到nullptr
+    void setConnectRetries( int n ) { connectRetries_ = n; }
+    // 池中连接建立和断开时的通知
+    void setConnectionCallback( const ConnectionCallback &cb ) { connectionCallback_ = cb; }
+
+    // 有空闲连接时直接回调，否则新建连接
+    void acquire( const InetAddress &addr , const AcquireCallback &cb );
+    // 归还连接，连接上的消息回调会被重置
+    // 在该连接的消息回调中归还时，release必须是最后一步，之后不能再访问回调捕获的对象
+    void release( const TcpConnectionPtr &conn );
+
+    EventLoop *getLoop() const { return loop_; }
+    size_t idleCount() const;
+    size_t size() const { return connections_.size(); }
+private:
+    using ConnectionList = std::vector<TcpConnectionPtr>;
+
+    // cb按值传递，回调所在的std::function随Connector析构时仍然有效
+    void newConnection( Connector *connector , AcquireCallback cb , int sockfd );
+    void connectFailed( Connector *connector , AcquireCallback cb );
+    ConnectorPtr takeConnector( Connector *connector );
+    void removeConnection( const TcpConnectionPtr &conn );
+    // 空闲连接上不应该收到数据
+    void idleMessage( const TcpConnectionPtr &conn , Buffer *buf , Timestamp );
+    void connectionChanged( const TcpConnectionPtr &conn );
+
+    EventLoop *loop_;
+    const std::string name_;
+    size_t maxIdlePerHost_;
+    int connectRetries_;
+    uint64_t nextConnId_;
+    ConnectionCallback connectionCallback_;
+
+    std::unordered_map<std::string , ConnectionList> idle_;     // key为ip:port
+    std::unordered_map<uint64_t , TcpConnectionPtr> connections_;   // 池创建的所有连接
+    std::unordered_map<Connector * , ConnectorPtr> connecting_;     // 正在建立的连接
+    std::unordered_map<std::string , TcpConnection::NamePrefix> namePrefixes_;
+};
@@ -0,0 +1,227 @@
+#include "TcpRelay.h"
+#include "TcpConnection.h"
+#include "TlsContext.h"
+#include "Channel.h"
+#include "EventLoop.h"
+#include "Logger.h"
+
+#include <atomic>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+// 单次从socket搬进管道的最大字节数，与默认的管道容量一致
+static const size_t kPipeSize = 64 * 1024;
+// 每个loop线程最多缓存的空闲管道数
+static const int kMaxIdlePipes = 64;
+
+static __thread int t_idlePipes[kMaxIdlePipes][2];
+static __thread int t_numIdlePipes = 0;
+
+static std::atomic<int64_t> g_bytesForwarded( 0 );
+
+static bool acquirePipe( int fds[2] ) {
+    if (t_numIdlePipes > 0) {
+        --t_numIdlePipes;
+        fds[0] = t_idlePipes[t_numIdlePipes][0];
+        fds[1] = t_idlePipes[t_numIdlePipes][1];
+        return true;
+    }
+    if (::pipe2( fds , O_NONBLOCK | O_CLOEXEC ) < 0) {
+        LOG_ERROR( "TcpRelay - pipe2 error:%d \n" , errno );
+        return false;
+    }
+    return true;
+}
+
+// 管道中还有数据时不能复用，直接关闭
+static void releasePipe( int fds[2] , bool empty ) {
+    if (fds[0] < 0) {
+        return;
+    }
+    if (empty && t_numIdlePipes < kMaxIdlePipes) {
+        t_idlePipes[t_numIdlePipes][0] = fds[0];
+        t_idlePipes[t_numIdlePipes][1] = fds[1];
+        ++t_numIdlePipes;
+    }
+    else {
+        ::close( fds[0] );
+        ::close( fds[1] );
+    }
+    fds[0] = fds[1] = -1;
+}
+
+std::shared_ptr<TcpRelay> TcpRelay::start( const TcpConnectionPtr &a , const TcpConnectionPtr &b ) {
+    EventLoop *loop = a->getLoop();
+    if (b->getLoop() != loop || !loop->isInLoopThread()) {
+        LOG_ERROR( "TcpRelay::start - %s and %s must be on the current loop \n" , a->name().c_str() , b->name().c_str() );
+        return std::shared_ptr<TcpRelay>();
+    }
+    if (!a->connected() || !b->connected() || a->relay_ || b->relay_) {
+        LOG_ERROR( "TcpRelay::start - %s or %s is not connected or already relayed \n" , a->name().c_str() , b->name().c_str() );
+        return std::shared_ptr<TcpRelay>();
+    }
+    // splice绕过了TLS会话，只有内核同时接管了两个方向的加解密才能转发
+    for (TcpConnection *conn : { a.get() , b.get() }) {
+        if (conn->tls_ && !( conn->tls_->ktlsSend() && conn->tls_->ktlsRecv() )) {
+            LOG_ERROR( "TcpRelay::start - %s uses TLS without kernel offload \n" , conn->name().c_str() );
+            return std::shared_ptr<TcpRelay>();
+        }
+    }
+
+    std::shared_ptr<TcpRelay> relay( new TcpRelay( a.get() , b.get() ) );
+    a->relay_ = relay;
+    b->relay_ = relay;
+    // 已经读到inputBuffer_中的数据按原来的方式发给对方，之后管道中的数据要等outputBuffer_发完
+    for (Direction &d : relay->directions_) {
+        Buffer &input = d.from->inputBuffer_;
+        if (input.readableBytes() > 0) {
+            d.to->sendInLoop( input.peek() , input.readableBytes() );
+            input.retrieveAll();
+            d.from->updateBufferAccounting();
+        }
+    }
+    return relay;
+}
+
+TcpRelay::TcpRelay( TcpConnection *a , TcpConnection *b )
+    : closing_( false ) {
+    directions_[0] = Direction { a , b , { -1 , -1 } , 0 , false , false , 0 };
+    directions_[1] = Direction { b , a , { -1 , -1 } , 0 , false , false , 0 };
+}
+
+TcpRelay::~TcpRelay() {
+    releasePipes();
+}
+
+int64_t TcpRelay::totalBytesForwarded() {
+    return g_bytesForwarded.load( std::memory_order_relaxed );
+}
+
+void TcpRelay::handleRead( TcpConnection *conn ) {
+    if (closing_) {
+        return;
+    }
+    Direction &d = directions_[0].from == conn ? directions_[0] : directions_[1];
+    if (d.pending >= kPipeSize) {
+        d.from->pauseReading( TcpConnection::kPausedByRelay );
+        return;
+    }
+    if (d.pipe[0] < 0 && !acquirePipe( d.pipe )) {
+        closeBoth();
+        return;
+    }
+    ssize_t n = ::splice( conn->channel_.fd() , nullptr , d.pipe[1] , nullptr , kPipeSize - d.pending ,
+        SPLICE_F_MOVE | SPLICE_F_NONBLOCK );
+    if (n > 0) {
+        d.pending += n;
+        conn->countRead( n );
+    }
+    else if (n == 0) {
+        // 读到EOF，不再读取，管道排空后对另一端shutdown
+        d.eof = true;
+        d.from->pauseReading( TcpConnection::kPausedByRelay );
+    }
+    else if (errno != EAGAIN && errno != EINTR) {
+        LOG_ERROR( "TcpRelay::handleRead - splice from %s error:%d \n" , conn->name().c_str() , errno );
+        closeBoth();
+        return;
+    }
+    flush( d );
+}
+
+void TcpRelay::handleWrite( TcpConnection *conn ) {
+    flush( directions_[0].to == conn ? directions_[0] : directions_[1] );
+}
+
+void TcpRelay::flush( Direction &d ) {
+    if (closing_) {
+        return;
+    }
+    TcpConnection *to = d.to;
+    if (to->pendingOutputBytes() > 0) {
+        // 转发开始前留在outputBuffer_中的数据还没发完，to的handleWrite发完后会回到这里
+        if (d.pending > 0) {
+            d.from->pauseReading( TcpConnection::kPausedByRelay );
+        }
+        return;
+    }
+
+    int64_t sent = 0;
+    while (d.pending > 0) {
+        ssize_t n = ::splice( d.pipe[0] , nullptr , to->channel_.fd() , nullptr , d.pending ,
+            SPLICE_F_MOVE | SPLICE_F_NONBLOCK );
+        if (n > 0) {
+            d.pending -= n;
+            sent += n;
+        }
+        else if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        else if (n < 0 && errno == EAGAIN) {
+            break;
+        }
+        else {
+            LOG_ERROR( "TcpRelay::flush - splice to %s error:%d \n" , to->name().c_str() , errno );
+            closeBoth();
+            return;
+        }
+    }
+    if (sent > 0) {
+        d.bytes += sent;
+        to->countWritten( sent );
+        g_bytesForwarded.fetch_add( sent , std::memory_order_relaxed );
+    }
+
+    if (d.pending > 0) {
+        // to的发送缓冲区已满，等可写后继续，期间停止从from读取
+        d.from->pauseReading( TcpConnection::kPausedByRelay );
+        if (!to->channel_.isWriting()) {
+            to->channel_.enableWriting();
+        }
+        return;
+    }
+
+    releasePipe( d.pipe , true );
+    if (to->channel_.isWriting()) {
+        to->channel_.disableWriting();
+    }
+    if (!d.eof) {
+        d.from->resumeReading( TcpConnection::kPausedByRelay );
+        return;
+    }
+    if (!d.shutdown) {
+        d.shutdown = true;
+        to->shutdown();
+    }
+    if (directions_[0].shutdown && directions_[1].shutdown) {
+        closeBoth();
+    }
+}
+
+void TcpRelay::handleClose( TcpConnection *conn ) {
+    // conn已经在handleClose中，只需要关闭另一端
+    TcpConnection *other = directions_[0].from == conn ? directions_[0].to : directions_[0].from;
+    directions_[0].from = directions_[0].to = nullptr;
+    directions_[1].from = directions_[1].to = nullptr;
+    closing_ = true;
+    releasePipes();
+    if (other != nullptr) {
+        std::shared_ptr<TcpRelay> guard;
+        guard.swap( other->relay_ );
+        other->forceClose();
+    }
+}
+
+void TcpRelay::closeBoth() {
+    closing_ = true;
+    directions_[0].from->forceClose();
+    directions_[0].to->forceClose();
+}
+
+void TcpRelay::releasePipes() {
+    for (Direction &d : directions_) {
+        releasePipe( d.pipe , d.pending == 0 );
+        d.pending = 0;
+    }
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include "noncopyable.h"
+#include "Callbacks.h"
+
+#include <memory>
+#include <stdint.h>
+#include <stddef.h>
+
+class TcpConnection;
+
+/**
+ * 两个TcpConnection之间的零拷贝转发（L4代理）
+ * 数据经 socket -> pipe -> socket 用splice在内核中搬运，不经过inputBuffer_/outputBuffer_
+ *
+ * - 背压：对端发送缓冲区满、管道中还有数据时停止从来源读取，对端可写后继续
+ * - 半关闭：一个方向读到EOF并且管道排空后，对另一端shutdown写端，另一个方向继续转发；两个方向都结束后关闭两个连接
+ * - 任意一端断开或出错时关闭另一端
+ *
+ * 开始转发后不再调用两个连接的messageCallback_，连接断开时仍然调用connectionCallback_
+ * 每个loop线程缓存空闲的管道，管道只在有数据待发送时被占用
+*/
+class TcpRelay : noncopyable {
+public:
+    /**
+     * 在a和b之间开始双向转发，两个连接必须已建立并属于同一个loop，只能在该loop线程中调用
+     * 两个连接的inputBuffer_中已经读到的数据先转发给对方。条件不满足时返回nullptr
+    */
+    static std::shared_ptr<TcpRelay> start( const TcpConnectionPtr &a , const TcpConnectionPtr &b );
+
+    ~TcpRelay();
+
+    // 两个方向累计转发的字节数，只能在loop线程中访问
+    int64_t bytesForwarded() const { return directions_[0].bytes + directions_[1].bytes; }
+    // 进程内所有TcpRelay用splice转发的字节数
+    static int64_t totalBytesForwarded();
+private:
+    friend class TcpConnection;
+
+    // 从from读到的数据经pipe写到to
+    struct Direction {
+        TcpConnection *from;
+        TcpConnection *to;
+        int pipe[2];        // 没有数据待发送时归还给loop的管道缓存，为-1
+        size_t pending;     // 管道中的字节数
+        bool eof;           // from已经读到EOF
+        bool shutdown;      // 已经对to执行了shutdown
+        int64_t bytes;
+    };
+
+    TcpRelay( TcpConnection *a , TcpConnection *b );
+
+    // 以下由TcpConnection在loop线程中调用
+    void handleRead( TcpConnection *conn );
+    // conn的outputBuffer_已经发完，继续发送管道中的数据
+    void handleWrite( TcpConnection *conn );
+    // conn断开，关闭另一端
+    void handleClose( TcpConnection *conn );
+
+    // 把管道中的数据尽量写到to，根据结果调整from的读取和to的写事件
+    void flush( Direction &d );
+    // 出错或两个方向都结束时关闭两个连接
+    void closeBoth();
+    void releasePipes();
+
+    Direction directions_[2];
+    bool closing_;
+};
@@ -5,11 +5,16 @@
 #include <functional>
 #include <string>
 #include <strings.h>
+#include <algorithm>
+#include <unistd.h>
+#include <mutex>
+#include <condition_variable>
 
 static EventLoop *CheckLoopNotNull( EventLoop *loop ) {
     if (loop == nullptr) {
         LOG_FATAL( "%s:%s:%d mainLoop is null! \n" , __FILE__ , __FUNCTION__ , __LINE__ );
     }
+    return loop;
 }
 
 TcpServer::TcpServer( EventLoop *loop , /* mainLoop, running in mainThread */
@@ -19,23 +24,76 @@ TcpServer::TcpServer( EventLoop *loop , /* mainLoop, running in mainThread */
     : loop_( CheckLoopNotNull( loop ) )
     , ipPort_( listenAddr.toIpPort() )
     , name_( nameArg )
-    , acceptor_( new Acceptor( loop , listenAddr , option == kReusePort ) ) /* 创建监听socket，并封装到acceptor和其内部的Channel和Socket，由mainLoop管理 */
+    , listenAddr_( listenAddr )
+    , option_( option )
+    , backlog_( 1024 )
     , threadPool_( new EventLoopThreadPool( loop , name_ ) ) /* 创建EventLoopThreadPool对象，以管理EventLoop对象和线程 */
     , connectionCallback_()
     , messageCallback_()
-    , nextConnId_( 1 ) {
-    // 当有新用户连接时，listenfd发生的读事件，在其读事件处理过程中会调用该回调将新连接分配到子线程去处理
-    acceptor_->setNewConnectionCallback( std::bind( &TcpServer::newConnection , this , std::placeholders::_1 , std::placeholders::_2 ) );
+    , started_( 0 )
+    , numConnections_( 0 )
+    , connNamePrefix_( std::make_shared<const std::string>( nameArg + "-" + ipPort_ + "#" ) ) {
+    if (option == kReusePort && listenAddr.isUnix()) {
+        LOG_INFO( "TcpServer [%s] - SO_REUSEPORT does not apply to %s, accepting in the base loop \n" , name_.c_str() , ipPort_.c_str() );
+    }
 }
 
 TcpServer::~TcpServer() {
-    for (auto &item : connections_) {
-        TcpConnectionPtr conn( item.second );
-        item.second.reset();
+    /**
+     * acceptor和连接分片都只能在所属的loop线程中销毁
+     * acceptor的新连接回调和连接的关闭回调都持有this，必须等subloop上的销毁任务执行完再返回，
+     * 否则之后accept或关闭的连接会访问已释放的server；只投递不等待时loop还可能在执行之前退出，acceptor泄漏
+     * subloop由threadPool_持有，此时一定还在运行；baseLoop上的任务在当前线程中直接执行
+    */
+    std::mutex mutex;
+    std::condition_variable cond;
+    size_t pending = 0;
+    auto runAndWait = [&mutex , &cond , &pending] ( EventLoop *ioLoop , const EventLoop::Functor &task ) {
+        if (ioLoop->isInLoopThread()) {
+            task();
+            return;
+        }
+        {
+            std::unique_lock<std::mutex> lock( mutex );
+            ++pending;
+        }
+        ioLoop->queueInLoop( [task , &mutex , &cond , &pending] () {
+            task();
+            std::unique_lock<std::mutex> lock( mutex );
+            if (--pending == 0) {
+                cond.notify_all();
+            }
+        } );
+    };
+
+    for (std::unique_ptr<Acceptor> &item : acceptors_) {
+        Acceptor *acceptor = item.release();
+        runAndWait( acceptor->getLoop() , [acceptor] () { delete acceptor; } );
+    }
+    // 每个分片只能在自己的loop中访问，每个loop执行一个任务销毁其上的连接
+    for (const ConnectionShardPtr &shard : shards_) {
+        ConnectionShard *target = shard.get();
+        runAndWait( shard->loop , [target] () {
+            ConnectionMap connections;
+            connections.swap( target->connections );
+            for (auto &item : connections) {
+                item.second->getLoop()->addConnectionCount( -1 );
+                item.second->connectDestroyed();
+            }
+        } );
+    }
+    {
+        std::unique_lock<std::mutex> lock( mutex );
+        while (pending != 0) {
+            cond.wait( lock );
+        }
+    }
 
-        conn->getLoop()->runInLoop(
-            std::bind( &TcpConnection::connectDestroyed , conn )
-        );
+    // 没有用到的继承socket
+    for (std::vector<int> &fds : adoptedFds_) {
+        for (int fd : fds) {
+            ::close( fd );
+        }
     }
 }
 
@@ -44,64 +102,206 @@ void TcpServer::setThreadNum( int numThreads ) {
     threadPool_->setThreadNum( numThreads );
 }
 
+void TcpServer::addListenAddress( const InetAddress &addr ) {
+    extraAddrs_.push_back( addr );
+}
+
+static InetAddress localAddressOf( int fd ) {
+    sockaddr_un local;
+    socklen_t len = sizeof local;
+    ::bzero( &local , sizeof local );
+    ::getsockname( fd , (sockaddr *)&local , &len );
+    InetAddress addr;
+    addr.setSockAddrGeneric( (sockaddr *)&local , len );
+    return addr;
+}
+
+static bool sameListenAddress( const InetAddress &a , const InetAddress &b ) {
+    if (a.family() != b.family()) {
+        return false;
+    }
+    if (a.isUnix()) {
+        return a.unixPath() == b.unixPath();
+    }
+    return a.getSockAddr()->sin_addr.s_addr == b.getSockAddr()->sin_addr.s_addr &&
+        a.getSockAddr()->sin_port == b.getSockAddr()->sin_port;
+}
+
+void TcpServer::adoptListenFds( std::vector<int> *fds ) {
+    adoptedFds_.resize( extraAddrs_.size() + 1 );
+    for (auto it = fds->begin(); it != fds->end();) {
+        InetAddress local = localAddressOf( *it );
+        size_t index = 0;
+        while (index < adoptedFds_.size() &&
+            !sameListenAddress( local , index == 0 ? listenAddr_ : extraAddrs_[index - 1] )) {
+            ++index;
+        }
+        if (index < adoptedFds_.size()) {
+            LOG_INFO( "TcpServer [%s] - adopt listening fd=%d on %s \n" , name_.c_str() , *it , local.toIpPort().c_str() );
+            adoptedFds_[index].push_back( *it );
+            it = fds->erase( it );
+        }
+        else {
+            ++it;
+        }
+    }
+}
+
+std::vector<int> TcpServer::listenFds() const {
+    std::vector<int> fds;
+    for (const std::unique_ptr<Acceptor> &acceptor : acceptors_) {
+        fds.push_back( acceptor->fd() );
+    }
+    return fds;
+}
+
+void TcpServer::stopAccepting() {
+    for (std::unique_ptr<Acceptor> &acceptor : acceptors_) {
+        acceptor->getLoop()->runInLoop( std::bind( &Acceptor::stop , acceptor.get() ) );
+    }
+}
+
+void TcpServer::broadcast( const Payload &payload ) {
+    for (const ConnectionShardPtr &shard : shards_) {
+        if (shard->broadcastQueue.push( payload )) {
+            shard->loop->queueInLoop( std::bind( &TcpServer::sendBroadcasts , shard ) );
+        }
+    }
+}
+
+void TcpServer::sendBroadcasts( const ConnectionShardPtr &shard ) {
+    shard->broadcastQueue.popAll( &shard->broadcastBatch );
+    // sendShared不会同步关闭连接，遍历期间分片不变
+    for (auto &item : shard->connections) {
+        item.second->sendShared( shard->broadcastBatch.data() , shard->broadcastBatch.size() );
+    }
+    shard->broadcastBatch.clear();
+}
+
+std::vector<EventLoop *> TcpServer::loops() const {
+    std::vector<EventLoop *> result;
+    for (const ConnectionShardPtr &shard : shards_) {
+        result.push_back( shard->loop );
+    }
+    return result;
+}
+
+int64_t TcpServer::trafficCount( TrafficCounters::Counter counter ) const {
+    int64_t total = 0;
+    for (const ConnectionShardPtr &shard : shards_) {
+        total += shard->traffic->get( counter );
+    }
+    return total;
+}
+
 // 开启服务器监听
 void TcpServer::start() {
     if (started_++ == 0) {
         threadPool_->start( threadInitCallback_ );  // 启动底层的loop线程池
-        /* 设置监听socket为被动监听，并设置其读事件上的回调，将其交给mainLoop处理 */
-        loop_->runInLoop( std::bind( &Acceptor::listen , acceptor_.get() ) );
+        std::vector<EventLoop *> loops = threadPool_->getAllLoops();
+        for (size_t i = 0; i < loops.size(); ++i) {
+            ConnectionShardPtr shard( new ConnectionShard );
+            shard->loop = loops[i];
+            shard->index = i;
+            shard->nextSeq = 1;
+            shard->traffic = std::make_shared<TrafficCounters>();
+            shards_.push_back( shard );
+            shardIndex_[loops[i]] = shard.get();
+        }
+        adoptedFds_.resize( extraAddrs_.size() + 1 );
+        if (option_ == kReusePort && loops[0] != loop_ && !listenAddr_.isUnix()) {
+            /* 每个subloop各自监听，连接在哪个loop上被accept就在哪个loop上处理，不再经过mainLoop */
+            createAcceptors( listenAddr_ , loops , true , adoptedFds_[0] );
+        }
+        else {
+            /* 监听socket由mainLoop处理，新连接按负载均衡策略分给subloop */
+            createAcceptors( listenAddr_ , std::vector<EventLoop *>( 1 , loop_ ) , false , adoptedFds_[0] );
+        }
+        for (size_t i = 0; i < extraAddrs_.size(); ++i) {
+            createAcceptors( extraAddrs_[i] , std::vector<EventLoop *>( 1 , loop_ ) , false , adoptedFds_[i + 1] );
+        }
+        adoptedFds_.clear();
+        for (std::unique_ptr<Acceptor> &acceptor : acceptors_) {
+            acceptor->getLoop()->runInLoop( std::bind( &Acceptor::listen , acceptor.get() ) );
+        }
+    }
+}
+
+void TcpServer::createAcceptors( const InetAddress &addr , const std::vector<EventLoop *> &loops , bool reuseport , const std::vector<int> &fds ) {
+    size_t n = reuseport ? std::max( loops.size() , fds.size() ) : std::max<size_t>( fds.size() , 1 );
+    for (size_t i = 0; i < n; ++i) {
+        EventLoop *ioLoop = loops[i % loops.size()];
+        // 继承的socket已经bind，不能再创建新的，否则端口冲突
+        Acceptor *acceptor = i < fds.size() ? new Acceptor( ioLoop , fds[i] ) : new Acceptor( ioLoop , addr , reuseport );
+        acceptor->setBacklog( backlog_ );
+        if (ioLoop == loop_) {
+            // 当有新用户连接时，listenfd发生的读事件，在其读事件处理过程中会调用该回调将新连接分配到子线程去处理
+            acceptor->setNewConnectionCallback( std::bind( &TcpServer::newConnection , this , std::placeholders::_1 , std::placeholders::_2 ) );
+        }
+        else {
+            acceptor->setNewConnectionCallback( [this , ioLoop] ( int sockfd , const InetAddress &peerAddr ) {
+                ioLoop->addConnectionCount( 1 );
+                establishConnection( ioLoop , sockfd , peerAddr );
+            } );
+        }
+        acceptors_.push_back( std::unique_ptr<Acceptor>( acceptor ) );
     }
 }
 
 /* 它将在监听socket的读事件回调中被调用 */
 void TcpServer::newConnection( int sockfd , const InetAddress &peerAddr ) {
-    // 轮询算法，选择一个subLoop，来管理channel
-    EventLoop *ioLoop = threadPool_->getNextLoop();
-    char buf[64] = { 0 };
-    snprintf( buf , sizeof buf , "-%s#%d" , ipPort_.c_str() , nextConnId_ );
-    ++nextConnId_;
-    std::string connName = name_ + buf;
+    // 按负载均衡策略（默认轮询），选择一个subLoop，来管理channel
+    EventLoop *ioLoop = threadPool_->getNextLoop( peerAddr );
+    // 选中loop时立即计数，连续到来的连接才能看到最新的负载
+    ioLoop->addConnectionCount( 1 );
+    ioLoop->runInLoop( std::bind( &TcpServer::establishConnection , this , ioLoop , sockfd , peerAddr ) );
+}
 
-    LOG_INFO( "TcpServer::newConnection [%s] - new connection [%s] from %s \n" , name_.c_str() ,
-        connName.c_str() , peerAddr.toIpPort().c_str() );
+TcpServer::ConnectionShard *TcpServer::shardOf( EventLoop *loop ) const {
+    return shardIndex_.find( loop )->second;
+}
 
-    sockaddr_in local;
-    ::bzero( &local , sizeof local );
-    socklen_t addrlen = sizeof local;
-    if (::getsockname( sockfd , (sockaddr *)&local , &addrlen ) < 0) {
-        LOG_ERROR( "sockets::getLocalAddr" );
-    }
-    InetAddress localAddr( local );
+void TcpServer::establishConnection( EventLoop *ioLoop , int sockfd , const InetAddress &peerAddr ) {
+    ConnectionShard *shard = shardOf( ioLoop );
+    uint64_t id = shard->nextSeq++ * shards_.size() + shard->index;
+
+    LOG_DEBUG( "TcpServer::newConnection [%s] - new connection [%llu] at fd=%d \n" , name_.c_str() ,
+        (unsigned long long)id , sockfd );
 
-    // 根据连接成功的sockfd，创建TcpConnection连接对象
-    TcpConnectionPtr conn( new TcpConnection(
+    // 根据连接成功的sockfd，创建TcpConnection连接对象，连接名和本端地址延迟到使用时才生成
+    TcpConnectionPtr conn( TcpConnection::create(
         ioLoop ,
-        connName ,
+        id ,
+        connNamePrefix_ ,
         sockfd ,
-        localAddr ,
         peerAddr
     ) );
-    connections_[connName] = conn;
+    shard->connections[id] = conn;
+    numConnections_.fetch_add( 1 , std::memory_order_relaxed );
     // 下面的回调都是用户设置给TcpServer => TcpConnection => Channel => Poller channel 调用回调
     conn->setConnectionCallback( connectionCallback_ );
     conn->setMessageCallback( messageCallback_ );
     conn->setWriteCompleteCallback( writeCompleteCallback_ );
+    conn->setTrafficCounters( shard->traffic );
+    shard->traffic->add( TrafficCounters::kConnectionsAccepted );
 
     // 设置如何关闭连接的回调
     conn->setCloseCallback( std::bind( &TcpServer::removeConnection , this , std::placeholders::_1 ) );
+    if (tlsContext_) {
+        conn->startTls( tlsContext_ );
+    }
     // 调用连接建立的回调函数，设置conn->state_ = Connected，设置新连接的读事件(将connsocket写入epollfd监听)，并调用用户设置的连接回调函数
-    ioLoop->runInLoop( std::bind( &TcpConnection::connectEstablished , conn ) );
+    conn->connectEstablished();
 }
 
+// 在连接所属的subloop中被调用，只访问该loop的分片，不需要再回到mainLoop
 void TcpServer::removeConnection( const TcpConnectionPtr &conn ) {
-    loop_->runInLoop(
-        std::bind( &TcpServer::removeConnectionInLoop , this , conn )
-    );
-}
-
-void TcpServer::removeConnectionInLoop( const TcpConnectionPtr &conn ) {
-    LOG_INFO( "TcpServer::removeConnectionInLoop [%s] - connection %s\n" , name_.c_str() , conn->name().c_str() );
-    size_t n = connections_.erase( conn->name() );
+    LOG_DEBUG( "TcpServer::removeConnection [%s] - connection %llu\n" , name_.c_str() , (unsigned long long)conn->id() );
     EventLoop *ioLoop = conn->getLoop();
+    ConnectionShard *shard = shards_[conn->id() % shards_.size()].get();
+    shard->connections.erase( conn->id() );
+    shard->traffic->add( TrafficCounters::kConnectionsClosed );
+    numConnections_.fetch_sub( 1 , std::memory_order_relaxed );
+    ioLoop->addConnectionCount( -1 );
     ioLoop->queueInLoop( std::bind( &TcpConnection::connectDestroyed , conn ) );
 }
\ No newline at end of file
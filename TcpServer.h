@@ -6,12 +6,17 @@
 #include "noncopyable.h"
 #include "EventLoopThreadPool.h"
 #include "Callbacks.h"
+#include "TcpConnection.h"
+#include "MpscQueue.h"
+#include "TrafficCounters.h"
 
 #include <functional>
 #include <string>
 #include <memory>
 #include <atomic>
+#include <vector>
 #include <unordered_map>
+#include <stdint.h>
 
 class TcpServer : noncopyable {
 public:
@@ -19,7 +24,7 @@ public:
 
     enum Option {
         kNoReusePort ,
-        kReusePort ,
+        kReusePort ,    // 每个subloop各自创建SO_REUSEPORT监听socket，由内核分发连接，连接在接收它的loop上处理
     };
 
     TcpServer( EventLoop *loop , const InetAddress &listenAddr , const std::string &nameArg, Option option = kNoReusePort );
@@ -31,22 +36,95 @@ public:
     void setWriteCompleteCallback( const WriteCompleteCallback &cb ) { writeCompleteCallback_ = cb; }
 
     void setThreadNum( int numThreads );
+    const std::string &name() const { return name_; }
+    // 监听socket的backlog，在start之前设置
+    void setListenBacklog( int backlog ) { backlog_ = backlog; }
+    /**
+     * 在另一个地址上同时监听，如TCP地址之外再监听一个AF_UNIX地址，在start之前调用
+     * 额外的监听socket都在baseLoop上accept，按负载均衡策略分配连接，对连接的使用没有区别
+    */
+    void addListenAddress( const InetAddress &addr );
+    /**
+     * 热重启：从fds中取出本地地址与本server监听地址相同的socket，start时直接使用而不再创建和bind
+     * 在addListenAddress之后、start之前调用，取走的fd从fds中删除，归server所有
+     * reuseport模式下继承的socket依次分给各个subloop，不够时为其余subloop新建
+    */
+    void adoptListenFds( std::vector<int> *fds );
+    // 所有监听socket的fd，start之后有效，用于交给新进程
+    std::vector<int> listenFds() const;
+    // 停止accept新连接，已建立的连接不受影响，在baseLoop线程中调用
+    void stopAccepting();
+    // 所有处理连接的loop，start之后有效，如交给Watchdog监视
+    std::vector<EventLoop *> loops() const;
+    // 当前的连接数
+    int numConnections() const { return numConnections_.load( std::memory_order_relaxed ); }
+    /**
+     * 所有loop上的流量计数之和，start之后可以在任意线程调用，不加锁
+     * 每个loop分片一组计数器，连接直接累加到所属loop的计数器，读取时才汇总
+    */
+    int64_t trafficCount( TrafficCounters::Counter counter ) const;
+    /**
+     * 把同一份只读数据发给所有已建立的连接，start之后可以在任意线程调用
+     * payload放入每个分片的无锁队列，队列由空变为非空时才向该subloop投递一个任务，
+     * 任务取出队列中的全部payload，对本分片的每个连接调用一次sendShared，各连接只保存payload的引用
+    */
+    void broadcast( const Payload &payload );
+    // 新连接分配到subloop的策略，在start之前设置；reuseport多acceptor模式下由内核分配，策略不生效
+    void setLoadBalance( EventLoopThreadPool::Strategy strategy ) { threadPool_->setStrategy( strategy ); }
+    void setLoopChooser( const EventLoopThreadPool::LoopChooser &chooser ) { threadPool_->setLoopChooser( chooser ); }
+    // subloop线程的cpu绑定和NUMA本地内存分配，在start之前设置，见EventLoopThreadPool::setCpuAffinity
+    void setThreadCpuAffinity( const std::vector<std::vector<int>> &cpuSets ) { threadPool_->setCpuAffinity( cpuSets ); }
+    void setThreadNumaLocal( bool on ) { threadPool_->setNumaLocal( on ); }
+    // 所有新连接先进行TLS握手，需要以MYMUDUO_TLS选项编译，在start之前设置
+    void setTlsContext( const std::shared_ptr<TlsContext> &context ) { tlsContext_ = context; }
 
     // 开启服务器监听
     void start();
 private:
+    // baseLoop上的acceptor接收到新连接，按负载均衡策略选择一个subloop
     void newConnection( int sockfd , const InetAddress &peerAddr );
+    // 在ioLoop中为sockfd创建TcpConnection，连接对象和Buffer都由ioLoop的线程分配，内存落在该线程的NUMA节点上
+    void establishConnection( EventLoop *ioLoop , int sockfd , const InetAddress &peerAddr );
+    // 在连接所属的loop中被调用，直接从该loop的分片中移除
     void removeConnection( const TcpConnectionPtr &conn );
-    void removeConnectionInLoop( const TcpConnectionPtr &conn );
+    /**
+     * 为addr在loops上创建acceptor，优先使用继承的fds
+     * reuseport时每个loop至少一个，否则所有fd都在loops[0]上
+    */
+    void createAcceptors( const InetAddress &addr , const std::vector<EventLoop *> &loops , bool reuseport , const std::vector<int> &fds );
 
-    using ConnectionMap = std::unordered_map<std::string , TcpConnectionPtr>;
+    using ConnectionMap = std::unordered_map<uint64_t , TcpConnectionPtr>;
+
+    /**
+     * 连接表按loop分片，每个分片只在所属loop的线程中访问，注册和移除都不需要加锁，也不需要回到mainLoop
+     * 连接id = 分片内序号 * 分片数 + 分片下标，由id可以直接找到分片
+    */
+    struct ConnectionShard {
+        EventLoop *loop;
+        uint64_t index;
+        uint64_t nextSeq;
+        ConnectionMap connections;
+        MpscQueue<Payload> broadcastQueue;  // 待广播的payload，任意线程写入
+        std::vector<Payload> broadcastBatch;    // 只在loop线程中使用，保留容量
+        std::shared_ptr<TrafficCounters> traffic;   // 本loop上连接的流量计数，连接也持有引用
+    };
+    using ConnectionShardPtr = std::shared_ptr<ConnectionShard>;
+    ConnectionShard *shardOf( EventLoop *loop ) const;
+    // 在分片所属loop中发出队列中的全部广播
+    static void sendBroadcasts( const ConnectionShardPtr &shard );
     
     EventLoop *loop_;   // baseLoop 用户定义的loop
     
     const std::string ipPort_;
     const std::string name_;
+    const InetAddress listenAddr_;
+    const Option option_;
+    int backlog_;
     
-    std::unique_ptr<Acceptor> acceptor_;
+    std::vector<InetAddress> extraAddrs_;   // addListenAddress添加的地址
+    std::vector<std::vector<int>> adoptedFds_;  // 继承的监听socket，下标0为listenAddr_，i为extraAddrs_[i - 1]
+    // start时创建：baseLoop上的acceptor，reuseport模式下每个subloop一个
+    std::vector<std::unique_ptr<Acceptor>> acceptors_;
     
     std::shared_ptr<EventLoopThreadPool> threadPool_;
     
@@ -55,9 +133,12 @@ private:
     WriteCompleteCallback writeCompleteCallback_; // 消息发送完成以后的回调
 
     ThreadInitCallback threadInitCallback_; // loop线程初始化的回调
+    std::shared_ptr<TlsContext> tlsContext_;
     
     std::atomic_int started_;
+    std::atomic_int numConnections_;
 
-    int nextConnId_;
-    ConnectionMap connections_; // 保存所有的连接
+    const TcpConnection::NamePrefix connNamePrefix_;   // 连接名前缀 name-ip:port#
+    std::vector<ConnectionShardPtr> shards_;    // 保存所有的连接，start之后分片列表只读
+    std::unordered_map<EventLoop * , ConnectionShard *> shardIndex_;
 };
\ No newline at end of file
@@ -1,6 +1,15 @@
 #include "Thread.h"
 #include "CurrentThread.h"
+#include "Logger.h"
 #include <semaphore.h>
+#include <pthread.h>
+#include <sched.h>
+#include <dirent.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
 
 std::atomic_int Thread::numCreated_(0);
 
@@ -9,7 +18,8 @@ Thread::Thread( ThreadFunc func, const std::string &name )
     , joined_( false )
     , tid_( 0 )
     , func_( std::move( func ) )
-    , name_( name ) {
+    , name_( name )
+    , numaLocal_( false ) {
     setDefaultName();
 }
 
@@ -27,6 +37,7 @@ void Thread::start() {
     thread_ = std::shared_ptr<std::thread>( new std::thread( [ & ] () {
         // 获取线程的tid值
         tid_ = CurrentThread::tid();
+        applyPlacement();
         sem_post( &sem );
         func_();    // 开启一个新线程
         } ) );
@@ -47,4 +58,56 @@ void Thread::setDefaultName() {
         snprintf( buf , sizeof buf , "Thread%d" , num );
         name_ = buf;
     }
-}
\ No newline at end of file
+}
+
+// 通过sysfs查询cpu所在的NUMA节点，/sys/devices/system/cpu/cpuN/下有nodeK目录
+static int cpuToNode( int cpu ) {
+    char path[64] = { 0 };
+    snprintf( path , sizeof path , "/sys/devices/system/cpu/cpu%d" , cpu );
+    DIR *dir = ::opendir( path );
+    if (dir == nullptr) {
+        return -1;
+    }
+    int node = -1;
+    struct dirent *entry;
+    while (( entry = ::readdir( dir ) ) != nullptr) {
+        if (strncmp( entry->d_name , "node" , 4 ) == 0 && entry->d_name[4] >= '0' && entry->d_name[4] <= '9') {
+            node = atoi( entry->d_name + 4 );
+            break;
+        }
+    }
+    ::closedir( dir );
+    return node;
+}
+
+void Thread::applyPlacement() {
+    // 内核限制线程名最长15个字符
+    ::pthread_setname_np( ::pthread_self() , name_.substr( 0 , 15 ).c_str() );
+
+    if (cpus_.empty()) {
+        return;
+    }
+    cpu_set_t cpuset;
+    CPU_ZERO( &cpuset );
+    for (int cpu : cpus_) {
+        CPU_SET( cpu , &cpuset );
+    }
+    int err = ::pthread_setaffinity_np( ::pthread_self() , sizeof cpuset , &cpuset );
+    if (err != 0) {
+        LOG_ERROR( "%s:%s:%d thread %s set cpu affinity err:%d \n" , __FILE__ , __FUNCTION__ , __LINE__ , name_.c_str() , err );
+        return;
+    }
+
+    if (numaLocal_) {
+        int node = cpuToNode( cpus_[0] );
+        if (node < 0 || node >= static_cast<int>( 8 * sizeof( unsigned long ) * 4 )) {
+            return;
+        }
+        // MPOL_PREFERRED：优先在本节点分配，本节点内存不足时退回其它节点，而不是OOM
+        unsigned long nodemask[4] = { 0 };
+        nodemask[node / ( 8 * sizeof( unsigned long ) )] |= 1UL << ( node % ( 8 * sizeof( unsigned long ) ) );
+        if (::syscall( SYS_set_mempolicy , MPOL_PREFERRED , nodemask , 8 * sizeof nodemask ) < 0) {
+            LOG_ERROR( "%s:%s:%d thread %s set_mempolicy node:%d err:%d \n" , __FILE__ , __FUNCTION__ , __LINE__ , name_.c_str() , node , errno );
+        }
+    }
+}
@@ -7,6 +7,7 @@
 #include <unistd.h>
 #include <string>
 #include <atomic>
+#include <vector>
 
 class Thread : noncopyable {
 public:
@@ -15,6 +16,12 @@ public:
     explicit Thread( ThreadFunc , const std::string &name = std::string() );
     ~Thread();
 
+    // 以下设置需要在start之前调用，在新线程执行func之前生效
+    // 把线程绑定到cpus中的cpu上，为空表示不绑定
+    void setCpuAffinity( const std::vector<int> &cpus ) { cpus_ = cpus; }
+    // 线程的内存分配优先使用其绑定cpu所在的NUMA节点，需要同时设置cpu亲和性
+    void setNumaLocal( bool on ) { numaLocal_ = on; }
+
     void start();
     void join();
 
@@ -25,11 +32,15 @@ public:
     static int numCreated() { return numCreated_; }
 private:
     void setDefaultName();
+    // 在新线程中设置线程名（top/perf可见）、cpu亲和性和NUMA内存策略
+    void applyPlacement();
     bool started_;
     bool joined_;
     std::shared_ptr<std::thread> thread_;
     pid_t tid_;
     ThreadFunc func_;
     std::string name_;
+    std::vector<int> cpus_;
+    bool numaLocal_;
     static std::atomic_int numCreated_;
 };
\ No newline at end of file
@@ -0,0 +1,37 @@
+#pragma once
+
+#include "noncopyable.h"
+#include "Timestamp.h"
+
+#include <functional>
+#include <atomic>
+
+// 定时器，记录到期时间、回调以及重复间隔
+class Timer : noncopyable {
+public:
+    using TimerCallback = std::function<void()>;
+
+    Timer( TimerCallback cb , Timestamp when , double interval )
+        : callback_( std::move( cb ) )
+        , expiration_( when )
+        , interval_( interval )
+        , repeat_( interval > 0.0 )
+        , sequence_( ++numCreated_ ) {}
+
+    void run() const { callback_(); }
+
+    Timestamp expiration() const { return expiration_; }
+    bool repeat() const { return repeat_; }
+    int64_t sequence() const { return sequence_; }
+
+    // 重复定时器在到期后重新计算下一次的到期时间
+    void restart( Timestamp now );
+private:
+    const TimerCallback callback_;
+    Timestamp expiration_;
+    const double interval_; // 重复间隔，单位秒，<=0表示一次性定时器
+    const bool repeat_;
+    const int64_t sequence_;    // 全局唯一序号，用于区分地址被复用的Timer
+
+    static std::atomic<int64_t> numCreated_;
+};
@@ -0,0 +1,53 @@
+#pragma once
+
+#include "noncopyable.h"
+#include "Timestamp.h"
+#include "Channel.h"
+#include "TimerId.h"
+
+#include <set>
+#include <vector>
+#include <functional>
+
+class EventLoop;
+class Timer;
+
+/**
+ * 定时器队列，通过timerfd把定时事件接入Poller，所有定时器都在所属loop的线程中处理
+ * 按到期时间排序，timerfd只设置为最早到期的时间
+*/
+class TimerQueue : noncopyable {
+public:
+    using TimerCallback = std::function<void()>;
+
+    explicit TimerQueue( EventLoop *loop );
+    ~TimerQueue();
+
+    // 线程安全，可以跨线程调用
+    TimerId addTimer( TimerCallback cb , Timestamp when , double interval );
+    void cancel( TimerId timerId );
+private:
+    using Entry = std::pair<Timestamp , Timer *>;
+    using TimerList = std::set<Entry>;
+    using ActiveTimer = std::pair<Timer * , int64_t>;
+    using ActiveTimerSet = std::set<ActiveTimer>;
+
+    void addTimerInLoop( Timer *timer );
+    void cancelInLoop( TimerId timerId );
+    // timerfd读事件回调
+    void handleRead();
+    // 取出所有已到期的定时器
+    std::vector<Entry> getExpired( Timestamp now );
+    void reset( const std::vector<Entry> &expired , Timestamp now );
+
+    bool insert( Timer *timer );
+
+    EventLoop *loop_;
+    const int timerfd_;
+    Channel timerfdChannel_;
+    TimerList timers_;  // 按到期时间排序
+
+    ActiveTimerSet activeTimers_;   // 按Timer地址排序，与timers_保存相同的定时器
+    bool callingExpiredTimers_;
+    ActiveTimerSet cancelingTimers_;    // 回调执行过程中被取消的定时器
+};
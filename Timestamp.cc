@@ -1,36 +1,36 @@
 #include "Timestamp.h"
-//#include <sys/time.h>
+#include <sys/time.h>
 #include <time.h>
 
-//const int64_t kMicroSecondsPerSecond = 1000000
-
 Timestamp::Timestamp() : microSecondsSinceEpoch_( 0 ) {}
 
 Timestamp::Timestamp( int64_t microSecondsSinceEpoch )
     :microSecondsSinceEpoch_(microSecondsSinceEpoch){}
 
+// 定时器需要微秒精度，这里不能再用time(nullptr)
 Timestamp Timestamp::now() {
-    // struct timeval tv;
-    // gettimeofday( &tv , NULL );
-    // int64_t seconds = tv.tv_sec;
-    // return Timestamp( seconds * kMicroSecondsPerSecond + tv.tv_usec );
-    return Timestamp( time( nullptr ) );
+    struct timeval tv;
+    gettimeofday( &tv , NULL );
+    int64_t seconds = tv.tv_sec;
+    return Timestamp( seconds * kMicroSecondsPerSecond + tv.tv_usec );
 }
 
 std::string Timestamp::toString() const {
     char buf[128] = { 0 };
-    struct tm* tm_time = localtime( &microSecondsSinceEpoch_ );
+    time_t seconds = static_cast<time_t>( microSecondsSinceEpoch_ / kMicroSecondsPerSecond );
+    struct tm tm_time;
+    localtime_r( &seconds , &tm_time );
     snprintf( buf , 128 , "%4d/%02d/%02d %02d:%02d:%02d" ,
-        tm_time->tm_year + 1900 ,
-        tm_time->tm_mon + 1 ,
-        tm_time->tm_mday ,
-        tm_time->tm_hour ,
-        tm_time->tm_min ,
-        tm_time->tm_sec );
+        tm_time.tm_year + 1900 ,
+        tm_time.tm_mon + 1 ,
+        tm_time.tm_mday ,
+        tm_time.tm_hour ,
+        tm_time.tm_min ,
+        tm_time.tm_sec );
     return buf;
 }
 
 // #include <iostream>
 // int main() {
 //     std::cout << Timestamp::now().toString() << std::endl;
-// }
\ No newline at end of file
+// }
@@ -1,6 +1,8 @@
 #pragma once
 
 #include <iostream>
+#include <string>
+#include <stdint.h>
 
 class Timestamp {
 public:
@@ -8,6 +10,31 @@ public:
     explicit Timestamp( int64_t microSecondsSinceEpoch );
     static Timestamp now();
     std::string toString() const;
+
+    int64_t microSecondsSinceEpoch() const { return microSecondsSinceEpoch_; }
+    bool valid() const { return microSecondsSinceEpoch_ > 0; }
+
+    static const int64_t kMicroSecondsPerSecond = 1000 * 1000;
 private:
     int64_t microSecondsSinceEpoch_;
-};
\ No newline at end of file
+};
+
+inline bool operator<( Timestamp lhs , Timestamp rhs ) {
+    return lhs.microSecondsSinceEpoch() < rhs.microSecondsSinceEpoch();
+}
+
+inline bool operator==( Timestamp lhs , Timestamp rhs ) {
+    return lhs.microSecondsSinceEpoch() == rhs.microSecondsSinceEpoch();
+}
+
+// 两个时间点的差值，单位秒
+inline double timeDifference( Timestamp high , Timestamp low ) {
+    int64_t diff = high.microSecondsSinceEpoch() - low.microSecondsSinceEpoch();
+    return static_cast<double>( diff ) / Timestamp::kMicroSecondsPerSecond;
+}
+
+// 在timestamp的基础上增加seconds秒
+inline Timestamp addTime( Timestamp timestamp , double seconds ) {
+    int64_t delta = static_cast<int64_t>( seconds * Timestamp::kMicroSecondsPerSecond );
+    return Timestamp( timestamp.microSecondsSinceEpoch() + delta );
+}
@@ -0,0 +1,218 @@
+#ifdef MYMUDUO_TLS
+
+#include "TlsContext.h"
+#include "Buffer.h"
+#include "Logger.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+
+// 取出OpenSSL错误队列中的所有错误记录到日志
+static void logSslErrors( const char *what ) {
+    unsigned long err;
+    while (( err = ERR_get_error() ) != 0) {
+        char reason[256];
+        ERR_error_string_n( err , reason , sizeof reason );
+        LOG_ERROR( "%s - %s \n" , what , reason );
+    }
+}
+
+TlsContext::TlsContext( SSL_CTX *ctx , bool server , const std::string &serverName )
+    : ctx_( ctx )
+    , server_( server )
+    , serverName_( serverName ) {
+    SSL_CTX_set_min_proto_version( ctx_ , TLS1_2_VERSION );
+    uint64_t options = SSL_OP_NO_RENEGOTIATION;
+#ifdef SSL_OP_IGNORE_UNEXPECTED_EOF
+    // 对方没有发送close_notify直接关闭时按正常关闭处理，和普通TCP连接一致
+    options |= SSL_OP_IGNORE_UNEXPECTED_EOF;
+#endif
+#ifdef SSL_OP_ENABLE_KTLS
+    options |= SSL_OP_ENABLE_KTLS;
+#endif
+    SSL_CTX_set_options( ctx_ , options );
+    // SSL_write可以只写入一部分；WANT_WRITE后用outputBuffer_中的数据重试，缓冲区地址可能已经改变
+    SSL_CTX_set_mode( ctx_ , SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER );
+}
+
+TlsContext::~TlsContext() {
+    SSL_CTX_free( ctx_ );
+}
+
+std::shared_ptr<TlsContext> TlsContext::newServerContext( const std::string &certFile , const std::string &keyFile ) {
+    SSL_CTX *ctx = SSL_CTX_new( TLS_server_method() );
+    if (ctx == nullptr) {
+        logSslErrors( "TlsContext::newServerContext" );
+        return std::shared_ptr<TlsContext>();
+    }
+    std::shared_ptr<TlsContext> context( new TlsContext( ctx , true , "" ) );
+    if (SSL_CTX_use_certificate_chain_file( ctx , certFile.c_str() ) != 1
+        || SSL_CTX_use_PrivateKey_file( ctx , keyFile.c_str() , SSL_FILETYPE_PEM ) != 1
+        || SSL_CTX_check_private_key( ctx ) != 1) {
+        logSslErrors( "TlsContext::newServerContext" );
+        LOG_ERROR( "TlsContext::newServerContext - cannot load cert=%s key=%s \n" , certFile.c_str() , keyFile.c_str() );
+        return std::shared_ptr<TlsContext>();
+    }
+    return context;
+}
+
+std::shared_ptr<TlsContext> TlsContext::newClientContext( const std::string &serverName , const std::string &caFile ) {
+    SSL_CTX *ctx = SSL_CTX_new( TLS_client_method() );
+    if (ctx == nullptr) {
+        logSslErrors( "TlsContext::newClientContext" );
+        return std::shared_ptr<TlsContext>();
+    }
+    std::shared_ptr<TlsContext> context( new TlsContext( ctx , false , serverName ) );
+    int ok = caFile.empty() ? SSL_CTX_set_default_verify_paths( ctx )
+        : SSL_CTX_load_verify_locations( ctx , caFile.c_str() , nullptr );
+    if (ok != 1) {
+        logSslErrors( "TlsContext::newClientContext" );
+        LOG_ERROR( "TlsContext::newClientContext - cannot load CA %s \n" , caFile.empty() ? "(default)" : caFile.c_str() );
+        return std::shared_ptr<TlsContext>();
+    }
+    context->setVerifyPeer( true );
+    return context;
+}
+
+void TlsContext::setVerifyPeer( bool on ) {
+    SSL_CTX_set_verify( ctx_ , on ? SSL_VERIFY_PEER : SSL_VERIFY_NONE , nullptr );
+}
+
+void TlsContext::setKtls( bool on ) {
+#ifdef SSL_OP_ENABLE_KTLS
+    if (on) {
+        SSL_CTX_set_options( ctx_ , SSL_OP_ENABLE_KTLS );
+    }
+    else {
+        SSL_CTX_clear_options( ctx_ , SSL_OP_ENABLE_KTLS );
+    }
+#else
+    if (on) {
+        LOG_INFO( "TlsContext::setKtls - OpenSSL is built without kTLS \n" );
+    }
+#endif
+}
+
+TlsStream::TlsStream( const std::shared_ptr<TlsContext> &context , int sockfd )
+    : context_( context )
+    , ssl_( SSL_new( context->nativeHandle() ) )
+    , established_( false )
+    , ktlsSend_( false )
+    , ktlsRecv_( false ) {
+    if (ssl_ == nullptr) {
+        logSslErrors( "TlsStream::TlsStream" );
+        return;
+    }
+    // socket BIO不拥有fd，fd仍然由Socket关闭
+    SSL_set_fd( ssl_ , sockfd );
+    if (context_->isServer()) {
+        SSL_set_accept_state( ssl_ );
+    }
+    else {
+        SSL_set_connect_state( ssl_ );
+        const std::string &serverName = context_->serverName();
+        if (!serverName.empty()) {
+            SSL_set_tlsext_host_name( ssl_ , serverName.c_str() );
+            SSL_set1_host( ssl_ , serverName.c_str() );
+        }
+    }
+}
+
+TlsStream::~TlsStream() {
+    SSL_free( ssl_ );
+}
+
+TlsStream::Result TlsStream::mapError( int ret , const char *what ) {
+    int savedErrno = errno;
+    switch (SSL_get_error( ssl_ , ret )) {
+    case SSL_ERROR_WANT_READ:
+        return kWantRead;
+    case SSL_ERROR_WANT_WRITE:
+        return kWantWrite;
+    case SSL_ERROR_ZERO_RETURN:
+        return kClosed;
+    case SSL_ERROR_SYSCALL:
+        if (savedErrno == 0 || savedErrno == ECONNRESET || savedErrno == EPIPE) {
+            return kClosed;
+        }
+        LOG_ERROR( "%s - errno:%d \n" , what , savedErrno );
+        return kError;
+    default:
+        logSslErrors( what );
+        return kError;
+    }
+}
+
+TlsStream::Result TlsStream::handshake() {
+    if (ssl_ == nullptr) {
+        return kError;
+    }
+    ERR_clear_error();
+    int ret = SSL_do_handshake( ssl_ );
+    if (ret != 1) {
+        return mapError( ret , "TlsStream::handshake" );
+    }
+    established_ = true;
+#ifdef BIO_get_ktls_send
+    // 开启了SSL_OP_ENABLE_KTLS时OpenSSL在握手完成时设置TCP_ULP和密钥，这里只查询结果
+    ktlsSend_ = BIO_get_ktls_send( SSL_get_wbio( ssl_ ) );
+    ktlsRecv_ = BIO_get_ktls_recv( SSL_get_rbio( ssl_ ) );
+#endif
+    return kOk;
+}
+
+std::string TlsStream::version() const {
+    return ssl_ != nullptr ? SSL_get_version( ssl_ ) : "";
+}
+
+std::string TlsStream::cipher() const {
+    return ssl_ != nullptr ? SSL_get_cipher_name( ssl_ ) : "";
+}
+
+ssize_t TlsStream::read( Buffer *buf , Result *result ) {
+    ssize_t total = 0;
+    *result = kOk;
+    while (true) {
+        buf->ensureWritableBytes( kReadChunk );
+        size_t len = buf->writableBytes() < kMaxReadPerEvent ? buf->writableBytes() : kMaxReadPerEvent;
+        ERR_clear_error();
+        // 开启kTLS接收时OpenSSL直接从socket读取内核解密后的记录
+        int n = SSL_read( ssl_ , buf->beginWrite() , static_cast<int>( len ) );
+        if (n <= 0) {
+            *result = mapError( n , "TlsStream::read" );
+            break;
+        }
+        buf->hasWritten( n );
+        total += n;
+        // 会话内部还有解密好的数据时必须读完，否则不会再有读事件通知
+        if (static_cast<size_t>( total ) >= kMaxReadPerEvent && SSL_pending( ssl_ ) == 0) {
+            break;
+        }
+    }
+    return total;
+}
+
+ssize_t TlsStream::write( const void *data , size_t len ) {
+    if (len == 0) {
+        return 0;
+    }
+    ERR_clear_error();
+    int n = SSL_write( ssl_ , data , len > INT_MAX ? INT_MAX : static_cast<int>( len ) );
+    if (n > 0) {
+        return n;
+    }
+    Result result = mapError( n , "TlsStream::write" );
+    errno = ( result == kWantRead || result == kWantWrite ) ? EWOULDBLOCK : EPIPE;
+    return -1;
+}
+
+void TlsStream::shutdown() {
+    if (established_) {
+        ERR_clear_error();
+        SSL_shutdown( ssl_ );
+    }
+}
+
+#endif // MYMUDUO_TLS
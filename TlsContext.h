@@ -0,0 +1,90 @@
+#pragma once
+
+#include "noncopyable.h"
+
+#include <memory>
+#include <string>
+#include <sys/types.h>
+
+class Buffer;
+struct ssl_st;
+struct ssl_ctx_st;
+
+/**
+ * TLS配置（OpenSSL的SSL_CTX），保存证书、私钥和协议参数，可以被所有loop上的连接共享
+ * 需要以MYMUDUO_TLS选项编译，设置给TcpServer/TcpClient后每个新连接都先进行TLS握手
+ *
+ * 默认开启kTLS：握手完成后OpenSSL用setsockopt(TCP_ULP, "tls")把对称加解密交给内核，
+ * 之后TcpConnection直接write明文，Buffer::writeFd和sendfile都不需要在用户态加密拷贝
+ * 内核没有tls模块、加密套件不受支持时，退回SSL_read/SSL_write在用户态加解密
+*/
+class TlsContext : noncopyable {
+public:
+    // 加载PEM格式的证书链和私钥，失败时记录日志并返回nullptr
+    static std::shared_ptr<TlsContext> newServerContext( const std::string &certFile , const std::string &keyFile );
+    // serverName用于SNI和证书主机名校验；caFile为空时使用系统默认的CA
+    static std::shared_ptr<TlsContext> newClientContext( const std::string &serverName = "" , const std::string &caFile = "" );
+    ~TlsContext();
+
+    bool isServer() const { return server_; }
+    const std::string &serverName() const { return serverName_; }
+    ssl_ctx_st *nativeHandle() const { return ctx_; }
+
+    // 客户端默认校验服务器证书，本机自签名证书测试时关闭
+    void setVerifyPeer( bool on );
+    // 是否尝试kTLS，关闭后始终在用户态加解密，作为对照
+    void setKtls( bool on );
+private:
+    TlsContext( ssl_ctx_st *ctx , bool server , const std::string &serverName );
+
+    ssl_ctx_st *ctx_;
+    const bool server_;
+    const std::string serverName_;
+};
+
+/**
+ * 一个连接上的TLS会话，由TcpConnection持有，只在连接所属loop线程中使用
+ * socket是非阻塞的，握手和读写遇到WANT_READ/WANT_WRITE时返回，等Channel的读写事件再继续
+*/
+class TlsStream : noncopyable {
+public:
+    enum Result {
+        kOk ,           // 完成
+        kWantRead ,     // 等待socket可读
+        kWantWrite ,    // 等待socket可写
+        kClosed ,       // 对方发送了close_notify或关闭了连接
+        kError ,        // 协议错误或证书校验失败，连接不能再使用
+    };
+
+    TlsStream( const std::shared_ptr<TlsContext> &context , int sockfd );
+    ~TlsStream();
+
+    // 推进握手，返回kOk时握手完成
+    Result handshake();
+    bool established() const { return established_; }
+    // 握手完成后内核是否接管了发送/接收方向的加解密
+    bool ktlsSend() const { return ktlsSend_; }
+    bool ktlsRecv() const { return ktlsRecv_; }
+    std::string version() const;
+    std::string cipher() const;
+
+    // 把已解密的数据读入buf，直到socket上暂时没有数据或读够一批，返回读到的字节数
+    ssize_t read( Buffer *buf , Result *result );
+    // 加密并发送，和::write一样返回写入的字节数，出错返回-1并设置errno（EWOULDBLOCK或EPIPE）
+    ssize_t write( const void *data , size_t len );
+    // 发送close_notify，不等待对方的回应
+    void shutdown();
+private:
+    // 一次读事件最多读取的明文字节数，TLS会话内部没有缓存数据时才停止
+    static const size_t kMaxReadPerEvent = 256 * 1024;
+    // 每次SSL_read预留的空间，一个TLS记录最多16KB
+    static const size_t kReadChunk = 16 * 1024;
+
+    Result mapError( int ret , const char *what );
+
+    std::shared_ptr<TlsContext> context_;
+    ssl_st *ssl_;
+    bool established_;
+    bool ktlsSend_;
+    bool ktlsRecv_;
+};
@@ -0,0 +1,214 @@
+#include "Tracer.h"
+#include "Timestamp.h"
+#include "CurrentThread.h"
+
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <utility>
+#include <stdio.h>
+#include <unistd.h>
+#include <pthread.h>
+
+std::atomic<uint32_t> Tracer::sampleRate_( 0 );
+__thread uint32_t Tracer::t_sampleCounter = 0;
+__thread bool Tracer::t_sampling = false;
+
+namespace {
+
+/**
+ * 一个线程的环形缓冲区，单写者
+ * 写入第pos条记录前把slot的seq置为奇数，写完后置为2 * pos + 2；
+ * 读取前后两次seq相同且为偶数时记录完整，否则正在被覆盖，跳过
+ * 字段都是relaxed原子变量，读写并发时没有数据竞争
+*/
+class TraceRing : noncopyable {
+public:
+    static const size_t kCapacity = 8192;
+
+    struct Slot {
+        std::atomic<uint64_t> seq;
+        std::atomic<const char *> name;
+        std::atomic<const char *> argName;
+        std::atomic<int64_t> start;
+        std::atomic<int64_t> duration;
+        std::atomic<int64_t> arg;
+    };
+
+    struct Event {
+        const char *name;
+        const char *argName;
+        int64_t start;
+        int64_t duration;
+        int64_t arg;
+    };
+
+    TraceRing() : tid_( CurrentThread::tid() ) , next_( 0 ) , slots_( new Slot[kCapacity] ) {
+        char threadName[32] = { 0 };
+        ::pthread_getname_np( ::pthread_self() , threadName , sizeof threadName );
+        threadName_ = threadName;
+        for (size_t i = 0; i < kCapacity; ++i) {
+            slots_[i].seq.store( 0 , std::memory_order_relaxed );
+        }
+    }
+
+    void push( const char *name , int64_t start , int64_t duration , const char *argName , int64_t arg ) {
+        uint64_t pos = next_.load( std::memory_order_relaxed );
+        Slot &slot = slots_[pos % kCapacity];
+        slot.seq.store( 2 * pos + 1 , std::memory_order_relaxed );
+        std::atomic_thread_fence( std::memory_order_release );
+        slot.name.store( name , std::memory_order_relaxed );
+        slot.argName.store( argName , std::memory_order_relaxed );
+        slot.start.store( start , std::memory_order_relaxed );
+        slot.duration.store( duration , std::memory_order_relaxed );
+        slot.arg.store( arg , std::memory_order_relaxed );
+        slot.seq.store( 2 * pos + 2 , std::memory_order_release );
+        next_.store( pos + 1 , std::memory_order_release );
+    }
+
+    // 任意线程调用，取出当前仍在缓冲区中的完整记录
+    void collect( std::vector<Event> *events ) const {
+        uint64_t end = next_.load( std::memory_order_acquire );
+        uint64_t begin = end > kCapacity ? end - kCapacity : 0;
+        for (uint64_t pos = begin; pos < end; ++pos) {
+            const Slot &slot = slots_[pos % kCapacity];
+            uint64_t seq = slot.seq.load( std::memory_order_acquire );
+            if (seq != 2 * pos + 2) {
+                continue;
+            }
+            Event event;
+            event.name = slot.name.load( std::memory_order_relaxed );
+            event.argName = slot.argName.load( std::memory_order_relaxed );
+            event.start = slot.start.load( std::memory_order_relaxed );
+            event.duration = slot.duration.load( std::memory_order_relaxed );
+            event.arg = slot.arg.load( std::memory_order_relaxed );
+            std::atomic_thread_fence( std::memory_order_acquire );
+            if (slot.seq.load( std::memory_order_relaxed ) == seq) {
+                events->push_back( event );
+            }
+        }
+    }
+
+    int tid() const { return tid_; }
+    const std::string &threadName() const { return threadName_; }
+private:
+    const int tid_;
+    std::string threadName_;
+    std::atomic<uint64_t> next_;
+    std::unique_ptr<Slot[]> slots_;
+};
+
+// 所有线程的缓冲区，线程退出后保留，导出时仍然可以读到
+std::mutex g_ringsMutex;
+std::vector<std::shared_ptr<TraceRing>> g_rings;
+__thread TraceRing *t_ring = nullptr;
+// 上一次recordIteration之后本线程是否记录过请求的区间
+__thread bool t_recorded = false;
+
+TraceRing *currentRing() {
+    if (t_ring == nullptr) {
+        std::shared_ptr<TraceRing> ring( new TraceRing );
+        std::unique_lock<std::mutex> lock( g_ringsMutex );
+        g_rings.push_back( ring );
+        t_ring = ring.get();
+    }
+    return t_ring;
+}
+
+void runQueued( int64_t queuedUs , const std::function<void()> &cb ) {
+    int64_t start = Timestamp::now().microSecondsSinceEpoch();
+    bool saved = Tracer::setSampling( true );
+    cb();
+    Tracer::setSampling( saved );
+    int64_t end = Timestamp::now().microSecondsSinceEpoch();
+    Tracer::record( "functor_queue" , queuedUs , start );
+    Tracer::record( "functor" , start , end );
+}
+
+// JSON字符串中需要转义的字符，线程名可能包含任意字符
+void appendJsonString( std::string *out , const std::string &value ) {
+    out->push_back( '"' );
+    for (char c : value) {
+        if (c == '"' || c == '\\') {
+            out->push_back( '\\' );
+            out->push_back( c );
+        }
+        else if (static_cast<unsigned char>( c ) < 0x20) {
+            char escaped[8];
+            ::snprintf( escaped , sizeof escaped , "\\u%04x" , c );
+            out->append( escaped );
+        }
+        else {
+            out->push_back( c );
+        }
+    }
+    out->push_back( '"' );
+}
+
+} // namespace
+
+void Tracer::record( const char *name , int64_t startUs , int64_t endUs , const char *argName , int64_t arg ) {
+    currentRing()->push( name , startUs , endUs - startUs , argName , arg );
+    t_recorded = true;
+}
+
+void Tracer::recordIteration( int64_t pollStart , int64_t pollReturn , int64_t end , int64_t channels ) {
+    if (!t_recorded) {
+        return;
+    }
+    t_recorded = false;
+    TraceRing *ring = currentRing();
+    ring->push( "poll_wait" , pollStart , pollReturn - pollStart , "channels" , channels );
+    ring->push( "dispatch" , pollReturn , end - pollReturn , nullptr , 0 );
+}
+
+std::function<void()> Tracer::wrapQueued( std::function<void()> cb ) {
+    return std::bind( &runQueued , Timestamp::now().microSecondsSinceEpoch() , std::move( cb ) );
+}
+
+std::string Tracer::dump() {
+    std::vector<std::shared_ptr<TraceRing>> rings;
+    {
+        std::unique_lock<std::mutex> lock( g_ringsMutex );
+        rings = g_rings;
+    }
+    int pid = static_cast<int>( ::getpid() );
+    std::string out( "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[" );
+    bool first = true;
+    std::vector<TraceRing::Event> events;
+    char line[256];
+    for (const std::shared_ptr<TraceRing> &ring : rings) {
+        // 线程名的元数据事件
+        ::snprintf( line , sizeof line , "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":" ,
+            first ? "" : "," , pid , ring->tid() );
+        first = false;
+        out.append( line );
+        appendJsonString( &out , ring->threadName() );
+        out.append( "}}" );
+
+        events.clear();
+        ring->collect( &events );
+        for (const TraceRing::Event &event : events) {
+            int n = ::snprintf( line , sizeof line , ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,\"ts\":%lld,\"dur\":%lld" ,
+                event.name , pid , ring->tid() , (long long)event.start , (long long)event.duration );
+            out.append( line , n );
+            if (event.argName != nullptr) {
+                n = ::snprintf( line , sizeof line , ",\"args\":{\"%s\":%lld}" , event.argName , (long long)event.arg );
+                out.append( line , n );
+            }
+            out.push_back( '}' );
+        }
+    }
+    out.append( "]}\n" );
+    return out;
+}
+
+bool Tracer::dumpToFile( const std::string &path ) {
+    FILE *fp = ::fopen( path.c_str() , "w" );
+    if (fp == nullptr) {
+        return false;
+    }
+    std::string json = dump();
+    bool ok = ::fwrite( json.data() , 1 , json.size() , fp ) == json.size();
+    return ::fclose( fp ) == 0 && ok;
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include "noncopyable.h"
+
+#include <atomic>
+#include <string>
+#include <functional>
+#include <stdint.h>
+
+/**
+ * 采样的请求延迟追踪，导出为Chrome trace_event格式（chrome://tracing 或 Perfetto打开）
+ *
+ * 每个线程一个固定大小的环形缓冲区，只由本线程写入，写满后覆盖最旧的记录；
+ * 每条记录带序号，导出时在任意线程无锁读取，正在被覆盖的记录直接跳过
+ *
+ * 采样率为每N个请求取1个，默认0表示关闭；只在请求进入loop时决定一次：连接收到数据，或者loop之外的线程提交回调
+ * 被采样的请求执行期间sampling()为true，其中queueInLoop的回调带着这一决定，执行时同样为true，
+ * 连接上未写完的数据由连接记住，因此一个被采样的请求的所有区间都会被记录，没有采样的请求一个都不记录
+ * 关闭时每个入口只多一次relaxed读取和一次分支
+ *
+ * 埋点：
+ *  poll_wait / dispatch        包含被采样请求的一轮循环中poll等待的时间和处理事件、回调的时间
+ *  poll_to_callback            poll返回到连接的messageCallback开始（同一轮中排在前面的事件）
+ *  message_callback            messageCallback的执行时间
+ *  write_flush / request       回调结束时还有数据没写出，到全部写入内核为止；request为poll返回到写完的总时间
+ *  functor_queue / functor     被采样请求中queueInLoop的回调在pendingFunctors_中等待的时间和执行时间
+*/
+class Tracer : noncopyable {
+public:
+    // 每n次采样一次，0关闭，可以在任意线程随时修改
+    static void setSampleRate( uint32_t n ) { sampleRate_.store( n , std::memory_order_relaxed ); }
+    static uint32_t sampleRate() { return sampleRate_.load( std::memory_order_relaxed ); }
+
+    // 请求入口处调用：这个请求是否采样，每个线程独立计数
+    static bool sample() {
+        uint32_t rate = sampleRate_.load( std::memory_order_relaxed );
+        if (__builtin_expect( rate == 0 , 1 )) {
+            return false;
+        }
+        if (++t_sampleCounter < rate) {
+            return false;
+        }
+        t_sampleCounter = 0;
+        return true;
+    }
+
+    // 当前线程是否正在执行被采样的请求，设置后返回原来的值，用于执行完恢复
+    static bool sampling() { return t_sampling; }
+    static bool setSampling( bool on ) {
+        bool old = t_sampling;
+        t_sampling = on;
+        return old;
+    }
+
+    /**
+     * 在当前线程的缓冲区中记录一个区间，时间为微秒（Timestamp::microSecondsSinceEpoch）
+     * name和argName必须是字符串字面量等不会释放的字符串；argName为nullptr时不输出参数
+    */
+    static void record( const char *name , int64_t startUs , int64_t endUs , const char *argName = nullptr , int64_t arg = 0 );
+
+    // 被采样请求的queueInLoop回调：记录排队和执行的时间，执行时sampling()为true
+    static std::function<void()> wrapQueued( std::function<void()> cb );
+
+    /**
+     * EventLoop每轮结束时调用：本轮记录过被采样请求的区间时，补上这一轮的poll_wait和dispatch
+     * 时间为微秒，pollStart为poll开始的时间
+    */
+    static void recordIteration( int64_t pollStart , int64_t pollReturn , int64_t end , int64_t channels );
+
+    // 所有线程缓冲区中的记录，Chrome trace_event的JSON格式，可以在任意线程调用
+    static std::string dump();
+    // 写入文件，成功返回true
+    static bool dumpToFile( const std::string &path );
+private:
+    static std::atomic<uint32_t> sampleRate_;
+    static __thread uint32_t t_sampleCounter;
+    static __thread bool t_sampling;
+};
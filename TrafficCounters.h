@@ -0,0 +1,67 @@
+#pragma once
+
+#include "noncopyable.h"
+
+#include <atomic>
+#include <stdint.h>
+
+/**
+ * 一个loop上的流量计数器，TcpServer每个loop分片一组，连接直接累加到所属loop的那一组
+ *
+ * 每组只由所属loop线程写入，累加用load + store而不是fetch_add，不需要带lock前缀的原子指令；
+ * 任意线程可以无锁读取，需要时再把各个loop的值相加，见TcpServer::trafficCount
+ * 计数器前后各留一个cache line：C++11的new不保证超过16字节的对齐，不能依赖alignas，
+ * 填充保证不同loop的计数器不会和其它数据落在同一个cache line上
+*/
+class TrafficCounters : noncopyable {
+public:
+    enum Counter {
+        kBytesRead ,        // 收到的字节数，TLS连接为解密后的明文
+        kBytesWritten ,     // 写入内核的字节数，包括TcpRelay转发的数据
+        kMessagesRead ,     // 收到数据后交给用户（messageCallback或协程）的次数
+        kMessagesSent ,     // send/sendShared发送的消息数
+        kHighWaterMarkHits ,    // 待发送数据越过高水位的次数
+        kConnectionsAccepted ,
+        kConnectionsClosed ,
+        kConnectionErrors , // 读写出错和socket错误的次数
+        kNumCounters ,
+    };
+
+    TrafficCounters() {
+        for (int i = 0; i < kNumCounters; ++i) {
+            values_[i].store( 0 , std::memory_order_relaxed );
+        }
+    }
+
+    // 只能在所属loop线程中调用
+    void add( Counter counter , int64_t n = 1 ) {
+        std::atomic<int64_t> &value = values_[counter];
+        value.store( value.load( std::memory_order_relaxed ) + n , std::memory_order_relaxed );
+    }
+    int64_t get( Counter counter ) const { return values_[counter].load( std::memory_order_relaxed ); }
+
+    // Prometheus指标名（不含前缀）、说明和类型
+    static const char *name( Counter counter ) {
+        static const char *const kNames[kNumCounters] = {
+            "bytes_read_total" , "bytes_written_total" , "messages_read_total" , "messages_sent_total" ,
+            "high_water_mark_hits_total" , "connections_accepted_total" , "connections_closed_total" ,
+            "connection_errors_total" ,
+        };
+        return kNames[counter];
+    }
+    static const char *help( Counter counter ) {
+        static const char *const kHelps[kNumCounters] = {
+            "Bytes received from connections." , "Bytes written to connections." ,
+            "Times received data was handed to the application." , "Messages passed to send or sendShared." ,
+            "Times pending output crossed the high water mark." , "Connections accepted." ,
+            "Connections closed." , "Read, write and socket errors on connections." ,
+        };
+        return kHelps[counter];
+    }
+private:
+    static const int kCacheLine = 64;
+
+    char padBefore_[kCacheLine];
+    std::atomic<int64_t> values_[kNumCounters];
+    char padAfter_[kCacheLine];
+};
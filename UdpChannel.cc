@@ -0,0 +1,365 @@
+#include "UdpChannel.h"
+#include "EventLoop.h"
+#include "Logger.h"
+
+#include <algorithm>
+#include <string>
+#include <string.h>
+#include <errno.h>
+#include <netinet/udp.h>
+
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+#ifndef UDP_GRO
+#define UDP_GRO 104
+#endif
+#ifndef SOL_UDP
+#define SOL_UDP 17
+#endif
+
+const size_t UdpChannel::kDefaultMaxDatagram;
+const int UdpChannel::kDefaultBatchSize;
+const int UdpChannel::kMaxGsoSegments;
+const size_t UdpChannel::kMaxGsoBytes;
+
+// 每个消息的辅助数据只放一个UDP_SEGMENT(uint16_t)或UDP_GRO(int)
+static const size_t kControlSize = CMSG_SPACE( sizeof( int ) );
+
+static int createUdpSocket() {
+    int sockfd = ::socket( AF_INET , SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC , 0 );
+    if (sockfd < 0) {
+        LOG_FATAL( "%s:%s:%d udp socket create err:%d \n" , __FILE__ , __FUNCTION__ , __LINE__ , errno );
+    }
+    return sockfd;
+}
+
+static bool sameAddress( const sockaddr_in &a , const sockaddr_in &b ) {
+    return a.sin_addr.s_addr == b.sin_addr.s_addr && a.sin_port == b.sin_port;
+}
+
+UdpChannel::UdpChannel( EventLoop *loop , const InetAddress &bindAddr , bool reuseport , int batchSize , size_t maxDatagram )
+    : loop_( loop )
+    , socket_( createUdpSocket() )
+    , channel_( loop , socket_.fd() )
+    , batchSize_( std::max( batchSize , 1 ) )
+    , maxDatagram_( maxDatagram )
+    , gso_( false )
+    , gro_( false )
+    , handlingRead_( false )
+    , flushQueued_( false )
+    , alive_( std::make_shared<bool>( true ) )
+    , recvBufferSize_( 0 )
+    , numPending_( 0 )
+    , received_( 0 )
+    , sent_( 0 )
+    , dropped_( 0 )
+    , truncated_( 0 )
+    , recvCalls_( 0 )
+    , sendCalls_( 0 ) {
+    socket_.setReuseAddr( true );
+    socket_.setReusePort( reuseport );
+    socket_.bindAddress( bindAddr );
+    channel_.setReadCallback( std::bind( &UdpChannel::handleRead , this , std::placeholders::_1 ) );
+
+    // 发送批次与GSO/GRO无关，在这里分配，start之前的send也能放入批次；接收缓冲区的大小取决于GRO，在start时分配
+    sendBuffers_.resize( batchSize_ * maxDatagram_ );
+    sendIovecs_.resize( batchSize_ );
+    sendAddrs_.resize( batchSize_ );
+    sendMsgs_.resize( batchSize_ );
+    sendGroups_.resize( batchSize_ );
+    sendControl_.resize( batchSize_ * kControlSize );
+    for (int i = 0; i < batchSize_; ++i) {
+        sendIovecs_[i].iov_base = &sendBuffers_[i * maxDatagram_];
+    }
+}
+
+UdpChannel::~UdpChannel() {
+    channel_.disableAll();
+    channel_.remove();
+}
+
+InetAddress UdpChannel::localAddress() const {
+    sockaddr_in addr;
+    socklen_t len = sizeof addr;
+    ::memset( &addr , 0 , sizeof addr );
+    ::getsockname( socket_.fd() , (sockaddr *)&addr , &len );
+    return InetAddress( addr );
+}
+
+void UdpChannel::start() {
+    if (gro_) {
+        int on = 1;
+        if (::setsockopt( socket_.fd() , SOL_UDP , UDP_GRO , &on , sizeof on ) < 0) {
+            LOG_ERROR( "UdpChannel::start - UDP_GRO not supported, errno:%d \n" , errno );
+            gro_ = false;
+        }
+    }
+    if (gso_) {
+        // 内核4.18之前没有UDP_SEGMENT
+        int segment = 0;
+        socklen_t len = sizeof segment;
+        if (::getsockopt( socket_.fd() , SOL_UDP , UDP_SEGMENT , &segment , &len ) < 0) {
+            LOG_ERROR( "UdpChannel::start - UDP_SEGMENT not supported, errno:%d \n" , errno );
+            gso_ = false;
+        }
+    }
+
+    // GRO合并后的数据报最大64KB
+    recvBufferSize_ = gro_ ? 65536 : maxDatagram_;
+    recvBuffers_.resize( batchSize_ * recvBufferSize_ );
+    recvMsgs_.resize( batchSize_ );
+    recvIovecs_.resize( batchSize_ );
+    recvAddrs_.resize( batchSize_ );
+    recvControl_.resize( batchSize_ * kControlSize );
+    for (int i = 0; i < batchSize_; ++i) {
+        recvIovecs_[i].iov_base = &recvBuffers_[i * recvBufferSize_];
+        recvIovecs_[i].iov_len = recvBufferSize_;
+        msghdr &hdr = recvMsgs_[i].msg_hdr;
+        ::memset( &hdr , 0 , sizeof hdr );
+        hdr.msg_name = &recvAddrs_[i];
+        hdr.msg_iov = &recvIovecs_[i];
+        hdr.msg_iovlen = 1;
+        hdr.msg_control = &recvControl_[i * kControlSize];
+    }
+
+    channel_.enableReading();
+}
+
+void UdpChannel::stop() {
+    flush();
+    channel_.disableAll();
+}
+
+void UdpChannel::handleRead( Timestamp receiveTime ) {
+    handlingRead_ = true;
+    if (batchSize_ == 1) {
+        // 对照组：逐个recvfrom，每次读事件处理的数据报个数上限与批量接收相同
+        char *data = &recvBuffers_[0];
+        for (int i = 0; i < kMaxReadsPerEvent * kDefaultBatchSize; ++i) {
+            sockaddr_in peer;
+            socklen_t len = sizeof peer;
+            // MSG_TRUNC时返回数据报的实际长度，超出缓冲区说明被截断
+            ssize_t n = ::recvfrom( socket_.fd() , data , recvBufferSize_ , MSG_TRUNC , (sockaddr *)&peer , &len );
+            ++recvCalls_;
+            if (n < 0) {
+                if (errno != EAGAIN && errno != EINTR) {
+                    LOG_ERROR( "UdpChannel::handleRead - recvfrom error:%d \n" , errno );
+                }
+                break;
+            }
+            if (static_cast<size_t>( n ) > recvBufferSize_) {
+                dropTruncated( n , peer );
+                continue;
+            }
+            deliver( data , n , 0 , peer , receiveTime );
+        }
+    }
+    else {
+        for (int round = 0; round < kMaxReadsPerEvent; ++round) {
+            // 每次调用前恢复地址和辅助数据的长度
+            for (int i = 0; i < batchSize_; ++i) {
+                recvMsgs_[i].msg_hdr.msg_namelen = sizeof( sockaddr_in );
+                recvMsgs_[i].msg_hdr.msg_controllen = gro_ ? kControlSize : 0;
+            }
+            int n = ::recvmmsg( socket_.fd() , recvMsgs_.data() , batchSize_ , MSG_DONTWAIT , nullptr );
+            ++recvCalls_;
+            if (n < 0) {
+                if (errno != EAGAIN && errno != EINTR) {
+                    LOG_ERROR( "UdpChannel::handleRead - recvmmsg error:%d \n" , errno );
+                }
+                break;
+            }
+            for (int i = 0; i < n; ++i) {
+                msghdr &hdr = recvMsgs_[i].msg_hdr;
+                if (hdr.msg_flags & MSG_TRUNC) {
+                    dropTruncated( recvMsgs_[i].msg_len , recvAddrs_[i] );
+                    continue;
+                }
+                size_t segment = 0;
+                if (gro_) {
+                    for (cmsghdr *cmsg = CMSG_FIRSTHDR( &hdr ); cmsg != nullptr; cmsg = CMSG_NXTHDR( &hdr , cmsg )) {
+                        if (cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO) {
+                            int size = 0;
+                            ::memcpy( &size , CMSG_DATA( cmsg ) , sizeof size );
+                            segment = size;
+                        }
+                    }
+                }
+                deliver( static_cast<char *>( recvIovecs_[i].iov_base ) , recvMsgs_[i].msg_len , segment , recvAddrs_[i] , receiveTime );
+            }
+            if (n < batchSize_) {
+                break;  // 接收队列已空
+            }
+        }
+    }
+    handlingRead_ = false;
+    // 回调中发送的应答用一次sendmmsg发出
+    flush();
+}
+
+void UdpChannel::deliver( const char *data , size_t len , size_t segmentSize , const sockaddr_in &peer , Timestamp receiveTime ) {
+    InetAddress peerAddr( peer );
+    if (segmentSize == 0 || segmentSize >= len) {
+        ++received_;
+        if (messageCallback_) {
+            messageCallback_( this , data , len , peerAddr , receiveTime );
+        }
+        return;
+    }
+    // GRO合并的数据报，除最后一个外长度都是segmentSize
+    for (size_t offset = 0; offset < len; offset += segmentSize) {
+        ++received_;
+        if (messageCallback_) {
+            messageCallback_( this , data + offset , std::min( segmentSize , len - offset ) , peerAddr , receiveTime );
+        }
+    }
+}
+
+// 只输出第一次，之后只计数，避免被超长数据报刷屏
+void UdpChannel::dropTruncated( size_t len , const sockaddr_in &peer ) {
+    if (truncated_++ == 0) {
+        LOG_ERROR( "UdpChannel::handleRead - dropped truncated datagram of %zu bytes from %s, buffer is %zu bytes \n" ,
+            len , InetAddress( peer ).toIpPort().c_str() , recvBufferSize_ );
+    }
+}
+
+void UdpChannel::send( const InetAddress &peer , const void *data , size_t len ) {
+    if (loop_->isInLoopThread()) {
+        sendInLoop( peer , data , len );
+        return;
+    }
+    // 其它线程的数据拷贝一份；任务执行时channel可能已经析构
+    std::weak_ptr<bool> alive( alive_ );
+    std::string copy( static_cast<const char *>( data ) , len );
+    loop_->queueInLoop( [this , alive , peer , copy] () {
+        if (alive.lock()) {
+            sendInLoop( peer , copy.data() , copy.size() );
+        }
+    } );
+}
+
+void UdpChannel::sendInLoop( const InetAddress &peer , const void *data , size_t len ) {
+    if (len > maxDatagram_) {
+        LOG_ERROR( "UdpChannel::send - datagram of %zu bytes exceeds %zu \n" , len , maxDatagram_ );
+        ++dropped_;
+        return;
+    }
+    if (batchSize_ == 1) {
+        ssize_t n = ::sendto( socket_.fd() , data , len , 0 , (const sockaddr *)peer.getSockAddr() , sizeof( sockaddr_in ) );
+        ++sendCalls_;
+        if (n < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                LOG_ERROR( "UdpChannel::send - sendto error:%d \n" , errno );
+            }
+            ++dropped_;
+        }
+        else {
+            ++sent_;
+        }
+        return;
+    }
+
+    if (numPending_ == static_cast<size_t>( batchSize_ )) {
+        flushBatch();
+    }
+    sendAddrs_[numPending_] = *peer.getSockAddr();
+    sendIovecs_[numPending_].iov_len = len;
+    ::memcpy( sendIovecs_[numPending_].iov_base , data , len );
+    ++numPending_;
+
+    // 读事件之外的发送在本轮loop的回调队列中flush
+    if (!handlingRead_ && !flushQueued_) {
+        flushQueued_ = true;
+        std::weak_ptr<bool> alive( alive_ );
+        loop_->queueInLoop( [this , alive] () {
+            if (alive.lock()) {
+                flush();
+            }
+        } );
+    }
+}
+
+void UdpChannel::flush() {
+    flushQueued_ = false;
+    if (numPending_ > 0) {
+        flushBatch();
+    }
+}
+
+size_t UdpChannel::gsoGroupEnd( size_t i ) const {
+    const size_t segment = sendIovecs_[i].iov_len;
+    size_t total = segment;
+    size_t j = i + 1;
+    while (j < numPending_ && j - i < static_cast<size_t>( kMaxGsoSegments ) && sameAddress( sendAddrs_[j] , sendAddrs_[i] )) {
+        size_t len = sendIovecs_[j].iov_len;
+        if (len > segment || len == 0 || total + len > kMaxGsoBytes) {
+            break;
+        }
+        total += len;
+        ++j;
+        if (len < segment) {
+            break;  // 比分段短的数据报只能是最后一个
+        }
+    }
+    return j;
+}
+
+int UdpChannel::buildMessages( size_t first ) {
+    int nmsgs = 0;
+    for (size_t i = first; i < numPending_; ++nmsgs) {
+        size_t j = gso_ ? gsoGroupEnd( i ) : i + 1;
+        msghdr &hdr = sendMsgs_[nmsgs].msg_hdr;
+        ::memset( &hdr , 0 , sizeof hdr );
+        hdr.msg_name = &sendAddrs_[i];
+        hdr.msg_namelen = sizeof( sockaddr_in );
+        hdr.msg_iov = &sendIovecs_[i];
+        hdr.msg_iovlen = j - i;
+        if (j - i > 1) {
+            hdr.msg_control = &sendControl_[nmsgs * kControlSize];
+            hdr.msg_controllen = CMSG_SPACE( sizeof( uint16_t ) );
+            cmsghdr *cmsg = CMSG_FIRSTHDR( &hdr );
+            cmsg->cmsg_level = SOL_UDP;
+            cmsg->cmsg_type = UDP_SEGMENT;
+            cmsg->cmsg_len = CMSG_LEN( sizeof( uint16_t ) );
+            uint16_t segment = static_cast<uint16_t>( sendIovecs_[i].iov_len );
+            ::memcpy( CMSG_DATA( cmsg ) , &segment , sizeof segment );
+        }
+        sendGroups_[nmsgs] = j - i;
+        i = j;
+    }
+    return nmsgs;
+}
+
+void UdpChannel::flushBatch() {
+    size_t first = 0;
+    while (first < numPending_) {
+        int nmsgs = buildMessages( first );
+        int n = ::sendmmsg( socket_.fd() , sendMsgs_.data() , nmsgs , 0 );
+        ++sendCalls_;
+        if (n > 0) {
+            for (int k = 0; k < n; ++k) {
+                sent_ += sendGroups_[k];
+                first += sendGroups_[k];
+            }
+            continue;
+        }
+        int savedErrno = errno;
+        if (savedErrno == EINTR) {
+            continue;
+        }
+        if (sendGroups_[0] > 1 && (savedErrno == EIO || savedErrno == EINVAL)) {
+            // 出口网卡不支持校验和卸载或分段超过MTU，关闭GSO后重发
+            LOG_ERROR( "UdpChannel::flush - GSO send failed, errno:%d, disable GSO \n" , savedErrno );
+            gso_ = false;
+            continue;
+        }
+        if (savedErrno != EAGAIN && savedErrno != EWOULDBLOCK) {
+            LOG_ERROR( "UdpChannel::flush - sendmmsg error:%d \n" , savedErrno );
+        }
+        // 发送缓冲区满，丢弃剩余的数据报
+        dropped_ += numPending_ - first;
+        break;
+    }
+    numPending_ = 0;
+}
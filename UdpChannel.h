@@ -0,0 +1,123 @@
+#pragma once
+
+#include "noncopyable.h"
+#include "Socket.h"
+#include "Channel.h"
+#include "InetAddress.h"
+#include "Timestamp.h"
+
+#include <functional>
+#include <vector>
+#include <memory>
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+class EventLoop;
+
+/**
+ * 一个绑定到本地地址的UDP socket，挂在某个loop上收发数据报
+ *
+ * - 接收：一次recvmmsg收一批数据报到预先分配的缓冲区，逐个回调messageCallback_
+ * - 发送：loop线程中send的数据报先放入发送批次，本轮读事件处理完（或本轮loop的回调队列执行时）用一次sendmmsg发出
+ *   开启GSO后，发往同一地址、长度相同的连续数据报合并成一个UDP_SEGMENT消息，由内核分段
+ * - 开启GRO后内核把同一流的多个数据报合并后上交，回调前按分段大小拆开
+ * - batchSize为1时退化为逐个recvfrom/sendto，作为对照
+ *
+ * 除send外的接口只能在loop线程中调用，析构也要在loop线程中进行，此前其它线程应停止send
+ * UDP不可靠，发送缓冲区满时丢弃数据报并计数
+*/
+class UdpChannel : noncopyable {
+public:
+    // data指向接收缓冲区，只在回调期间有效
+    using MessageCallback = std::function<void( UdpChannel *channel , const char *data , size_t len ,
+        const InetAddress &peer , Timestamp receiveTime )>;
+
+    // 数据报最大长度，收到的更长的数据报被丢弃并计入datagramsTruncated
+    static const size_t kDefaultMaxDatagram = 2048;
+    static const int kDefaultBatchSize = 32;
+
+    UdpChannel( EventLoop *loop , const InetAddress &bindAddr , bool reuseport ,
+        int batchSize = kDefaultBatchSize , size_t maxDatagram = kDefaultMaxDatagram );
+    ~UdpChannel();
+
+    void setMessageCallback( const MessageCallback &cb ) { messageCallback_ = cb; }
+    // 在start之前设置；内核不支持时记录日志并保持关闭
+    void setGso( bool on ) { gso_ = on; }
+    void setGro( bool on ) { gro_ = on; }
+
+    void start();
+    void stop();
+
+    // 可以在任意线程调用，其它线程调用时拷贝数据投递到loop线程
+    void send( const InetAddress &peer , const void *data , size_t len );
+    // 立即发出发送批次中的数据报
+    void flush();
+
+    EventLoop *getLoop() const { return loop_; }
+    int fd() const { return socket_.fd(); }
+    InetAddress localAddress() const;
+
+    // 以下计数只能在loop线程中读取
+    int64_t datagramsReceived() const { return received_; }
+    int64_t datagramsSent() const { return sent_; }
+    int64_t datagramsDropped() const { return dropped_; }
+    // 超出接收缓冲区、被内核截断而丢弃的数据报
+    int64_t datagramsTruncated() const { return truncated_; }
+    // recvmmsg/recvfrom和sendmmsg/sendto的调用次数
+    int64_t recvCalls() const { return recvCalls_; }
+    int64_t sendCalls() const { return sendCalls_; }
+private:
+    // 一次读事件最多执行的recvmmsg次数，避免一个socket长时间占用loop
+    static const int kMaxReadsPerEvent = 8;
+    // GSO一个消息最多64个分段，总长度不超过64KB
+    static const int kMaxGsoSegments = 64;
+    static const size_t kMaxGsoBytes = 65000;
+
+    void handleRead( Timestamp receiveTime );
+    void deliver( const char *data , size_t len , size_t segmentSize , const sockaddr_in &peer , Timestamp receiveTime );
+    void dropTruncated( size_t len , const sockaddr_in &peer );
+    void sendInLoop( const InetAddress &peer , const void *data , size_t len );
+    // 从第i个数据报开始能合并为一个GSO消息的数据报的结束位置
+    size_t gsoGroupEnd( size_t i ) const;
+    // 把发送批次中从first开始的数据报填入sendMsgs_，返回消息个数
+    int buildMessages( size_t first );
+    void flushBatch();
+
+    EventLoop *loop_;
+    Socket socket_;
+    Channel channel_;
+    MessageCallback messageCallback_;
+    const int batchSize_;
+    const size_t maxDatagram_;
+    bool gso_;
+    bool gro_;
+    bool handlingRead_;     // 正在处理读事件，读事件结束时统一flush
+    bool flushQueued_;      // 已经投递了flush任务
+    std::shared_ptr<bool> alive_;   // 投递到loop的任务持有它的weak_ptr，channel析构后任务不再执行
+
+    // 接收批次
+    size_t recvBufferSize_;
+    std::vector<char> recvBuffers_;
+    std::vector<mmsghdr> recvMsgs_;
+    std::vector<iovec> recvIovecs_;
+    std::vector<sockaddr_in> recvAddrs_;
+    std::vector<char> recvControl_;
+
+    // 发送批次，第i个数据报拷贝在sendBuffers_[i * maxDatagram_]；构造时分配，start之前就可以send
+    size_t numPending_;
+    std::vector<char> sendBuffers_;
+    std::vector<iovec> sendIovecs_;
+    std::vector<sockaddr_in> sendAddrs_;
+    std::vector<mmsghdr> sendMsgs_;
+    std::vector<size_t> sendGroups_;    // 每个消息包含的数据报个数
+    std::vector<char> sendControl_;
+
+    int64_t received_;
+    int64_t sent_;
+    int64_t dropped_;
+    int64_t truncated_;
+    int64_t recvCalls_;
+    int64_t sendCalls_;
+};
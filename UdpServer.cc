@@ -0,0 +1,74 @@
+#include "UdpServer.h"
+#include "EventLoop.h"
+#include "Logger.h"
+
+#include <mutex>
+#include <condition_variable>
+
+UdpServer::UdpServer( EventLoop *loop , const InetAddress &listenAddr , const std::string &nameArg )
+    : loop_( loop )
+    , listenAddr_( listenAddr )
+    , name_( nameArg )
+    , threadPool_( new EventLoopThreadPool( loop , name_ ) )
+    , batchSize_( UdpChannel::kDefaultBatchSize )
+    , maxDatagram_( UdpChannel::kDefaultMaxDatagram )
+    , gso_( false )
+    , gro_( false )
+    , started_( 0 ) {
+    if (loop == nullptr) {
+        LOG_FATAL( "%s:%s:%d mainLoop is null! \n" , __FILE__ , __FUNCTION__ , __LINE__ );
+    }
+}
+
+UdpServer::~UdpServer() {
+    /**
+     * channel必须在它所属的loop线程中析构，与TcpServer相同：等subloop上的析构任务执行完再返回，
+     * 只投递不等待时loop可能在执行之前退出，socket和缓冲区泄漏；当前线程的loop上的直接析构
+    */
+    std::mutex mutex;
+    std::condition_variable cond;
+    size_t pending = 0;
+    for (std::unique_ptr<UdpChannel> &item : channels_) {
+        UdpChannel *channel = item.release();
+        EventLoop *ioLoop = channel->getLoop();
+        if (ioLoop->isInLoopThread()) {
+            delete channel;
+            continue;
+        }
+        {
+            std::unique_lock<std::mutex> lock( mutex );
+            ++pending;
+        }
+        ioLoop->queueInLoop( [channel , &mutex , &cond , &pending] () {
+            delete channel;
+            std::unique_lock<std::mutex> lock( mutex );
+            if (--pending == 0) {
+                cond.notify_all();
+            }
+        } );
+    }
+    std::unique_lock<std::mutex> lock( mutex );
+    while (pending != 0) {
+        cond.wait( lock );
+    }
+}
+
+void UdpServer::start() {
+    if (started_++ != 0) {
+        return;
+    }
+    threadPool_->start( threadInitCallback_ );
+    std::vector<EventLoop *> loops = threadPool_->getAllLoops();
+    // 只有一个loop时不需要SO_REUSEPORT
+    bool reuseport = loops.size() > 1;
+    for (EventLoop *ioLoop : loops) {
+        // 在当前线程创建并bind，端口冲突时在这里就能发现
+        UdpChannel *channel = new UdpChannel( ioLoop , listenAddr_ , reuseport , batchSize_ , maxDatagram_ );
+        channel->setMessageCallback( messageCallback_ );
+        channel->setGso( gso_ );
+        channel->setGro( gro_ );
+        channels_.push_back( std::unique_ptr<UdpChannel>( channel ) );
+        ioLoop->runInLoop( std::bind( &UdpChannel::start , channel ) );
+    }
+    LOG_INFO( "UdpServer [%s] listening on %s with %zu sockets \n" , name_.c_str() , listenAddr_.toIpPort().c_str() , loops.size() );
+}
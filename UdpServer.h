@@ -0,0 +1,52 @@
+#pragma once
+
+#include "noncopyable.h"
+#include "UdpChannel.h"
+#include "InetAddress.h"
+#include "EventLoopThreadPool.h"
+
+#include <functional>
+#include <string>
+#include <vector>
+#include <memory>
+#include <atomic>
+
+class EventLoop;
+
+/**
+ * UDP服务器：每个loop（设置了线程数时为各个subloop）各自创建一个绑定到同一地址的SO_REUSEPORT socket
+ * 内核按四元组把数据报分发到这些socket，同一个对端的数据报总是在同一个loop上处理
+ * 在回调中通过channel->send应答，应答在本次读事件结束时批量发出
+*/
+class UdpServer : noncopyable {
+public:
+    using ThreadInitCallback = std::function<void( EventLoop * )>;
+
+    UdpServer( EventLoop *loop , const InetAddress &listenAddr , const std::string &nameArg );
+    ~UdpServer();
+
+    // 以下在start之前设置
+    void setThreadInitcallback( const ThreadInitCallback &cb ) { threadInitCallback_ = cb; }
+    void setMessageCallback( const UdpChannel::MessageCallback &cb ) { messageCallback_ = cb; }
+    void setThreadNum( int numThreads ) { threadPool_->setThreadNum( numThreads ); }
+    void setBatchSize( int batchSize ) { batchSize_ = batchSize; }
+    void setMaxDatagram( size_t maxDatagram ) { maxDatagram_ = maxDatagram; }
+    void setGso( bool on ) { gso_ = on; }
+    void setGro( bool on ) { gro_ = on; }
+
+    const std::string &name() const { return name_; }
+    void start();
+private:
+    EventLoop *loop_;
+    const InetAddress listenAddr_;
+    const std::string name_;
+    std::unique_ptr<EventLoopThreadPool> threadPool_;
+    ThreadInitCallback threadInitCallback_;
+    UdpChannel::MessageCallback messageCallback_;
+    int batchSize_;
+    size_t maxDatagram_;
+    bool gso_;
+    bool gro_;
+    std::atomic_int started_;
+    std::vector<std::unique_ptr<UdpChannel>> channels_;    // 每个loop一个
+};
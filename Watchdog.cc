@@ -0,0 +1,211 @@
+#include "Watchdog.h"
+#include "EventLoop.h"
+#include "Timestamp.h"
+#include "Logger.h"
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <errno.h>
+#include <execinfo.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+namespace {
+
+/**
+ * 一次调用栈采集：watchdog线程设置目标线程后发送信号，目标线程在信号处理函数中填写frames
+ * 同一时刻只有一次采集，由g_captureMutex保证
+*/
+const int kMaxFrames = 64;
+std::mutex g_captureMutex;
+std::atomic<pid_t> g_captureTid( 0 );
+std::atomic_bool g_captureDone( false );
+void *g_frames[kMaxFrames];
+int g_depth = 0;
+
+// 只调用异步信号安全的函数；backtrace在start时预先调用过一次，不会在这里加载libgcc
+void stackSignalHandler( int ) {
+    int savedErrno = errno;
+    pid_t tid = static_cast<pid_t>( ::syscall( SYS_gettid ) );
+    if (tid == g_captureTid.load( std::memory_order_acquire )) {
+        g_depth = ::backtrace( g_frames , kMaxFrames );
+        g_captureTid.store( 0 , std::memory_order_relaxed );
+        g_captureDone.store( true , std::memory_order_release );
+    }
+    errno = savedErrno;
+}
+
+const int64_t kCaptureTimeoutUs = 100 * 1000;
+
+} // namespace
+
+int Watchdog::stackSignal() {
+    return SIGRTMIN + 2;
+}
+
+Watchdog::Watchdog( double stallThreshold )
+    : stallThresholdUs_( static_cast<int64_t>( stallThreshold * 1000 * 1000 ) )
+    , checkIntervalMs_( std::min<int64_t>( stallThresholdUs_ / 4000 , 100 ) )
+    , logIntervalUs_( 10 * 1000 * 1000 )
+    , captureStack_( true )
+    , running_( false )
+    , thread_( std::bind( &Watchdog::threadFunc , this ) , "watchdog" )
+    , lastLogUs_( 0 )
+    , stalls_( 0 )
+    , suppressed_( 0 )
+    , stalledLoops_( 0 )
+    , longestStallUs_( 0 ) {
+    if (checkIntervalMs_ < 1) {
+        checkIntervalMs_ = 1;
+    }
+}
+
+Watchdog::~Watchdog() {
+    stop();
+}
+
+void Watchdog::addLoop( EventLoop *loop ) {
+    Watched watched = { loop , 0 , 0 , false };
+    std::unique_lock<std::mutex> lock( mutex_ );
+    loops_.push_back( watched );
+}
+
+void Watchdog::addLoops( const std::vector<EventLoop *> &loops ) {
+    for (EventLoop *loop : loops) {
+        addLoop( loop );
+    }
+}
+
+void Watchdog::removeLoop( EventLoop *loop ) {
+    // 检查过程中持有锁，返回之后watchdog线程不会再访问loop
+    std::unique_lock<std::mutex> lock( mutex_ );
+    for (auto it = loops_.begin(); it != loops_.end(); ++it) {
+        if (it->loop == loop) {
+            if (it->stalledSince != 0) {
+                stalledLoops_.fetch_sub( 1 , std::memory_order_relaxed );
+            }
+            loops_.erase( it );
+            break;
+        }
+    }
+}
+
+void Watchdog::start() {
+    if (captureStack_) {
+        // 第一次调用backtrace会加载libgcc并分配内存，不能发生在信号处理函数中
+        void *frames[1];
+        ::backtrace( frames , 1 );
+        struct sigaction action;
+        ::memset( &action , 0 , sizeof action );
+        action.sa_handler = stackSignalHandler;
+        action.sa_flags = SA_RESTART;
+        ::sigemptyset( &action.sa_mask );
+        ::sigaction( stackSignal() , &action , nullptr );
+    }
+    {
+        std::unique_lock<std::mutex> lock( mutex_ );
+        running_ = true;
+    }
+    thread_.start();
+}
+
+void Watchdog::stop() {
+    {
+        std::unique_lock<std::mutex> lock( mutex_ );
+        if (!running_) {
+            return;
+        }
+        running_ = false;
+    }
+    cond_.notify_all();
+    thread_.join();
+}
+
+void Watchdog::threadFunc() {
+    std::unique_lock<std::mutex> lock( mutex_ );
+    while (running_) {
+        cond_.wait_for( lock , std::chrono::milliseconds( checkIntervalMs_ ) );
+        if (!running_) {
+            break;
+        }
+        int64_t now = Timestamp::now().microSecondsSinceEpoch();
+        for (Watched &watched : loops_) {
+            check( &watched , now );
+        }
+    }
+}
+
+void Watchdog::check( Watched *watched , int64_t now ) {
+    EventLoop *loop = watched->loop;
+    int64_t busySince = loop->busySince();
+    uint64_t iteration = loop->iterations();
+    if (watched->stalledSince != 0) {
+        if (busySince == watched->stalledSince && iteration == watched->stalledIteration) {
+            return;     // 仍然卡在同一轮中，已经报告过
+        }
+        // 卡顿结束，持续时间的误差不超过一个检查间隔
+        int64_t duration = now - watched->stalledSince;
+        if (duration > longestStallUs_.load( std::memory_order_relaxed )) {
+            longestStallUs_.store( duration , std::memory_order_relaxed );
+        }
+        stalledLoops_.fetch_sub( 1 , std::memory_order_relaxed );
+        watched->stalledSince = 0;
+        if (watched->logged) {
+            LOG_INFO( "Watchdog - loop %p (thread %d) recovered after about %lld ms \n" , loop , (int)loop->threadId() ,
+                (long long)( duration / 1000 ) );
+        }
+    }
+    if (busySince != 0 && now - busySince >= stallThresholdUs_) {
+        watched->stalledSince = busySince;
+        watched->stalledIteration = iteration;
+        stalls_.fetch_add( 1 , std::memory_order_relaxed );
+        stalledLoops_.fetch_add( 1 , std::memory_order_relaxed );
+        watched->logged = reportStall( loop , now - busySince );
+    }
+}
+
+bool Watchdog::reportStall( EventLoop *loop , int64_t busyUs ) {
+    int64_t now = Timestamp::now().microSecondsSinceEpoch();
+    if (lastLogUs_ != 0 && now - lastLogUs_ < logIntervalUs_) {
+        suppressed_.fetch_add( 1 , std::memory_order_relaxed );
+        return false;
+    }
+    lastLogUs_ = now;
+    LOG_ERROR( "Watchdog - loop %p (thread %d) stalled for %lld ms in %s fd=%d conn=%llu, %lld stalls not logged so far \n" ,
+        loop , (int)loop->threadId() , (long long)( busyUs / 1000 ) , loop->activity() , loop->activityFd() ,
+        (unsigned long long)loop->activityConnection() , (long long)suppressed_.load( std::memory_order_relaxed ) );
+    if (captureStack_ && !logStack( loop )) {
+        LOG_ERROR( "Watchdog - no stack from thread %d \n" , (int)loop->threadId() );
+    }
+    return true;
+}
+
+bool Watchdog::logStack( EventLoop *loop ) {
+    std::unique_lock<std::mutex> lock( g_captureMutex );
+    g_captureDone.store( false , std::memory_order_relaxed );
+    g_captureTid.store( loop->threadId() , std::memory_order_release );
+    if (::syscall( SYS_tgkill , ::getpid() , loop->threadId() , stackSignal() ) < 0) {
+        g_captureTid.store( 0 , std::memory_order_relaxed );
+        return false;
+    }
+    int64_t deadline = Timestamp::now().microSecondsSinceEpoch() + kCaptureTimeoutUs;
+    while (!g_captureDone.load( std::memory_order_acquire )) {
+        if (Timestamp::now().microSecondsSinceEpoch() > deadline) {
+            // 信号被屏蔽或线程已经退出；之后到达的信号因为tid不匹配被忽略
+            g_captureTid.store( 0 , std::memory_order_relaxed );
+            return false;
+        }
+        ::usleep( 1000 );
+    }
+    // 第0、1帧是信号处理函数和信号跳板
+    char **symbols = ::backtrace_symbols( g_frames , g_depth );
+    for (int i = 0; i < g_depth; ++i) {
+        LOG_ERROR( "Watchdog -   #%d %s \n" , i , symbols != nullptr ? symbols[i] : "?" );
+    }
+    ::free( symbols );
+    return true;
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include "noncopyable.h"
+#include "Thread.h"
+
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+#include <stdint.h>
+
+class EventLoop;
+
+/**
+ * loop卡顿检测：独立线程定期检查每个loop的心跳（EventLoop::iterations/busySince）
+ *
+ * loop一轮的处理时间超过阈值时视为卡住，记一次卡顿，向卡住的线程发送kStackSignal，
+ * 由信号处理函数在该线程中用backtrace采集调用栈，watchdog线程再解析符号并输出日志，
+ * 同时报告卡住时正在执行的操作（EventLoop::activity）以及相关的fd和连接id
+ * 日志限速：任意两次卡顿日志之间至少间隔logInterval，期间的卡顿只计数；恢复时输出一行持续时间
+ * 可执行文件以-rdynamic链接时调用栈中才有其中函数的符号
+ * 采集信号会让卡住的线程中不自动重启的系统调用（如sleep、带超时的等待）提前返回EINTR
+*/
+class Watchdog : noncopyable {
+public:
+    // 采集调用栈使用的信号，进程中不能有其它用途
+    static int stackSignal();
+
+    // stallThreshold：判定为卡顿的处理时间，秒
+    explicit Watchdog( double stallThreshold = 1.0 );
+    ~Watchdog();
+
+    // 检查间隔（默认阈值的1/4，最长0.1秒）和日志的最小间隔（默认10秒），在start之前设置
+    void setCheckInterval( double seconds ) { checkIntervalMs_ = static_cast<int64_t>( seconds * 1000 ); }
+    void setLogInterval( double seconds ) { logIntervalUs_ = static_cast<int64_t>( seconds * 1000 * 1000 ); }
+    // 关闭调用栈采集，只输出卡住时的操作
+    void setCaptureStack( bool on ) { captureStack_ = on; }
+
+    // 任意线程调用；loop析构之前要先removeLoop或者析构Watchdog
+    void addLoop( EventLoop *loop );
+    void addLoops( const std::vector<EventLoop *> &loops );
+    void removeLoop( EventLoop *loop );
+
+    void start();
+    void stop();
+
+    // 卡顿次数、没有输出日志的卡顿次数、当前卡住的loop数、最长一次卡顿的时间（微秒，卡顿结束后更新）
+    int64_t stalls() const { return stalls_.load( std::memory_order_relaxed ); }
+    int64_t suppressedReports() const { return suppressed_.load( std::memory_order_relaxed ); }
+    int stalledLoops() const { return stalledLoops_.load( std::memory_order_relaxed ); }
+    int64_t longestStallUs() const { return longestStallUs_.load( std::memory_order_relaxed ); }
+private:
+    // 一个loop的检测状态，只在watchdog线程中访问
+    struct Watched {
+        EventLoop *loop;
+        int64_t stalledSince;   // 正在报告的卡顿的busySince，没有卡顿时为0
+        uint64_t stalledIteration;
+        bool logged;    // 这次卡顿输出了日志，恢复时同样输出
+    };
+
+    void threadFunc();
+    void check( Watched *watched , int64_t now );
+    // 限速输出卡顿日志和调用栈，返回是否输出
+    bool reportStall( EventLoop *loop , int64_t busyUs );
+    // 在loop线程中采集调用栈并输出，超时返回false
+    bool logStack( EventLoop *loop );
+
+    const int64_t stallThresholdUs_;
+    int64_t checkIntervalMs_;
+    int64_t logIntervalUs_;
+    bool captureStack_;
+
+    std::mutex mutex_;  // 保护loops_和running_
+    std::condition_variable cond_;
+    std::vector<Watched> loops_;
+    bool running_;
+    Thread thread_;
+
+    int64_t lastLogUs_;     // 只在watchdog线程中访问
+    std::atomic<int64_t> stalls_;
+    std::atomic<int64_t> suppressed_;
+    std::atomic_int stalledLoops_;
+    std::atomic<int64_t> longestStallUs_;
+};
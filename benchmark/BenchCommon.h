@@ -0,0 +1,248 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+#include <utility>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+
+/**
+ * 压测程序共用的工具：命令行参数、延迟直方图、JSON结果输出
+ * 所有压测程序的结果都以一行JSON输出到stdout，便于脚本收集和比较
+*/
+
+// 解析 --name=value 和 --flag 形式的参数
+class BenchOptions {
+public:
+    BenchOptions( int argc , char *argv[] ) {
+        for (int i = 1; i < argc; ++i) {
+            std::string arg( argv[i] );
+            if (arg.compare( 0 , 2 , "--" ) != 0) {
+                fprintf( stderr , "unknown argument: %s\n" , argv[i] );
+                exit( 1 );
+            }
+            size_t eq = arg.find( '=' );
+            if (eq == std::string::npos) {
+                values_[arg.substr( 2 )] = "1";
+            }
+            else {
+                values_[arg.substr( 2 , eq - 2 )] = arg.substr( eq + 1 );
+            }
+        }
+    }
+
+    bool has( const std::string &name ) const { return values_.count( name ) > 0; }
+    std::string get( const std::string &name , const std::string &def ) const {
+        auto it = values_.find( name );
+        return it == values_.end() ? def : it->second;
+    }
+    int64_t getInt( const std::string &name , int64_t def ) const {
+        auto it = values_.find( name );
+        return it == values_.end() ? def : strtoll( it->second.c_str() , nullptr , 10 );
+    }
+    double getDouble( const std::string &name , double def ) const {
+        auto it = values_.find( name );
+        return it == values_.end() ? def : strtod( it->second.c_str() , nullptr );
+    }
+private:
+    std::map<std::string , std::string> values_;
+};
+
+/**
+ * 对数分桶的延迟直方图，单位微秒
+ * 小于64的值精确记录，之后每个2的幂区间分为32个桶，相对误差不超过1/32
+*/
+class Histogram {
+public:
+    Histogram() : counts_( kNumBuckets , 0 ) , count_( 0 ) , sum_( 0 ) , max_( 0 ) {}
+
+    void add( int64_t value ) {
+        if (value < 0) {
+            value = 0;
+        }
+        ++counts_[bucketOf( value )];
+        ++count_;
+        sum_ += value;
+        if (value > max_) {
+            max_ = value;
+        }
+    }
+
+    void merge( const Histogram &other ) {
+        for (int i = 0; i < kNumBuckets; ++i) {
+            counts_[i] += other.counts_[i];
+        }
+        count_ += other.count_;
+        sum_ += other.sum_;
+        if (other.max_ > max_) {
+            max_ = other.max_;
+        }
+    }
+
+    uint64_t count() const { return count_; }
+    int64_t max() const { return max_; }
+    double mean() const { return count_ == 0 ? 0 : static_cast<double>( sum_ ) / count_; }
+
+    // p取值0~100，返回所在桶的上界
+    int64_t percentile( double p ) const {
+        if (count_ == 0) {
+            return 0;
+        }
+        uint64_t rank = static_cast<uint64_t>( p / 100.0 * count_ );
+        if (rank >= count_) {
+            rank = count_ - 1;
+        }
+        uint64_t seen = 0;
+        for (int i = 0; i < kNumBuckets; ++i) {
+            seen += counts_[i];
+            if (seen > rank) {
+                int64_t upper = bucketUpper( i );
+                return upper < max_ ? upper : max_;
+            }
+        }
+        return max_;
+    }
+private:
+    static const int kSubBits = 5;
+    static const int kSubBuckets = 1 << kSubBits;
+    static const int kLinear = kSubBuckets * 2;
+    static const int kNumBuckets = kLinear + ( 63 - kSubBits ) * kSubBuckets;
+
+    static int bucketOf( int64_t v ) {
+        if (v < kLinear) {
+            return static_cast<int>( v );
+        }
+        int msb = 63 - __builtin_clzll( static_cast<uint64_t>( v ) );
+        int shift = msb - kSubBits;
+        return kLinear + ( msb - kSubBits - 1 ) * kSubBuckets + static_cast<int>( ( v >> shift ) - kSubBuckets );
+    }
+    static int64_t bucketUpper( int i ) {
+        if (i < kLinear) {
+            return i;
+        }
+        int shift = ( i - kLinear ) / kSubBuckets + 1;
+        int64_t sub = ( i - kLinear ) % kSubBuckets + kSubBuckets;
+        return ( ( sub + 1 ) << shift ) - 1;
+    }
+
+    std::vector<uint64_t> counts_;
+    uint64_t count_;
+    int64_t sum_;
+    int64_t max_;
+};
+
+// 按插入顺序输出一个扁平的JSON对象
+class JsonLine {
+public:
+    JsonLine &add( const std::string &key , const std::string &value ) {
+        std::string quoted( "\"" );
+        for (char c : value) {
+            if (c == '"' || c == '\\') {
+                quoted += '\\';
+            }
+            quoted += c;
+        }
+        quoted += '"';
+        fields_.push_back( std::make_pair( key , quoted ) );
+        return *this;
+    }
+    JsonLine &add( const std::string &key , const char *value ) { return add( key , std::string( value ) ); }
+    JsonLine &add( const std::string &key , int64_t value ) {
+        fields_.push_back( std::make_pair( key , std::to_string( value ) ) );
+        return *this;
+    }
+    JsonLine &add( const std::string &key , int value ) { return add( key , static_cast<int64_t>( value ) ); }
+    JsonLine &add( const std::string &key , uint64_t value ) {
+        fields_.push_back( std::make_pair( key , std::to_string( value ) ) );
+        return *this;
+    }
+    JsonLine &add( const std::string &key , double value ) {
+        char buf[64];
+        snprintf( buf , sizeof buf , "%.3f" , value );
+        fields_.push_back( std::make_pair( key , std::string( buf ) ) );
+        return *this;
+    }
+    JsonLine &add( const std::string &key , bool value ) {
+        fields_.push_back( std::make_pair( key , std::string( value ? "true" : "false" ) ) );
+        return *this;
+    }
+
+    std::string str() const {
+        std::string s( "{" );
+        for (size_t i = 0; i < fields_.size(); ++i) {
+            if (i > 0) {
+                s += ",";
+            }
+            s += "\"" + fields_[i].first + "\":" + fields_[i].second;
+        }
+        s += "}";
+        return s;
+    }
+    void print() const {
+        printf( "%s\n" , str().c_str() );
+        fflush( stdout );
+    }
+private:
+    std::vector<std::pair<std::string , std::string>> fields_;
+};
+
+// 本进程write类系统调用（write、writev、sendfile等，包括唤醒loop的eventfd）的累计次数，来自/proc/self/io
+inline int64_t writeSyscalls() {
+    long long value = 0;
+    FILE *fp = ::fopen( "/proc/self/io" , "r" );
+    if (fp != nullptr) {
+        if (::fscanf( fp , "rchar: %*d wchar: %*d syscr: %*d syscw: %lld" , &value ) != 1) {
+            value = 0;
+        }
+        ::fclose( fp );
+    }
+    return value;
+}
+
+// /proc/self/status中以KB为单位的字段，如VmRSS（当前常驻内存）、VmHWM（常驻内存峰值）
+inline int64_t procStatusKb( const char *field ) {
+    long long value = 0;
+    FILE *fp = ::fopen( "/proc/self/status" , "r" );
+    if (fp != nullptr) {
+        char line[256];
+        size_t len = strlen( field );
+        while (::fgets( line , sizeof line , fp ) != nullptr) {
+            if (strncmp( line , field , len ) == 0 && line[len] == ':') {
+                value = strtoll( line + len + 1 , nullptr , 10 );
+                break;
+            }
+        }
+        ::fclose( fp );
+    }
+    return value;
+}
+
+// 把RLIMIT_NOFILE的当前值提高到need（不超过硬限制），返回是否足够
+inline bool raiseFdLimit( int64_t need ) {
+    struct rlimit limit;
+    ::getrlimit( RLIMIT_NOFILE , &limit );
+    if (limit.rlim_cur < static_cast<rlim_t>( need )) {
+        limit.rlim_cur = limit.rlim_max < static_cast<rlim_t>( need ) ? limit.rlim_max : need;
+        ::setrlimit( RLIMIT_NOFILE , &limit );
+    }
+    return limit.rlim_cur >= static_cast<rlim_t>( need );
+}
+
+// 按逗号分隔的cpu列表，例如 "0,2,4"，每个subloop绑定一个cpu
+inline std::vector<std::vector<int>> parseCpuList( const std::string &list ) {
+    std::vector<std::vector<int>> cpuSets;
+    size_t pos = 0;
+    while (pos < list.size()) {
+        size_t comma = list.find( ',' , pos );
+        if (comma == std::string::npos) {
+            comma = list.size();
+        }
+        cpuSets.push_back( std::vector<int>( 1 , atoi( list.substr( pos , comma - pos ).c_str() ) ) );
+        pos = comma + 1;
+    }
+    return cpuSets;
+}
@@ -0,0 +1,519 @@
+/**
+ * 压测客户端，连接bench_server，按场景输出一行JSON结果
+ *
+ *  bench_client --scenario=pingpong [--connections=100] [--block=16384] [--busy-every=1]
+ *      每个连接发送一个block，之后把收到的数据原样发回，统计吞吐量MB/s
+ *      --busy-every=k时只有每k个连接中的一个收发数据，其余连接空闲，用于测试负载不均时的分配策略
+ *  bench_client --scenario=latency [--connections=1] [--size=64]
+ *      每个连接同一时刻只有一个请求，统计往返延迟的分布（微秒）
+ *  bench_client --scenario=churn [--connections=10] [--pool]
+ *      每个并发单元循环执行 建立连接、一次请求、关闭连接，统计每秒完成的连接数
+ *      --pool时从TcpConnectionPool获取连接，用完归还，对比复用连接的效果
+ *  bench_client --scenario=flood [--connections=10] [--block=65536]
+ *      只发送不读取的慢客户端，配合bench_server --report-interval观察服务端的缓冲
+ *
+ * 公共参数：[--ip=127.0.0.1] [--port=9981] [--threads=1] [--seconds=5] [--label=name] [--unix=path]
+ * --unix时通过AF_UNIX地址连接（bench_server --unix），不再使用ip和port
+ * --label原样写入结果，用于区分服务端的配置
+ * --tls时与bench_server --tls-cert进行TLS握手，不校验服务器证书，需要以-DMYMUDUO_TLS=ON编译；
+ * churn场景每个连接都是一次完整握手，per_sec即每秒握手次数
+*/
+#include "BenchCommon.h"
+
+#include "TcpClient.h"
+#include "TcpConnection.h"
+#include "TcpConnectionPool.h"
+#include "EventLoop.h"
+#include "EventLoopThreadPool.h"
+#include "Buffer.h"
+#include "Logger.h"
+#include "Timestamp.h"
+#ifdef MYMUDUO_TLS
+#include "TlsContext.h"
+#endif
+
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <functional>
+#include <string.h>
+
+class BenchClient;
+
+// 场景中的一个并发单元，所有成员只在所属loop线程中访问
+class Session : noncopyable {
+public:
+    Session( EventLoop *loop , const InetAddress &serverAddr , const std::string &name , BenchClient *owner , bool busy );
+
+    EventLoop *getLoop() const { return loop_; }
+    void start();
+    // 停止收发，连接关闭后向owner汇报统计
+    void stop();
+
+    int64_t bytes() const { return bytes_; }
+    int64_t messages() const { return messages_; }
+    const Histogram &latency() const { return latency_; }
+private:
+    void onConnection( const TcpConnectionPtr &conn );
+    void onMessage( const TcpConnectionPtr &conn , Buffer *buf , Timestamp );
+    void onWriteComplete( const TcpConnectionPtr &conn );
+    void sendRequest( const TcpConnectionPtr &conn );
+
+    // --pool时的请求流程
+    void acquire();
+    void onAcquired( const TcpConnectionPtr &conn );
+    void onPooledMessage( const TcpConnectionPtr &conn , Buffer *buf , Timestamp );
+
+    void report();
+
+    EventLoop *loop_;
+    BenchClient *owner_;
+    std::unique_ptr<TcpClient> client_;
+    const bool busy_;
+    bool stopped_;
+    bool established_;  // 收到了建立回调（TLS时握手已完成）
+    bool reported_;
+    bool inFlight_;
+    int64_t bytes_;
+    int64_t messages_;
+    Histogram latency_;
+};
+
+class BenchClient : noncopyable {
+public:
+    enum Scenario { kPingPong , kLatency , kChurn , kFlood };
+
+    BenchClient( EventLoop *loop , const BenchOptions &options );
+    ~BenchClient();
+
+    void start();
+
+    Scenario scenario() const { return scenario_; }
+    const std::string &message() const { return message_; }
+    bool usePool() const { return usePool_; }
+    bool measuring() const { return measuring_.load( std::memory_order_relaxed ); }
+    TcpConnectionPool *poolOf( EventLoop *loop ) { return pools_[loop]; }
+    const InetAddress &serverAddress() const { return serverAddr_; }
+    const std::shared_ptr<TlsContext> &tlsContext() const { return tlsContext_; }
+
+    // 以下在各个client loop线程中调用
+    void sessionConnected();
+    void sessionStopped( Session *session );
+private:
+    void initPool( EventLoop *loop );
+    void startMeasuring();
+    void finish();
+    void checkConnected();
+    void printResult();
+
+    EventLoop *loop_;
+    const BenchOptions &options_;
+    Scenario scenario_;
+    InetAddress serverAddr_;
+    int numConnections_;
+    double seconds_;
+    bool usePool_;
+    std::string message_;
+    EventLoopThreadPool threadPool_;
+    std::vector<Session *> sessions_;
+    std::shared_ptr<TlsContext> tlsContext_;
+
+    std::mutex mutex_;
+    std::map<EventLoop * , TcpConnectionPool *> pools_;    // start之后只读
+
+    std::atomic_int connected_;
+    std::atomic_bool measuring_;
+    Timestamp startTime_;
+    Timestamp endTime_;
+
+    int stopped_;   // 受mutex_保护，以下统计同样
+    int64_t bytes_;
+    int64_t messages_;
+    Histogram latency_;
+};
+
+static void deleteSession( Session *session ) {
+    delete session;
+}
+
+static void deletePool( TcpConnectionPool *pool ) {
+    delete pool;
+}
+
+Session::Session( EventLoop *loop , const InetAddress &serverAddr , const std::string &name , BenchClient *owner , bool busy )
+    : loop_( loop )
+    , owner_( owner )
+    , busy_( busy )
+    , stopped_( false )
+    , established_( false )
+    , reported_( false )
+    , inFlight_( false )
+    , bytes_( 0 )
+    , messages_( 0 ) {
+    if (!owner_->usePool()) {
+        client_.reset( new TcpClient( loop , serverAddr , name ) );
+        client_->setConnectionCallback( std::bind( &Session::onConnection , this , std::placeholders::_1 ) );
+        client_->setMessageCallback( std::bind( &Session::onMessage , this ,
+            std::placeholders::_1 , std::placeholders::_2 , std::placeholders::_3 ) );
+        client_->setWriteCompleteCallback( std::bind( &Session::onWriteComplete , this , std::placeholders::_1 ) );
+        client_->setTlsContext( owner_->tlsContext() );
+    }
+}
+
+void Session::start() {
+    if (client_) {
+        client_->connect();
+    }
+    else {
+        acquire();
+    }
+}
+
+void Session::stop() {
+    stopped_ = true;
+    if (client_) {
+        TcpConnectionPtr conn = client_->connection();
+        if (conn && established_) {
+            conn->forceClose();  // 连接断开时汇报
+            return;
+        }
+        // 没有连接，或者TLS握手还没完成：握手完成前关闭的连接不会回调断开，直接汇报
+        client_->stop();
+        if (conn) {
+            conn->forceClose();
+        }
+        report();
+    }
+    else if (!inFlight_) {
+        report();
+    }
+}
+
+void Session::onConnection( const TcpConnectionPtr &conn ) {
+    established_ = conn->connected();
+    if (!conn->connected()) {
+        if (stopped_) {
+            report();
+        }
+        else if (owner_->scenario() == BenchClient::kChurn) {
+            ++messages_;
+            client_->connect();
+        }
+        return;
+    }
+    if (stopped_) {
+        // stop之后才完成TLS握手，已经汇报过
+        conn->forceClose();
+        return;
+    }
+
+    switch (owner_->scenario()) {
+    case BenchClient::kPingPong:
+        owner_->sessionConnected();
+        if (busy_) {
+            conn->send( owner_->message() );
+        }
+        break;
+    case BenchClient::kLatency:
+        owner_->sessionConnected();
+        sendRequest( conn );
+        break;
+    case BenchClient::kChurn:
+        sendRequest( conn );
+        break;
+    case BenchClient::kFlood:
+        conn->stopRead();
+        owner_->sessionConnected();
+        conn->send( owner_->message() );
+        break;
+    }
+}
+
+void Session::onMessage( const TcpConnectionPtr &conn , Buffer *buf , Timestamp ) {
+    switch (owner_->scenario()) {
+    case BenchClient::kPingPong:
+        if (owner_->measuring()) {
+            bytes_ += buf->readableBytes();
+            ++messages_;
+        }
+        if (stopped_) {
+            buf->retrieveAll();
+        }
+        else {
+            conn->send( buf->retrieveAllAsString() );
+        }
+        break;
+    case BenchClient::kLatency: {
+        const size_t size = owner_->message().size();
+        if (buf->readableBytes() < size) {
+            break;
+        }
+        int64_t sent = 0;
+        ::memcpy( &sent , buf->peek() , sizeof sent );
+        buf->retrieve( size );
+        if (owner_->measuring()) {
+            latency_.add( Timestamp::now().microSecondsSinceEpoch() - sent );
+            ++messages_;
+        }
+        if (!stopped_) {
+            sendRequest( conn );
+        }
+        break;
+    }
+    case BenchClient::kChurn:
+        buf->retrieveAll();
+        client_->disconnect();
+        break;
+    case BenchClient::kFlood:
+        buf->retrieveAll();
+        break;
+    }
+}
+
+void Session::onWriteComplete( const TcpConnectionPtr &conn ) {
+    if (owner_->scenario() != BenchClient::kFlood) {
+        return;
+    }
+    if (owner_->measuring()) {
+        bytes_ += owner_->message().size();
+        ++messages_;
+    }
+    if (!stopped_) {
+        conn->send( owner_->message() );
+    }
+}
+
+// 请求的前8个字节是发送时间
+void Session::sendRequest( const TcpConnectionPtr &conn ) {
+    std::string request( owner_->message() );
+    int64_t now = Timestamp::now().microSecondsSinceEpoch();
+    ::memcpy( &request[0] , &now , sizeof now );
+    conn->send( request );
+}
+
+void Session::acquire() {
+    inFlight_ = true;
+    owner_->poolOf( loop_ )->acquire( owner_->serverAddress() , std::bind( &Session::onAcquired , this , std::placeholders::_1 ) );
+}
+
+void Session::onAcquired( const TcpConnectionPtr &conn ) {
+    if (!conn) {
+        LOG_FATAL( "bench_client - connect to %s failed \n" , owner_->serverAddress().toIpPort().c_str() );
+    }
+    conn->setMessageCallback( std::bind( &Session::onPooledMessage , this ,
+        std::placeholders::_1 , std::placeholders::_2 , std::placeholders::_3 ) );
+    sendRequest( conn );
+}
+
+void Session::onPooledMessage( const TcpConnectionPtr &conn , Buffer *buf , Timestamp ) {
+    if (buf->readableBytes() < owner_->message().size()) {
+        return;
+    }
+    buf->retrieveAll();
+    ++messages_;
+    inFlight_ = false;
+    if (stopped_) {
+        report();
+    }
+    else {
+        loop_->queueInLoop( std::bind( &Session::acquire , this ) );
+    }
+    owner_->poolOf( loop_ )->release( conn );   // 会替换当前的消息回调，必须放在最后
+}
+
+void Session::report() {
+    if (!reported_) {
+        reported_ = true;
+        owner_->sessionStopped( this );
+    }
+}
+
+BenchClient::BenchClient( EventLoop *loop , const BenchOptions &options )
+    : loop_( loop )
+    , options_( options )
+    , serverAddr_( options.has( "unix" ) ? InetAddress::unixAddress( options.get( "unix" , "" ) ) :
+        InetAddress( static_cast<uint16_t>( options.getInt( "port" , 9981 ) ) , options.get( "ip" , "127.0.0.1" ) ) )
+    , numConnections_( static_cast<int>( options.getInt( "connections" , 0 ) ) )
+    , seconds_( options.getDouble( "seconds" , 5 ) )
+    , usePool_( false )
+    , threadPool_( loop , "client" )
+    , connected_( 0 )
+    , measuring_( false )
+    , stopped_( 0 )
+    , bytes_( 0 )
+    , messages_( 0 ) {
+    std::string scenario = options.get( "scenario" , "pingpong" );
+    size_t size = 0;
+    if (scenario == "pingpong") {
+        scenario_ = kPingPong;
+        size = options.getInt( "block" , 16384 );
+        numConnections_ = numConnections_ > 0 ? numConnections_ : 100;
+    }
+    else if (scenario == "latency") {
+        scenario_ = kLatency;
+        size = options.getInt( "size" , 64 );
+        numConnections_ = numConnections_ > 0 ? numConnections_ : 1;
+    }
+    else if (scenario == "churn") {
+        scenario_ = kChurn;
+        size = options.getInt( "size" , 64 );
+        usePool_ = options.has( "pool" );
+        numConnections_ = numConnections_ > 0 ? numConnections_ : 10;
+    }
+    else if (scenario == "flood") {
+        scenario_ = kFlood;
+        size = options.getInt( "block" , 65536 );
+        numConnections_ = numConnections_ > 0 ? numConnections_ : 10;
+    }
+    else {
+        LOG_FATAL( "bench_client - unknown scenario %s \n" , scenario.c_str() );
+    }
+    if (size < sizeof( int64_t )) {
+        size = sizeof( int64_t );
+    }
+    message_.assign( size , 'x' );
+
+    if (options.has( "tls" )) {
+#ifdef MYMUDUO_TLS
+        if (usePool_) {
+            LOG_FATAL( "bench_client - --tls does not support --pool \n" );
+        }
+        tlsContext_ = TlsContext::newClientContext();
+        if (!tlsContext_) {
+            LOG_FATAL( "bench_client - cannot create TLS context \n" );
+        }
+        tlsContext_->setVerifyPeer( false );
+        tlsContext_->setKtls( !options.has( "no-ktls" ) );
+#else
+        LOG_FATAL( "--tls requires building with -DMYMUDUO_TLS=ON \n" );
+#endif
+    }
+
+    // 至少一个client线程，base loop只负责计时和汇总
+    int threads = static_cast<int>( options.getInt( "threads" , 1 ) );
+    threadPool_.setThreadNum( threads > 0 ? threads : 1 );
+}
+
+BenchClient::~BenchClient() {
+    // 在各自的loop线程中析构，这些任务在threadPool_析构（quit）之前入队，一定会被执行
+    for (Session *session : sessions_) {
+        session->getLoop()->runInLoop( std::bind( &deleteSession , session ) );
+    }
+    for (auto &item : pools_) {
+        item.first->runInLoop( std::bind( &deletePool , item.second ) );
+    }
+}
+
+void BenchClient::start() {
+    threadPool_.start( usePool_ ? std::bind( &BenchClient::initPool , this , std::placeholders::_1 )
+                                : EventLoopThreadPool::ThreadInitCallback() );
+    int busyEvery = static_cast<int>( options_.getInt( "busy-every" , 1 ) );
+    for (int i = 0; i < numConnections_; ++i) {
+        char name[32];
+        snprintf( name , sizeof name , "client%d" , i );
+        bool busy = busyEvery <= 1 || i % busyEvery == 0;
+        sessions_.push_back( new Session( threadPool_.getNextLoop() , serverAddr_ , name , this , busy ) );
+    }
+    for (Session *session : sessions_) {
+        session->getLoop()->runInLoop( std::bind( &Session::start , session ) );
+    }
+
+    if (scenario_ == kChurn) {
+        startMeasuring();
+    }
+    else {
+        loop_->runAfter( 10.0 , std::bind( &BenchClient::checkConnected , this ) );
+    }
+}
+
+void BenchClient::initPool( EventLoop *loop ) {
+    TcpConnectionPool *pool = new TcpConnectionPool( loop , "pool" );
+    pool->setMaxIdlePerHost( numConnections_ );
+    std::unique_lock<std::mutex> lock( mutex_ );
+    pools_[loop] = pool;
+}
+
+void BenchClient::sessionConnected() {
+    if (++connected_ == numConnections_) {
+        loop_->runInLoop( std::bind( &BenchClient::startMeasuring , this ) );
+    }
+}
+
+void BenchClient::checkConnected() {
+    if (!measuring_ && startTime_.microSecondsSinceEpoch() == 0) {
+        LOG_FATAL( "bench_client - only %d of %d connections established \n" , connected_.load() , numConnections_ );
+    }
+}
+
+void BenchClient::startMeasuring() {
+    startTime_ = Timestamp::now();
+    measuring_ = true;
+    loop_->runAfter( seconds_ , std::bind( &BenchClient::finish , this ) );
+}
+
+void BenchClient::finish() {
+    measuring_ = false;
+    endTime_ = Timestamp::now();
+    for (Session *session : sessions_) {
+        session->getLoop()->runInLoop( std::bind( &Session::stop , session ) );
+    }
+}
+
+void BenchClient::sessionStopped( Session *session ) {
+    std::unique_lock<std::mutex> lock( mutex_ );
+    bytes_ += session->bytes();
+    messages_ += session->messages();
+    latency_.merge( session->latency() );
+    if (++stopped_ == numConnections_) {
+        loop_->queueInLoop( std::bind( &BenchClient::printResult , this ) );
+    }
+}
+
+void BenchClient::printResult() {
+    double elapsed = timeDifference( endTime_ , startTime_ );
+    JsonLine result;
+    result.add( "benchmark" , options_.get( "scenario" , "pingpong" ) )
+        .add( "label" , options_.get( "label" , "" ) )
+        .add( "connections" , numConnections_ )
+        .add( "threads" , static_cast<int>( threadPool_.getAllLoops().size() ) )
+        .add( "message_size" , static_cast<int64_t>( message_.size() ) )
+        .add( "tls" , static_cast<bool>( tlsContext_ ) )
+        .add( "seconds" , elapsed );
+    switch (scenario_) {
+    case kPingPong:
+    case kFlood:
+        result.add( "bytes" , bytes_ )
+            .add( "messages" , messages_ )
+            .add( "mb_per_sec" , bytes_ / elapsed / 1024 / 1024 );
+        break;
+    case kLatency:
+        result.add( "requests" , messages_ )
+            .add( "requests_per_sec" , messages_ / elapsed )
+            .add( "mean_us" , latency_.mean() )
+            .add( "p50_us" , latency_.percentile( 50 ) )
+            .add( "p90_us" , latency_.percentile( 90 ) )
+            .add( "p99_us" , latency_.percentile( 99 ) )
+            .add( "p999_us" , latency_.percentile( 99.9 ) )
+            .add( "max_us" , latency_.max() );
+        break;
+    case kChurn:
+        result.add( "pool" , usePool_ )
+            .add( "connections_completed" , messages_ )
+            .add( "per_sec" , messages_ / elapsed );
+        break;
+    }
+    result.print();
+    loop_->quit();
+}
+
+int main( int argc , char *argv[] ) {
+    BenchOptions options( argc , argv );
+    EventLoop loop;
+    BenchClient client( &loop , options );
+    client.start();
+    loop.loop();
+    return 0;
+}
@@ -0,0 +1,394 @@
+/**
+ * 压测用的echo服务端，配合bench_client使用
+ *
+ *  bench_server [--port=9981] [--threads=4] [--reuseport]
+ *               [--balance=rr|least-conn|least-util|hash] [--cpus=0,1,2,3] [--numa]
+ *               [--backpressure=bytes] [--budget=bytes] [--budget-policy=pause|reject|close]
+ *               [--coroutine] [--report-interval=seconds] [--label=name] [--unix=path]
+ *               [--hot-restart=control-path] [--drain-timeout=seconds]
+ *               [--tls-cert=cert.pem --tls-key=key.pem] [--no-ktls]
+ *               [--fragments=n] [--auto-cork] [--stats-port=port] [--trace-sample=n] [--watchdog=seconds]
+ *
+ * --stats-port时在该端口上启动StatsServer，curl http://127.0.0.1:port/metrics 查看流量计数
+ * --trace-sample=n时每n个请求采样一个，记录它的全部追踪区间（见Tracer），从StatsServer的/trace下载
+ * --watchdog时所有loop一轮处理超过该时间即报告卡顿和调用栈（见Watchdog），卡顿计数同时输出到StatsServer
+ * --fragments=n时每个回复分n次send发出（模拟头部、正文、尾部分开发送的处理函数）；
+ * --auto-cork时连接开启TcpConnection::setAutoCork，一轮循环中的多次send合并为一次写
+ * --tls-cert/--tls-key时所有连接先进行TLS握手，需要以-DMYMUDUO_TLS=ON编译；--no-ktls时始终在用户态加解密
+ * --unix在TCP端口之外同时监听一个AF_UNIX地址，以@开头为抽象地址
+ * --hot-restart时先从控制地址上运行的旧进程继承监听socket，之后在控制地址上等待下一个新进程，
+ * 交接完成后停止accept，连接全部关闭或超过--drain-timeout（默认10秒）后退出；见benchmark/hot_restart_test.py
+ *
+ * --report-interval大于0时，每隔一段时间输出一行JSON，记录连接数和所有连接缓冲区占用的内存（MemoryBudget::usage），
+ * 以及进程的RSS和峰值RSS（/proc/self/status的VmRSS、VmHWM，KB），用于观察慢读客户端（bench_client --scenario=flood）下
+ * 服务端内存是否有界，budget_bytes为--budget设置的预算；
+ * 同时记录进程内operator new的次数，allocs_per_connection为最近一个有新连接的统计周期内每个连接的分配次数
+ * （包括建立、收发一次请求和销毁连接），配合bench_client --scenario=churn使用；
+ * write_syscalls_per_response为每个回复的写系统调用次数（/proc/self/io的syscw），
+ * tcp_segments_per_response为每个回复期间本机发出的TCP段数（/proc/net/snmp的OutSegs，回环上包括请求和ACK）；
+ * loop_cpu_ms为每个处理连接的loop线程累计的cpu时间（/proc/self/task/<tid>/stat，逗号分隔），
+ * loop_cpu_spread为其中最大值与平均值之比（1表示均匀），loop_utilization为各loop最近的EventLoop::utilization（千分比）
+*/
+#include "BenchCommon.h"
+
+#include "TcpServer.h"
+#include "TcpConnection.h"
+#include "EventLoop.h"
+#include "MemoryBudget.h"
+#include "HotRestart.h"
+#include "StatsServer.h"
+#include "Tracer.h"
+#include "Watchdog.h"
+#include "Buffer.h"
+#include "Logger.h"
+#ifdef MYMUDUO_COROUTINE
+#include "Coroutine.h"
+#endif
+#ifdef MYMUDUO_TLS
+#include "TlsContext.h"
+#endif
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <new>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+// 进程内operator new的调用次数，替换全局的operator new，库中的分配同样被统计
+static std::atomic<int64_t> gAllocations( 0 );
+
+void *operator new( size_t size ) {
+    gAllocations.fetch_add( 1 , std::memory_order_relaxed );
+    void *ptr = ::malloc( size > 0 ? size : 1 );
+    if (ptr == nullptr) {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+void operator delete( void *ptr ) noexcept {
+    ::free( ptr );
+}
+
+void operator delete( void *ptr , size_t ) noexcept {
+    ::free( ptr );
+}
+
+// 本机累计发出的TCP段数，/proc/net/snmp中第一个Tcp:行是列名，第二个是数值
+static int64_t tcpOutSegments() {
+    int64_t value = 0;
+    FILE *fp = ::fopen( "/proc/net/snmp" , "r" );
+    if (fp == nullptr) {
+        return 0;
+    }
+    char line[512];
+    int column = -1;
+    while (::fgets( line , sizeof line , fp ) != nullptr) {
+        if (::strncmp( line , "Tcp:" , 4 ) != 0) {
+            continue;
+        }
+        bool header = column < 0;
+        char *save = nullptr;
+        int index = 0;
+        for (char *field = ::strtok_r( line , " \n" , &save ); field != nullptr; field = ::strtok_r( nullptr , " \n" , &save )) {
+            if (header && ::strcmp( field , "OutSegs" ) == 0) {
+                column = index;
+            }
+            else if (!header && index == column) {
+                value = ::strtoll( field , nullptr , 10 );
+            }
+            ++index;
+        }
+    }
+    ::fclose( fp );
+    return value;
+}
+
+// 线程累计的cpu时间（用户态加内核态），毫秒；stat中进程名之后第12、13个字段为utime、stime
+static int64_t threadCpuMs( pid_t tid ) {
+    char path[64];
+    snprintf( path , sizeof path , "/proc/self/task/%d/stat" , static_cast<int>( tid ) );
+    FILE *fp = ::fopen( path , "r" );
+    if (fp == nullptr) {
+        return 0;
+    }
+    char line[1024];
+    int64_t ticks = 0;
+    if (::fgets( line , sizeof line , fp ) != nullptr) {
+        // 进程名可能包含空格和括号，从最后一个')'之后开始数
+        char *p = ::strrchr( line , ')' );
+        long long utime = 0 , stime = 0;
+        if (p != nullptr && ::sscanf( p + 1 , " %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lld %lld" , &utime , &stime ) == 2) {
+            ticks = utime + stime;
+        }
+    }
+    ::fclose( fp );
+    return ticks * 1000 / ::sysconf( _SC_CLK_TCK );
+}
+
+class BenchServer {
+public:
+    BenchServer( EventLoop *loop , const InetAddress &addr , const BenchOptions &options )
+        : loop_( loop )
+        , server_( loop , addr , "bench" , options.has( "reuseport" ) ? TcpServer::kReusePort : TcpServer::kNoReusePort )
+        , backpressure_( options.getInt( "backpressure" , 0 ) )
+        , coroutine_( options.has( "coroutine" ) )
+        , fragments_( options.getInt( "fragments" , 1 ) )
+        , autoCork_( options.has( "auto-cork" ) )
+        , label_( options.get( "label" , "" ) )
+        , peakBuffered_( 0 )
+        , accepted_( 0 )
+        , lastAccepted_( 0 )
+        , lastAllocations_( 0 )
+        , allocsPerConnection_( 0 )
+        , responses_( 0 )
+        , lastResponses_( 0 )
+        , lastWriteSyscalls_( writeSyscalls() )
+        , lastSegments_( tcpOutSegments() )
+        , writesPerResponse_( 0 )
+        , segmentsPerResponse_( 0 ) {
+        server_.setConnectionCallback( std::bind( &BenchServer::onConnection , this , std::placeholders::_1 ) );
+        if (options.has( "unix" )) {
+            server_.addListenAddress( InetAddress::unixAddress( options.get( "unix" , "" ) ) );
+        }
+        if (!coroutine_) {
+            server_.setMessageCallback( std::bind( &BenchServer::onMessage , this ,
+                std::placeholders::_1 , std::placeholders::_2 , std::placeholders::_3 ) );
+        }
+        server_.setThreadNum( static_cast<int>( options.getInt( "threads" , 0 ) ) );
+
+        std::string balance = options.get( "balance" , "rr" );
+        if (balance == "least-conn") {
+            server_.setLoadBalance( EventLoopThreadPool::kLeastConnections );
+        }
+        else if (balance == "least-util") {
+            server_.setLoadBalance( EventLoopThreadPool::kLeastUtilization );
+        }
+        else if (balance == "hash") {
+            server_.setLoadBalance( EventLoopThreadPool::kConsistentHash );
+        }
+        if (options.has( "cpus" )) {
+            server_.setThreadCpuAffinity( parseCpuList( options.get( "cpus" , "" ) ) );
+            server_.setThreadNumaLocal( options.has( "numa" ) );
+        }
+
+        int64_t budget = options.getInt( "budget" , 0 );
+        if (budget > 0) {
+            std::string policy = options.get( "budget-policy" , "pause" );
+            MemoryBudget::instance().setLimit( budget ,
+                policy == "reject" ? MemoryBudget::kRejectAccepts :
+                policy == "close" ? MemoryBudget::kCloseConnections : MemoryBudget::kPauseReading );
+        }
+
+#ifdef MYMUDUO_TLS
+        if (options.has( "tls-cert" )) {
+            std::shared_ptr<TlsContext> tls = TlsContext::newServerContext( options.get( "tls-cert" , "" ) , options.get( "tls-key" , "" ) );
+            if (!tls) {
+                LOG_FATAL( "bench_server - cannot create TLS context \n" );
+            }
+            tls->setKtls( !options.has( "no-ktls" ) );
+            server_.setTlsContext( tls );
+        }
+#endif
+
+        double interval = options.getDouble( "report-interval" , 0 );
+        if (interval > 0) {
+            loop_->runEvery( interval , std::bind( &BenchServer::report , this ) );
+        }
+    }
+
+    void start() { server_.start(); }
+    TcpServer *tcpServer() { return &server_; }
+private:
+    void onConnection( const TcpConnectionPtr &conn ) {
+        if (!conn->connected()) {
+            return;
+        }
+        accepted_.fetch_add( 1 , std::memory_order_relaxed );
+        if (backpressure_ > 0) {
+            conn->setReadBackpressure( backpressure_ , backpressure_ / 2 );
+        }
+        conn->setAutoCork( autoCork_ );
+#ifdef MYMUDUO_COROUTINE
+        if (coroutine_) {
+            co_spawn( conn->getLoop() , echo( conn ) );
+        }
+#endif
+    }
+
+    void onMessage( const TcpConnectionPtr &conn , Buffer *buf , Timestamp ) {
+        responses_.fetch_add( 1 , std::memory_order_relaxed );
+        if (fragments_ <= 1) {
+            conn->send( buf->retrieveAllAsString() );
+            return;
+        }
+        // 回复分成fragments_段依次send，最后一段包括余数
+        size_t len = buf->readableBytes();
+        size_t piece = len / fragments_;
+        for (int64_t i = 1; i < fragments_ && piece > 0; ++i) {
+            conn->send( buf->retrieveAsString( piece ) );
+        }
+        conn->send( buf->retrieveAllAsString() );
+    }
+
+#ifdef MYMUDUO_COROUTINE
+    static Task<> echo( TcpConnectionPtr conn ) {
+        while (Buffer *buf = co_await conn->readAtLeast( 1 )) {
+            if (!co_await conn->write( buf->retrieveAllAsString() )) {
+                break;
+            }
+        }
+    }
+#endif
+
+    void report() {
+        MemoryBudget &budget = MemoryBudget::instance();
+        int64_t buffered = budget.usage();
+        if (buffered > peakBuffered_) {
+            peakBuffered_ = buffered;
+        }
+        int64_t accepted = accepted_.load( std::memory_order_relaxed );
+        int64_t allocations = gAllocations.load( std::memory_order_relaxed );
+        if (accepted > lastAccepted_) {
+            allocsPerConnection_ = static_cast<double>( allocations - lastAllocations_ ) / ( accepted - lastAccepted_ );
+        }
+        lastAccepted_ = accepted;
+        lastAllocations_ = allocations;
+        int64_t responses = responses_.load( std::memory_order_relaxed );
+        int64_t writes = writeSyscalls();
+        int64_t segments = tcpOutSegments();
+        if (responses > lastResponses_) {
+            writesPerResponse_ = static_cast<double>( writes - lastWriteSyscalls_ ) / ( responses - lastResponses_ );
+            segmentsPerResponse_ = static_cast<double>( segments - lastSegments_ ) / ( responses - lastResponses_ );
+        }
+        lastResponses_ = responses;
+        lastWriteSyscalls_ = writes;
+        lastSegments_ = segments;
+
+        // 每个loop线程的cpu时间，负载不均时繁忙连接集中的loop明显高于平均值
+        std::string loopCpu;
+        std::string loopUtil;
+        int64_t cpuMax = 0;
+        int64_t cpuSum = 0;
+        std::vector<EventLoop *> loops = server_.loops();
+        for (EventLoop *loop : loops) {
+            int64_t cpu = threadCpuMs( loop->threadId() );
+            cpuSum += cpu;
+            if (cpu > cpuMax) {
+                cpuMax = cpu;
+            }
+            if (!loopCpu.empty()) {
+                loopCpu += ",";
+                loopUtil += ",";
+            }
+            loopCpu += std::to_string( cpu );
+            loopUtil += std::to_string( loop->utilization() );
+        }
+        double spread = cpuSum > 0 ? static_cast<double>( cpuMax ) * loops.size() / cpuSum : 0;
+        JsonLine()
+            .add( "benchmark" , "server" )
+            .add( "label" , label_ )
+            .add( "connections" , budget.connections() )
+            .add( "buffered_bytes" , buffered )
+            .add( "peak_buffered_bytes" , peakBuffered_ )
+            .add( "budget_bytes" , static_cast<int64_t>( budget.limit() ) )
+            .add( "rss_kb" , procStatusKb( "VmRSS" ) )
+            .add( "peak_rss_kb" , procStatusKb( "VmHWM" ) )
+            .add( "accepted" , accepted )
+            .add( "allocs_per_connection" , allocsPerConnection_ )
+            .add( "responses" , responses )
+            .add( "write_syscalls_per_response" , writesPerResponse_ )
+            .add( "tcp_segments_per_response" , segmentsPerResponse_ )
+            .add( "loop_cpu_ms" , loopCpu )
+            .add( "loop_cpu_spread" , spread )
+            .add( "loop_utilization" , loopUtil )
+            .print();
+    }
+
+    EventLoop *loop_;
+    TcpServer server_;
+    const int64_t backpressure_;
+    const bool coroutine_;
+    const int64_t fragments_;
+    const bool autoCork_;
+    const std::string label_;
+    int64_t peakBuffered_;
+    std::atomic<int64_t> accepted_;
+    int64_t lastAccepted_;
+    int64_t lastAllocations_;
+    double allocsPerConnection_;
+    std::atomic<int64_t> responses_;    // 非协程模式下处理的消息数
+    int64_t lastResponses_;
+    int64_t lastWriteSyscalls_;
+    int64_t lastSegments_;
+    double writesPerResponse_;
+    double segmentsPerResponse_;
+};
+
+int main( int argc , char *argv[] ) {
+    BenchOptions options( argc , argv );
+#ifndef MYMUDUO_COROUTINE
+    if (options.has( "coroutine" )) {
+        LOG_FATAL( "--coroutine requires building with -DMYMUDUO_COROUTINE=ON \n" );
+    }
+#endif
+#ifndef MYMUDUO_TLS
+    if (options.has( "tls-cert" )) {
+        LOG_FATAL( "--tls-cert requires building with -DMYMUDUO_TLS=ON \n" );
+    }
+#endif
+    Tracer::setSampleRate( static_cast<uint32_t>( options.getInt( "trace-sample" , 0 ) ) );
+    EventLoop loop;
+    InetAddress addr( static_cast<uint16_t>( options.getInt( "port" , 9981 ) ) , options.get( "ip" , "127.0.0.1" ) );
+    BenchServer server( &loop , addr , options );
+
+    std::unique_ptr<HotRestart> restart;
+    if (options.has( "hot-restart" )) {
+        restart.reset( new HotRestart( &loop , InetAddress::unixAddress( options.get( "hot-restart" , "" ) ) ) );
+        if (restart->inherit()) {
+            server.tcpServer()->adoptListenFds( restart->inheritedFds() );
+        }
+        restart->addServer( server.tcpServer() );
+        double drainTimeout = options.getDouble( "drain-timeout" , 10 );
+        HotRestart *r = restart.get();
+        restart->setHandoverCallback( [r , drainTimeout , &loop] () {
+            r->drain( drainTimeout , [&loop] () { loop.quit(); } );
+        } );
+    }
+    std::unique_ptr<StatsServer> stats;
+    if (options.has( "stats-port" )) {
+        InetAddress statsAddr( static_cast<uint16_t>( options.getInt( "stats-port" , 0 ) ) , options.get( "ip" , "127.0.0.1" ) );
+        stats.reset( new StatsServer( &loop , statsAddr ) );
+        stats->addServer( server.tcpServer() );
+    }
+    server.start();
+    std::unique_ptr<Watchdog> watchdog;
+    if (options.has( "watchdog" )) {
+        watchdog.reset( new Watchdog( options.getDouble( "watchdog" , 1.0 ) ) );
+        watchdog->addLoops( server.tcpServer()->loops() );
+        watchdog->start();
+        if (stats) {
+            Watchdog *w = watchdog.get();
+            stats->addCounter( "loop_stalls_total" , "Loop iterations that exceeded the stall threshold." ,
+                [w] () { return w->stalls(); } );
+            stats->addGauge( "stalled_loops" , "Loops currently stalled." ,
+                [w] () { return static_cast<int64_t>( w->stalledLoops() ); } );
+            stats->addGauge( "longest_stall_microseconds" , "Longest finished stall." ,
+                [w] () { return w->longestStallUs(); } );
+        }
+    }
+    if (stats) {
+        stats->start();
+    }
+    if (restart) {
+        restart->ready();
+        restart->listen();
+    }
+    loop.loop();
+    return 0;
+}
@@ -0,0 +1,335 @@
+/**
+ * 广播扇出压测：服务端把同一条消息发给所有连接，接收端只读取
+ *
+ *  broadcast_bench [--connections=50000] [--messages=10] [--size=1024] [--threads=1] [--client-threads=1]
+ *                  [--mode=shared|copy] [--ip=127.0.0.1] [--port=9981] [--label=name]
+ *
+ * 接收端在fork出的子进程中（client-threads个loop线程），内存只统计服务端进程；
+ * 每个进程把RLIMIT_NOFILE提高到硬限制，不够连接数时退出；
+ * 每个监听端口最多接入20000个连接（本地端口范围的限制），超过时服务端依次多监听几个端口
+ *
+ * 连接全部建立后广播messages次，接收端收齐全部字节后经管道通知服务端：
+ *  - shared：TcpServer::broadcast，每个io loop一个任务，连接只保存消息的引用
+ *  - copy：逐个连接跨线程send，每个连接拷贝一次消息并各自投递任务
+ * 输出每秒送达的消息数（消息数 x 连接数），服务端的常驻内存、广播期间常驻内存的增长峰值和operator new次数
+*/
+#include "BenchCommon.h"
+
+#include "TcpServer.h"
+#include "TcpClient.h"
+#include "TcpConnection.h"
+#include "EventLoop.h"
+#include "EventLoopThread.h"
+#include "Buffer.h"
+#include "Logger.h"
+#include "Timestamp.h"
+
+#include <string>
+#include <vector>
+#include <set>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <new>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+static std::atomic<int64_t> gAllocations( 0 );
+
+void *operator new( size_t size ) {
+    gAllocations.fetch_add( 1 , std::memory_order_relaxed );
+    void *ptr = ::malloc( size > 0 ? size : 1 );
+    if (ptr == nullptr) {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+void operator delete( void *ptr ) noexcept {
+    ::free( ptr );
+}
+
+void operator delete( void *ptr , size_t ) noexcept {
+    ::free( ptr );
+}
+
+static const int kConnectionsPerPort = 20000;
+static const int kConnectBatch = 1000;  // 接收端每批发起的连接数，避免一次发起过多超出监听队列
+
+// 两个进程共用的参数
+struct BenchConfig {
+    explicit BenchConfig( const BenchOptions &options )
+        : ip( options.get( "ip" , "127.0.0.1" ) )
+        , port( static_cast<uint16_t>( options.getInt( "port" , 9981 ) ) )
+        , connections( static_cast<int>( options.getInt( "connections" , 50000 ) ) )
+        , ports( ( connections + kConnectionsPerPort - 1 ) / kConnectionsPerPort )
+        , messages( options.getInt( "messages" , 10 ) )
+        , messageSize( static_cast<size_t>( options.getInt( "size" , 1024 ) ) ) {}
+
+    const std::string ip;
+    const uint16_t port;
+    const int connections;
+    const int ports;
+    const int64_t messages;
+    const size_t messageSize;
+};
+
+/**
+ * 子进程：分批建立全部连接，收齐messages x size字节后向doneFd写一个字节，
+ * 之后等待startFd关闭（服务端统计完毕）再退出，退出时由内核关闭所有连接
+*/
+class Receivers : noncopyable {
+public:
+    Receivers( const BenchConfig &config , int threads , int startFd , int doneFd )
+        : config_( config )
+        , startFd_( startFd )
+        , doneFd_( doneFd )
+        , received_( 0 )
+        , expected_( static_cast<int64_t>( config.messageSize ) * config.messages * config.connections )
+        , established_( 0 ) {
+        for (int i = 0; i < threads; ++i) {
+            threads_.push_back( std::unique_ptr<EventLoopThread>( new EventLoopThread() ) );
+            loops_.push_back( threads_.back()->startLoop() );
+        }
+    }
+
+    void run() {
+        char c;
+        if (::read( startFd_ , &c , 1 ) != 1) {
+            return;     // 服务端没有启动
+        }
+        for (int i = 0; i < config_.connections; ++i) {
+            EventLoop *loop = loops_[i % loops_.size()];
+            InetAddress serverAddr( static_cast<uint16_t>( config_.port + i % config_.ports ) , config_.ip );
+            char name[32];
+            snprintf( name , sizeof name , "receiver%d" , i );
+            TcpClient *client = new TcpClient( loop , serverAddr , name );
+            client->setConnectionCallback( std::bind( &Receivers::onConnection , this , std::placeholders::_1 ) );
+            client->setMessageCallback( std::bind( &Receivers::onMessage , this ,
+                std::placeholders::_1 , std::placeholders::_2 , std::placeholders::_3 ) );
+            clients_.push_back( std::unique_ptr<TcpClient>( client ) );
+            loop->runInLoop( std::bind( &TcpClient::connect , client ) );
+
+            if (( i + 1 ) % kConnectBatch == 0 || i + 1 == config_.connections) {
+                std::unique_lock<std::mutex> lock( mutex_ );
+                if (!cond_.wait_for( lock , std::chrono::seconds( 30 ) , [this , i] () { return established_ == i + 1; } )) {
+                    LOG_FATAL( "broadcast_bench - only %d of %d connections established \n" , established_ , i + 1 );
+                }
+            }
+        }
+        // 读到EOF说明服务端已经统计完毕
+        while (::read( startFd_ , &c , 1 ) > 0) {
+        }
+    }
+private:
+    void onConnection( const TcpConnectionPtr &conn ) {
+        if (conn->connected()) {
+            std::unique_lock<std::mutex> lock( mutex_ );
+            ++established_;
+            cond_.notify_all();
+        }
+    }
+
+    void onMessage( const TcpConnectionPtr & , Buffer *buf , Timestamp ) {
+        int64_t received = received_.fetch_add( buf->readableBytes() , std::memory_order_relaxed ) + buf->readableBytes();
+        buf->retrieveAll();
+        if (received == expected_) {
+            char c = 1;
+            if (::write( doneFd_ , &c , 1 ) != 1) {
+                LOG_ERROR( "broadcast_bench - cannot notify the server \n" );
+            }
+        }
+    }
+
+    const BenchConfig &config_;
+    const int startFd_;
+    const int doneFd_;
+    std::vector<std::unique_ptr<EventLoopThread>> threads_;
+    std::vector<EventLoop *> loops_;
+    std::vector<std::unique_ptr<TcpClient>> clients_;  // 进程退出时不析构
+    std::atomic<int64_t> received_;
+    const int64_t expected_;
+
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    int established_;
+};
+
+// 父进程：服务端
+class BroadcastBench : noncopyable {
+public:
+    BroadcastBench( EventLoop *loop , const BenchOptions &options , const BenchConfig &config , int startFd , int doneFd )
+        : loop_( loop )
+        , options_( options )
+        , config_( config )
+        , server_( loop , InetAddress( config.port , config.ip ) , "broadcast-bench" )
+        , shared_( options.get( "mode" , "shared" ) != "copy" )
+        , startFd_( startFd )
+        , doneFd_( doneFd )
+        , live_( 0 ) {
+        server_.setThreadNum( static_cast<int>( options.getInt( "threads" , 1 ) ) );
+        server_.setListenBacklog( kConnectBatch * 2 );
+        for (int i = 1; i < config.ports; ++i) {
+            server_.addListenAddress( InetAddress( static_cast<uint16_t>( config.port + i ) , config.ip ) );
+        }
+        server_.setConnectionCallback( std::bind( &BroadcastBench::onConnection , this , std::placeholders::_1 ) );
+    }
+
+    void start() {
+        server_.start();
+        driver_ = std::thread( &BroadcastBench::drive , this );
+    }
+
+    // loop退出后调用
+    void stop() {
+        driver_.join();
+    }
+private:
+    // 在服务端的io线程中调用
+    void onConnection( const TcpConnectionPtr &conn ) {
+        std::unique_lock<std::mutex> lock( mutex_ );
+        if (conn->connected()) {
+            connections_.push_back( conn );
+            serverLoops_.insert( conn->getLoop() );
+            ++live_;
+        }
+        else {
+            --live_;
+        }
+        cond_.notify_all();
+    }
+
+    void drive() {
+        // 监听socket在start中已经listen，通知接收端开始连接
+        char c = 1;
+        if (::write( startFd_ , &c , 1 ) != 1) {
+            LOG_FATAL( "broadcast_bench - cannot start the receivers \n" );
+        }
+        {
+            std::unique_lock<std::mutex> lock( mutex_ );
+            if (!cond_.wait_for( lock , std::chrono::seconds( 30 + config_.connections / 100 ) ,
+                [this] () { return static_cast<int>( connections_.size() ) == config_.connections; } )) {
+                LOG_FATAL( "broadcast_bench - only %d of %d connections accepted \n" , (int)connections_.size() , config_.connections );
+            }
+        }
+
+        int64_t rss = procStatusKb( "VmRSS" );
+        // 重置VmHWM，之后的峰值只反映广播期间
+        FILE *fp = ::fopen( "/proc/self/clear_refs" , "w" );
+        if (fp != nullptr) {
+            ::fputs( "5" , fp );
+            ::fclose( fp );
+        }
+        int64_t allocations = gAllocations.load( std::memory_order_relaxed );
+        Timestamp start( Timestamp::now() );
+        for (int64_t i = 0; i < config_.messages; ++i) {
+            char fill = static_cast<char>( 'a' + i % 26 );
+            if (shared_) {
+                server_.broadcast( std::make_shared<const std::string>( config_.messageSize , fill ) );
+            }
+            else {
+                std::string message( config_.messageSize , fill );
+                for (const TcpConnectionPtr &conn : connections_) {
+                    conn->send( message );
+                }
+            }
+        }
+        if (::read( doneFd_ , &c , 1 ) != 1) {
+            LOG_FATAL( "broadcast_bench - receivers exited before receiving all messages \n" );
+        }
+        double elapsed = timeDifference( Timestamp::now() , start );
+        allocations = gAllocations.load( std::memory_order_relaxed ) - allocations;
+        int64_t peak = procStatusKb( "VmHWM" );
+
+        int64_t delivered = config_.messages * config_.connections;
+        JsonLine()
+            .add( "benchmark" , "broadcast" )
+            .add( "label" , options_.get( "label" , "" ) )
+            .add( "mode" , shared_ ? "shared" : "copy" )
+            .add( "connections" , config_.connections )
+            .add( "message_size" , static_cast<int64_t>( config_.messageSize ) )
+            .add( "broadcasts" , config_.messages )
+            .add( "messages" , delivered )
+            .add( "seconds" , elapsed )
+            .add( "messages_per_sec" , delivered / elapsed )
+            .add( "mb_per_sec" , static_cast<double>( delivered ) * config_.messageSize / elapsed / 1024 / 1024 )
+            .add( "rss_mb" , rss / 1024.0 )
+            .add( "peak_memory_growth_mb" , ( peak > rss ? peak - rss : 0 ) / 1024.0 )
+            .add( "allocs_per_message" , static_cast<double>( allocations ) / delivered )
+            .print();
+
+        // 通知接收端退出，服务端的连接都断开、io loop执行完TcpServer::removeConnection后再退出
+        connections_.clear();
+        ::close( startFd_ );
+        std::unique_lock<std::mutex> lock( mutex_ );
+        cond_.wait_for( lock , std::chrono::seconds( 30 ) , [this] () { return live_ == 0; } );
+        int pending = static_cast<int>( serverLoops_.size() );
+        for (EventLoop *ioLoop : serverLoops_) {
+            ioLoop->queueInLoop( [this , &pending] () {
+                std::unique_lock<std::mutex> guard( mutex_ );
+                --pending;
+                cond_.notify_all();
+            } );
+        }
+        cond_.wait( lock , [&pending] () { return pending == 0; } );
+        loop_->quit();
+    }
+
+    EventLoop *loop_;
+    const BenchOptions &options_;
+    const BenchConfig &config_;
+    TcpServer server_;
+    const bool shared_;
+    const int startFd_;
+    const int doneFd_;
+
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    std::vector<TcpConnectionPtr> connections_;  // 受mutex_保护，广播开始之后只读
+    int live_;  // 服务端尚未断开的连接数
+    std::set<EventLoop *> serverLoops_;
+    std::thread driver_;
+};
+
+int main( int argc , char *argv[] ) {
+    BenchOptions options( argc , argv );
+    BenchConfig config( options );
+    if (!raiseFdLimit( config.connections + 256 )) {
+        LOG_FATAL( "broadcast_bench - needs %d fds per process, raise the limit with ulimit -n \n" , config.connections + 256 );
+    }
+
+    // startPipe：服务端通知开始连接，关闭时通知退出；donePipe：接收端收齐数据
+    int startPipe[2];
+    int donePipe[2];
+    if (::pipe( startPipe ) < 0 || ::pipe( donePipe ) < 0) {
+        LOG_FATAL( "broadcast_bench - pipe failed \n" );
+    }
+    // 在创建任何线程之前fork
+    pid_t pid = ::fork();
+    if (pid < 0) {
+        LOG_FATAL( "broadcast_bench - fork failed \n" );
+    }
+    if (pid == 0) {
+        ::close( startPipe[1] );
+        ::close( donePipe[0] );
+        Receivers receivers( config , static_cast<int>( options.getInt( "client-threads" , 1 ) ) , startPipe[0] , donePipe[1] );
+        receivers.run();
+        ::_exit( 0 );
+    }
+    ::close( startPipe[0] );
+    ::close( donePipe[1] );
+
+    EventLoop loop;
+    BroadcastBench bench( &loop , options , config , startPipe[1] , donePipe[0] );
+    bench.start();
+    loop.loop();
+    bench.stop();
+    ::waitpid( pid , nullptr , 0 );
+    return 0;
+}
@@ -0,0 +1,117 @@
+#!/usr/bin/env python3
+"""比较两次构建的压测结果，变差超过阈值时返回非0
+
+  benchmark/compare.py baseline contender [--threshold=5]
+
+支持两种结果文件：
+  - micro_bench --benchmark_out=x.json --benchmark_out_format=json 的输出，比较cpu_time
+  - run_benchmarks.sh 输出的JSON行，按benchmark+label配对，比较每个场景的主要指标
+"""
+
+import json
+import sys
+
+# run_benchmarks.sh的每种结果：(指标, 是否越大越好)
+LINE_METRICS = {
+    "pingpong": [("mb_per_sec", True)],
+    "flood": [("mb_per_sec", True)],
+    "latency": [("p50_us", False), ("p99_us", False), ("p999_us", False), ("requests_per_sec", True)],
+    "churn": [("per_sec", True)],
+    "server": [("peak_buffered_bytes", False), ("peak_rss_kb", False), ("allocs_per_connection", False),
+               ("write_syscalls_per_response", False), ("tcp_segments_per_response", False),
+               ("loop_cpu_spread", False)],
+    "relay": [("cpu_seconds_per_gb", False)],
+    "udp": [("packets_per_sec", True)],
+    "send": [("messages_per_sec", True), ("write_syscalls_per_message", False)],
+    "broadcast": [("messages_per_sec", True), ("peak_memory_growth_mb", False)],
+    "pubsub": [("messages_per_sec", True), ("p50_us", False), ("p99_us", False)],
+    "hot_restart": [("max_connection_ms", False)],
+}
+
+
+def load(path):
+    """返回 {名称: [(指标, 值, 是否越大越好)]}"""
+    with open(path) as f:
+        text = f.read()
+    try:
+        doc = json.loads(text)
+    except ValueError:
+        doc = None
+    if isinstance(doc, dict) and "benchmarks" in doc:
+        return load_google_benchmark(doc)
+    return load_lines(text)
+
+
+def load_google_benchmark(doc):
+    runs = doc["benchmarks"]
+    # 使用了--benchmark_repetitions时只比较中位数
+    if any(r.get("aggregate_name") == "median" for r in runs):
+        runs = [r for r in runs if r.get("aggregate_name") == "median"]
+    else:
+        runs = [r for r in runs if r.get("run_type", "iteration") == "iteration"]
+    result = {}
+    for r in runs:
+        name = r.get("run_name", r["name"])
+        result[name] = [("cpu_time_" + r.get("time_unit", "ns"), r["cpu_time"], False)]
+    return result
+
+
+def load_lines(text):
+    result = {}
+    for line in text.splitlines():
+        line = line.strip()
+        if not line.startswith("{"):
+            continue
+        row = json.loads(line)
+        kind = row.get("benchmark")
+        if kind not in LINE_METRICS:
+            continue
+        name = kind + "/" + row.get("label", "")
+        result[name] = [(m, row[m], higher) for m, higher in LINE_METRICS[kind] if m in row]
+    return result
+
+
+def main(argv):
+    threshold = 5.0
+    paths = []
+    for arg in argv[1:]:
+        if arg.startswith("--threshold="):
+            threshold = float(arg.split("=", 1)[1])
+        else:
+            paths.append(arg)
+    if len(paths) != 2:
+        print(__doc__)
+        return 2
+
+    baseline, contender = load(paths[0]), load(paths[1])
+    regressions = 0
+    print("%-60s %-22s %14s %14s %9s" % ("benchmark", "metric", "baseline", "contender", "change"))
+    for name in sorted(baseline):
+        if name not in contender:
+            print("%-60s missing in %s" % (name, paths[1]))
+            continue
+        new_metrics = dict((m, v) for m, v, _ in contender[name])
+        for metric, old, higher in baseline[name]:
+            if metric not in new_metrics:
+                continue
+            new = new_metrics[metric]
+            change = (new - old) / old * 100.0 if old else 0.0
+            worse = -change if higher else change
+            flag = ""
+            if worse > threshold:
+                flag = "  REGRESSION"
+                regressions += 1
+            elif worse < -threshold:
+                flag = "  improved"
+            print("%-60s %-22s %14.3f %14.3f %+8.1f%%%s" % (name, metric, old, new, change, flag))
+    for name in sorted(set(contender) - set(baseline)):
+        print("%-60s new in %s" % (name, paths[1]))
+
+    if regressions:
+        print("%d metric(s) regressed by more than %.1f%%" % (regressions, threshold))
+        return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv))
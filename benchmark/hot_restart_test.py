@@ -0,0 +1,150 @@
+#!/usr/bin/env python3
+"""热重启测试：持续建立短连接的同时多次重启bench_server，统计被拒绝或出错的连接
+
+  benchmark/hot_restart_test.py [--build=build] [--port=9981] [--restarts=3] [--interval=1]
+                                [--workers=8] [--threads=2] [--reuseport] [--label=name]
+
+每次重启启动一个参数相同的新bench_server，它从旧进程继承监听socket，旧进程停止accept、连接处理完后退出
+每个worker循环执行 连接、发送64字节、读回64字节、关闭，连接被拒绝、重置或超时都计为失败
+输出一行JSON，有失败或旧进程没有按时退出时返回1
+"""
+
+import json
+import os
+import socket
+import subprocess
+import sys
+import threading
+import time
+
+MESSAGE = b"x" * 64
+
+
+def parse_args(argv):
+    args = {"build": "build", "port": "9981", "restarts": "3", "interval": "1",
+            "workers": "8", "threads": "2", "label": ""}
+    for arg in argv[1:]:
+        if not arg.startswith("--"):
+            print(__doc__)
+            sys.exit(2)
+        key, _, value = arg[2:].partition("=")
+        args[key] = value if value else "1"
+    return args
+
+
+class Load:
+    def __init__(self, port, workers):
+        self.port = port
+        self.stopped = False
+        self.lock = threading.Lock()
+        self.ok = 0
+        self.refused = 0
+        self.errors = 0
+        self.max_ms = 0.0
+        self.threads = [threading.Thread(target=self.run) for _ in range(workers)]
+
+    def start(self):
+        for t in self.threads:
+            t.start()
+
+    def stop(self):
+        self.stopped = True
+        for t in self.threads:
+            t.join()
+
+    def run(self):
+        while not self.stopped:
+            begin = time.monotonic()
+            try:
+                with socket.create_connection(("127.0.0.1", self.port), timeout=3) as s:
+                    s.sendall(MESSAGE)
+                    received = 0
+                    while received < len(MESSAGE):
+                        data = s.recv(len(MESSAGE) - received)
+                        if not data:
+                            raise ConnectionResetError("closed before reply")
+                        received += len(data)
+                result = "ok"
+            except ConnectionRefusedError:
+                result = "refused"
+            except OSError:
+                result = "error"
+            elapsed = (time.monotonic() - begin) * 1000
+            with self.lock:
+                if result == "ok":
+                    self.ok += 1
+                    self.max_ms = max(self.max_ms, elapsed)
+                elif result == "refused":
+                    self.refused += 1
+                else:
+                    self.errors += 1
+
+
+def wait_listening(port, timeout=5):
+    deadline = time.monotonic() + timeout
+    while time.monotonic() < deadline:
+        try:
+            socket.create_connection(("127.0.0.1", port), timeout=1).close()
+            return True
+        except OSError:
+            time.sleep(0.1)
+    return False
+
+
+def main(argv):
+    args = parse_args(argv)
+    server = os.path.join(args["build"], "benchmark", "bench_server")
+    if not os.access(server, os.X_OK):
+        print("bench_server not found under %s/benchmark" % args["build"], file=sys.stderr)
+        return 1
+    port = int(args["port"])
+    command = [server, "--port=%d" % port, "--threads=" + args["threads"],
+               "--hot-restart=@mymuduo-hot-restart-%d" % os.getpid(), "--drain-timeout=5"]
+    if "reuseport" in args:
+        command.append("--reuseport")
+
+    log = open(os.devnull, "w")
+    current = subprocess.Popen(command, stdout=log, stderr=log)
+    if not wait_listening(port):
+        current.kill()
+        print("bench_server did not start", file=sys.stderr)
+        return 1
+
+    load = Load(port, int(args["workers"]))
+    load.start()
+    failures = 0
+    try:
+        for _ in range(int(args["restarts"])):
+            time.sleep(float(args["interval"]))
+            old, current = current, subprocess.Popen(command, stdout=log, stderr=log)
+            try:
+                # 新进程就绪后旧进程drain并退出
+                if old.wait(timeout=15) != 0:
+                    failures += 1
+            except subprocess.TimeoutExpired:
+                old.kill()
+                failures += 1
+            if current.poll() is not None:
+                failures += 1
+                break
+        time.sleep(float(args["interval"]))
+    finally:
+        load.stop()
+        current.terminate()
+        current.wait()
+
+    print(json.dumps({
+        "benchmark": "hot_restart",
+        "label": args["label"],
+        "restarts": int(args["restarts"]),
+        "connections": load.ok,
+        "refused": load.refused,
+        "errors": load.errors,
+        "max_connection_ms": round(load.max_ms, 3),
+        "failed_restarts": failures,
+    }))
+    return 1 if load.refused or load.errors or failures else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv))
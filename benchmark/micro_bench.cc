@@ -0,0 +1,274 @@
+/**
+ * 核心组件的微基准测试，基于Google Benchmark
+ *
+ *  micro_bench [--benchmark_filter=Buffer] [--benchmark_out=micro.json --benchmark_out_format=json]
+ *
+ * 两次构建的json结果可以用benchmark/compare.py比较
+ * 库默认不开优化，测量前用 -DCMAKE_BUILD_TYPE=Release 配置
+*/
+#include "Buffer.h"
+#include "Channel.h"
+#include "EventLoop.h"
+#include "EventLoopThread.h"
+#include "Logger.h"
+#include "Timestamp.h"
+#include "noncopyable.h"
+
+#include <benchmark/benchmark.h>
+
+#include <string>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <functional>
+#include <fcntl.h>
+#include <malloc.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+// append后全部取走，缓冲区一直复用同一块内存
+static void BM_BufferAppendRetrieveAll( benchmark::State &state ) {
+    const std::string data( state.range( 0 ) , 'x' );
+    Buffer buf;
+    for (auto _ : state) {
+        buf.append( data.data() , data.size() );
+        buf.retrieveAll();
+    }
+    state.SetBytesProcessed( state.iterations() * data.size() );
+}
+BENCHMARK( BM_BufferAppendRetrieveAll )->Arg( 16 )->Arg( 256 )->Arg( 4096 )->Arg( 65536 );
+
+// 缓冲区中始终留有半个块的数据，readerIndex_不断后移，可写空间不足时makeSpace把剩余数据挪到头部
+static void BM_BufferAppendPartialRetrieve( benchmark::State &state ) {
+    const std::string data( state.range( 0 ) , 'x' );
+    Buffer buf;
+    buf.append( data.data() , data.size() / 2 );
+    for (auto _ : state) {
+        buf.append( data.data() , data.size() );
+        buf.retrieve( data.size() );
+    }
+    state.SetBytesProcessed( state.iterations() * data.size() );
+}
+BENCHMARK( BM_BufferAppendPartialRetrieve )->Arg( 16 )->Arg( 256 )->Arg( 4096 );
+
+// 新建的缓冲区不断append，makeSpace反复扩容
+static void BM_BufferGrow( benchmark::State &state ) {
+    const std::string data( 512 , 'x' );
+    const int64_t total = state.range( 0 );
+    for (auto _ : state) {
+        Buffer buf;
+        for (int64_t n = 0; n < total; n += data.size()) {
+            buf.append( data.data() , data.size() );
+        }
+        benchmark::DoNotOptimize( buf.peek() );
+    }
+    state.SetBytesProcessed( state.iterations() * total );
+}
+BENCHMARK( BM_BufferGrow )->Arg( 64 * 1024 )->Arg( 1024 * 1024 );
+
+// socketpair一端写入，另一端用readFd读入Buffer
+static void BM_BufferReadFd( benchmark::State &state ) {
+    int fds[2];
+    if (::socketpair( AF_UNIX , SOCK_STREAM | SOCK_NONBLOCK , 0 , fds ) < 0) {
+        state.SkipWithError( "socketpair failed" );
+        return;
+    }
+    const std::string data( state.range( 0 ) , 'x' );
+    Buffer buf;
+    int savedErrno = 0;
+    for (auto _ : state) {
+        state.PauseTiming();
+        ssize_t n = ::write( fds[0] , data.data() , data.size() );
+        state.ResumeTiming();
+        if (buf.readFd( fds[1] , &savedErrno ) != n) {
+            state.SkipWithError( "short read" );
+            break;
+        }
+        buf.retrieveAll();
+    }
+    state.SetBytesProcessed( state.iterations() * data.size() );
+    ::close( fds[0] );
+    ::close( fds[1] );
+}
+BENCHMARK( BM_BufferReadFd )->Arg( 64 )->Arg( 4096 )->Arg( 65536 );
+
+// Logger直接写stdout，基准运行期间把stdout重定向到/dev/null
+class StdoutToNull : noncopyable {
+public:
+    StdoutToNull() : saved_( ::dup( STDOUT_FILENO ) ) {
+        fflush( stdout );
+        int null = ::open( "/dev/null" , O_WRONLY | O_CLOEXEC );
+        ::dup2( null , STDOUT_FILENO );
+        ::close( null );
+    }
+    ~StdoutToNull() {
+        fflush( stdout );
+        ::dup2( saved_ , STDOUT_FILENO );
+        ::close( saved_ );
+    }
+private:
+    int saved_;
+};
+
+// 其它线程向loop投递任务的吞吐量，包括加锁入队和eventfd唤醒
+static void BM_QueueInLoopCrossThread( benchmark::State &state ) {
+    StdoutToNull redirect;  // loop线程启动和退出的日志
+    EventLoopThread thread;
+    EventLoop *loop = thread.startLoop();
+    std::atomic<int64_t> done( 0 );
+    int64_t queued = 0;
+    for (auto _ : state) {
+        loop->queueInLoop( [&done] { done.fetch_add( 1 , std::memory_order_relaxed ); } );
+        ++queued;
+    }
+    // 计时包括loop把任务全部执行完
+    while (done.load( std::memory_order_relaxed ) < queued) {
+        ::usleep( 100 );
+    }
+    state.SetItemsProcessed( queued );
+}
+BENCHMARK( BM_QueueInLoopCrossThread )->UseRealTime();
+
+// 每个线程只能有一个EventLoop，所有在主线程运行的基准共用一个
+static EventLoop *mainLoop() {
+    static EventLoop loop;
+    return &loop;
+}
+
+static void onRead( int64_t *count , Timestamp ) {
+    ++*count;
+}
+
+// Channel::handleEvent的分发开销，range(0)为1时绑定tie，每次分发多一次weak_ptr::lock
+static void BM_ChannelHandleEvent( benchmark::State &state ) {
+    int fd = ::open( "/dev/null" , O_RDONLY | O_CLOEXEC );
+    int64_t count = 0;
+    Channel channel( mainLoop() , fd );
+    channel.setReadCallback( std::bind( &onRead , &count , std::placeholders::_1 ) );
+    std::shared_ptr<int> owner = std::make_shared<int>( 0 );
+    if (state.range( 0 )) {
+        channel.tie( owner );
+    }
+    channel.set_revents( EPOLLIN );
+    Timestamp now = Timestamp::now();
+    for (auto _ : state) {
+        channel.handleEvent( now );
+    }
+    benchmark::DoNotOptimize( count );
+    state.SetItemsProcessed( state.iterations() );
+    ::close( fd );
+}
+BENCHMARK( BM_ChannelHandleEvent )->ArgName( "tied" )->Arg( 0 )->Arg( 1 );
+
+// 紧凑分发的owner，和TcpConnection一样提供四个事件处理函数
+class CompactOwner : noncopyable {
+public:
+    CompactOwner() : reads_( 0 ) {}
+    void handleRead( Timestamp ) { ++reads_; }
+    void handleWrite() {}
+    void handleClose() {}
+    void handleError() {}
+    int64_t reads() const { return reads_; }
+private:
+    int64_t reads_;
+};
+
+// Channel::setOwner的分发开销，函数指针直接调用owner，没有std::function和tie
+static void BM_ChannelHandleEventCompact( benchmark::State &state ) {
+    int fd = ::open( "/dev/null" , O_RDONLY | O_CLOEXEC );
+    CompactOwner owner;
+    Channel channel( mainLoop() , fd );
+    channel.setOwner( &owner );
+    channel.set_revents( EPOLLIN );
+    Timestamp now = Timestamp::now();
+    for (auto _ : state) {
+        channel.handleEvent( now );
+    }
+    benchmark::DoNotOptimize( owner.reads() );
+    state.SetItemsProcessed( state.iterations() );
+    ::close( fd );
+}
+BENCHMARK( BM_ChannelHandleEventCompact );
+
+// TcpConnection原来的接法：四个std::bind回调加tie
+static void setupWithCallbacks( Channel *channel , CompactOwner *owner , const std::shared_ptr<int> &tie ) {
+    channel->setReadCallback( std::bind( &CompactOwner::handleRead , owner , std::placeholders::_1 ) );
+    channel->setWriteCallback( std::bind( &CompactOwner::handleWrite , owner ) );
+    channel->setCloseCallback( std::bind( &CompactOwner::handleClose , owner ) );
+    channel->setErrorCallback( std::bind( &CompactOwner::handleError , owner ) );
+    channel->tie( tie );
+}
+
+/**
+ * 每个连接的Channel的创建开销和内存占用，range(0)为1时使用紧凑分发
+ * bytes_per_channel为Channel对象加上回调的堆内存（含malloc的管理开销），由mallinfo2统计
+*/
+static void BM_ChannelSetup( benchmark::State &state ) {
+    const bool compact = state.range( 0 ) != 0;
+    CompactOwner owner;
+    std::shared_ptr<int> tie = std::make_shared<int>( 0 );
+    for (auto _ : state) {
+        Channel channel( mainLoop() , -1 );
+        if (compact) {
+            channel.setOwner( &owner );
+        }
+        else {
+            setupWithCallbacks( &channel , &owner , tie );
+        }
+        benchmark::DoNotOptimize( &channel );
+    }
+    state.SetItemsProcessed( state.iterations() );
+
+    const int kChannels = 10000;
+    std::vector<Channel *> channels;
+    channels.reserve( kChannels );
+    size_t before = mallinfo2().uordblks;
+    for (int i = 0; i < kChannels; ++i) {
+        Channel *channel = new Channel( mainLoop() , -1 );
+        if (compact) {
+            channel->setOwner( &owner );
+        }
+        else {
+            setupWithCallbacks( channel , &owner , tie );
+        }
+        channels.push_back( channel );
+    }
+    size_t after = mallinfo2().uordblks;
+    for (Channel *channel : channels) {
+        delete channel;
+    }
+    state.counters["sizeof_channel"] = sizeof( Channel );
+    state.counters["bytes_per_channel"] = static_cast<double>( after - before ) / kChannels;
+}
+BENCHMARK( BM_ChannelSetup )->ArgName( "compact" )->Arg( 0 )->Arg( 1 );
+
+static void BM_TimestampNow( benchmark::State &state ) {
+    for (auto _ : state) {
+        benchmark::DoNotOptimize( Timestamp::now() );
+    }
+}
+BENCHMARK( BM_TimestampNow );
+
+static void BM_LogInfo( benchmark::State &state ) {
+    StdoutToNull redirect;
+    int64_t i = 0;
+    for (auto _ : state) {
+        LOG_INFO( "benchmark message %ld fd=%d \n" , ++i , 42 );
+    }
+    state.SetItemsProcessed( state.iterations() );
+}
+BENCHMARK( BM_LogInfo );
+
+// 没有定义MUDEBUG时LOG_DEBUG被编译掉，作为对照
+static void BM_LogDebugDisabled( benchmark::State &state ) {
+    int64_t i = 0;
+    for (auto _ : state) {
+        LOG_DEBUG( "benchmark message %ld fd=%d \n" , ++i , 42 );
+        benchmark::DoNotOptimize( i );
+    }
+    state.SetItemsProcessed( state.iterations() );
+}
+BENCHMARK( BM_LogDebugDisabled );
+
+BENCHMARK_MAIN();
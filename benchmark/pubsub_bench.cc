@@ -0,0 +1,293 @@
+/**
+ * 发布/订阅压测：PubSubServer在父进程中，发布者和订阅者在fork出的子进程中
+ *
+ *  pubsub_bench [--subscribers=100] [--topics=1] [--publishers=1] [--messages=n] [--size=64] [--window=16]
+ *               [--threads=1] [--client-threads=1] [--policy=drop|disconnect] [--ip=127.0.0.1] [--port=9981] [--label=name]
+ *
+ * 每个主题subscribers个订阅者，publishers个发布者轮流向各个主题发布messages条消息，
+ * messages默认使总推送数约为50万；在途（已发布但还没有送达全部订阅者）的消息不超过window条
+ * 消息内容的前8个字节是发布时刻，订阅者收到时记录端到端延迟
+ * 输出每秒推送给订阅者的消息数、每秒发布数和延迟分位数
+*/
+#include "BenchCommon.h"
+
+#include "PubSubServer.h"
+#include "PubSubCodec.h"
+#include "TcpClient.h"
+#include "TcpConnection.h"
+#include "EventLoop.h"
+#include "EventLoopThread.h"
+#include "Buffer.h"
+#include "Logger.h"
+#include "Timestamp.h"
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <algorithm>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+static const int kConnectBatch = 1000;  // 每批发起的连接数，避免一次发起过多超出监听队列
+
+static std::string topicName( int i ) {
+    return "topic" + std::to_string( i );
+}
+
+/**
+ * 子进程：建立订阅者和发布者的连接，同步订阅之后开始发布，收齐全部推送后输出结果
+ * 结束后直接退出，由内核关闭所有连接
+*/
+class PubSubHarness : noncopyable {
+public:
+    PubSubHarness( const BenchOptions &options , int startFd )
+        : options_( options )
+        , startFd_( startFd )
+        , serverAddr_( static_cast<uint16_t>( options.getInt( "port" , 9981 ) ) , options.get( "ip" , "127.0.0.1" ) )
+        , subscribersPerTopic_( static_cast<int>( options.getInt( "subscribers" , 100 ) ) )
+        , numTopics_( static_cast<int>( options.getInt( "topics" , 1 ) ) )
+        , numPublishers_( static_cast<int>( options.getInt( "publishers" , 1 ) ) )
+        , numSubscribers_( subscribersPerTopic_ * numTopics_ )
+        , numMessages_( options.getInt( "messages" , std::max<int64_t>( 200 , 500000 / numSubscribers_ ) ) )
+        , messageSize_( std::max<size_t>( sizeof( int64_t ) , options.getInt( "size" , 64 ) ) )
+        , window_( std::max<int64_t>( 1 , options.getInt( "window" , 16 ) ) )
+        , delivered_( 0 )
+        , ready_( 0 )
+        , probes_( 0 )
+        , established_( 0 ) {
+        int threads = static_cast<int>( options.getInt( "client-threads" , 1 ) );
+        for (int i = 0; i < threads; ++i) {
+            threads_.push_back( std::unique_ptr<EventLoopThread>( new EventLoopThread() ) );
+            loops_.push_back( threads_.back()->startLoop() );
+        }
+        latency_.resize( threads );
+        subscriberReady_.resize( numSubscribers_ , false );
+    }
+
+    void run() {
+        char c;
+        if (::read( startFd_ , &c , 1 ) != 1) {
+            return;     // 服务端没有启动
+        }
+        for (int i = 0; i < numSubscribers_ + numPublishers_; ++i) {
+            connect( i );
+            if (( i + 1 ) % kConnectBatch == 0 || i + 1 == numSubscribers_ + numPublishers_) {
+                std::unique_lock<std::mutex> lock( mutex_ );
+                if (!cond_.wait_for( lock , std::chrono::seconds( 30 ) , [this , i] () { return established_ == i + 1; } )) {
+                    LOG_FATAL( "pubsub_bench - only %d of %d connections established \n" , established_ , i + 1 );
+                }
+            }
+        }
+        for (int i = 0; i < numPublishers_; ++i) {
+            publishers_.push_back( clients_[numSubscribers_ + i]->connection() );
+        }
+
+        // 订阅帧和发布帧来自不同的连接，发布时刻为0的探测消息，直到每个订阅者都收到过；
+        // 每轮等探测消息不再到达（20ms内没有新的）再发下一轮，开始计时时没有积压的探测消息
+        while (ready_.load() < numSubscribers_) {
+            for (int t = 0; t < numTopics_; ++t) {
+                publish( 0 , t , 0 );
+            }
+            int64_t probes;
+            do {
+                probes = probes_.load();
+                std::this_thread::sleep_for( std::chrono::milliseconds( 20 ) );
+            } while (probes_.load() != probes);
+        }
+
+        int64_t expected = numMessages_ * subscribersPerTopic_;
+        Timestamp start( Timestamp::now() );
+        for (int64_t i = 0; i < numMessages_; ++i) {
+            while (( i - window_ ) * subscribersPerTopic_ >= delivered_.load( std::memory_order_relaxed )) {
+                std::this_thread::sleep_for( std::chrono::microseconds( 50 ) );
+            }
+            publish( static_cast<int>( i % numPublishers_ ) , static_cast<int>( i % numTopics_ ) ,
+                Timestamp::now().microSecondsSinceEpoch() );
+        }
+        {
+            std::unique_lock<std::mutex> lock( mutex_ );
+            if (!cond_.wait_for( lock , std::chrono::seconds( 120 ) ,
+                [this , expected] () { return delivered_.load() >= expected; } )) {
+                LOG_FATAL( "pubsub_bench - delivered %ld of %ld messages \n" , (long)delivered_.load() , (long)expected );
+            }
+        }
+        double elapsed = timeDifference( Timestamp::now() , start );
+
+        Histogram latency;
+        for (const Histogram &h : latency_) {
+            latency.merge( h );
+        }
+        JsonLine()
+            .add( "benchmark" , "pubsub" )
+            .add( "label" , options_.get( "label" , "" ) )
+            .add( "subscribers_per_topic" , subscribersPerTopic_ )
+            .add( "topics" , numTopics_ )
+            .add( "publishers" , numPublishers_ )
+            .add( "message_size" , static_cast<int64_t>( messageSize_ ) )
+            .add( "published" , numMessages_ )
+            .add( "delivered" , expected )
+            .add( "seconds" , elapsed )
+            .add( "publishes_per_sec" , numMessages_ / elapsed )
+            .add( "messages_per_sec" , expected / elapsed )
+            .add( "p50_us" , latency.percentile( 50 ) )
+            .add( "p99_us" , latency.percentile( 99 ) )
+            .add( "p999_us" , latency.percentile( 99.9 ) )
+            .add( "max_us" , latency.max() )
+            .print();
+    }
+private:
+    // 前numSubscribers_个连接是订阅者，订阅者i订阅主题i % numTopics_，其余是发布者
+    void connect( int i ) {
+        int loopIndex = i % static_cast<int>( loops_.size() );
+        char name[32];
+        snprintf( name , sizeof name , i < numSubscribers_ ? "subscriber%d" : "publisher%d" , i );
+        TcpClient *client = new TcpClient( loops_[loopIndex] , serverAddr_ , name );
+        client->setConnectionCallback( std::bind( &PubSubHarness::onConnection , this , std::placeholders::_1 ,
+            i < numSubscribers_ ? topicName( i % numTopics_ ) : std::string() ) );
+        if (i < numSubscribers_) {
+            client->setMessageCallback( std::bind( &PubSubHarness::onMessage , this , i , loopIndex ,
+                std::placeholders::_1 , std::placeholders::_2 ) );
+        }
+        clients_.push_back( std::unique_ptr<TcpClient>( client ) );
+        loops_[loopIndex]->runInLoop( std::bind( &TcpClient::connect , client ) );
+    }
+
+    void onConnection( const TcpConnectionPtr &conn , const std::string &topic ) {
+        if (!conn->connected()) {
+            return;
+        }
+        conn->setTcpNoDelay( true );
+        if (!topic.empty()) {
+            conn->send( PubSubCodec::encode( PubSubCodec::kSubscribe , topic , "" , 0 ) );
+        }
+        std::unique_lock<std::mutex> lock( mutex_ );
+        ++established_;
+        cond_.notify_all();
+    }
+
+    // 在订阅者所在的loop线程中调用
+    void onMessage( int subscriber , int loopIndex , const TcpConnectionPtr & , Buffer *buf ) {
+        PubSubCodec::Frame frame;
+        ssize_t n;
+        int64_t count = 0;
+        int64_t now = Timestamp::now().microSecondsSinceEpoch();
+        while (( n = PubSubCodec::decode( buf , &frame ) ) > 0) {
+            int64_t sent;
+            memcpy( &sent , frame.content , sizeof sent );
+            if (sent == 0) {
+                probes_.fetch_add( 1 , std::memory_order_relaxed );
+                if (!subscriberReady_[subscriber]) {
+                    subscriberReady_[subscriber] = true;
+                    ready_.fetch_add( 1 );
+                }
+            }
+            else {
+                latency_[loopIndex].add( now - sent );
+                ++count;
+            }
+            buf->retrieve( n );
+        }
+        if (count > 0) {
+            delivered_.fetch_add( count );
+            if (delivered_.load( std::memory_order_relaxed ) >= numMessages_ * subscribersPerTopic_) {
+                std::unique_lock<std::mutex> lock( mutex_ );
+                cond_.notify_all();
+            }
+        }
+    }
+
+    void publish( int publisher , int topic , int64_t sent ) {
+        std::string content( messageSize_ , 'x' );
+        memcpy( &content[0] , &sent , sizeof sent );
+        publishers_[publisher]->send( PubSubCodec::encode( PubSubCodec::kPublish , topicName( topic ) ,
+            content.data() , content.size() ) );
+    }
+
+    const BenchOptions &options_;
+    const int startFd_;
+    const InetAddress serverAddr_;
+    const int subscribersPerTopic_;
+    const int numTopics_;
+    const int numPublishers_;
+    const int numSubscribers_;
+    const int64_t numMessages_;
+    const size_t messageSize_;
+    const int64_t window_;
+
+    std::vector<std::unique_ptr<EventLoopThread>> threads_;
+    std::vector<EventLoop *> loops_;
+    std::vector<std::unique_ptr<TcpClient>> clients_;  // 进程退出时不析构
+    std::vector<TcpConnectionPtr> publishers_;
+    std::vector<Histogram> latency_;    // 每个loop线程一个
+    std::vector<bool> subscriberReady_;     // 下标i只在订阅者i的loop线程中访问
+
+    std::atomic<int64_t> delivered_;
+    std::atomic<int> ready_;    // 收到过探测消息的订阅者数
+    std::atomic<int64_t> probes_;   // 收到的探测消息数
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    int established_;
+};
+
+int main( int argc , char *argv[] ) {
+    BenchOptions options( argc , argv );
+    int connections = static_cast<int>( options.getInt( "subscribers" , 100 ) * options.getInt( "topics" , 1 )
+        + options.getInt( "publishers" , 1 ) );
+    if (!raiseFdLimit( connections + 256 )) {
+        LOG_FATAL( "pubsub_bench - needs %d fds per process, raise the limit with ulimit -n \n" , connections + 256 );
+    }
+
+    // startPipe：服务端通知开始连接
+    int startPipe[2];
+    if (::pipe( startPipe ) < 0) {
+        LOG_FATAL( "pubsub_bench - pipe failed \n" );
+    }
+    // 在创建任何线程之前fork
+    pid_t pid = ::fork();
+    if (pid < 0) {
+        LOG_FATAL( "pubsub_bench - fork failed \n" );
+    }
+    if (pid == 0) {
+        ::close( startPipe[1] );
+        PubSubHarness harness( options , startPipe[0] );
+        harness.run();
+        ::_exit( 0 );
+    }
+    ::close( startPipe[0] );
+
+    EventLoop loop;
+    PubSubServer server( &loop , InetAddress( static_cast<uint16_t>( options.getInt( "port" , 9981 ) ) ,
+        options.get( "ip" , "127.0.0.1" ) ) , "pubsub-bench" );
+    server.setThreadNum( static_cast<int>( options.getInt( "threads" , 1 ) ) );
+    server.setSlowSubscriberPolicy( 4 * 1024 * 1024 ,
+        options.get( "policy" , "drop" ) == "disconnect" ? PubSubServer::kDisconnect : PubSubServer::kDropMessages );
+    server.start();
+
+    // 子进程退出、所有连接都断开后退出loop，再等io loop处理完TcpServer::removeConnection
+    std::thread waiter( [&] () {
+        char c = 1;
+        if (::write( startPipe[1] , &c , 1 ) != 1) {
+            LOG_FATAL( "pubsub_bench - cannot start the clients \n" );
+        }
+        ::waitpid( pid , nullptr , 0 );
+        while (server.numConnections() > 0) {
+            std::this_thread::sleep_for( std::chrono::milliseconds( 10 ) );
+        }
+        std::this_thread::sleep_for( std::chrono::milliseconds( 100 ) );
+        loop.quit();
+    } );
+    loop.loop();
+    waiter.join();
+    if (server.droppedMessages() > 0) {
+        LOG_INFO( "pubsub_bench - server dropped %lld messages to slow subscribers \n" , (long long)server.droppedMessages() );
+    }
+    return 0;
+}
@@ -0,0 +1,154 @@
+/**
+ * TCP代理：把每个客户端连接转发到后端，用于比较splice转发和经过Buffer的普通转发
+ *
+ *  relay_proxy --backend-port=9982 [--backend-ip=127.0.0.1] [--port=9981] [--threads=4]
+ *              [--mode=splice|buffered] [--report-interval=seconds] [--label=name]
+ *
+ * 后端连接建立在客户端连接所在的loop上，splice模式要求两个连接属于同一个loop
+ * buffered模式下TcpConnection读到EOF即关闭连接，不支持半关闭，只用于吞吐量对比
+ * --report-interval大于0时定期输出累计转发的字节数和进程的cpu时间，cpu_seconds_per_gb即每转发1GB消耗的cpu秒数
+*/
+#include "BenchCommon.h"
+
+#include "TcpServer.h"
+#include "TcpConnection.h"
+#include "TcpConnectionPool.h"
+#include "TcpRelay.h"
+#include "EventLoop.h"
+#include "Buffer.h"
+#include "Logger.h"
+
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <string>
+#include <functional>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+class RelayProxy : noncopyable {
+public:
+    RelayProxy( EventLoop *loop , const BenchOptions &options )
+        : loop_( loop )
+        , server_( loop , InetAddress( static_cast<uint16_t>( options.getInt( "port" , 9981 ) ) , options.get( "ip" , "127.0.0.1" ) ) , "proxy" )
+        , backendAddr_( static_cast<uint16_t>( options.getInt( "backend-port" , 9982 ) ) , options.get( "backend-ip" , "127.0.0.1" ) )
+        , splice_( options.get( "mode" , "splice" ) == "splice" )
+        , label_( options.get( "label" , "" ) )
+        , bufferedBytes_( 0 ) {
+        server_.setThreadNum( static_cast<int>( options.getInt( "threads" , 0 ) ) );
+        server_.setThreadInitcallback( std::bind( &RelayProxy::initPool , this , std::placeholders::_1 ) );
+        server_.setConnectionCallback( std::bind( &RelayProxy::onClientConnection , this , std::placeholders::_1 ) );
+        double interval = options.getDouble( "report-interval" , 0 );
+        if (interval > 0) {
+            loop_->runEvery( interval , std::bind( &RelayProxy::report , this ) );
+        }
+    }
+
+    void start() { server_.start(); }
+private:
+    // 每个loop一个连接池，只用来在本loop上建立后端连接，连接不归还
+    void initPool( EventLoop *loop ) {
+        TcpConnectionPool *pool = new TcpConnectionPool( loop , "backend" );
+        std::unique_lock<std::mutex> lock( mutex_ );
+        pools_[loop] = pool;
+    }
+
+    void onClientConnection( const TcpConnectionPtr &client ) {
+        if (!client->connected()) {
+            return;
+        }
+        // 后端连接建立之前不读取客户端的数据
+        client->stopRead();
+        TcpConnectionPool *pool = pools_[client->getLoop()];
+        std::weak_ptr<TcpConnection> weakClient( client );
+        pool->acquire( backendAddr_ , std::bind( &RelayProxy::onBackendConnected , this , weakClient , std::placeholders::_1 ) );
+    }
+
+    void onBackendConnected( const std::weak_ptr<TcpConnection> &weakClient , const TcpConnectionPtr &backend ) {
+        TcpConnectionPtr client( weakClient.lock() );
+        if (!backend || !client || !client->connected()) {
+            if (client) {
+                client->forceClose();
+            }
+            if (backend) {
+                backend->forceClose();
+            }
+            return;
+        }
+        client->startRead();
+        if (splice_) {
+            if (!TcpRelay::start( client , backend )) {
+                client->forceClose();
+                backend->forceClose();
+            }
+            return;
+        }
+
+        // 普通转发：数据经过两次inputBuffer_/outputBuffer_拷贝，用对端的水位做背压
+        client->setMessageCallback( std::bind( &RelayProxy::forward , this , std::weak_ptr<TcpConnection>( backend ) ,
+            std::placeholders::_1 , std::placeholders::_2 , std::placeholders::_3 ) );
+        backend->setMessageCallback( std::bind( &RelayProxy::forward , this , weakClient ,
+            std::placeholders::_1 , std::placeholders::_2 , std::placeholders::_3 ) );
+        client->setConnectionCallback( std::bind( &RelayProxy::onDisconnected , std::weak_ptr<TcpConnection>( backend ) , std::placeholders::_1 ) );
+        backend->setConnectionCallback( std::bind( &RelayProxy::onDisconnected , weakClient , std::placeholders::_1 ) );
+        client->setBackpressurePeer( backend );
+        backend->setBackpressurePeer( client );
+        backend->setReadBackpressure( 1024 * 1024 , 256 * 1024 );
+        client->setReadBackpressure( 1024 * 1024 , 256 * 1024 );
+    }
+
+    void forward( const std::weak_ptr<TcpConnection> &weakPeer , const TcpConnectionPtr & , Buffer *buf , Timestamp ) {
+        TcpConnectionPtr peer( weakPeer.lock() );
+        bufferedBytes_.fetch_add( buf->readableBytes() , std::memory_order_relaxed );
+        if (peer) {
+            peer->send( buf->retrieveAllAsString() );
+        }
+        else {
+            buf->retrieveAll();
+        }
+    }
+
+    // 一端断开后，另一端把已经收到的数据发完再关闭
+    static void onDisconnected( const std::weak_ptr<TcpConnection> &weakPeer , const TcpConnectionPtr &conn ) {
+        TcpConnectionPtr peer( weakPeer.lock() );
+        if (!conn->connected() && peer) {
+            peer->shutdown();
+        }
+    }
+
+    void report() {
+        struct rusage usage;
+        ::getrusage( RUSAGE_SELF , &usage );
+        double cpu = usage.ru_utime.tv_sec + usage.ru_stime.tv_sec +
+            ( usage.ru_utime.tv_usec + usage.ru_stime.tv_usec ) / 1000000.0;
+        int64_t bytes = splice_ ? TcpRelay::totalBytesForwarded() : bufferedBytes_.load( std::memory_order_relaxed );
+        double gb = bytes / 1024.0 / 1024.0 / 1024.0;
+        JsonLine()
+            .add( "benchmark" , "relay" )
+            .add( "label" , label_ )
+            .add( "mode" , splice_ ? "splice" : "buffered" )
+            .add( "bytes" , bytes )
+            .add( "cpu_seconds" , cpu )
+            .add( "cpu_seconds_per_gb" , gb > 0 ? cpu / gb : 0.0 )
+            .print();
+    }
+
+    EventLoop *loop_;
+    TcpServer server_;
+    const InetAddress backendAddr_;
+    const bool splice_;
+    const std::string label_;
+    std::atomic<int64_t> bufferedBytes_;
+
+    std::mutex mutex_;
+    std::map<EventLoop * , TcpConnectionPool *> pools_;    // start之后只读
+};
+
+int main( int argc , char *argv[] ) {
+    BenchOptions options( argc , argv );
+    EventLoop loop;
+    RelayProxy proxy( &loop , options );
+    proxy.start();
+    loop.loop();
+    return 0;
+}
@@ -0,0 +1,253 @@
+#!/bin/bash
+# 在本机回环上依次运行所有压测场景，每个结果一行JSON
+#
+#  benchmark/run_benchmarks.sh [-b build-dir] [-o result.jsonl] [-s seconds] [-t server-threads] [-c client-threads] [-p port]
+#
+# 库默认不开优化，测量前用 cmake -DCMAKE_BUILD_TYPE=Release 配置
+# 不同版本各跑一次，用 benchmark/compare.py old.jsonl new.jsonl 比较
+
+set -e
+
+BUILD_DIR=build
+OUTPUT=/dev/stdout
+SECONDS_PER_RUN=5
+SERVER_THREADS=4
+CLIENT_THREADS=4
+PORT=9981
+
+while getopts "b:o:s:t:c:p:" opt; do
+    case $opt in
+        b) BUILD_DIR=$OPTARG ;;
+        o) OUTPUT=$OPTARG ;;
+        s) SECONDS_PER_RUN=$OPTARG ;;
+        t) SERVER_THREADS=$OPTARG ;;
+        c) CLIENT_THREADS=$OPTARG ;;
+        p) PORT=$OPTARG ;;
+        *) sed -n '2,6p' "$0"; exit 1 ;;
+    esac
+done
+
+SERVER=$BUILD_DIR/benchmark/bench_server
+CLIENT=$BUILD_DIR/benchmark/bench_client
+PROXY=$BUILD_DIR/benchmark/relay_proxy
+UDP=$BUILD_DIR/benchmark/udp_bench
+SEND=$BUILD_DIR/benchmark/send_bench
+BROADCAST=$BUILD_DIR/benchmark/broadcast_bench
+PUBSUB=$BUILD_DIR/benchmark/pubsub_bench
+if [ ! -x "$SERVER" ] || [ ! -x "$CLIENT" ]; then
+    echo "bench_server/bench_client not found under $BUILD_DIR/benchmark" >&2
+    exit 1
+fi
+
+SERVER_LOG=$(mktemp)
+SERVER_PID=
+PROXY_LOG=$(mktemp)
+PROXY_PID=
+trap 'stop_proxy; stop_server; rm -f "$SERVER_LOG" "$PROXY_LOG"' EXIT
+[ "$OUTPUT" != /dev/stdout ] && : > "$OUTPUT"
+
+# 日志和结果都写到stdout，结果行以{开头
+results() {
+    grep '^{' || true
+}
+
+wait_port() {
+    for _ in $(seq 50); do
+        if (exec 3<>/dev/tcp/127.0.0.1/"$1") 2>/dev/null; then
+            return
+        fi
+        sleep 0.1
+    done
+    echo "nothing listening on port $1" >&2
+    exit 1
+}
+
+start_server() {
+    "$SERVER" --port="$PORT" --threads="$SERVER_THREADS" --report-interval=0.5 "$@" > "$SERVER_LOG" 2>&1 &
+    SERVER_PID=$!
+    wait_port "$PORT"
+}
+
+stop_server() {
+    if [ -n "$SERVER_PID" ]; then
+        kill "$SERVER_PID" 2>/dev/null || true
+        wait "$SERVER_PID" 2>/dev/null || true
+        SERVER_PID=
+    fi
+}
+
+# run <label> <server参数...> -- <client参数...>
+run() {
+    local label=$1
+    shift
+    local server_args=()
+    while [ "$1" != "--" ]; do
+        server_args+=("$1")
+        shift
+    done
+    shift
+    start_server --label="$label" "${server_args[@]}"
+    "$CLIENT" --port="$PORT" --threads="$CLIENT_THREADS" --seconds="$SECONDS_PER_RUN" --label="$label" "$@" | results >> "$OUTPUT"
+    stop_server
+}
+
+stop_proxy() {
+    if [ -n "$PROXY_PID" ]; then
+        kill "$PROXY_PID" 2>/dev/null || true
+        wait "$PROXY_PID" 2>/dev/null || true
+        PROXY_PID=
+    fi
+}
+
+# run_relay <label> <relay_proxy参数...>：bench_client -> relay_proxy(PORT) -> bench_server(PORT+1)
+# 另外记录代理转发的字节数和cpu时间
+run_relay() {
+    local label=$1
+    shift
+    "$SERVER" --port=$((PORT + 1)) --threads="$SERVER_THREADS" > "$SERVER_LOG" 2>&1 &
+    SERVER_PID=$!
+    wait_port $((PORT + 1))
+    "$PROXY" --port="$PORT" --backend-port=$((PORT + 1)) --threads="$SERVER_THREADS" --report-interval=0.5 --label="$label" "$@" > "$PROXY_LOG" 2>&1 &
+    PROXY_PID=$!
+    wait_port "$PORT"
+    "$CLIENT" --port="$PORT" --threads="$CLIENT_THREADS" --seconds="$SECONDS_PER_RUN" --label="$label" \
+        --scenario=pingpong --connections=10 --block=65536 | results >> "$OUTPUT"
+    sleep 0.6
+    stop_proxy
+    stop_server
+    results < "$PROXY_LOG" | tail -n 1 >> "$OUTPUT"
+}
+
+# run_udp <label> <udp_bench参数...>：服务端和客户端使用相同的批量参数
+run_udp() {
+    local label=$1
+    shift
+    "$UDP" --mode=server --port="$PORT" --threads="$SERVER_THREADS" "$@" > "$SERVER_LOG" 2>&1 &
+    SERVER_PID=$!
+    sleep 0.2
+    "$UDP" --mode=client --port="$PORT" --threads="$CLIENT_THREADS" --seconds="$SECONDS_PER_RUN" --label="$label" "$@" | results >> "$OUTPUT"
+    stop_server
+}
+
+# run_report和run一样，另外记录服务端的最后一次报告：缓冲数据的峰值、每个连接的内存分配次数、
+# 每个回复的写系统调用次数和TCP段数、各loop线程的cpu时间
+run_report() {
+    run "$@"
+    results < "$SERVER_LOG" | tail -n 1 >> "$OUTPUT"
+}
+
+# 吞吐量：块大小 x 连接数
+for block in 4096 16384 65536; do
+    for conns in 1 10 100; do
+        run "pingpong-b$block-c$conns" -- --scenario=pingpong --block=$block --connections=$conns
+    done
+done
+run "pingpong-reuseport" --reuseport -- --scenario=pingpong --connections=100
+
+# 负载不均：每SERVER_THREADS个连接中只有一个繁忙，轮询会把繁忙连接都分到同一个loop上
+# 服务端报告中的loop_cpu_ms/loop_cpu_spread为各loop线程的cpu时间分布
+for balance in rr least-conn least-util hash; do
+    run_report "skew-$balance" --balance=$balance -- --scenario=pingpong --connections=$((SERVER_THREADS * 16)) --busy-every=$SERVER_THREADS
+done
+
+# 绑核和NUMA本地分配：每个subloop绑定一个cpu，内存优先从该cpu所在的节点分配，和不绑定时比较吞吐量和p99/p999延迟
+# 多路机器上CPUS应覆盖各个节点，差别包括线程迁移和远端内存访问；单路机器只有一个节点，--numa不改变分配位置，
+# 这组结果只反映线程迁移（缓存失效和调度）的影响，作为多路机器上测量的替代，远端内存访问的代价不在其中
+CPU_COUNT=$(nproc)
+[ "$CPU_COUNT" -gt "$SERVER_THREADS" ] && CPU_COUNT=$SERVER_THREADS
+CPUS=$(seq -s, 0 $((CPU_COUNT - 1)))
+for pin in unpinned pinned; do
+    PIN_ARGS=()
+    [ $pin = pinned ] && PIN_ARGS=(--cpus="$CPUS" --numa)
+    run "pingpong-$pin" "${PIN_ARGS[@]}" -- --scenario=pingpong --connections=100
+    run "latency-c100-$pin" "${PIN_ARGS[@]}" -- --scenario=latency --connections=100
+done
+
+# 延迟
+run "latency-c1" -- --scenario=latency --connections=1
+run "latency-c100" -- --scenario=latency --connections=100
+# 同一台机器上AF_UNIX和TCP回环的对比，服务端同时监听两个地址
+UDS=@mymuduo-bench-$$
+run "latency-c1-uds" --unix="$UDS" -- --scenario=latency --connections=1 --unix="$UDS"
+run "latency-c100-uds" --unix="$UDS" -- --scenario=latency --connections=100 --unix="$UDS"
+run "pingpong-b65536-c10-uds" --unix="$UDS" -- --scenario=pingpong --block=65536 --connections=10 --unix="$UDS"
+# 一个回复分3次send：每次直接写（3次系统调用，小包和Nagle、延迟ACK互相等待），auto-cork在一轮循环结束时合并为一次写
+run_report "latency-c1-fragments3" --fragments=3 -- --scenario=latency --connections=1
+run_report "latency-c1-fragments3-autocork" --fragments=3 --auto-cork -- --scenario=latency --connections=1
+if grep -q "^MYMUDUO_COROUTINE:BOOL=ON" "$BUILD_DIR/CMakeCache.txt" 2>/dev/null; then
+    run "latency-c100-coroutine" --coroutine -- --scenario=latency --connections=100
+    run "pingpong-coroutine" --coroutine -- --scenario=pingpong --connections=100
+else
+    echo "skipping coroutine runs: build with -DMYMUDUO_COROUTINE=ON" >&2
+fi
+
+# TLS：吞吐量和每秒握手次数（churn每个连接一次完整握手），使用临时生成的自签名证书
+if grep -q "^MYMUDUO_TLS:BOOL=ON" "$BUILD_DIR/CMakeCache.txt" 2>/dev/null && command -v openssl > /dev/null; then
+    TLS_DIR=$(mktemp -d)
+    openssl req -x509 -newkey rsa:2048 -nodes -subj /CN=localhost -days 1 \
+        -keyout "$TLS_DIR/key.pem" -out "$TLS_DIR/cert.pem" 2> /dev/null
+    TLS_SERVER=(--tls-cert="$TLS_DIR/cert.pem" --tls-key="$TLS_DIR/key.pem")
+    run "pingpong-b16384-c10-tls" "${TLS_SERVER[@]}" -- --scenario=pingpong --block=16384 --connections=10 --tls
+    run "pingpong-b16384-c10-tls-userspace" "${TLS_SERVER[@]}" --no-ktls -- --scenario=pingpong --block=16384 --connections=10 --tls --no-ktls
+    run "churn-tls" "${TLS_SERVER[@]}" -- --scenario=churn --connections=16 --tls
+    rm -rf "$TLS_DIR"
+else
+    echo "skipping TLS runs: build with -DMYMUDUO_TLS=ON" >&2
+fi
+
+# 代理：splice零拷贝转发和经过Buffer的普通转发
+if [ -x "$PROXY" ]; then
+    run_relay "relay-splice" --mode=splice
+    run_relay "relay-buffered" --mode=buffered
+fi
+
+# UDP包速率：逐个recvfrom/sendto、recvmmsg/sendmmsg批量收发、再加GSO
+if [ -x "$UDP" ]; then
+    run_udp "udp-single" --batch=1
+    run_udp "udp-mmsg" --batch=32
+    run_udp "udp-mmsg-gso" --batch=32 --gso
+fi
+
+# 跨线程send：8个生产者线程向1个和1000个连接发送64字节的消息
+if [ -x "$SEND" ]; then
+    for conns in 1 1000; do
+        "$SEND" --port="$PORT" --threads="$SERVER_THREADS" --connections=$conns --producers=8 --label="send-c$conns" | results >> "$OUTPUT"
+    done
+fi
+
+# 广播扇出：50000个连接，1KB消息，共享payload和逐个连接拷贝发送，需要ulimit -n不小于50256
+if [ -x "$BROADCAST" ]; then
+    for mode in shared copy; do
+        "$BROADCAST" --port="$PORT" --threads="$SERVER_THREADS" --client-threads="$CLIENT_THREADS" \
+            --connections=50000 --size=1024 --mode=$mode --label="broadcast-c50000-$mode" | results >> "$OUTPUT"
+    done
+fi
+
+# 发布/订阅：每个主题1、100、10000个订阅者，每秒推送数和端到端延迟
+if [ -x "$PUBSUB" ]; then
+    for subs in 1 100 10000; do
+        "$PUBSUB" --port="$PORT" --threads="$SERVER_THREADS" --client-threads="$CLIENT_THREADS" \
+            --subscribers=$subs --label="pubsub-s$subs" | results >> "$OUTPUT"
+    done
+fi
+
+# 连接建立/关闭
+run_report "churn" -- --scenario=churn --connections=16
+run_report "churn-reuseport" --reuseport -- --scenario=churn --connections=16
+run "churn-pool" -- --scenario=churn --connections=16 --pool
+
+# 慢读客户端下服务端的缓冲
+run_report "flood" -- --scenario=flood --connections=16
+run_report "flood-backpressure" --backpressure=$((1024 * 1024)) -- --scenario=flood --connections=16
+BUDGET=$((64 * 1024 * 1024))
+run_report "flood-budget" --budget=$BUDGET --budget-policy=pause -- --scenario=flood --connections=16
+# 预算按缓冲区容量计算，峰值RSS（VmHWM）应接近预算；另外留出32MB给进程本身、每个loop未刷新的计数和分配器缓存
+PEAK_RSS_KB=$(results < "$SERVER_LOG" | tail -n 1 | sed -n 's/.*"peak_rss_kb":\([0-9]*\).*/\1/p')
+if [ -n "$PEAK_RSS_KB" ] && [ "$PEAK_RSS_KB" -gt $((BUDGET / 1024 + 32 * 1024)) ]; then
+    echo "flood-budget: peak RSS ${PEAK_RSS_KB}KB exceeds the $((BUDGET / 1024))KB budget by more than 32MB" >&2
+fi
+
+# 压测中热重启，记录被拒绝的连接数（应为0）
+if command -v python3 > /dev/null; then
+    python3 "$(dirname "$0")/hot_restart_test.py" --build="$BUILD_DIR" --port="$PORT" --threads="$SERVER_THREADS" --label="hot-restart" | results >> "$OUTPUT"
+fi
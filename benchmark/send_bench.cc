@@ -0,0 +1,226 @@
+/**
+ * 跨线程send压测：多个生产者线程向服务端的连接发送小消息，接收端只读取
+ *
+ *  send_bench [--connections=1] [--producers=8] [--messages=100000] [--size=64] [--threads=1]
+ *             [--ip=127.0.0.1] [--port=9981] [--label=name]
+ *
+ * 服务端（threads个io线程）和接收端（一个loop线程）在同一进程中，经本机回环连接；
+ * 所有连接建立后，producers个线程各自发送messages条消息，依次轮流发给每个连接，接收端收齐全部字节后结束
+ * 输出每秒消息数，以及每条消息的write类系统调用次数（包括唤醒loop的eventfd）和operator new次数
+*/
+#include "BenchCommon.h"
+
+#include "TcpServer.h"
+#include "TcpClient.h"
+#include "TcpConnection.h"
+#include "EventLoop.h"
+#include "EventLoopThread.h"
+#include "Buffer.h"
+#include "Logger.h"
+#include "Timestamp.h"
+
+#include <string>
+#include <vector>
+#include <set>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <new>
+#include <stdlib.h>
+
+// 进程内operator new的调用次数，和bench_server一样替换全局的operator new
+static std::atomic<int64_t> gAllocations( 0 );
+
+void *operator new( size_t size ) {
+    gAllocations.fetch_add( 1 , std::memory_order_relaxed );
+    void *ptr = ::malloc( size > 0 ? size : 1 );
+    if (ptr == nullptr) {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+void operator delete( void *ptr ) noexcept {
+    ::free( ptr );
+}
+
+void operator delete( void *ptr , size_t ) noexcept {
+    ::free( ptr );
+}
+
+static void ignoreConnection( const TcpConnectionPtr & ) {
+}
+
+class SendBench : noncopyable {
+public:
+    SendBench( EventLoop *loop , const BenchOptions &options )
+        : loop_( loop )
+        , options_( options )
+        , server_( loop , InetAddress( static_cast<uint16_t>( options.getInt( "port" , 9981 ) ) , options.get( "ip" , "127.0.0.1" ) ) ,
+            "send-bench" )
+        , numConnections_( static_cast<int>( options.getInt( "connections" , 1 ) ) )
+        , numProducers_( static_cast<int>( options.getInt( "producers" , 8 ) ) )
+        , messagesPerProducer_( options.getInt( "messages" , 100000 ) )
+        , message_( options.getInt( "size" , 64 ) , 'x' )
+        , clientLoop_( nullptr )
+        , received_( 0 )
+        , expected_( static_cast<int64_t>( message_.size() ) * numProducers_ * messagesPerProducer_ )
+        , live_( 0 )
+        , done_( false ) {
+        server_.setThreadNum( static_cast<int>( options.getInt( "threads" , 1 ) ) );
+        server_.setConnectionCallback( std::bind( &SendBench::onServerConnection , this , std::placeholders::_1 ) );
+    }
+
+    void start() {
+        server_.start();
+        clientLoop_ = clientThread_.startLoop();
+        InetAddress serverAddr( static_cast<uint16_t>( options_.getInt( "port" , 9981 ) ) , options_.get( "ip" , "127.0.0.1" ) );
+        for (int i = 0; i < numConnections_; ++i) {
+            char name[32];
+            snprintf( name , sizeof name , "receiver%d" , i );
+            TcpClient *client = new TcpClient( clientLoop_ , serverAddr , name );
+            client->setConnectionCallback( &ignoreConnection );
+            client->setMessageCallback( std::bind( &SendBench::onReceived , this ,
+                std::placeholders::_1 , std::placeholders::_2 , std::placeholders::_3 ) );
+            clients_.push_back( std::unique_ptr<TcpClient>( client ) );
+            clientLoop_->runInLoop( std::bind( &TcpClient::connect , client ) );
+        }
+        driver_ = std::thread( &SendBench::drive , this );
+    }
+
+    // loop退出后调用
+    void stop() {
+        driver_.join();
+    }
+private:
+    // 在服务端的io线程中调用
+    void onServerConnection( const TcpConnectionPtr &conn ) {
+        std::unique_lock<std::mutex> lock( mutex_ );
+        if (conn->connected()) {
+            connections_.push_back( conn );
+            serverLoops_.insert( conn->getLoop() );
+            ++live_;
+        }
+        else {
+            --live_;
+        }
+        cond_.notify_all();
+    }
+
+    // 在接收端的loop线程中调用
+    void onReceived( const TcpConnectionPtr & , Buffer *buf , Timestamp ) {
+        int64_t received = received_.fetch_add( buf->readableBytes() , std::memory_order_relaxed ) + buf->readableBytes();
+        buf->retrieveAll();
+        if (received == expected_) {
+            std::unique_lock<std::mutex> lock( mutex_ );
+            done_ = true;
+            cond_.notify_all();
+        }
+    }
+
+    void produce( int id ) {
+        const size_t n = connections_.size();
+        size_t next = id % n;
+        for (int64_t i = 0; i < messagesPerProducer_; ++i) {
+            connections_[next]->send( message_ );
+            next = ( next + 1 ) % n;
+        }
+    }
+
+    void drive() {
+        {
+            std::unique_lock<std::mutex> lock( mutex_ );
+            if (!cond_.wait_for( lock , std::chrono::seconds( 10 ) ,
+                [this] () { return static_cast<int>( connections_.size() ) == numConnections_; } )) {
+                LOG_FATAL( "send_bench - only %d of %d connections established \n" , (int)connections_.size() , numConnections_ );
+            }
+        }
+
+        int64_t allocations = gAllocations.load( std::memory_order_relaxed );
+        int64_t writes = writeSyscalls();
+        Timestamp start( Timestamp::now() );
+        std::vector<std::thread> producers;
+        for (int i = 0; i < numProducers_; ++i) {
+            producers.emplace_back( &SendBench::produce , this , i );
+        }
+        for (std::thread &t : producers) {
+            t.join();
+        }
+        {
+            std::unique_lock<std::mutex> lock( mutex_ );
+            if (!cond_.wait_for( lock , std::chrono::seconds( 60 ) , [this] () { return done_; } )) {
+                LOG_FATAL( "send_bench - received %ld of %ld bytes \n" , (long)received_.load() , (long)expected_ );
+            }
+        }
+        double elapsed = timeDifference( Timestamp::now() , start );
+        writes = writeSyscalls() - writes;
+        allocations = gAllocations.load( std::memory_order_relaxed ) - allocations;
+
+        int64_t messages = numProducers_ * messagesPerProducer_;
+        JsonLine()
+            .add( "benchmark" , "send" )
+            .add( "label" , options_.get( "label" , "" ) )
+            .add( "connections" , numConnections_ )
+            .add( "producers" , numProducers_ )
+            .add( "message_size" , static_cast<int64_t>( message_.size() ) )
+            .add( "messages" , messages )
+            .add( "seconds" , elapsed )
+            .add( "messages_per_sec" , messages / elapsed )
+            .add( "write_syscalls_per_message" , static_cast<double>( writes ) / messages )
+            .add( "allocs_per_message" , static_cast<double>( allocations ) / messages )
+            .print();
+
+        // 客户端在自己的loop线程中析构并关闭连接，服务端的连接都断开后再退出，TcpServer析构时不再有连接
+        connections_.clear();
+        clientLoop_->runInLoop( [this] () { clients_.clear(); } );
+        std::unique_lock<std::mutex> lock( mutex_ );
+        cond_.wait_for( lock , std::chrono::seconds( 10 ) , [this] () { return live_ == 0; } );
+        // 断开回调之后io线程还要执行TcpServer::removeConnection，等每个io loop处理完当前的事件
+        int pending = static_cast<int>( serverLoops_.size() );
+        for (EventLoop *ioLoop : serverLoops_) {
+            ioLoop->queueInLoop( [this , &pending] () {
+                std::unique_lock<std::mutex> guard( mutex_ );
+                --pending;
+                cond_.notify_all();
+            } );
+        }
+        cond_.wait( lock , [&pending] () { return pending == 0; } );
+        loop_->quit();
+    }
+
+    EventLoop *loop_;
+    const BenchOptions &options_;
+    TcpServer server_;
+    const int numConnections_;
+    const int numProducers_;
+    const int64_t messagesPerProducer_;
+    const std::string message_;
+
+    EventLoopThread clientThread_;
+    EventLoop *clientLoop_;
+    std::vector<std::unique_ptr<TcpClient>> clients_;
+    std::atomic<int64_t> received_;
+    const int64_t expected_;
+
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    std::vector<TcpConnectionPtr> connections_;  // 受mutex_保护，生产者开始之后只读
+    int live_;  // 服务端尚未断开的连接数
+    std::set<EventLoop *> serverLoops_;
+    bool done_;
+    std::thread driver_;
+};
+
+int main( int argc , char *argv[] ) {
+    BenchOptions options( argc , argv );
+    EventLoop loop;
+    SendBench bench( &loop , options );
+    bench.start();
+    loop.loop();
+    bench.stop();
+    return 0;
+}
@@ -0,0 +1,217 @@
+/**
+ * UDP收发包速率压测，比较recvmmsg/sendmmsg批量收发和逐个recvfrom/sendto
+ *
+ *  udp_bench --mode=server [--port=9981] [--threads=0] [--batch=32] [--gso] [--gro]
+ *      UdpServer回显服务器，设置了线程数时每个subloop一个SO_REUSEPORT socket
+ *  udp_bench --mode=client [--port=9981] [--threads=1] [--sockets=16] [--window=64] [--size=64] [--seconds=5]
+ *            [--batch=32] [--gso] [--label=name]
+ *      每个socket保持window个数据报在途，收到一个应答就再发一个，统计每秒收到的应答数
+ *      在途的数据报全部丢失时，100ms后重新发出window个
+ *
+ * --batch=1时收发都退化为每个数据报一次系统调用，作为对照
+ * syscalls_per_packet为客户端收发系统调用次数与收到应答数之比
+*/
+#include "BenchCommon.h"
+
+#include "UdpServer.h"
+#include "UdpChannel.h"
+#include "EventLoop.h"
+#include "EventLoopThreadPool.h"
+#include "Logger.h"
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+
+static void echo( UdpChannel *channel , const char *data , size_t len , const InetAddress &peer , Timestamp ) {
+    channel->send( peer , data , len );
+}
+
+static int runServer( const BenchOptions &options ) {
+    EventLoop loop;
+    UdpServer server( &loop , InetAddress( static_cast<uint16_t>( options.getInt( "port" , 9981 ) ) , options.get( "ip" , "127.0.0.1" ) ) , "udp-bench" );
+    server.setThreadNum( static_cast<int>( options.getInt( "threads" , 0 ) ) );
+    server.setBatchSize( static_cast<int>( options.getInt( "batch" , UdpChannel::kDefaultBatchSize ) ) );
+    server.setGso( options.has( "gso" ) );
+    server.setGro( options.has( "gro" ) );
+    server.setMessageCallback( &echo );
+    server.start();
+    loop.loop();
+    return 0;
+}
+
+// 一个客户端socket，除replies_外的成员只在所属loop线程中访问
+class UdpSession : noncopyable {
+public:
+    UdpSession( EventLoop *loop , const InetAddress &serverAddr , const BenchOptions &options )
+        : loop_( loop )
+        , channel_( loop , InetAddress( 0 , options.get( "ip" , "127.0.0.1" ) ) , false ,
+            static_cast<int>( options.getInt( "batch" , UdpChannel::kDefaultBatchSize ) ) )
+        , serverAddr_( serverAddr )
+        , payload_( options.getInt( "size" , 64 ) , 'x' )
+        , window_( static_cast<int>( options.getInt( "window" , 64 ) ) )
+        , replies_( 0 )
+        , lastReplies_( 0 ) {
+        channel_.setGso( options.has( "gso" ) );
+        channel_.setMessageCallback( std::bind( &UdpSession::onMessage , this ,
+            std::placeholders::_1 , std::placeholders::_3 ) );
+    }
+
+    EventLoop *getLoop() const { return loop_; }
+    int64_t replies() const { return replies_.load( std::memory_order_relaxed ); }
+    int64_t syscalls() const { return channel_.recvCalls() + channel_.sendCalls(); }
+
+    void start() {
+        channel_.start();
+        sendWindow();
+        stallTimer_ = loop_->runEvery( 0.1 , std::bind( &UdpSession::checkStall , this ) );
+    }
+
+    void stop() {
+        loop_->cancel( stallTimer_ );
+        channel_.stop();
+    }
+private:
+    void onMessage( UdpChannel *channel , size_t len ) {
+        if (len == payload_.size()) {
+            replies_.fetch_add( 1 , std::memory_order_relaxed );
+            channel->send( serverAddr_ , payload_.data() , payload_.size() );
+        }
+    }
+
+    void sendWindow() {
+        for (int i = 0; i < window_; ++i) {
+            channel_.send( serverAddr_ , payload_.data() , payload_.size() );
+        }
+    }
+
+    void checkStall() {
+        int64_t n = replies();
+        if (n == lastReplies_) {
+            sendWindow();
+        }
+        lastReplies_ = n;
+    }
+
+    EventLoop *loop_;
+    UdpChannel channel_;
+    const InetAddress serverAddr_;
+    const std::string payload_;
+    const int window_;
+    std::atomic<int64_t> replies_;
+    int64_t lastReplies_;
+    TimerId stallTimer_;
+};
+
+class UdpBenchClient : noncopyable {
+public:
+    UdpBenchClient( EventLoop *loop , const BenchOptions &options )
+        : loop_( loop )
+        , options_( options )
+        , threadPool_( loop , "udp-client" )
+        , seconds_( options.getDouble( "seconds" , 5 ) )
+        , startReplies_( 0 )
+        , pendingStops_( 0 )
+        , syscalls_( 0 )
+        , totalAll_( 0 ) {
+        threadPool_.setThreadNum( static_cast<int>( options.getInt( "threads" , 1 ) ) );
+    }
+
+    void start() {
+        threadPool_.start();
+        InetAddress serverAddr( static_cast<uint16_t>( options_.getInt( "port" , 9981 ) ) , options_.get( "ip" , "127.0.0.1" ) );
+        int64_t sockets = options_.getInt( "sockets" , 16 );
+        for (int64_t i = 0; i < sockets; ++i) {
+            EventLoop *ioLoop = threadPool_.getNextLoop();
+            UdpSession *session = new UdpSession( ioLoop , serverAddr , options_ );
+            sessions_.push_back( session );
+            ioLoop->runInLoop( std::bind( &UdpSession::start , session ) );
+        }
+        // 预热0.5秒后开始计数
+        loop_->runAfter( 0.5 , [this] () {
+            startReplies_ = totalReplies();
+            startTime_ = Timestamp::now();
+        } );
+        loop_->runAfter( 0.5 + seconds_ , std::bind( &UdpBenchClient::finish , this ) );
+    }
+private:
+    int64_t totalReplies() const {
+        int64_t n = 0;
+        for (UdpSession *session : sessions_) {
+            n += session->replies();
+        }
+        return n;
+    }
+
+    void finish() {
+        int64_t replies = totalReplies() - startReplies_;
+        double elapsed = ( Timestamp::now().microSecondsSinceEpoch() - startTime_.microSecondsSinceEpoch() ) / 1000000.0;
+
+        // 在各自的loop中停止并销毁，同时收集系统调用次数
+        pendingStops_ = static_cast<int>( sessions_.size() );
+        for (UdpSession *session : sessions_) {
+            session->getLoop()->runInLoop( [this , session] () {
+                session->stop();
+                std::unique_lock<std::mutex> lock( mutex_ );
+                syscalls_ += session->syscalls();
+                totalAll_ += session->replies();
+                delete session;
+                if (--pendingStops_ == 0) {
+                    stopped_.notify_one();
+                }
+            } );
+        }
+        {
+            std::unique_lock<std::mutex> lock( mutex_ );
+            stopped_.wait( lock , [this] () { return pendingStops_ == 0; } );
+        }
+
+        int64_t size = options_.getInt( "size" , 64 );
+        int64_t batch = options_.getInt( "batch" , UdpChannel::kDefaultBatchSize );
+        JsonLine()
+            .add( "benchmark" , "udp" )
+            .add( "label" , options_.get( "label" , "" ) )
+            .add( "mode" , batch > 1 ? "mmsg" : "single" )
+            .add( "batch" , batch )
+            .add( "gso" , options_.has( "gso" ) )
+            .add( "sockets" , static_cast<int64_t>( sessions_.size() ) )
+            .add( "window" , options_.getInt( "window" , 64 ) )
+            .add( "size" , size )
+            .add( "seconds" , elapsed )
+            .add( "packets_per_sec" , replies / elapsed )
+            .add( "mb_per_sec" , replies * size / elapsed / 1024 / 1024 )
+            .add( "syscalls_per_packet" , totalAll_ > 0 ? static_cast<double>( syscalls_ ) / totalAll_ : 0.0 )
+            .print();
+        sessions_.clear();
+        loop_->quit();
+    }
+
+    EventLoop *loop_;
+    const BenchOptions &options_;
+    EventLoopThreadPool threadPool_;
+    const double seconds_;
+    std::vector<UdpSession *> sessions_;
+    int64_t startReplies_;
+    Timestamp startTime_;
+
+    std::mutex mutex_;
+    std::condition_variable stopped_;
+    int pendingStops_;
+    int64_t syscalls_;
+    int64_t totalAll_;
+};
+
+int main( int argc , char *argv[] ) {
+    BenchOptions options( argc , argv );
+    if (options.get( "mode" , "client" ) == "server") {
+        return runServer( options );
+    }
+    EventLoop loop;
+    UdpBenchClient client( &loop , options );
+    client.start();
+    loop.loop();
+    return 0;
+}